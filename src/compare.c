@@ -0,0 +1,824 @@
+#include "compare.h"
+#include "walk.h"
+#include "fsio.h"
+#include "trace.h"
+#include <gtk/gtk.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COMPARE_CHUNK (1024 * 1024)
+#define COMPARE_ROWS_MAX 20000
+#define COMPARE_TICK_MS 250
+
+typedef enum {
+    STAGE_IDLE,
+    STAGE_WALK,
+    STAGE_CONTENTS,
+    STAGE_SYNC
+} CompareStage;
+
+typedef enum {
+    KIND_LEFT,          /* only in the left tree */
+    KIND_RIGHT,
+    KIND_DIFFERENT,
+    KIND_TIME,          /* same contents, different mtime */
+    KIND_SAME
+} DiffKind;
+
+typedef struct {
+    const char *rel;    /* in the side's string chunk */
+    guint64 size;
+    gint64 mtime;
+    guint32 mode;
+} Entry;
+
+typedef struct {
+    const Entry *left;
+    const Entry *right;
+    gint kind;
+    gboolean check;     /* size matches, time does not: read both */
+} Diff;
+
+typedef struct {
+    char *root;
+    gsize root_len;
+    Walk *walk;
+    GMutex lock;
+    GStringChunk *names;
+    GArray *entries;    /* Entry, sorted by path_cmp once the walk is done */
+} Side;
+
+typedef struct {
+    gint ref;
+    gint cancelled;
+    Side side[2];
+    gint walks;
+
+    GArray *diffs;      /* Diff, in path order; the same are only counted */
+    guint64 same;
+    gboolean contents;
+
+    /* progress, written by workers */
+    gint stage;
+    guint64 seen[2];
+    guint64 unread[2];  /* entries a walk or lstat() could not read */
+    guint64 checks;
+    guint64 checked;
+    guint64 bytes;
+    guint64 done;
+    guint64 failed;
+    char *error;        /* first sync failure */
+
+    /* main thread only */
+    GtkWidget *window;
+    GtkWidget *status;
+    GtkWidget *check;
+    GtkWidget *sync;
+    GtkListStore *store;
+    guint tick;
+    guint counts[KIND_SAME];
+    guint64 plan_items;
+    guint64 plan_bytes;
+    gboolean nested;
+    CompareOpenFunc open;
+    gpointer open_data;
+} Compare;
+
+static Compare* compare_ref(Compare *c)
+{
+    g_atomic_int_inc(&c->ref);
+    return c;
+}
+
+static void side_reset(Side *s)
+{
+    if (s->walk) walk_unref(s->walk);
+    s->walk = NULL;
+    if (s->names) g_string_chunk_free(s->names);
+    s->names = g_string_chunk_new(64 * 1024);
+    if (s->entries) g_array_free(s->entries, TRUE);
+    s->entries = g_array_new(FALSE, FALSE, sizeof(Entry));
+}
+
+static void compare_unref(Compare *c)
+{
+    if (!g_atomic_int_dec_and_test(&c->ref)) return;
+
+    for (int i = 0; i < 2; i++) {
+        Side *s = &c->side[i];
+        if (s->walk) walk_unref(s->walk);
+        g_string_chunk_free(s->names);
+        g_array_free(s->entries, TRUE);
+        g_mutex_clear(&s->lock);
+        g_free(s->root);
+    }
+    g_array_free(c->diffs, TRUE);
+    g_free(c->error);
+    g_free(c);
+}
+
+static gboolean cancelled(Compare *c)
+{
+    return g_atomic_int_get(&c->cancelled);
+}
+
+/* ---------- walking both trees ---------- */
+
+/* '/' before every other byte, so a folder's entries follow it directly */
+static int path_cmp(const char *a, const char *b)
+{
+    while (*a && *a == *b) a++, b++;
+    unsigned char ca = *a == '/' ? 1 : *a, cb = *b == '/' ? 1 : *b;
+    return ca - cb;
+}
+
+static gint by_path(gconstpointer a, gconstpointer b)
+{
+    return path_cmp(((const Entry*) a)->rel, ((const Entry*) b)->rel);
+}
+
+typedef struct {
+    Compare *c;
+    int side;
+} Visit;
+
+static gboolean visit(Walk *w, const WalkEntry *e, gpointer data)
+{
+    Visit *v = data;
+    Side *s = &v->c->side[v->side];
+
+    struct stat st;
+    if (fstatat(e->dirfd, e->name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        if (errno != ENOENT) __atomic_fetch_add(&v->c->unread[v->side], 1, __ATOMIC_RELAXED);
+        return FALSE;
+    }
+    /* sockets, fifos and devices cannot be synced; leave them out of both sides */
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode) && !S_ISLNK(st.st_mode)) return FALSE;
+
+    __atomic_fetch_add(&v->c->seen[v->side], 1, __ATOMIC_RELAXED);
+
+    /* "/" and "/a/" end in the separator, "/a" does not */
+    const char *rel = e->path + s->root_len;
+    if (*rel == '/') rel++;
+
+    Entry en = { NULL, st.st_size, st.st_mtime, st.st_mode };
+    g_mutex_lock(&s->lock);
+    en.rel = g_string_chunk_insert(s->names, rel);
+    g_array_append_val(s->entries, en);
+    g_mutex_unlock(&s->lock);
+
+    return S_ISDIR(st.st_mode);
+}
+
+/* ---------- merging ---------- */
+
+static char* full_path(Compare *c, int side, const Entry *e)
+{
+    return g_build_filename(c->side[side].root, e->rel, NULL);
+}
+
+static gboolean same_link(Compare *c, const Entry *l, const Entry *r)
+{
+    if (l->size != r->size) return FALSE;
+
+    char *lp = full_path(c, 0, l), *rp = full_path(c, 1, r);
+    char *lt = g_file_read_link(lp, NULL), *rt = g_file_read_link(rp, NULL);
+    gboolean same = lt && rt && !strcmp(lt, rt);
+
+    g_free(lt);
+    g_free(rt);
+    g_free(lp);
+    g_free(rp);
+    return same;
+}
+
+static void pair(Compare *c, const Entry *l, const Entry *r)
+{
+    Diff d = { l, r, KIND_DIFFERENT, FALSE };
+
+    if ((l->mode & S_IFMT) != (r->mode & S_IFMT)) {
+        /* the type changed; handled as different below */
+    } else if (S_ISDIR(l->mode)) {
+        d.kind = KIND_SAME;
+    } else if (S_ISLNK(l->mode)) {
+        if (same_link(c, l, r)) d.kind = KIND_SAME;
+    } else if (l->size == r->size) {
+        if (l->mtime == r->mtime) d.kind = KIND_SAME;
+        else if (c->contents) d.check = TRUE;
+    }
+
+    if (d.kind == KIND_SAME) {
+        c->same++;
+        return;
+    }
+    if (d.check) c->checks++;
+    g_array_append_val(c->diffs, d);
+}
+
+static void merge(Compare *c)
+{
+    TRACE_SCOPE("compare merge");
+
+    GArray *L = c->side[0].entries, *R = c->side[1].entries;
+    g_array_sort(L, by_path);
+    g_array_sort(R, by_path);
+    TRACE_ITEMS(L->len + R->len);
+
+    guint i = 0, j = 0;
+    while ((i < L->len || j < R->len) && !cancelled(c)) {
+        const Entry *l = i < L->len ? &g_array_index(L, Entry, i) : NULL;
+        const Entry *r = j < R->len ? &g_array_index(R, Entry, j) : NULL;
+        int cmp = !l ? 1 : !r ? -1 : path_cmp(l->rel, r->rel);
+
+        if (cmp < 0) {
+            Diff d = { l, NULL, KIND_LEFT, FALSE };
+            g_array_append_val(c->diffs, d);
+            i++;
+        } else if (cmp > 0) {
+            Diff d = { NULL, r, KIND_RIGHT, FALSE };
+            g_array_append_val(c->diffs, d);
+            j++;
+        } else {
+            pair(c, l, r);
+            i++;
+            j++;
+        }
+    }
+}
+
+/* ---------- contents of files that differ only in time ---------- */
+
+static int open_quiet(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+    if (fd < 0 && errno == EPERM)
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    return fd;
+}
+
+static gboolean read_full(int fd, guchar *buf, gsize len)
+{
+    while (len) {
+        gssize n = read(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        buf += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+/* both files side by side, stopping at the first chunk that differs */
+static gboolean same_contents(Compare *c, const char *a, const char *b, guint64 size)
+{
+    int fa = open_quiet(a), fb = open_quiet(b);
+    gboolean same = fa >= 0 && fb >= 0;
+
+    if (same) {
+        posix_fadvise(fa, 0, 0, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(fb, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    guchar *ba = g_malloc(COMPARE_CHUNK), *bb = g_malloc(COMPARE_CHUNK);
+    for (guint64 left = size; same && left && !cancelled(c); ) {
+        gsize n = MIN(left, COMPARE_CHUNK);
+        same = read_full(fa, ba, n) && read_full(fb, bb, n) && !memcmp(ba, bb, n);
+        __atomic_fetch_add(&c->bytes, n * 2, __ATOMIC_RELAXED);
+        left -= n;
+    }
+    g_free(ba);
+    g_free(bb);
+
+    if (fa >= 0) close(fa);
+    if (fb >= 0) close(fb);
+    return same && !cancelled(c);
+}
+
+static void check_job(gpointer data, gpointer user)
+{
+    Diff *d = data;
+    Compare *c = user;
+
+    if (!cancelled(c)) {
+        char *a = full_path(c, 0, d->left), *b = full_path(c, 1, d->right);
+        if (same_contents(c, a, b, d->left->size)) d->kind = KIND_TIME;
+        g_free(a);
+        g_free(b);
+    }
+    __atomic_fetch_add(&c->checked, 1, __ATOMIC_RELAXED);
+}
+
+static void check_contents(Compare *c)
+{
+    if (!c->checks) return;
+
+    TRACE_SCOPE("compare contents");
+    TRACE_ITEMS(c->checks);
+    g_atomic_int_set(&c->stage, STAGE_CONTENTS);
+
+    int threads = CLAMP((int) g_get_num_processors(), 2, 8);
+    GThreadPool *pool = g_thread_pool_new(check_job, c, threads, TRUE, NULL);
+    for (guint i = 0; i < c->diffs->len; i++) {
+        Diff *d = &g_array_index(c->diffs, Diff, i);
+        if (d->check) g_thread_pool_push(pool, d, NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+static gboolean compared(gpointer data);
+
+static gpointer compare_thread(gpointer data)
+{
+    Compare *c = data;
+
+    merge(c);
+    check_contents(c);
+
+    g_idle_add(compared, c);
+    return NULL;
+}
+
+static void walk_done(Walk *w, gboolean was_cancelled, gpointer data)
+{
+    Visit *v = data;
+    Compare *c = v->c;
+    c->unread[v->side] += walk_failed(w);
+    g_free(v);
+
+    if (--c->walks) {
+        compare_unref(c);
+        return;
+    }
+    if (cancelled(c)) {
+        g_atomic_int_set(&c->stage, STAGE_IDLE);
+        compare_unref(c);
+        return;
+    }
+
+    /* the last walk's reference moves to the compare thread */
+    g_thread_unref(g_thread_new("compare", compare_thread, c));
+}
+
+/* ---------- sync, left to right ---------- */
+
+static void sync_failed(Compare *c, const char *path, int err)
+{
+    __atomic_fetch_add(&c->failed, 1, __ATOMIC_RELAXED);
+    if (!c->error) c->error = g_strdup_printf("%s: %s", path, g_strerror(err));
+}
+
+static int set_time(const char *dst, const Entry *from)
+{
+    struct timespec ts[2] = { { 0, UTIME_OMIT }, { from->mtime, 0 } };
+    return utimensat(AT_FDCWD, dst, ts, AT_SYMLINK_NOFOLLOW) ? errno : 0;
+}
+
+static int create(const char *src, const char *dst, const Entry *e, guint64 *bytes)
+{
+    if (S_ISDIR(e->mode))
+        return mkdir(dst, e->mode & 07777) && errno != EEXIST ? errno : 0;
+
+    if (S_ISLNK(e->mode)) {
+        char *target = g_file_read_link(src, NULL);
+        int rc = !target ? EIO : symlink(target, dst) ? errno : 0;
+        g_free(target);
+        return rc;
+    }
+
+    /* the time is the left one, so the next comparison finds them equal */
+    int rc = fsio_copy_file(src, dst, e->mode & 07777, TRUE, bytes);
+    if (!rc) rc = chmod(dst, e->mode & 07777) ? errno : 0;
+    return rc ? rc : set_time(dst, e);
+}
+
+static gboolean synced(gpointer data);
+
+static gpointer sync_thread(gpointer data)
+{
+    Compare *c = data;
+    TRACE_SCOPE("compare sync");
+    TRACE_ITEMS(c->diffs->len);
+
+    /* removals deepest first, so folders are empty when their turn comes */
+    for (guint i = c->diffs->len; i-- > 0 && !cancelled(c); ) {
+        Diff *d = &g_array_index(c->diffs, Diff, i);
+        gboolean replace = d->kind == KIND_DIFFERENT &&
+                           (!S_ISREG(d->left->mode) || !S_ISREG(d->right->mode));
+        if (d->kind != KIND_RIGHT && !replace) continue;
+
+        char *dst = full_path(c, 1, d->right);
+        int rc = (S_ISDIR(d->right->mode) ? rmdir(dst) : unlink(dst)) ? errno : 0;
+        if (rc && rc != ENOENT) sync_failed(c, dst, rc);
+        if (d->kind == KIND_RIGHT) __atomic_fetch_add(&c->done, 1, __ATOMIC_RELAXED);
+        g_free(dst);
+    }
+
+    /* then in path order, so folders exist before what goes into them */
+    for (guint i = 0; i < c->diffs->len && !cancelled(c); i++) {
+        Diff *d = &g_array_index(c->diffs, Diff, i);
+        if (d->kind == KIND_RIGHT) continue;
+
+        char *src = full_path(c, 0, d->left);
+        char *dst = g_build_filename(c->side[1].root, d->left->rel, NULL);
+        int rc = d->kind == KIND_TIME ? set_time(dst, d->left) : create(src, dst, d->left, &c->bytes);
+
+        if (rc) sync_failed(c, dst, rc);
+        __atomic_fetch_add(&c->done, 1, __ATOMIC_RELAXED);
+        g_free(dst);
+        g_free(src);
+    }
+
+    g_idle_add(synced, c);
+    return NULL;
+}
+
+/* ---------- main thread ---------- */
+
+/*
+ * Whatever a walk could not read is missing from its listing: an unreadable
+ * left folder would pair with the right one and have everything under it
+ * deleted there, so a sync needs both listings whole.
+ */
+static guint64 unread(Compare *c)
+{
+    return __atomic_load_n(&c->unread[0], __ATOMIC_RELAXED) +
+           __atomic_load_n(&c->unread[1], __ATOMIC_RELAXED);
+}
+
+/* why Sync is off, "" when it is not */
+static char* sync_off(Compare *c)
+{
+    if (c->nested) return g_strdup(" | one folder is inside the other, sync is off");
+    if (unread(c)) return g_strdup_printf(" | %" G_GUINT64_FORMAT " could not be read, sync is off", unread(c));
+    return g_strdup("");
+}
+
+static void update_status(Compare *c)
+{
+    char *bytes = g_format_size(__atomic_load_n(&c->bytes, __ATOMIC_RELAXED));
+    char *txt, *off = NULL;
+
+    switch (g_atomic_int_get(&c->stage)) {
+    case STAGE_WALK:
+        txt = g_strdup_printf("Scanning… %" G_GUINT64_FORMAT " left, %" G_GUINT64_FORMAT " right",
+                              __atomic_load_n(&c->seen[0], __ATOMIC_RELAXED),
+                              __atomic_load_n(&c->seen[1], __ATOMIC_RELAXED));
+        break;
+    case STAGE_CONTENTS:
+        txt = g_strdup_printf("Checking contents of %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT
+                              " files, %s read",
+                              __atomic_load_n(&c->checked, __ATOMIC_RELAXED), c->checks, bytes);
+        break;
+    case STAGE_SYNC:
+        txt = g_strdup_printf("Syncing %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT
+                              " items, %s copied",
+                              __atomic_load_n(&c->done, __ATOMIC_RELAXED), c->plan_items, bytes);
+        break;
+    default:
+        off = sync_off(c);
+        txt = g_strdup_printf("%u only left, %u only right, %u differ, %u differ in time only | "
+                              "%" G_GUINT64_FORMAT " the same%s",
+                              c->counts[KIND_LEFT], c->counts[KIND_RIGHT], c->counts[KIND_DIFFERENT],
+                              c->counts[KIND_TIME], c->same, off);
+    }
+
+    gtk_label_set_text(GTK_LABEL(c->status), txt);
+    g_free(txt);
+    g_free(off);
+    g_free(bytes);
+}
+
+static gboolean on_tick(gpointer data)
+{
+    update_status(data);
+    return G_SOURCE_CONTINUE;
+}
+
+static void set_busy(Compare *c, gboolean busy)
+{
+    gtk_widget_set_sensitive(c->check, !busy);
+    gtk_widget_set_sensitive(c->sync, !busy && !c->nested && !unread(c) && c->diffs->len);
+
+    if (busy && !c->tick) c->tick = g_timeout_add(COMPARE_TICK_MS, on_tick, c);
+    if (!busy && c->tick) {
+        g_source_remove(c->tick);
+        c->tick = 0;
+    }
+    update_status(c);
+}
+
+static char* describe(const Entry *e)
+{
+    if (!e) return NULL;
+    if (S_ISDIR(e->mode)) return g_strdup("folder");
+
+    GDateTime *t = g_date_time_new_from_unix_local(e->mtime);
+    char *when = t ? g_date_time_format(t, "%Y-%m-%d %H:%M") : g_strdup("?");
+    char *size = S_ISLNK(e->mode) ? g_strdup("link") : g_format_size(e->size);
+    char *out = g_strdup_printf("%s, %s", size, when);
+
+    g_free(size);
+    g_free(when);
+    if (t) g_date_time_unref(t);
+    return out;
+}
+
+static const char* kind_label(const Diff *d)
+{
+    switch (d->kind) {
+    case KIND_LEFT: return "Only left";
+    case KIND_RIGHT: return "Only right";
+    case KIND_TIME: return "Time only";
+    default: break;
+    }
+    if ((d->left->mode & S_IFMT) != (d->right->mode & S_IFMT)) return "Type differs";
+    if (!S_ISREG(d->left->mode) || d->left->size != d->right->size) return "Differs";
+    return d->left->mtime > d->right->mtime ? "Left newer" : "Right newer";
+}
+
+static void add_row(Compare *c, const Diff *d, guint inside)
+{
+    const Entry *e = d->left ? d->left : d->right;
+    int side = d->left ? 0 : 1;
+    char *path = full_path(c, side, e);
+    char *name = inside ? g_strdup_printf("%s/ (%u %s)", e->rel, inside, inside == 1 ? "item" : "items")
+                        : S_ISDIR(e->mode) ? g_strdup_printf("%s/", e->rel) : g_strdup(e->rel);
+    char *left = describe(d->left), *right = describe(d->right);
+
+    gtk_list_store_insert_with_values(c->store, NULL, -1,
+        0, kind_label(d), 1, name, 2, left, 3, right, 4, path, -1);
+
+    g_free(right);
+    g_free(left);
+    g_free(name);
+    g_free(path);
+}
+
+/* a folder on one side only stands for everything under it */
+static guint subtree_end(GArray *diffs, guint i)
+{
+    const Diff *top = &g_array_index(diffs, Diff, i);
+    const char *rel = (top->left ? top->left : top->right)->rel;
+    gsize len = strlen(rel);
+
+    guint j = i + 1;
+    for (; j < diffs->len; j++) {
+        const Diff *d = &g_array_index(diffs, Diff, j);
+        const char *r = (d->left ? d->left : d->right)->rel;
+        if (d->kind != top->kind || strncmp(r, rel, len) || r[len] != '/') break;
+    }
+    return j;
+}
+
+static void fill(Compare *c)
+{
+    TRACE_SCOPE("compare fill");
+
+    memset(c->counts, 0, sizeof(c->counts));
+    c->plan_items = c->plan_bytes = 0;
+    gtk_list_store_clear(c->store);
+
+    for (guint i = 0; i < c->diffs->len; i++) {
+        Diff *d = &g_array_index(c->diffs, Diff, i);
+        c->counts[d->kind]++;
+        c->plan_items++;
+        if (d->kind != KIND_RIGHT && d->kind != KIND_TIME && S_ISREG(d->left->mode))
+            c->plan_bytes += d->left->size;
+    }
+
+    /* the sync works from the full list; the view only needs what the user reads */
+    guint rows = 0;
+    for (guint i = 0; i < c->diffs->len && rows < COMPARE_ROWS_MAX; rows++) {
+        Diff *d = &g_array_index(c->diffs, Diff, i);
+        const Entry *e = d->left ? d->left : d->right;
+        guint end = i + 1;
+
+        if (S_ISDIR(e->mode) && (d->kind == KIND_LEFT || d->kind == KIND_RIGHT))
+            end = subtree_end(c->diffs, i);
+        add_row(c, d, end - i - 1);
+        i = end;
+    }
+
+    if (rows == COMPARE_ROWS_MAX)
+        gtk_list_store_insert_with_values(c->store, NULL, -1,
+            1, "… more differences not shown", -1);
+}
+
+static gboolean compared(gpointer data)
+{
+    Compare *c = data;
+
+    g_atomic_int_set(&c->stage, STAGE_IDLE);
+    if (c->window) {
+        fill(c);
+        set_busy(c, FALSE);
+    }
+
+    compare_unref(c);
+    return G_SOURCE_REMOVE;
+}
+
+static void run(Compare *c)
+{
+    for (int i = 0; i < 2; i++) {
+        side_reset(&c->side[i]);
+        c->seen[i] = c->unread[i] = 0;
+    }
+    g_array_set_size(c->diffs, 0);
+    c->same = c->checks = c->checked = c->bytes = 0;
+    c->contents = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(c->check));
+    gtk_list_store_clear(c->store);
+
+    g_atomic_int_set(&c->stage, STAGE_WALK);
+    set_busy(c, TRUE);
+
+    /* a sync has to see everything, hidden files included */
+    c->walks = 2;
+    for (int i = 0; i < 2; i++) {
+        Visit *v = g_new(Visit, 1);
+        v->c = compare_ref(c);
+        v->side = i;
+        c->side[i].walk = walk_start(c->side[i].root, TRUE, visit, walk_done, v);
+    }
+}
+
+static gboolean synced(gpointer data)
+{
+    Compare *c = data;
+
+    if (c->window) {
+        if (c->failed) {
+            char *msg = g_strdup_printf("%" G_GUINT64_FORMAT " items could not be synced.\n%s",
+                                        c->failed, c->error);
+            GtkWidget *d = gtk_message_dialog_new(GTK_WINDOW(c->window), GTK_DIALOG_MODAL,
+                GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "Sync incomplete");
+            gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(d), "%s", msg);
+            gtk_dialog_run(GTK_DIALOG(d));
+            gtk_widget_destroy(d);
+            g_free(msg);
+        }
+        /* compare again: what is listed now is what is still different */
+        run(c);
+    }
+
+    compare_unref(c);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_sync(GtkButton *b, gpointer data)
+{
+    Compare *c = data;
+    if (c->nested || unread(c)) return;
+
+    char *bytes = g_format_size(c->plan_bytes);
+    GtkWidget *d = gtk_message_dialog_new(GTK_WINDOW(c->window), GTK_DIALOG_MODAL,
+        GTK_MESSAGE_QUESTION, GTK_BUTTONS_OK_CANCEL, "Make %s a copy of %s?",
+        c->side[1].root, c->side[0].root);
+    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(d),
+        "%u items will be copied or replaced (%s), %u deleted from the right and %u "
+        "given the left time.",
+        c->counts[KIND_LEFT] + c->counts[KIND_DIFFERENT], bytes, c->counts[KIND_RIGHT],
+        c->counts[KIND_TIME]);
+    int response = gtk_dialog_run(GTK_DIALOG(d));
+    gtk_widget_destroy(d);
+    g_free(bytes);
+    if (response != GTK_RESPONSE_OK) return;
+
+    c->done = c->failed = c->bytes = 0;
+    g_clear_pointer(&c->error, g_free);
+    g_atomic_int_set(&c->stage, STAGE_SYNC);
+    set_busy(c, TRUE);
+
+    g_thread_unref(g_thread_new("compare-sync", sync_thread, compare_ref(c)));
+}
+
+static void on_contents(GtkToggleButton *b, gpointer data)
+{
+    run(data);
+}
+
+static void on_row_activated(GtkTreeView *v, GtkTreePath *p, GtkTreeViewColumn *col, gpointer data)
+{
+    Compare *c = data;
+    GtkTreeModel *m = GTK_TREE_MODEL(c->store);
+    GtkTreeIter it;
+    char *path = NULL;
+
+    if (!gtk_tree_model_get_iter(m, &it, p)) return;
+    gtk_tree_model_get(m, &it, 4, &path, -1);
+
+    if (path && c->open) {
+        char *dir = g_path_get_dirname(path);
+        c->open(dir, c->open_data);
+        g_free(dir);
+    }
+    g_free(path);
+}
+
+static void on_destroy(GtkWidget *w, gpointer data)
+{
+    Compare *c = data;
+
+    g_atomic_int_set(&c->cancelled, 1);
+    for (int i = 0; i < 2; i++)
+        if (c->side[i].walk) walk_cancel(c->side[i].walk);
+    if (c->tick) g_source_remove(c->tick);
+    c->tick = 0;
+    c->window = NULL;
+    g_object_unref(c->store);
+
+    compare_unref(c);
+}
+
+static gboolean inside(const char *a, const char *b)
+{
+    gsize len = strlen(b);
+    return !strncmp(a, b, len) && (a[len] == '/' || !a[len] || (len && b[len - 1] == '/'));
+}
+
+static void add_column(GtkWidget *view, const char *title, int col, gboolean expand)
+{
+    GtkCellRenderer *cell = gtk_cell_renderer_text_new();
+    GtkTreeViewColumn *c = gtk_tree_view_column_new_with_attributes(title, cell, "text", col, NULL);
+    gtk_tree_view_column_set_resizable(c, TRUE);
+    gtk_tree_view_column_set_expand(c, expand);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(view), c);
+}
+
+void compare_window_open(GtkWindow *parent, const char *left, const char *right,
+                         CompareOpenFunc open, gpointer data)
+{
+    Compare *c = g_malloc0(sizeof(Compare));
+    c->ref = 1;
+    c->diffs = g_array_new(FALSE, FALSE, sizeof(Diff));
+    /*
+     * Walked and checked resolved: ~/link and /data/backup look apart as
+     * strings but nest once the link is followed. One that does not
+     * resolve is walked as given, and the walk reports it unreadable.
+     */
+    const char *given[2] = { left, right };
+    for (int i = 0; i < 2; i++) {
+        char *real = realpath(given[i], NULL);
+        c->side[i].root = g_strdup(real ? real : given[i]);
+        free(real);
+        g_mutex_init(&c->side[i].lock);
+        c->side[i].root_len = strlen(c->side[i].root);
+        side_reset(&c->side[i]);
+    }
+    /* syncing into a folder that is part of the source would feed on itself */
+    c->nested = inside(c->side[0].root, c->side[1].root) || inside(c->side[1].root, c->side[0].root);
+    c->open = open;
+    c->open_data = data;
+
+    char *title = g_strdup_printf("Compare %s ↔ %s", left, right);
+    c->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(c->window), title);
+    gtk_window_set_transient_for(GTK_WINDOW(c->window), parent);
+    gtk_window_set_destroy_with_parent(GTK_WINDOW(c->window), TRUE);
+    gtk_window_set_default_size(GTK_WINDOW(c->window), 900, 560);
+    g_free(title);
+
+    c->store = gtk_list_store_new(5, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
+                                  G_TYPE_STRING, G_TYPE_STRING);
+    GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(c->store));
+    char *lname = g_path_get_basename(left), *rname = g_path_get_basename(right);
+    add_column(view, NULL, 0, FALSE);
+    add_column(view, "Path", 1, TRUE);
+    add_column(view, lname, 2, FALSE);
+    add_column(view, rname, 3, FALSE);
+    g_free(rname);
+    g_free(lname);
+
+    GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+    gtk_container_add(GTK_CONTAINER(scroll), view);
+
+    c->status = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(c->status), 0);
+    gtk_label_set_ellipsize(GTK_LABEL(c->status), PANGO_ELLIPSIZE_END);
+    c->check = gtk_check_button_new_with_label("Check contents when only the time differs");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(c->check), TRUE);
+    c->sync = gtk_button_new_with_label("Sync left → right");
+
+    GtkWidget *bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_box_pack_start(GTK_BOX(bar), c->status, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(bar), c->check, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(bar), c->sync, FALSE, FALSE, 0);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+    gtk_container_set_border_width(GTK_CONTAINER(box), 6);
+    gtk_box_pack_start(GTK_BOX(box), scroll, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(box), bar, FALSE, FALSE, 0);
+    gtk_container_add(GTK_CONTAINER(c->window), box);
+
+    g_signal_connect(view, "row-activated", G_CALLBACK(on_row_activated), c);
+    g_signal_connect(c->check, "toggled", G_CALLBACK(on_contents), c);
+    g_signal_connect(c->sync, "clicked", G_CALLBACK(on_sync), c);
+    g_signal_connect(c->window, "destroy", G_CALLBACK(on_destroy), c);
+
+    gtk_widget_show_all(c->window);
+    run(c);
+}
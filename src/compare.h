@@ -0,0 +1,25 @@
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <gtk/gtk.h>
+
+/*
+ * "Compare with…": a window listing how two folder trees differ. Both
+ * trees are walked at once on the shared walk pool, every entry is
+ * lstat()ed where the walk reads it, and the two listings are merged
+ * in one sorted pass. Files of equal size and mtime (to the second) are
+ * taken as the same without being read; only files whose size matches
+ * but whose time does not have their contents checked, and that only
+ * when asked. "Sync left → right" then makes the right tree a copy of
+ * the left with the fewest operations the comparison found: missing and
+ * changed entries are copied, extra ones deleted, and files that differ
+ * only in their time get the left time.
+ */
+
+/* activating a row asks the caller to show the folder it is in */
+typedef void (*CompareOpenFunc)(const char *dir, gpointer data);
+
+void compare_window_open(GtkWindow *parent, const char *left, const char *right,
+                         CompareOpenFunc open, gpointer data);
+
+#endif
@@ -0,0 +1,219 @@
+#include "complete.h"
+#include "utils.h"
+#include "trace.h"
+#include <gio/gio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COMPLETE_CACHE_MAX 32
+
+typedef struct {
+    GStringChunk *chunk;
+    GPtrArray *names;       /* child folder names, sorted by strcmp */
+    struct timespec mtime;  /* of the folder when it was read */
+    gboolean hidden;        /* names include dot-folders */
+    gint64 last_used;
+} DirNames;
+
+static GHashTable *dirs = NULL;      /* folder -> DirNames */
+static GHashTable *loading = NULL;   /* folders being read in the background */
+static CompleteNotifyFunc notify = NULL;
+
+static DirNames* names_new(void)
+{
+    DirNames *d = g_malloc0(sizeof(DirNames));
+    d->chunk = g_string_chunk_new(4096);
+    d->names = g_ptr_array_new();
+    return d;
+}
+
+static void names_free(DirNames *d)
+{
+    g_ptr_array_free(d->names, TRUE);
+    g_string_chunk_free(d->chunk);
+    g_free(d);
+}
+
+static int cmp_names(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+static void store(const char *dir, DirNames *d)
+{
+    if (!dirs) dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) names_free);
+
+    if (!g_hash_table_contains(dirs, dir) && g_hash_table_size(dirs) >= COMPLETE_CACHE_MAX) {
+        GHashTableIter it;
+        gpointer k, v;
+        const char *oldest = NULL;
+        gint64 oldest_used = G_MAXINT64;
+
+        g_hash_table_iter_init(&it, dirs);
+        while (g_hash_table_iter_next(&it, &k, &v)) {
+            if (((DirNames*) v)->last_used < oldest_used) {
+                oldest = k;
+                oldest_used = ((DirNames*) v)->last_used;
+            }
+        }
+        if (oldest) g_hash_table_remove(dirs, oldest);
+    }
+
+    d->last_used = g_get_monotonic_time();
+    g_hash_table_insert(dirs, g_strdup(dir), d);
+}
+
+void complete_set_notify(CompleteNotifyFunc func)
+{
+    notify = func;
+}
+
+void complete_feed(const char *dir, GList *entries, gboolean hidden)
+{
+    TRACE_SCOPE("complete_feed");
+    struct stat st;
+    if (stat(dir, &st) != 0) return;
+
+    DirNames *d = names_new();
+    for (GList *l = entries; l; l = l->next) {
+        UtilsEntry *e = l->data;
+        if (e->is_dir) g_ptr_array_add(d->names, g_string_chunk_insert(d->chunk, e->name));
+    }
+    g_ptr_array_sort(d->names, cmp_names);
+    d->mtime = st.st_mtim;
+    d->hidden = hidden;
+    TRACE_ITEMS(d->names->len);
+
+    store(dir, d);
+}
+
+/* worker thread: names only, d_type says which are folders on most filesystems */
+static void read_thread(GTask *task, gpointer src, gpointer data, GCancellable *c)
+{
+    const char *dir = data;
+    DirNames *d = names_new();
+    d->hidden = TRUE;
+
+    struct stat st;
+    if (stat(dir, &st) == 0) d->mtime = st.st_mtim;
+
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dp = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dp && fd >= 0) close(fd);
+
+    struct dirent *ent;
+    while (dp && (ent = readdir(dp))) {
+        const char *n = ent->d_name;
+        if (n[0] == '.' && (!n[1] || (n[1] == '.' && !n[2]))) continue;
+
+        gboolean is_dir = ent->d_type == DT_DIR;
+        /* links to folders complete like folders */
+        if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK) {
+            struct stat s;
+            is_dir = fstatat(fd, n, &s, 0) == 0 && S_ISDIR(s.st_mode);
+        }
+        if (is_dir) g_ptr_array_add(d->names, g_string_chunk_insert(d->chunk, n));
+    }
+    if (dp) closedir(dp);
+
+    g_ptr_array_sort(d->names, cmp_names);
+    g_task_return_pointer(task, d, (GDestroyNotify) names_free);
+}
+
+static void read_done(GObject *src, GAsyncResult *res, gpointer data)
+{
+    const char *dir = g_task_get_task_data(G_TASK(res));
+    DirNames *d = g_task_propagate_pointer(G_TASK(res), NULL);
+
+    if (d) store(dir, d);
+    if (notify) notify(dir);
+    g_hash_table_remove(loading, dir);
+}
+
+static void start_read(const char *dir)
+{
+    if (!loading) loading = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    if (g_hash_table_contains(loading, dir)) return;
+    g_hash_table_add(loading, g_strdup(dir));
+
+    GTask *task = g_task_new(NULL, NULL, read_done, NULL);
+    g_task_set_task_data(task, g_strdup(dir), g_free);
+    g_task_run_in_thread(task, read_thread);
+    g_object_unref(task);
+}
+
+static char* join(const char *dir, const char *name, gsize len)
+{
+    return g_strdup_printf("%s%s%.*s", dir, strcmp(dir, "/") ? "/" : "", (int) len, name);
+}
+
+gboolean complete_lookup(const char *text, guint max, GPtrArray *out, char **common)
+{
+    TRACE_SCOPE("complete_lookup");
+    *common = NULL;
+
+    const char *slash = strrchr(text, '/');
+    if (!slash) return TRUE;
+
+    char *dir = slash == text ? g_strdup("/") : g_strndup(text, slash - text);
+    const char *prefix = slash + 1;
+    gsize plen = strlen(prefix);
+    gboolean want_hidden = prefix[0] == '.';
+
+    DirNames *d = dirs ? g_hash_table_lookup(dirs, dir) : NULL;
+
+    /* a changed folder is re-read, but its old names serve until then */
+    struct stat st;
+    gboolean stale = d && stat(dir, &st) == 0 &&
+        (st.st_mtim.tv_sec != d->mtime.tv_sec || st.st_mtim.tv_nsec != d->mtime.tv_nsec);
+    if (!d || stale || (want_hidden && !d->hidden)) start_read(dir);
+
+    if (!d) {
+        g_free(dir);
+        return FALSE;
+    }
+    d->last_used = g_get_monotonic_time();
+
+    char **names = (char**) d->names->pdata;
+    guint lo = 0, hi = d->names->len;
+
+    /* first name >= prefix, then first name past the ones starting with it */
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (strcmp(names[mid], prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    guint first = lo;
+    hi = d->names->len;
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+        if (strncmp(names[mid], prefix, plen) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    guint last = lo;
+
+    guint shown = 0;
+    for (guint i = first; i < last && shown < max; i++) {
+        if (!want_hidden && names[i][0] == '.') continue;
+        g_ptr_array_add(out, join(dir, names[i], strlen(names[i])));
+        shown++;
+    }
+    TRACE_ITEMS(last - first);
+
+    /* sorted, so what the first and last share, all of them share */
+    if (first < last) {
+        const char *a = names[first], *b = names[last - 1];
+        gsize n = 0;
+        while (a[n] && a[n] == b[n]) n++;
+        if (first + 1 == last && (want_hidden || a[0] != '.'))
+            *common = g_strconcat(dir, strcmp(dir, "/") ? "/" : "", a, "/", NULL);
+        else if (n > plen)
+            *common = join(dir, a, n);
+    }
+
+    g_free(dir);
+    return TRUE;
+}
@@ -0,0 +1,28 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <glib.h>
+
+/*
+ * Path bar completion. The child folder names of recently seen folders
+ * are kept as sorted arrays, so a prefix is a binary search however big
+ * the folder is. Folders come from the grid's own listings or, when the
+ * user types into one that has not been shown, from a background read.
+ */
+
+/* called on the main thread when a background read of dir has landed */
+typedef void (*CompleteNotifyFunc)(const char *dir);
+
+void complete_set_notify(CompleteNotifyFunc func);
+
+/* the listing the grid just showed; hidden says whether it has dot-folders */
+void complete_feed(const char *dir, GList *entries, gboolean hidden);
+
+/*
+ * Up to max full paths of folders that text could be completing, into out
+ * (freed by the caller), and in *common the longest text all matches
+ * share. FALSE when text's folder is still being read.
+ */
+gboolean complete_lookup(const char *text, guint max, GPtrArray *out, char **common);
+
+#endif
@@ -0,0 +1,237 @@
+#define _GNU_SOURCE
+#include "copyjob.h"
+#include "priv.h"
+#include "fsio.h"
+#include "utils.h"
+#include "trace.h"
+#include <glib.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define COPYJOB_TICK_MS 250
+
+typedef struct {
+    GBytes *uris;
+    char *dest;
+    CopyJobMode mode;
+    gboolean sudo;
+
+    /* counters written by the worker */
+    CopyJobProgress progress;
+    char *error;            /* first failure, read once the task is done */
+
+    guint tick;
+    CopyJobProgressFunc on_progress;
+    CopyJobDoneFunc on_done;
+    gpointer data;
+} CopyJob;
+
+static void count(guint64 *field, guint64 n)
+{
+    __atomic_fetch_add(field, n, __ATOMIC_RELAXED);
+}
+
+static void fail(CopyJob *j, const char *what, const char *why)
+{
+    count(&j->progress.failed, 1);
+    if (!j->error) j->error = g_strdup_printf("%s: %s", what, why);
+}
+
+static int copy_tree(CopyJob *j, const char *src, const char *dst)
+{
+    struct stat st;
+    if (lstat(src, &st) != 0) return errno;
+
+    int rc = 0;
+    if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t n = readlink(src, target, sizeof(target) - 1);
+        if (n < 0) return errno;
+        target[n] = 0;
+        rc = symlink(target, dst) ? errno : 0;
+    } else if (!S_ISDIR(st.st_mode)) {
+        rc = fsio_copy_file(src, dst, st.st_mode, FALSE, &j->progress.bytes);
+    } else {
+        if (mkdir(dst, st.st_mode & 07777) != 0) return errno;
+
+        DIR *d = opendir(src);
+        if (!d) return errno;
+
+        struct dirent *ent;
+        while (!rc && (ent = readdir(d)) != NULL) {
+            if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+
+            char s[PATH_MAX], t[PATH_MAX];
+            snprintf(s, sizeof(s), "%s/%s", src, ent->d_name);
+            snprintf(t, sizeof(t), "%s/%s", dst, ent->d_name);
+            rc = copy_tree(j, s, t);
+        }
+        closedir(d);
+    }
+
+    if (!rc) count(&j->progress.files, 1);
+    return rc;
+}
+
+static int rm_one(const char *p, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(p) ? errno : 0;
+}
+
+static int delete_tree(const char *path)
+{
+    int rc = nftw(path, rm_one, 64, FTW_DEPTH | FTW_PHYS);
+    return rc < 0 ? errno : rc;
+}
+
+/* as root: a folder we may not search would make every name look free */
+static int priv_exists(const char *path)
+{
+    PrivStat ps;
+    return priv_stat(path, &ps);
+}
+
+static void transfer(CopyJob *j, const char *uri)
+{
+    char *src = g_filename_from_uri(uri, NULL, NULL);
+    if (!src) {
+        /* http:// and friends; only local files are taken */
+        fail(j, uri, "not a local file");
+        count(&j->progress.items, 1);
+        return;
+    }
+
+    char *dir = g_path_get_dirname(src);
+    char *name = g_path_get_basename(src);
+    size_t slen = strlen(src);
+
+    if (!strcmp(dir, j->dest)) {
+        /* dropped back where it came from */
+    } else if (!strncmp(j->dest, src, slen) && (j->dest[slen] == '/' || !j->dest[slen])) {
+        fail(j, src, "a folder cannot go inside itself");
+    } else {
+        int rc = 0;
+        char *dst = utils_free_name(j->dest, name, j->sudo ? priv_exists : NULL, &rc);
+
+        if (!dst) {
+            /* rc says why the name could not be checked */
+        } else if (j->sudo) {
+            rc = j->mode == COPYJOB_MOVE ? priv_move(src, dst) : priv_copy(src, dst);
+        } else if (j->mode == COPYJOB_MOVE) {
+            rc = rename(src, dst) ? errno : 0;
+            if (rc == EXDEV) {
+                rc = copy_tree(j, src, dst);
+                if (!rc) rc = delete_tree(src);
+            } else if (!rc) {
+                count(&j->progress.files, 1);
+            }
+        } else {
+            rc = copy_tree(j, src, dst);
+        }
+
+        if (rc) fail(j, src, g_strerror(rc));
+        else if (j->sudo) count(&j->progress.files, 1);
+        g_free(dst);
+    }
+
+    count(&j->progress.items, 1);
+    g_free(name);
+    g_free(dir);
+    g_free(src);
+}
+
+/* worker thread */
+static void job_thread(GTask *task, gpointer src, gpointer data, GCancellable *c)
+{
+    CopyJob *j = data;
+    TRACE_SCOPE("copyjob");
+
+    /* a connection of its own, so a long copy never holds the one folders are listed through */
+    int rc = j->sudo ? priv_attach() : 0;
+    if (rc) {
+        fail(j, "SUDO mode", g_strerror(rc));
+        g_task_return_boolean(task, TRUE);
+        return;
+    }
+
+    gsize len;
+    const char *p = g_bytes_get_data(j->uris, &len);
+    const char *end = p + len;
+
+    /* one line at a time; a URI is handled before the next is looked at */
+    while (p && p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *eol = nl ? nl : end;
+        char *line = g_strndup(p, eol - p);
+        p = nl ? nl + 1 : end;
+
+        g_strstrip(line);
+        if (*line && *line != '#') transfer(j, line);
+        g_free(line);
+    }
+
+    if (j->sudo) priv_detach();
+    TRACE_ITEMS(j->progress.items);
+    g_task_return_boolean(task, TRUE);
+}
+
+static void snapshot(CopyJob *j, CopyJobProgress *out)
+{
+    out->items = __atomic_load_n(&j->progress.items, __ATOMIC_RELAXED);
+    out->files = __atomic_load_n(&j->progress.files, __ATOMIC_RELAXED);
+    out->bytes = __atomic_load_n(&j->progress.bytes, __ATOMIC_RELAXED);
+    out->failed = __atomic_load_n(&j->progress.failed, __ATOMIC_RELAXED);
+}
+
+static gboolean on_tick(gpointer data)
+{
+    CopyJob *j = data;
+    CopyJobProgress p;
+    snapshot(j, &p);
+    if (j->on_progress) j->on_progress(&p, j->data);
+    return G_SOURCE_CONTINUE;
+}
+
+static void job_done(GObject *src, GAsyncResult *res, gpointer data)
+{
+    CopyJob *j = g_task_get_task_data(G_TASK(res));
+    CopyJobProgress p;
+
+    g_source_remove(j->tick);
+    snapshot(j, &p);
+    if (j->on_done) j->on_done(&p, j->error, j->data);
+}
+
+static void job_free(CopyJob *j)
+{
+    g_bytes_unref(j->uris);
+    g_free(j->dest);
+    g_free(j->error);
+    g_free(j);
+}
+
+void copyjob_start(GBytes *uri_list, const char *dest, CopyJobMode mode,
+                   CopyJobProgressFunc progress, CopyJobDoneFunc done, gpointer data)
+{
+    CopyJob *j = g_malloc0(sizeof(CopyJob));
+    j->uris = g_bytes_ref(uri_list);
+    j->dest = g_strdup(dest);
+    j->mode = mode;
+    j->sudo = sudo_mode;
+    j->on_progress = progress;
+    j->on_done = done;
+    j->data = data;
+    j->tick = g_timeout_add(COPYJOB_TICK_MS, on_tick, j);
+
+    GTask *task = g_task_new(NULL, NULL, job_done, NULL);
+    g_task_set_task_data(task, j, (GDestroyNotify) job_free);
+    g_task_run_in_thread(task, job_thread);
+    g_object_unref(task);
+}
@@ -0,0 +1,34 @@
+#ifndef COPYJOB_H
+#define COPYJOB_H
+
+#include <glib.h>
+
+/*
+ * Background copy and move of a dropped text/uri-list. The list is split
+ * on the worker thread one line at a time, so the first files are being
+ * copied while the rest of a 10k-item drop is still unparsed; the main
+ * thread only hands over the bytes. Moves are a rename() when source and
+ * folder share a filesystem and a copy then delete when they do not.
+ * In SUDO mode every item goes through the root helper instead.
+ */
+
+typedef enum {
+    COPYJOB_COPY,
+    COPYJOB_MOVE
+} CopyJobMode;
+
+typedef struct {
+    guint64 items;      /* dropped items finished, failed ones included */
+    guint64 files;      /* files, folders and links written */
+    guint64 bytes;
+    guint64 failed;
+} CopyJobProgress;
+
+/* both on the main thread; error is the first failure, NULL when none */
+typedef void (*CopyJobProgressFunc)(const CopyJobProgress *p, gpointer data);
+typedef void (*CopyJobDoneFunc)(const CopyJobProgress *p, const char *error, gpointer data);
+
+void copyjob_start(GBytes *uri_list, const char *dest, CopyJobMode mode,
+                   CopyJobProgressFunc progress, CopyJobDoneFunc done, gpointer data);
+
+#endif
@@ -0,0 +1,631 @@
+#include "dupes.h"
+#include "walk.h"
+#include "hash.h"
+#include "trace.h"
+#include <gtk/gtk.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DUPES_EDGE (64 * 1024)
+#define DUPES_CHUNK (1024 * 1024)
+#define DUPES_BATCH_MIN 64
+#define DUPES_TICK_MS 250
+
+typedef enum {
+    STAGE_WALK,
+    STAGE_COMPARE,
+    STAGE_DONE
+} DupesStage;
+
+typedef struct {
+    char *path;
+    guint64 size;
+    guint64 dev;
+    guint64 ino;
+    guint64 key;        /* edge hash, then full hash */
+    gboolean failed;
+    GPtrArray *links;   /* further names of this inode */
+} DupFile;
+
+typedef struct {
+    gint ref;
+    gint cancelled;
+    Walk *walk;
+
+    GMutex lock;
+    GHashTable *by_size;    /* size -> GPtrArray of DupFile, filled by the walk */
+
+    /* progress, written by workers */
+    gint stage;
+    guint64 files;
+    guint64 candidates;
+    guint64 compared;
+    guint64 bytes_read;
+
+    /* main thread only */
+    GtkWidget *window;
+    GtkWidget *status;
+    GtkTreeStore *store;
+    guint tick;
+    guint groups;
+    guint64 reclaim;
+    DupesOpenFunc open;
+    gpointer open_data;
+} Dupes;
+
+typedef struct {
+    gint pending;
+    GMutex lock;
+    GCond cond;
+} Barrier;
+
+typedef struct {
+    Dupes *d;
+    DupFile *file;
+    gboolean full;
+    Barrier *barrier;
+} HashJob;
+
+typedef struct {
+    Dupes *d;
+    guint64 size;
+    guint inodes;
+    GPtrArray *names;   /* char*, hardlinks marked */
+} DupGroup;
+
+static void dup_file_free(DupFile *f)
+{
+    g_free(f->path);
+    if (f->links) g_ptr_array_free(f->links, TRUE);
+    g_free(f);
+}
+
+static Dupes* dupes_ref(Dupes *d)
+{
+    g_atomic_int_inc(&d->ref);
+    return d;
+}
+
+static void dupes_unref(Dupes *d)
+{
+    if (!g_atomic_int_dec_and_test(&d->ref)) return;
+
+    g_hash_table_destroy(d->by_size);
+    walk_unref(d->walk);
+    g_mutex_clear(&d->lock);
+    g_free(d);
+}
+
+static gboolean cancelled(Dupes *d)
+{
+    return g_atomic_int_get(&d->cancelled);
+}
+
+/* ---------- stage 1: walk and bucket by size ---------- */
+
+static gboolean visit(Walk *w, const WalkEntry *e, gpointer data)
+{
+    Dupes *d = data;
+
+    if (e->is_dir) return TRUE;
+    if (e->type != DT_REG) return FALSE;
+
+    struct stat st;
+    if (fstatat(e->dirfd, e->name, &st, AT_SYMLINK_NOFOLLOW) != 0 || st.st_size == 0)
+        return FALSE;
+
+    __atomic_fetch_add(&d->files, 1, __ATOMIC_RELAXED);
+
+    DupFile *f = g_malloc0(sizeof(DupFile));
+    f->path = g_strdup(e->path);
+    f->size = st.st_size;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+
+    g_mutex_lock(&d->lock);
+    GPtrArray *bucket = g_hash_table_lookup(d->by_size, &f->size);
+    if (!bucket) {
+        bucket = g_ptr_array_new_with_free_func((GDestroyNotify) dup_file_free);
+        g_hash_table_insert(d->by_size, &f->size, bucket);
+    }
+    g_ptr_array_add(bucket, f);
+    g_mutex_unlock(&d->lock);
+
+    return FALSE;
+}
+
+/* ---------- stages 2 and 3: edge hash, full hash ---------- */
+
+static int open_quiet(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOATIME);
+    if (fd < 0 && errno == EPERM)
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    return fd;
+}
+
+/* head and tail; for files up to two edges long this is the whole file */
+static gboolean hash_edges(Dupes *d, DupFile *f, int fd)
+{
+    gsize head = MIN(f->size, DUPES_EDGE * 2);
+    gsize tail = f->size > DUPES_EDGE * 2 ? DUPES_EDGE : 0;
+    if (tail) head = DUPES_EDGE;
+
+    guchar *buf = g_malloc(head + tail);
+    gboolean ok = pread(fd, buf, head, 0) == (gssize) head &&
+                  (!tail || pread(fd, buf + head, tail, f->size - tail) == (gssize) tail);
+
+    if (ok) f->key = hash_buffer(buf, head + tail, f->size);
+    __atomic_fetch_add(&d->bytes_read, head + tail, __ATOMIC_RELAXED);
+
+    g_free(buf);
+    return ok;
+}
+
+static gboolean hash_full(Dupes *d, DupFile *f, int fd)
+{
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    guchar *buf = g_malloc(DUPES_CHUNK);
+    HashState h;
+    hash_init(&h, f->size);
+
+    guint64 total = 0;
+    gssize n;
+    while ((n = read(fd, buf, DUPES_CHUNK)) > 0 && !cancelled(d)) {
+        hash_update(&h, buf, n);
+        total += n;
+        __atomic_fetch_add(&d->bytes_read, n, __ATOMIC_RELAXED);
+    }
+    g_free(buf);
+
+    /* a file that changed size while we read it is no longer a candidate */
+    if (n < 0 || total != f->size) return FALSE;
+
+    f->key = hash_digest(&h);
+    return TRUE;
+}
+
+static void hash_job(gpointer data, gpointer unused)
+{
+    HashJob *j = data;
+    DupFile *f = j->file;
+
+    if (!cancelled(j->d)) {
+        int fd = open_quiet(f->path);
+        f->failed = fd < 0 || !(j->full ? hash_full(j->d, f, fd) : hash_edges(j->d, f, fd));
+        if (fd >= 0) close(fd);
+    } else {
+        f->failed = TRUE;
+    }
+
+    if (!j->full) __atomic_fetch_add(&j->d->compared, 1, __ATOMIC_RELAXED);
+
+    Barrier *b = j->barrier;
+    g_free(j);
+
+    g_mutex_lock(&b->lock);
+    if (--b->pending == 0) g_cond_signal(&b->cond);
+    g_mutex_unlock(&b->lock);
+}
+
+/* hash every file in `files` on the pool and wait for all of them */
+static void hash_all(Dupes *d, GThreadPool *pool, GPtrArray *files, gboolean full)
+{
+    if (!files->len) return;
+
+    TRACE_SCOPE(full ? "dupes full hash" : "dupes edge hash");
+    TRACE_ITEMS(files->len);
+
+    Barrier b;
+    b.pending = files->len;
+    g_mutex_init(&b.lock);
+    g_cond_init(&b.cond);
+
+    for (guint i = 0; i < files->len; i++) {
+        HashJob *j = g_malloc(sizeof(HashJob));
+        j->d = d;
+        j->file = files->pdata[i];
+        j->full = full;
+        j->barrier = &b;
+        g_thread_pool_push(pool, j, NULL);
+    }
+
+    g_mutex_lock(&b.lock);
+    while (b.pending) g_cond_wait(&b.cond, &b.lock);
+    g_mutex_unlock(&b.lock);
+
+    g_mutex_clear(&b.lock);
+    g_cond_clear(&b.cond);
+}
+
+static gint by_key(gconstpointer a, gconstpointer b)
+{
+    const DupFile *fa = *(DupFile* const*) a, *fb = *(DupFile* const*) b;
+    return fa->key < fb->key ? -1 : fa->key > fb->key;
+}
+
+static gint by_size_desc(gconstpointer a, gconstpointer b)
+{
+    GPtrArray *ba = *(GPtrArray* const*) a, *bb = *(GPtrArray* const*) b;
+    guint64 sa = ((DupFile*) ba->pdata[0])->size, sb = ((DupFile*) bb->pdata[0])->size;
+    return sa > sb ? -1 : sa < sb;
+}
+
+static guint inode_hash(gconstpointer p)
+{
+    const DupFile *f = p;
+    return (guint) (f->ino ^ (f->ino >> 32) ^ f->dev * 31);
+}
+
+static gboolean inode_equal(gconstpointer a, gconstpointer b)
+{
+    const DupFile *fa = a, *fb = b;
+    return fa->dev == fb->dev && fa->ino == fb->ino;
+}
+
+/* folds names of one (dev, ino) into a single DupFile; returns the distinct inodes */
+static GPtrArray* collapse_links(GPtrArray *bucket)
+{
+    GHashTable *seen = g_hash_table_new(inode_hash, inode_equal);
+    GPtrArray *inodes = g_ptr_array_new();
+
+    for (guint i = 0; i < bucket->len; i++) {
+        DupFile *f = bucket->pdata[i];
+        DupFile *first = g_hash_table_lookup(seen, f);
+
+        if (first) {
+            if (!first->links) first->links = g_ptr_array_new_with_free_func(g_free);
+            g_ptr_array_add(first->links, g_strdup(f->path));
+            continue;
+        }
+
+        g_hash_table_add(seen, f);
+        g_ptr_array_add(inodes, f);
+    }
+
+    g_hash_table_destroy(seen);
+    return inodes;
+}
+
+/* runs of equal keys with at least two members; failed files drop out */
+static void split_runs(GPtrArray *files, GPtrArray *out_groups)
+{
+    GPtrArray *ok = g_ptr_array_new();
+    for (guint i = 0; i < files->len; i++)
+        if (!((DupFile*) files->pdata[i])->failed) g_ptr_array_add(ok, files->pdata[i]);
+
+    g_ptr_array_sort(ok, by_key);
+
+    for (guint i = 0; i < ok->len; ) {
+        guint j = i + 1;
+        while (j < ok->len && ((DupFile*) ok->pdata[j])->key == ((DupFile*) ok->pdata[i])->key) j++;
+
+        if (j - i >= 2) {
+            GPtrArray *g = g_ptr_array_new();
+            for (guint k = i; k < j; k++) g_ptr_array_add(g, ok->pdata[k]);
+            g_ptr_array_add(out_groups, g);
+        }
+        i = j;
+    }
+
+    g_ptr_array_free(ok, TRUE);
+}
+
+static gboolean add_group(gpointer data);
+
+static void emit_group(Dupes *d, GPtrArray *g)
+{
+    DupGroup *out = g_malloc0(sizeof(DupGroup));
+    out->d = dupes_ref(d);
+    out->size = ((DupFile*) g->pdata[0])->size;
+    out->inodes = g->len;
+    out->names = g_ptr_array_new_with_free_func(g_free);
+
+    for (guint i = 0; i < g->len; i++) {
+        DupFile *f = g->pdata[i];
+        g_ptr_array_add(out->names, g_strdup(f->path));
+        for (guint k = 0; f->links && k < f->links->len; k++)
+            g_ptr_array_add(out->names, g_strdup_printf("%s\t(hardlink)", (char*) f->links->pdata[k]));
+    }
+
+    g_idle_add(add_group, out);
+}
+
+/* one batch of size buckets through the edge and full hash stages */
+static void compare_batch(Dupes *d, GThreadPool *pool, GPtrArray *buckets)
+{
+    GPtrArray *edge = g_ptr_array_new();
+    GPtrArray *per_bucket = g_ptr_array_new();
+
+    for (guint i = 0; i < buckets->len; i++) {
+        GPtrArray *bucket = buckets->pdata[i];
+        GPtrArray *inodes = collapse_links(bucket);
+
+        /* names of an inode are compared through its first name */
+        __atomic_fetch_add(&d->compared, bucket->len - inodes->len, __ATOMIC_RELAXED);
+
+        if (inodes->len < 2) {
+            __atomic_fetch_add(&d->compared, inodes->len, __ATOMIC_RELAXED);
+            g_ptr_array_free(inodes, TRUE);
+            continue;
+        }
+        for (guint k = 0; k < inodes->len; k++) g_ptr_array_add(edge, inodes->pdata[k]);
+        g_ptr_array_add(per_bucket, inodes);
+    }
+
+    hash_all(d, pool, edge, FALSE);
+
+    GPtrArray *edge_groups = g_ptr_array_new();
+    for (guint i = 0; i < per_bucket->len; i++) {
+        split_runs(per_bucket->pdata[i], edge_groups);
+        g_ptr_array_free(per_bucket->pdata[i], TRUE);
+    }
+
+    /* small files were read whole by the edge hash already */
+    GPtrArray *full = g_ptr_array_new();
+    GPtrArray *need_full = g_ptr_array_new();
+    for (guint i = 0; i < edge_groups->len; i++) {
+        GPtrArray *g = edge_groups->pdata[i];
+        if (((DupFile*) g->pdata[0])->size <= DUPES_EDGE * 2) {
+            if (!cancelled(d)) emit_group(d, g);
+            g_ptr_array_free(g, TRUE);
+            continue;
+        }
+        for (guint k = 0; k < g->len; k++) g_ptr_array_add(full, g->pdata[k]);
+        g_ptr_array_add(need_full, g);
+    }
+
+    hash_all(d, pool, full, TRUE);
+
+    for (guint i = 0; i < need_full->len; i++) {
+        GPtrArray *same = g_ptr_array_new();
+        split_runs(need_full->pdata[i], same);
+        for (guint k = 0; k < same->len; k++) {
+            if (!cancelled(d)) emit_group(d, same->pdata[k]);
+            g_ptr_array_free(same->pdata[k], TRUE);
+        }
+        g_ptr_array_free(same, TRUE);
+        g_ptr_array_free(need_full->pdata[i], TRUE);
+    }
+
+    g_ptr_array_free(need_full, TRUE);
+    g_ptr_array_free(full, TRUE);
+    g_ptr_array_free(edge_groups, TRUE);
+    g_ptr_array_free(per_bucket, TRUE);
+    g_ptr_array_free(edge, TRUE);
+}
+
+static gboolean finished(gpointer data);
+
+static gpointer compare_thread(gpointer data)
+{
+    Dupes *d = data;
+
+    /* biggest sizes first: they free the most space and show up soonest */
+    GPtrArray *buckets = g_ptr_array_new();
+    GHashTableIter it;
+    gpointer k, v;
+    g_hash_table_iter_init(&it, d->by_size);
+    while (g_hash_table_iter_next(&it, &k, &v)) {
+        GPtrArray *b = v;
+        if (b->len < 2) continue;
+        g_ptr_array_add(buckets, b);
+        __atomic_fetch_add(&d->candidates, b->len, __ATOMIC_RELAXED);
+    }
+    g_ptr_array_sort(buckets, by_size_desc);
+
+    g_atomic_int_set(&d->stage, STAGE_COMPARE);
+
+    int threads = CLAMP((int) g_get_num_processors(), 2, 8);
+    GThreadPool *pool = g_thread_pool_new(hash_job, NULL, threads, TRUE, NULL);
+
+    GPtrArray *batch = g_ptr_array_new();
+    guint batch_files = 0;
+
+    for (guint i = 0; i < buckets->len && !cancelled(d); i++) {
+        g_ptr_array_add(batch, buckets->pdata[i]);
+        batch_files += ((GPtrArray*) buckets->pdata[i])->len;
+
+        if (batch_files >= DUPES_BATCH_MIN || i + 1 == buckets->len) {
+            compare_batch(d, pool, batch);
+            g_ptr_array_set_size(batch, 0);
+            batch_files = 0;
+        }
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_ptr_array_free(batch, TRUE);
+    g_ptr_array_free(buckets, TRUE);
+
+    g_atomic_int_set(&d->stage, STAGE_DONE);
+    g_idle_add(finished, d);
+    return NULL;
+}
+
+/* ---------- main thread ---------- */
+
+static void update_status(Dupes *d)
+{
+    char *reclaim = g_format_size(d->reclaim);
+    char *read = g_format_size(__atomic_load_n(&d->bytes_read, __ATOMIC_RELAXED));
+    guint64 files = __atomic_load_n(&d->files, __ATOMIC_RELAXED);
+    char *txt;
+
+    switch (g_atomic_int_get(&d->stage)) {
+    case STAGE_WALK:
+        txt = g_strdup_printf("Scanning… %" G_GUINT64_FORMAT " files", files);
+        break;
+    case STAGE_COMPARE:
+        txt = g_strdup_printf("Comparing %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT
+                              " same-size files, %s read | %u groups, %s reclaimable",
+                              __atomic_load_n(&d->compared, __ATOMIC_RELAXED),
+                              __atomic_load_n(&d->candidates, __ATOMIC_RELAXED),
+                              read, d->groups, reclaim);
+        break;
+    default:
+        txt = g_strdup_printf("%u duplicate groups, %s reclaimable | %" G_GUINT64_FORMAT
+                              " files scanned, %s read",
+                              d->groups, reclaim, files, read);
+    }
+
+    gtk_label_set_text(GTK_LABEL(d->status), txt);
+    g_free(txt);
+    g_free(read);
+    g_free(reclaim);
+}
+
+static gboolean on_tick(gpointer data)
+{
+    update_status(data);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean add_group(gpointer data)
+{
+    DupGroup *g = data;
+    Dupes *d = g->d;
+
+    if (d->window) {
+        guint64 reclaim = g->size * (g->inodes - 1);
+        d->groups++;
+        d->reclaim += reclaim;
+
+        char *size = g_format_size(g->size);
+        char *free = g_format_size(reclaim);
+        char *title = g_strdup_printf("%u copies of %s — %s reclaimable", g->inodes, size, free);
+
+        GtkTreeIter parent, child;
+        gtk_tree_store_append(d->store, &parent, NULL);
+        gtk_tree_store_set(d->store, &parent, 0, title, 1, NULL, -1);
+
+        for (guint i = 0; i < g->names->len; i++) {
+            char *name = g->names->pdata[i];
+            char *tab = strchr(name, '\t');
+            char *path = tab ? g_strndup(name, tab - name) : g_strdup(name);
+
+            gtk_tree_store_append(d->store, &child, &parent);
+            gtk_tree_store_set(d->store, &child, 0, name, 1, path, -1);
+            g_free(path);
+        }
+
+        g_free(title);
+        g_free(free);
+        g_free(size);
+    }
+
+    g_ptr_array_free(g->names, TRUE);
+    dupes_unref(d);
+    g_free(g);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean finished(gpointer data)
+{
+    Dupes *d = data;
+
+    if (d->window) {
+        if (d->tick) g_source_remove(d->tick);
+        d->tick = 0;
+        update_status(d);
+    }
+
+    dupes_unref(d);
+    return G_SOURCE_REMOVE;
+}
+
+static void walk_done(Walk *w, gboolean was_cancelled, gpointer data)
+{
+    Dupes *d = data;
+
+    if (was_cancelled || cancelled(d)) {
+        dupes_unref(d);
+        return;
+    }
+
+    /* the walk's reference moves to the compare thread */
+    g_thread_unref(g_thread_new("dupes", compare_thread, d));
+}
+
+static void on_row_activated(GtkTreeView *v, GtkTreePath *p, GtkTreeViewColumn *c, gpointer data)
+{
+    Dupes *d = data;
+    GtkTreeModel *m = GTK_TREE_MODEL(d->store);
+    GtkTreeIter it;
+    char *path = NULL;
+
+    if (!gtk_tree_model_get_iter(m, &it, p)) return;
+    gtk_tree_model_get(m, &it, 1, &path, -1);
+
+    if (path && d->open) {
+        char *dir = g_path_get_dirname(path);
+        d->open(dir, d->open_data);
+        g_free(dir);
+    }
+    g_free(path);
+}
+
+static void on_destroy(GtkWidget *w, gpointer data)
+{
+    Dupes *d = data;
+
+    g_atomic_int_set(&d->cancelled, 1);
+    if (d->walk) walk_cancel(d->walk);
+    if (d->tick) g_source_remove(d->tick);
+    d->tick = 0;
+    d->window = NULL;
+    g_object_unref(d->store);
+
+    dupes_unref(d);
+}
+
+void dupes_window_open(GtkWindow *parent, const char *root, DupesOpenFunc open, gpointer data)
+{
+    Dupes *d = g_malloc0(sizeof(Dupes));
+    d->ref = 1;
+    g_mutex_init(&d->lock);
+    d->by_size = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                       (GDestroyNotify) g_ptr_array_unref);
+    d->open = open;
+    d->open_data = data;
+
+    char *title = g_strdup_printf("Duplicates in %s", root);
+    d->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(d->window), title);
+    gtk_window_set_transient_for(GTK_WINDOW(d->window), parent);
+    gtk_window_set_destroy_with_parent(GTK_WINDOW(d->window), TRUE);
+    gtk_window_set_default_size(GTK_WINDOW(d->window), 760, 520);
+    g_free(title);
+
+    d->store = gtk_tree_store_new(2, G_TYPE_STRING, G_TYPE_STRING);
+    GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(d->store));
+    gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(view), FALSE);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, NULL,
+        gtk_cell_renderer_text_new(), "text", 0, NULL);
+
+    GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+    gtk_container_add(GTK_CONTAINER(scroll), view);
+
+    d->status = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(d->status), 0);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+    gtk_container_set_border_width(GTK_CONTAINER(box), 6);
+    gtk_box_pack_start(GTK_BOX(box), scroll, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(box), d->status, FALSE, FALSE, 0);
+    gtk_container_add(GTK_CONTAINER(d->window), box);
+
+    g_signal_connect(view, "row-activated", G_CALLBACK(on_row_activated), d);
+    g_signal_connect(d->window, "destroy", G_CALLBACK(on_destroy), d);
+
+    d->tick = g_timeout_add(DUPES_TICK_MS, on_tick, d);
+    update_status(d);
+    gtk_widget_show_all(d->window);
+
+    /* hidden folders are skipped as in the listing; copies under .git are expected */
+    d->walk = walk_start(root, FALSE, visit, walk_done, dupes_ref(d));
+}
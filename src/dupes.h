@@ -0,0 +1,19 @@
+#ifndef DUPES_H
+#define DUPES_H
+
+#include <gtk/gtk.h>
+
+/*
+ * "Find duplicates here": a window listing groups of identical files under
+ * a folder. Files are bucketed by size during a parallel walk; same-size
+ * files are compared by a hash of their first and last 64 KB, and only
+ * the survivors are hashed in full (XXH64, on a thread pool). Names of
+ * one inode are hardlinks and never count as reclaimable.
+ */
+
+/* activating a file row asks the caller to show the folder it is in */
+typedef void (*DupesOpenFunc)(const char *dir, gpointer data);
+
+void dupes_window_open(GtkWindow *parent, const char *root, DupesOpenFunc open, gpointer data);
+
+#endif
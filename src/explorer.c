@@ -1,185 +1,76 @@
 #include "explorer.h"
 #include "utils.h"
 #include "ui.h"
+#include "query.h"
+#include "dupes.h"
+#include "compare.h"
+#include "vfs.h"
+#include "prefetch.h"
+#include "complete.h"
+#include "preview.h"
+#include "iconcache.h"
+#include "copyjob.h"
+#include "zipjob.h"
+#include "frecency.h"
+#include "jump.h"
+#include "launch.h"
+#include "session.h"
+#include "fsio.h"
+#include "theme.h"
+#include "priv.h"
+#include "trace.h"
+#include "watchdog.h"
 #include <gtk/gtk.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 
-char current_path[4096];
+/* shared by every window of the process */
 char clipboard_path[4096] = "";
 gboolean clipboard_cut = FALSE;
 gboolean sudo_mode = FALSE;
 
-static GPtrArray *history_back;
-static GPtrArray *history_forward;
-
-static GtkWidget *status_label;
-static GtkWidget *path_entry;
-static GtkWidget *search_entry;
-static GtkWidget *grid_view;
-static GtkWidget *sidebar_top;
-static GtkCssProvider *css_provider = NULL;
-static GtkWidget *main_window;
-
-static void add_shortcut(GtkButton *b);
-static void load_path(const char *path, gboolean hist);
-
-static void ensure_theme_directory(void)
-{
-    struct stat st = {0};
-    if (stat("assets/themes", &st) == -1) {
-        mkdir("assets", 0755);
-        mkdir("assets/themes", 0755);
-    }
-}
-
+/* one per window, as the window's "explorer" data */
+typedef struct {
+    GtkWidget *window;
+    GtkWidget *status_label;
+    GtkWidget *path_entry;
+    GtkWidget *search_entry;
+    GtkWidget *grid_view;
+    GtkWidget *sidebar_top;
+    GtkWidget *theme_box;
+    GtkWidget *sudo_btn;
+    GtkWidget *preview;
+    GtkWidget *preview_btn;
+    GtkWidget *zip_cancel;
+    GPtrArray *history_back;
+    GPtrArray *history_forward;
+    GtkTreePath *hovered;
+    GtkListStore *completions;
+    GCancellable *zip_job;
+    GCancellable *revalidate;   /* the background check of a restored snapshot */
+    char current_path[4096];
+    int view_error;
+    guint query_timer;
+    double zoom_scroll;         /* smooth-scroll delta not yet turned into a zoom step */
+} Explorer;
+
+static void add_shortcut(GtkButton *b, Explorer *ex);
+static void load_path(Explorer *ex, const char *path, gboolean hist);
 
 static gboolean copy_file(const char *src, const char *dst)
 {
-    FILE *src_file = fopen(src, "rb");
-    if (!src_file) return FALSE;
-    
-    FILE *dst_file = fopen(dst, "wb");
-    if (!dst_file) {
-        fclose(src_file);
-        return FALSE;
-    }
-    
-    char buffer[4096];
-    size_t bytes;
-    while ((bytes = fread(buffer, 1, sizeof(buffer), src_file)) > 0) {
-        fwrite(buffer, 1, bytes, dst_file);
-    }
-    
-    fclose(src_file);
-    fclose(dst_file);
-    return TRUE;
-}
-
-
-static char* extract_css_from_wo(const char *path)
-{
-    FILE *f = fopen(path, "r");
-    if (!f) return NULL;
-
-    GString *css = g_string_new("");
-    char line[4096];
-    gboolean in_css = FALSE;
-    gboolean has_theme_name = FALSE;
-
-    while (fgets(line, sizeof(line), f)) {
-        if (!in_css) {
-         
-            if (g_str_has_prefix(line, "THEMENAME:")) {
-                has_theme_name = TRUE;
-                continue;
-            }
-            
-    
-            if (g_str_has_prefix(line, "---") || has_theme_name) {
-                in_css = TRUE;
-                
-           
-                if (g_str_has_prefix(line, "---")) {
-                    continue;
-                }
-            } else {
-              
-                continue;
-            }
-        }
-
-   
-        g_string_append(css, line);
-    }
-
-    fclose(f);
-    
-    if (css->len == 0) {
-        g_string_free(css, TRUE);
-        return NULL;
-    }
-    
-    return g_string_free(css, FALSE);
-}
-
-
-static char* extract_theme_name_from_wo(const char *path)
-{
-    FILE *f = fopen(path, "r");
-    if (!f) {
-        return NULL;
-    }
-
-    char line[256];
-    char *theme_name = NULL;
-
-    if (fgets(line, sizeof(line), f)) {
-        if (g_str_has_prefix(line, "THEMENAME:")) {
-            char name[128] = {0};
-            if (sscanf(line, "THEMENAME: %127[^\n]", name) == 1) {
-                theme_name = g_strdup(name);
-            }
-        }
-    }
-    
-    fclose(f);
-    return theme_name;
+    return fsio_copy_file(src, dst, 0644, TRUE, NULL) == 0;
 }
 
-
-static void load_theme_from_wo(const char *path)
-{
-    char *css_content = extract_css_from_wo(path);
-    if (!css_content) {
-        g_warning("No CSS content extracted from: %s", path);
-        return;
-    }
-
-
-    GtkCssProvider *provider = gtk_css_provider_new();
-
-    GError *error = NULL;
-    if (!gtk_css_provider_load_from_data(provider, css_content, -1, &error)) {
-        g_warning("CSS load failed: %s", error ? error->message : "Unknown error");
-        if (error) g_error_free(error);
-        g_free(css_content);
-        g_object_unref(provider);
-        return;
-    }
-
-
-    if (css_provider) {
-        gtk_style_context_remove_provider_for_screen(
-            gdk_screen_get_default(),
-            GTK_STYLE_PROVIDER(css_provider)
-        );
-        g_object_unref(css_provider);
-        css_provider = NULL;
-    }
-
-
-    css_provider = provider;
-
-
-    gtk_style_context_add_provider_for_screen(
-        gdk_screen_get_default(),
-        GTK_STYLE_PROVIDER(css_provider),
-        GTK_STYLE_PROVIDER_PRIORITY_APPLICATION
-    );
-
-    g_free(css_content);
-}
-
-
 static gboolean save_wo_file(const char *src_path, char **saved_filename)
 {
-    ensure_theme_directory();
+    theme_ensure_dir();
     
 
-    char *theme_name = extract_theme_name_from_wo(src_path);
+    char *theme_name = theme_name_from_wo(src_path);
     if (!theme_name) {
         
         const char *base_name = g_path_get_basename(src_path);
@@ -209,7 +100,7 @@ static gboolean save_wo_file(const char *src_path, char **saved_filename)
     }
     
     char dst_path[512];
-    snprintf(dst_path, sizeof(dst_path), "assets/themes/%s", safe_name);
+    snprintf(dst_path, sizeof(dst_path), THEME_DIR "/%s", safe_name);
     
    
     gboolean success = copy_file(src_path, dst_path);
@@ -229,12 +120,13 @@ static void apply_wo_theme(const char *path, GtkWidget *theme_box)
     if (save_wo_file(path, &saved_filename)) {
     
         char saved_path[512];
-        snprintf(saved_path, sizeof(saved_path), "assets/themes/%s", saved_filename);
-        load_theme_from_wo(saved_path);
+        snprintf(saved_path, sizeof(saved_path), THEME_DIR "/%s", saved_filename);
+        theme_apply(saved_filename);
         
     
-        char *theme_name = extract_theme_name_from_wo(saved_path);
+        char *theme_name = theme_name_from_wo(saved_path);
         if (theme_name && theme_name[0]) {
+            theme_register(theme_name, saved_filename);
            
             gboolean found = FALSE;
             GtkTreeModel *model = gtk_combo_box_get_model(GTK_COMBO_BOX(theme_box));
@@ -258,13 +150,20 @@ static void apply_wo_theme(const char *path, GtkWidget *theme_box)
             }
             
 
-            int item_count = gtk_tree_model_iter_n_children(model, NULL);
-            for (int i = 0; i < item_count; i++) {
-                gtk_combo_box_set_active(GTK_COMBO_BOX(theme_box), i);
-                const char *current = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(theme_box));
-                if (current && !strcmp(current, theme_name)) {
-                    break;
-                }
+            /* select it once; every set_active re-runs on_theme */
+            int index = 0;
+            if (gtk_tree_model_get_iter_first(model, &iter)) {
+                do {
+                    gchar *existing_name;
+                    gtk_tree_model_get(model, &iter, 0, &existing_name, -1);
+                    gboolean match = existing_name && !strcmp(existing_name, theme_name);
+                    g_free(existing_name);
+                    if (match) {
+                        gtk_combo_box_set_active(GTK_COMBO_BOX(theme_box), index);
+                        break;
+                    }
+                    index++;
+                } while (gtk_tree_model_iter_next(model, &iter));
             }
             
             g_free(theme_name);
@@ -277,20 +176,21 @@ static void apply_wo_theme(const char *path, GtkWidget *theme_box)
 
 static void load_saved_wo_themes(GtkWidget *theme_box)
 {
-    ensure_theme_directory();
+    theme_ensure_dir();
     
-    GDir *dir = g_dir_open("assets/themes", 0, NULL);
+    GDir *dir = g_dir_open(THEME_DIR, 0, NULL);
     if (!dir) return;
     
     const gchar *filename;
     while ((filename = g_dir_read_name(dir)) != NULL) {
         if (g_str_has_suffix(filename, ".wo")) {
             char full_path[512];
-            snprintf(full_path, sizeof(full_path), "assets/themes/%s", filename);
+            snprintf(full_path, sizeof(full_path), THEME_DIR "/%s", filename);
             
            
-            char *theme_name = extract_theme_name_from_wo(full_path);
+            char *theme_name = theme_name_from_wo(full_path);
             if (theme_name && theme_name[0]) {
+                theme_register(theme_name, filename);
               
                 gboolean found = FALSE;
                 GtkTreeModel *model = gtk_combo_box_get_model(GTK_COMBO_BOX(theme_box));
@@ -322,6 +222,7 @@ static void load_saved_wo_themes(GtkWidget *theme_box)
 }
 
 
+
 static void on_theme_drop(GtkWidget *w,
                           GdkDragContext *ctx,
                           gint x, gint y,
@@ -329,6 +230,8 @@ static void on_theme_drop(GtkWidget *w,
                           guint info, guint time,
                           gpointer user_data)
 {
+    WATCHDOG_SCOPE("on_theme_drop");
+    Explorer *ex = user_data;
     if (!data) return;
 
     const gchar *uris = (const gchar*) gtk_selection_data_get_data(data);
@@ -343,57 +246,34 @@ static void on_theme_drop(GtkWidget *w,
   
     char *path = g_filename_from_uri(list[0], NULL, NULL);
 
-    if (path && g_str_has_suffix(path, ".wo")) {
-    
-        GtkWidget *theme_box = NULL;
-        GtkWidget *hbox = gtk_bin_get_child(GTK_BIN(main_window));
-        if (hbox) {
-            GList *children = gtk_container_get_children(GTK_CONTAINER(hbox));
-            if (children && children->next) {
-                GtkWidget *right = children->next->data;
-                GList *right_children = gtk_container_get_children(GTK_CONTAINER(right));
-                if (right_children) {
-                    GtkWidget *bar = right_children->data;
-                    GList *bar_children = gtk_container_get_children(GTK_CONTAINER(bar));
-                    if (bar_children) {
-                       
-                        theme_box = g_list_last(bar_children)->data;
-                    }
-                    g_list_free(bar_children);
-                }
-                g_list_free(right_children);
-            }
-            g_list_free(children);
-        }
-        
-        if (theme_box) {
-            apply_wo_theme(path, theme_box);
-        }
-    }
+    if (path && g_str_has_suffix(path, ".wo"))
+        apply_wo_theme(path, ex->theme_box);
 
     g_free(path);
     g_strfreev(list);
 }
 
 
-static void enable_theme_drop(GtkWidget *win)
+static void enable_theme_drop(Explorer *ex)
 {
     GtkTargetEntry targets[] = {
         { "text/uri-list", 0, 0 }
     };
 
-    gtk_drag_dest_set(win,
+    gtk_drag_dest_set(ex->window,
         GTK_DEST_DEFAULT_ALL,
         targets, 1,
         GDK_ACTION_COPY);
 
-    g_signal_connect(win, "drag-data-received",
-        G_CALLBACK(on_theme_drop), NULL);
+    g_signal_connect(ex->window, "drag-data-received",
+        G_CALLBACK(on_theme_drop), ex);
 }
 
 
 static gchar* get_free(const char *path){
+    WATCHDOG_SCOPE("get_free");
     struct statvfs s;
+    TRACE_COUNT(TRACE_SYSCALLS,1);
     if(statvfs(path,&s)!=0) return g_strdup("?");
     unsigned long long fb=(unsigned long long)s.f_bsize*(unsigned long long)s.f_bavail;
     double gb = (double)fb/(1024.0*1024.0*1024.0);
@@ -402,8 +282,14 @@ static gchar* get_free(const char *path){
 
 static gchar* get_human_size(const char* p){
     struct stat st;
-    if(stat(p,&st)!=0) return g_strdup("?");
-    double s = st.st_size;
+    double s;
+    PrivStat ps;
+    guint64 vs;
+    TRACE_COUNT(TRACE_SYSCALLS,1);
+    if(stat(p,&st)==0) s = st.st_size;
+    else if(sudo_mode && priv_stat(p,&ps)==0) s = ps.size;
+    else if(vfs_stat(p,&vs,NULL)) s = vs;
+    else return g_strdup("?");
     if(s<1024) return g_strdup_printf("%.0f B",s);
     s/=1024.0;
     if(s<1024) return g_strdup_printf("%.1f KB",s);
@@ -413,38 +299,32 @@ static gchar* get_human_size(const char* p){
     return g_strdup_printf("%.2f GB",s);
 }
 
-void load_theme(const char *file){
-    if(!css_provider) css_provider = gtk_css_provider_new();
-    char full[512];
-    snprintf(full,sizeof(full),"assets/themes/%s",file);
-    
-    
-    if (g_str_has_suffix(file, ".wo")) {
-        load_theme_from_wo(full);
-    } else {
-
-        gtk_css_provider_load_from_path(css_provider,full,NULL);
-        gtk_style_context_add_provider_for_screen(
-            gdk_screen_get_default(),
-            GTK_STYLE_PROVIDER(css_provider),
-            GTK_STYLE_PROVIDER_PRIORITY_APPLICATION
-        );
+static void update_status(Explorer *ex){
+    WATCHDOG_SCOPE("update_status");
+    TRACE_SCOPE("update_status");
+    if(ex->view_error){
+        const char *hint="";
+        if(ex->view_error==ENOTCONN) hint=" — SUDO helper is not running";
+        else if(ex->view_error==EACCES && !sudo_mode) hint=" — try SUDO mode";
+        gchar *txt = g_strdup_printf("Cannot open %s: %s%s",
+            ex->current_path,g_strerror(ex->view_error),hint);
+        gtk_label_set_text(GTK_LABEL(ex->status_label),txt);
+        g_free(txt);
+        return;
     }
-}
 
-static void update_status(void){
-    GtkTreeModel *m = gtk_icon_view_get_model(GTK_ICON_VIEW(grid_view));
+    GtkTreeModel *m = gtk_icon_view_get_model(GTK_ICON_VIEW(ex->grid_view));
     GtkTreeIter it;
     int count = 0;
     gboolean ok = gtk_tree_model_get_iter_first(m,&it);
     while(ok){ count++; ok = gtk_tree_model_iter_next(m,&it); }
 
-    gchar *free = get_free(current_path);
+    gchar *free = get_free(ex->current_path);
 
-    GList *sel = gtk_icon_view_get_selected_items(GTK_ICON_VIEW(grid_view));
+    GList *sel = gtk_icon_view_get_selected_items(GTK_ICON_VIEW(ex->grid_view));
     if(!sel){
         gchar *txt = g_strdup_printf("Items: %d | Free: %s",count,free);
-        gtk_label_set_text(GTK_LABEL(status_label),txt);
+        gtk_label_set_text(GTK_LABEL(ex->status_label),txt);
         g_free(txt);
         g_free(free);
         return;
@@ -462,7 +342,7 @@ static void update_status(void){
         count,free,g_path_get_basename(path),sz
     );
 
-    gtk_label_set_text(GTK_LABEL(status_label),txt);
+    gtk_label_set_text(GTK_LABEL(ex->status_label),txt);
     g_free(txt);
     g_free(path);
     g_free(sz);
@@ -470,87 +350,294 @@ static void update_status(void){
     g_free(free);
 }
 
-static void push_back(const char *p){ g_ptr_array_add(history_back,g_strdup(p)); }
-static void push_forward(const char *p){ g_ptr_array_add(history_forward,g_strdup(p)); }
+/* a restored snapshot's check is only good for the view it was painted into */
+static void stop_revalidate(Explorer *ex){
+    if(!ex->revalidate) return;
+    g_cancellable_cancel(ex->revalidate);
+    g_clear_object(&ex->revalidate);
+}
+
+static void refresh_view(Explorer *ex){
+    stop_revalidate(ex);
+    ui_load_directory(GTK_ICON_VIEW(ex->grid_view),ex->current_path);
+    ex->view_error = utils_list_error();
+    update_status(ex);
+}
+
+static void show_error(Explorer *ex,const char *title,const char *msg){
+    GtkWidget *d=gtk_message_dialog_new(ex ? GTK_WINDOW(ex->window) : NULL,
+        GTK_DIALOG_MODAL,GTK_MESSAGE_ERROR,GTK_BUTTONS_CLOSE,"%s",title);
+    gtk_message_dialog_format_secondary_text(GTK_MESSAGE_DIALOG(d),"%s",msg);
+    gtk_dialog_run(GTK_DIALOG(d));
+    gtk_widget_destroy(d);
+}
+
+/* async results come back to a window that may have been closed meanwhile */
+static gpointer hold(Explorer *ex){ return g_object_ref(ex->window); }
+
+static Explorer* release(gpointer w){
+    Explorer *ex=g_object_get_data(G_OBJECT(w),"explorer");
+    g_object_unref(w);
+    return ex;
+}
+
+#define HISTORY_MAX 64
+
+/* a folder is in a history once, at its latest place; the oldest fall off */
+static void push(GPtrArray *h,const char *p){
+    for(guint i=0;i<h->len;i++){
+        if(strcmp(h->pdata[i],p)) continue;
+        g_free(h->pdata[i]);
+        g_ptr_array_remove_index(h,i);
+        break;
+    }
+    if(h->len==HISTORY_MAX){
+        g_free(h->pdata[0]);
+        g_ptr_array_remove_index(h,0);
+    }
+    g_ptr_array_add(h,g_strdup(p));
+}
 
-static char* pop_back(void){
-    if(!history_back->len) return NULL;
-    char *v = history_back->pdata[history_back->len-1];
-    g_ptr_array_remove_index_fast(history_back,history_back->len-1);
+static void push_back(Explorer *ex,const char *p){ push(ex->history_back,p); }
+static void push_forward(Explorer *ex,const char *p){ push(ex->history_forward,p); }
+
+static char* pop_back(Explorer *ex){
+    if(!ex->history_back->len) return NULL;
+    char *v = ex->history_back->pdata[ex->history_back->len-1];
+    g_ptr_array_remove_index_fast(ex->history_back,ex->history_back->len-1);
     return v;
 }
 
-static char* pop_forward(void){
-    if(!history_forward->len) return NULL;
-    char *v = history_forward->pdata[history_forward->len-1];
-    g_ptr_array_remove_index_fast(history_forward,history_forward->len-1);
+static char* pop_forward(Explorer *ex){
+    if(!ex->history_forward->len) return NULL;
+    char *v = ex->history_forward->pdata[ex->history_forward->len-1];
+    g_ptr_array_remove_index_fast(ex->history_forward,ex->history_forward->len-1);
     return v;
 }
 
-static void clear_forward(void){
-    for(guint i=0;i<history_forward->len;i++)
-        g_free(history_forward->pdata[i]);
-    g_ptr_array_set_size(history_forward,0);
+static void clear_forward(Explorer *ex){
+    for(guint i=0;i<ex->history_forward->len;i++)
+        g_free(ex->history_forward->pdata[i]);
+    g_ptr_array_set_size(ex->history_forward,0);
 }
 
-static void load_path(const char *path,gboolean hist){
-    if(hist && current_path[0]) push_back(current_path);
-    g_strlcpy(current_path,path,sizeof(current_path));
-    gtk_entry_set_text(GTK_ENTRY(path_entry),current_path);
-    ui_load_directory(GTK_ICON_VIEW(grid_view),current_path);
-    update_status();
-    if(hist) clear_forward();
+/* the parent and the last few folders left behind are the usual next stops */
+static void prefetch_neighbours(Explorer *ex){
+    char *parent=g_path_get_dirname(ex->current_path);
+    if(strcmp(parent,ex->current_path)) prefetch_hint(parent,FALSE);
+    g_free(parent);
+
+    GPtrArray *h=ex->history_back;
+    for(guint i=0;i<3 && i<h->len;i++)
+        prefetch_hint(h->pdata[h->len-1-i],FALSE);
 }
 
-static void on_back(GtkButton *b){
-    char *p=pop_back(); if(!p) return;
-    push_forward(current_path);
-    load_path(p,FALSE);
+static void load_path(Explorer *ex,const char *path,gboolean hist){
+    WATCHDOG_SCOPE("load_path");
+    if(hist && ex->current_path[0]) push_back(ex,ex->current_path);
+    g_strlcpy(ex->current_path,path,sizeof(ex->current_path));
+    gtk_entry_set_text(GTK_ENTRY(ex->path_entry),ex->current_path);
+    refresh_view(ex);
+    if(hist) clear_forward(ex);
+    if(!ex->view_error) frecency_visit(ex->current_path);
+
+    prefetch_forget();
+    prefetch_neighbours(ex);
+}
+
+static void on_back(GtkButton *b,Explorer *ex){
+    WATCHDOG_SCOPE("on_back");
+    char *p=pop_back(ex); if(!p) return;
+    push_forward(ex,ex->current_path);
+    load_path(ex,p,FALSE);
     g_free(p);
 }
 
-static void on_forward(GtkButton *b){
-    char *p=pop_forward(); if(!p) return;
-    push_back(current_path);
-    load_path(p,FALSE);
+static void on_forward(GtkButton *b,Explorer *ex){
+    WATCHDOG_SCOPE("on_forward");
+    char *p=pop_forward(ex); if(!p) return;
+    push_back(ex,ex->current_path);
+    load_path(ex,p,FALSE);
     g_free(p);
 }
 
-static void on_up(GtkButton *b){
-    if(!strcmp(current_path,"/")) return;
-    char p[4096]; g_strlcpy(p,current_path,sizeof(p));
+static void on_up(GtkButton *b,Explorer *ex){
+    WATCHDOG_SCOPE("on_up");
+    if(!strcmp(ex->current_path,"/")) return;
+    char p[4096]; g_strlcpy(p,ex->current_path,sizeof(p));
     char *s=g_strrstr(p,"/");
     if(s==p) p[1]=0;
     else *s=0;
-    load_path(p,TRUE);
+    load_path(ex,p,TRUE);
 }
 
-static void on_path_enter(GtkEntry *e){
+static void on_path_enter(GtkEntry *e,Explorer *ex){
+    WATCHDOG_SCOPE("on_path_enter");
     const char *t=gtk_entry_get_text(e);
-    if(g_file_test(t,G_FILE_TEST_IS_DIR))
-        load_path(t,TRUE);
+    if(g_file_test(t,G_FILE_TEST_IS_DIR) || vfs_is_dir(t))
+        load_path(ex,t,TRUE);
     else
-        gtk_entry_set_text(GTK_ENTRY(path_entry),current_path);
+        gtk_entry_set_text(GTK_ENTRY(ex->path_entry),ex->current_path);
+}
+
+#define PATH_COMPLETIONS 12
+
+/* the popup only ever holds the few rows complete_lookup() picked */
+static void update_completions(Explorer *ex){
+    const char *t=gtk_entry_get_text(GTK_ENTRY(ex->path_entry));
+    GPtrArray *found=g_ptr_array_new_with_free_func(g_free);
+    char *common=NULL;
+
+    complete_lookup(t,PATH_COMPLETIONS,found,&common);
+    gtk_list_store_clear(ex->completions);
+    for(guint i=0;i<found->len;i++)
+        gtk_list_store_insert_with_values(ex->completions,NULL,-1,0,found->pdata[i],-1);
+
+    g_free(common);
+    g_ptr_array_free(found,TRUE);
+}
+
+static void on_path_changed(GtkEditable *e,Explorer *ex){
+    /* load_path() setting the text is not typing */
+    if(!gtk_widget_has_focus(GTK_WIDGET(e))) return;
+    update_completions(ex);
+}
+
+/* a folder someone is typing into was read in the background */
+static void on_completions_ready(const char *dir){
+    GList *l=gtk_application_get_windows(GTK_APPLICATION(g_application_get_default()));
+    for(;l;l=l->next){
+        Explorer *ex=g_object_get_data(G_OBJECT(l->data),"explorer");
+        if(!ex || !gtk_widget_has_focus(ex->path_entry)) continue;
+
+        const char *t=gtk_entry_get_text(GTK_ENTRY(ex->path_entry));
+        const char *slash=strrchr(t,'/');
+        if(!slash) continue;
+        gboolean same = slash==t ? !strcmp(dir,"/")
+                                 : strlen(dir)==(size_t)(slash-t) && !strncmp(t,dir,slash-t);
+        if(!same) continue;
+
+        update_completions(ex);
+        gtk_entry_completion_complete(gtk_entry_get_completion(GTK_ENTRY(ex->path_entry)));
+    }
+}
+
+/* Tab fills in what every match shares, like a shell */
+static gboolean on_path_key(GtkWidget *w,GdkEventKey *ev,Explorer *ex){
+    if(ev->keyval!=GDK_KEY_Tab) return FALSE;
+
+    GPtrArray *found=g_ptr_array_new_with_free_func(g_free);
+    char *common=NULL;
+    complete_lookup(gtk_entry_get_text(GTK_ENTRY(w)),0,found,&common);
+    g_ptr_array_free(found,TRUE);
+    if(!common) return FALSE;
+
+    gtk_entry_set_text(GTK_ENTRY(w),common);
+    gtk_editable_set_position(GTK_EDITABLE(w),-1);
+    g_free(common);
+    return TRUE;
+}
+
+/* rows are already matches; the completion must not filter them again */
+static gboolean match_any(GtkEntryCompletion *c,const gchar *key,GtkTreeIter *it,gpointer d){
+    return TRUE;
+}
+
+static void create_path_completion(Explorer *ex){
+    ex->completions=gtk_list_store_new(1,G_TYPE_STRING);
+
+    GtkEntryCompletion *c=gtk_entry_completion_new();
+    gtk_entry_completion_set_model(c,GTK_TREE_MODEL(ex->completions));
+    gtk_entry_completion_set_text_column(c,0);
+    gtk_entry_completion_set_match_func(c,match_any,NULL,NULL);
+    gtk_entry_completion_set_minimum_key_length(c,1);
+
+    /* ours first, so the rows are in place before the popup looks at them */
+    g_signal_connect(ex->path_entry,"changed",G_CALLBACK(on_path_changed),ex);
+    g_signal_connect(ex->path_entry,"key-press-event",G_CALLBACK(on_path_key),ex);
+    gtk_entry_set_completion(GTK_ENTRY(ex->path_entry),c);
+
+    g_object_unref(c);
+    g_object_unref(ex->completions);
+    complete_set_notify(on_completions_ready);
 }
 
-static void on_search(GtkEntry *e){
+static void on_query_progress(const SearchProgress *p,gpointer data){
+    Explorer *ex=data;
+    gchar *txt;
+    if(p->bytes)
+        txt = g_strdup_printf("%s %u match%s | %" G_GUINT64_FORMAT " entries checked, %.1f MB scanned",
+            p->done?"Found":"Searching…",p->found,p->found==1?"":"es",
+            p->entries,p->bytes/(1024.0*1024.0));
+    else
+        txt = g_strdup_printf("%s %u match%s | %" G_GUINT64_FORMAT " entries checked",
+            p->done?"Found":"Searching…",p->found,p->found==1?"":"es",p->entries);
+    gtk_label_set_text(GTK_LABEL(ex->status_label),txt);
+    g_free(txt);
+}
+
+/* structured queries walk the whole tree, so wait for the user to stop typing */
+static gboolean run_query_search(gpointer data){
+    WATCHDOG_SCOPE("run_query_search");
+    Explorer *ex=data;
+    ex->query_timer = 0;
+    const char *q = gtk_entry_get_text(GTK_ENTRY(ex->search_entry));
+
+    GError *err=NULL;
+    Query *query = query_compile(q,&err);
+    if(!query){
+        gchar *txt = g_strdup_printf("Bad query: %s",err->message);
+        gtk_label_set_text(GTK_LABEL(ex->status_label),txt);
+        g_free(txt);
+        g_error_free(err);
+        return G_SOURCE_REMOVE;
+    }
+    ui_query_search(GTK_ICON_VIEW(ex->grid_view),ex->current_path,query,on_query_progress,ex);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_search(GtkEntry *e,Explorer *ex){
+    WATCHDOG_SCOPE("on_search");
     const char *q = gtk_entry_get_text(e);
+    if(ex->query_timer){ g_source_remove(ex->query_timer); ex->query_timer=0; }
+    stop_revalidate(ex);
     if(!q || !q[0]){
-        ui_load_directory(GTK_ICON_VIEW(grid_view),current_path);
-        update_status();
+        refresh_view(ex);
         return;
     }
-    ui_filter_search(GTK_ICON_VIEW(grid_view),current_path,q);
-    update_status();
+    if(query_looks_structured(q)){
+        ex->query_timer = g_timeout_add(300,run_query_search,ex);
+        return;
+    }
+    ui_filter_search(GTK_ICON_VIEW(ex->grid_view),ex->current_path,q);
+    update_status(ex);
+}
+
+static void open_with_default(Explorer *ex,const char *p){
+    GError *err=NULL;
+    if(launch_default(p,&err)) return;
+    show_error(ex,"Could not open file",err->message);
+    g_error_free(err);
+}
+
+static void on_extracted(GObject *src,GAsyncResult *res,gpointer data){
+    Explorer *ex=release(data);
+    GError *err=NULL;
+    char *out=vfs_extract_finish(res,&err);
+    if(out) open_with_default(ex,out);
+    else { show_error(ex,"Could not open archive member",err->message); g_error_free(err); }
+    g_free(out);
 }
 
-static void open_with_default(const char *p){
-    char cmd[6000];
-    snprintf(cmd,sizeof(cmd),"xdg-open \"%s\" 2>/dev/null &",p);
-    system(cmd);
+/* archives are browsed, their members are copied out before handing them on */
+static void open_file(Explorer *ex,const char *p){
+    if(vfs_is_archive(p)) load_path(ex,p,TRUE);
+    else if(vfs_is_virtual(p)) vfs_extract_async(p,NULL,on_extracted,hold(ex));
+    else open_with_default(ex,p);
 }
 
-static void on_item_activated(GtkIconView *v,GtkTreePath *p){
+static void on_item_activated(GtkIconView *v,GtkTreePath *p,Explorer *ex){
+    WATCHDOG_SCOPE("on_item_activated");
     GtkTreeModel *m = gtk_icon_view_get_model(v);
     GtkTreeIter it;
     if(!gtk_tree_model_get_iter(m,&it,p)) return;
@@ -558,19 +645,91 @@ static void on_item_activated(GtkIconView *v,GtkTreePath *p){
     gchar *full=NULL; gboolean dir=FALSE;
     gtk_tree_model_get(m,&it,2,&full,3,&dir,-1);
 
-    if(dir) load_path(full,TRUE);
-    else open_with_default(full);
+    if(dir) load_path(ex,full,TRUE);
+    else open_file(ex,full);
 
     g_free(full);
 }
 
-static gboolean get_sel(char **path,gboolean *dir){
-    GList *l = gtk_icon_view_get_selected_items(GTK_ICON_VIEW(grid_view));
+static gboolean on_grid_motion(GtkWidget *w,GdkEventMotion *ev,Explorer *ex){
+    GtkTreePath *tp=gtk_icon_view_get_path_at_pos(GTK_ICON_VIEW(w),ev->x,ev->y);
+
+    /* once per folder the pointer comes to rest on, not per motion event */
+    if(tp && (!ex->hovered || gtk_tree_path_compare(tp,ex->hovered))){
+        GtkTreeModel *m=gtk_icon_view_get_model(GTK_ICON_VIEW(w));
+        GtkTreeIter it;
+        gchar *full=NULL; gboolean dir=FALSE;
+        if(gtk_tree_model_get_iter(m,&it,tp)){
+            gtk_tree_model_get(m,&it,2,&full,3,&dir,-1);
+            if(dir) prefetch_hint(full,TRUE);
+            g_free(full);
+        }
+    }
+    if(ex->hovered) gtk_tree_path_free(ex->hovered);
+    ex->hovered=tp;
+    return FALSE;
+}
+
+/* the item under the pointer, or the first selected one, stays in view */
+static void zoom_by(Explorer *ex,int step){
+    GtkIconView *v=GTK_ICON_VIEW(ex->grid_view);
+    int level=ui_get_zoom(v);
+    ui_set_zoom(v,level+step);
+    if(ui_get_zoom(v)==level) return;
+
+    GList *sel=gtk_icon_view_get_selected_items(v);
+    GtkTreePath *keep=ex->hovered ? ex->hovered : sel ? sel->data : NULL;
+    if(keep) gtk_icon_view_scroll_to_path(v,keep,TRUE,0.5,0.5);
+    g_list_free_full(sel,(GDestroyNotify)gtk_tree_path_free);
+}
+
+static gboolean on_grid_scroll(GtkWidget *w,GdkEventScroll *ev,Explorer *ex){
+    if(!(ev->state&GDK_CONTROL_MASK)) return FALSE;
+
+    if(ev->direction==GDK_SCROLL_UP) zoom_by(ex,1);
+    else if(ev->direction==GDK_SCROLL_DOWN) zoom_by(ex,-1);
+    else if(ev->direction==GDK_SCROLL_SMOOTH){
+        /* touchpads send fractions; a level per whole notch */
+        ex->zoom_scroll-=ev->delta_y;
+        while(ex->zoom_scroll>=1){ zoom_by(ex,1); ex->zoom_scroll-=1; }
+        while(ex->zoom_scroll<=-1){ zoom_by(ex,-1); ex->zoom_scroll+=1; }
+    }
+    return TRUE;
+}
+
+static void on_grid_selection(GtkIconView *v,Explorer *ex){
+    GList *l=gtk_icon_view_get_selected_items(v);
+    GtkTreeModel *m=gtk_icon_view_get_model(v);
+    gboolean previewing=gtk_widget_get_visible(ex->preview) && l && !l->next;
+
+    for(GList *i=l;i;i=i->next){
+        GtkTreeIter it;
+        gchar *full=NULL; gboolean dir=FALSE;
+        if(!gtk_tree_model_get_iter(m,&it,i->data)) continue;
+        gtk_tree_model_get(m,&it,2,&full,3,&dir,-1);
+        if(dir) prefetch_hint(full,TRUE);
+        /* the pane shows a single plain file; archive members would need extracting */
+        if(previewing)
+            preview_show(ex->preview,dir || vfs_is_virtual(full) ? NULL : full);
+        g_free(full);
+    }
+    g_list_free_full(l,(GDestroyNotify)gtk_tree_path_free);
+}
+
+static void on_preview_toggled(GtkToggleButton *b,Explorer *ex){
+    gboolean on=gtk_toggle_button_get_active(b);
+    gtk_widget_set_visible(ex->preview,on);
+    if(on) on_grid_selection(GTK_ICON_VIEW(ex->grid_view),ex);
+    else preview_show(ex->preview,NULL);
+}
+
+static gboolean get_sel(Explorer *ex,char **path,gboolean *dir){
+    GList *l = gtk_icon_view_get_selected_items(GTK_ICON_VIEW(ex->grid_view));
     if(!l) return FALSE;
 
     GtkTreePath *tp=l->data;
     GtkTreeIter it;
-    GtkTreeModel *m=gtk_icon_view_get_model(GTK_ICON_VIEW(grid_view));
+    GtkTreeModel *m=gtk_icon_view_get_model(GTK_ICON_VIEW(ex->grid_view));
 
     if(!gtk_tree_model_get_iter(m,&it,tp)) return FALSE;
 
@@ -579,11 +738,23 @@ static gboolean get_sel(char **path,gboolean *dir){
     return TRUE;
 }
 
-static void file_delete(const char *p){
-    char c[6000]; snprintf(c,sizeof(c),"rm -rf \"%s\"",p);
-    system(c);
-    ui_load_directory(GTK_ICON_VIEW(grid_view),current_path);
-    update_status();
+static gboolean read_only(Explorer *ex,const char *p,const char *title){
+    if(!vfs_is_virtual(p)) return FALSE;
+    show_error(ex,title,"Archives are read-only.");
+    return TRUE;
+}
+
+static void file_delete(Explorer *ex,const char *p){
+    WATCHDOG_SCOPE("file_delete");
+    if(read_only(ex,p,"Delete failed")) return;
+    if(sudo_mode){
+        int rc=priv_delete(p);
+        if(rc) show_error(ex,"Delete failed",g_strerror(rc));
+    } else {
+        char c[6000]; snprintf(c,sizeof(c),"rm -rf \"%s\"",p);
+        system(c);
+    }
+    refresh_view(ex);
 }
 
 static void do_copy(const char *p) {
@@ -597,37 +768,298 @@ static void do_cut(const char *p) {
 }
 
 
-static void file_paste(const char *dest){
+static void on_pasted(GObject *src,GAsyncResult *res,gpointer data){
+    Explorer *ex=release(data);
+    GError *err=NULL;
+    char *out=vfs_extract_finish(res,&err);
+    if(!out){ show_error(ex,"Paste failed",err->message); g_error_free(err); }
+    g_free(out);
+    if(ex) refresh_view(ex);
+}
+
+static void file_paste(Explorer *ex,const char *dest){
+    WATCHDOG_SCOPE("file_paste");
     if(!clipboard_path[0]) return;
+    if(!g_file_test(dest,G_FILE_TEST_IS_DIR) && vfs_is_dir(dest)){
+        show_error(ex,"Paste failed","Archives are read-only.");
+        return;
+    }
+
+    /* copying out of an archive streams the member; it cannot be cut */
+    if(vfs_is_virtual(clipboard_path)){
+        gboolean isd=FALSE;
+        if(vfs_stat(clipboard_path,NULL,&isd) && isd)
+            show_error(ex,"Paste failed","Folders inside archives cannot be copied yet.");
+        else
+            vfs_extract_async(clipboard_path,dest,on_pasted,hold(ex));
+        clipboard_cut=FALSE;
+        clipboard_path[0]=0;
+        return;
+    }
 
     char *base=g_path_get_basename(clipboard_path);
     char out[4096];
     snprintf(out,sizeof(out),"%s/%s",dest,base);
 
-    char cmd[9000];
-    if(clipboard_cut)
-        snprintf(cmd,sizeof(cmd),"mv \"%s\" \"%s\"",clipboard_path,out);
-    else
-        snprintf(cmd,sizeof(cmd),"cp -r \"%s\" \"%s\"",clipboard_path,out);
+    if(sudo_mode){
+        int rc=clipboard_cut ? priv_move(clipboard_path,out)
+                             : priv_copy(clipboard_path,out);
+        if(rc) show_error(ex,"Paste failed",g_strerror(rc));
+    } else {
+        char cmd[9000];
+        if(clipboard_cut)
+            snprintf(cmd,sizeof(cmd),"mv \"%s\" \"%s\"",clipboard_path,out);
+        else
+            snprintf(cmd,sizeof(cmd),"cp -r \"%s\" \"%s\"",clipboard_path,out);
 
-    system(cmd);
+        system(cmd);
+    }
 
     clipboard_cut=FALSE;
     clipboard_path[0]=0;
     g_free(base);
 
-    ui_load_directory(GTK_ICON_VIEW(grid_view),current_path);
-    update_status();
+    refresh_view(ex);
+}
+
+/* the grid hands its selection out as a uri-list and takes drops into the folder */
+static const GtkTargetEntry uri_targets[]={ { "text/uri-list",0,0 } };
+
+static void on_drag_get(GtkWidget *w,GdkDragContext *ctx,GtkSelectionData *data,
+                        guint info,guint time,Explorer *ex){
+    GList *l=gtk_icon_view_get_selected_items(GTK_ICON_VIEW(w));
+    GtkTreeModel *m=gtk_icon_view_get_model(GTK_ICON_VIEW(w));
+    GPtrArray *uris=g_ptr_array_new_with_free_func(g_free);
+
+    for(GList *i=l;i;i=i->next){
+        GtkTreeIter it;
+        gchar *full=NULL;
+        if(!gtk_tree_model_get_iter(m,&it,i->data)) continue;
+        gtk_tree_model_get(m,&it,2,&full,-1);
+        /* archive members have no file to hand over */
+        char *uri=full && !vfs_is_virtual(full) ? g_filename_to_uri(full,NULL,NULL) : NULL;
+        if(uri) g_ptr_array_add(uris,uri);
+        g_free(full);
+    }
+    g_ptr_array_add(uris,NULL);
+    gtk_selection_data_set_uris(data,(gchar**)uris->pdata);
+
+    g_ptr_array_free(uris,TRUE);
+    g_list_free_full(l,(GDestroyNotify)gtk_tree_path_free);
+}
+
+/* another app moved them; the icon view would only drop the one row it dragged by */
+static void on_drag_delete(GtkWidget *w,GdkDragContext *ctx,Explorer *ex){
+    g_signal_stop_emission_by_name(w,"drag-data-delete");
+    refresh_view(ex);
+}
+
+static void on_drop_progress(const CopyJobProgress *p,gpointer data){
+    Explorer *ex=g_object_get_data(G_OBJECT(data),"explorer");
+    if(!ex) return;
+
+    gchar *sz=g_format_size(p->bytes);
+    gchar *txt=g_strdup_printf("Transferring… %" G_GUINT64_FORMAT " items, %"
+        G_GUINT64_FORMAT " files, %s",p->items,p->files,sz);
+    gtk_label_set_text(GTK_LABEL(ex->status_label),txt);
+    g_free(txt);
+    g_free(sz);
+}
+
+/* after a background job: sources and destination can be on show in any window */
+static void refresh_all(void){
+    GList *l=gtk_application_get_windows(GTK_APPLICATION(g_application_get_default()));
+    for(;l;l=l->next){
+        Explorer *o=g_object_get_data(G_OBJECT(l->data),"explorer");
+        if(o) refresh_view(o);
+    }
+}
+
+static void on_drop_done(const CopyJobProgress *p,const char *error,gpointer data){
+    Explorer *ex=release(data);
+    refresh_all();
+
+    if(error){
+        gchar *msg=g_strdup_printf("%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT
+            " items failed. The first was:\n%s",p->failed,p->items,error);
+        show_error(ex,"Transfer failed",msg);
+        g_free(msg);
+    }
+}
+
+static void on_grid_drop(GtkWidget *w,GdkDragContext *ctx,gint x,gint y,
+                         GtkSelectionData *data,guint info,guint time,Explorer *ex){
+    WATCHDOG_SCOPE("on_grid_drop");
+    /* the icon view's own handler would try to insert rows into the model */
+    g_signal_stop_emission_by_name(w,"drag-data-received");
+
+    gint len=gtk_selection_data_get_length(data);
+    if(len<=0){ gtk_drag_finish(ctx,FALSE,FALSE,time); return; }
+
+    /* onto a folder goes into it, anywhere else into the folder on show */
+    char *dest=NULL;
+    GtkTreePath *tp=NULL;
+    GtkIconViewDropPosition pos;
+    if(gtk_icon_view_get_dest_item_at_pos(GTK_ICON_VIEW(w),x,y,&tp,&pos) && pos==GTK_ICON_VIEW_DROP_INTO){
+        GtkTreeModel *m=gtk_icon_view_get_model(GTK_ICON_VIEW(w));
+        GtkTreeIter it;
+        gchar *full=NULL; gboolean dir=FALSE;
+        if(gtk_tree_model_get_iter(m,&it,tp)) gtk_tree_model_get(m,&it,2,&full,3,&dir,-1);
+        if(dir) dest=full;
+        else g_free(full);
+    }
+    if(tp) gtk_tree_path_free(tp);
+    if(!dest) dest=g_strdup(ex->current_path);
+
+    /* only the bytes are copied here; the job parses and transfers */
+    gboolean ok=!vfs_is_virtual(dest) && g_file_test(dest,G_FILE_TEST_IS_DIR);
+    if(ok){
+        GBytes *uris=g_bytes_new(gtk_selection_data_get_data(data),len);
+        CopyJobMode mode=gdk_drag_context_get_selected_action(ctx)==GDK_ACTION_MOVE
+            ? COPYJOB_MOVE : COPYJOB_COPY;
+        copyjob_start(uris,dest,mode,on_drop_progress,on_drop_done,hold(ex));
+        g_bytes_unref(uris);
+    }
+    gtk_drag_finish(ctx,ok,FALSE,time);
+
+    if(!ok) show_error(ex,"Drop failed","Archives are read-only.");
+    g_free(dest);
 }
 
-static void file_rename(GtkMenuItem *i,gpointer data){
-    const char *old=data;
+static void enable_grid_dnd(Explorer *ex){
+    GtkIconView *v=GTK_ICON_VIEW(ex->grid_view);
+    gtk_icon_view_enable_model_drag_source(v,GDK_BUTTON1_MASK,uri_targets,
+        G_N_ELEMENTS(uri_targets),GDK_ACTION_COPY|GDK_ACTION_MOVE);
+    gtk_icon_view_enable_model_drag_dest(v,uri_targets,
+        G_N_ELEMENTS(uri_targets),GDK_ACTION_COPY|GDK_ACTION_MOVE);
+
+    g_signal_connect(v,"drag-data-get",G_CALLBACK(on_drag_get),ex);
+    g_signal_connect(v,"drag-data-delete",G_CALLBACK(on_drag_delete),ex);
+    g_signal_connect(v,"drag-data-received",G_CALLBACK(on_grid_drop),ex);
+}
+
+static void zip_status(gpointer w,const char *verb,const ZipJobProgress *p){
+    Explorer *ex=g_object_get_data(G_OBJECT(w),"explorer");
+    if(!ex) return;
+
+    gchar *sz=g_format_size(p->bytes),*rate=g_format_size(p->rate);
+    gchar *txt=p->total
+        ? g_strdup_printf("%s… %d%%, %" G_GUINT64_FORMAT " files, %s at %s/s",verb,
+            (int)(p->bytes*100/p->total),p->files,sz,rate)
+        : g_strdup_printf("%s… %" G_GUINT64_FORMAT " files, %s at %s/s",verb,p->files,sz,rate);
+    gtk_label_set_text(GTK_LABEL(ex->status_label),txt);
+    g_free(txt);
+    g_free(rate);
+    g_free(sz);
+}
+
+static void on_compress_progress(const ZipJobProgress *p,gpointer data){ zip_status(data,"Compressing",p); }
+static void on_extract_progress(const ZipJobProgress *p,gpointer data){ zip_status(data,"Extracting",p); }
+
+static void on_zip_done(const ZipJobProgress *p,const char *error,gpointer data){
+    Explorer *ex=release(data);
+    if(ex){
+        g_clear_object(&ex->zip_job);
+        gtk_widget_hide(ex->zip_cancel);
+    }
+    refresh_all();
+
+    if(error){
+        gchar *msg=g_strdup_printf("%" G_GUINT64_FORMAT " items failed. The first was:\n%s",
+            p->failed,error);
+        show_error(ex,"Archive failed",msg);
+        g_free(msg);
+    }
+}
+
+static void on_zip_cancel(GtkButton *b,Explorer *ex){
+    if(ex->zip_job) g_cancellable_cancel(ex->zip_job);
+}
+
+/* one archive job per window, so the status bar and its Cancel have a single owner */
+static gboolean zip_busy(Explorer *ex){
+    if(!ex->zip_job) return FALSE;
+    show_error(ex,"Archive job running","Wait for it to finish, or cancel it from the status bar.");
+    return TRUE;
+}
+
+static void compress_selection(Explorer *ex,const char *fallback){
+    WATCHDOG_SCOPE("compress_selection");
+    if(zip_busy(ex) || read_only(ex,fallback,"Compress failed")) return;
+
+    GList *l=gtk_icon_view_get_selected_items(GTK_ICON_VIEW(ex->grid_view));
+    GtkTreeModel *m=gtk_icon_view_get_model(GTK_ICON_VIEW(ex->grid_view));
+    GPtrArray *src=g_ptr_array_new_with_free_func(g_free);
+
+    for(GList *i=l;i;i=i->next){
+        GtkTreeIter it;
+        gchar *full=NULL;
+        if(gtk_tree_model_get_iter(m,&it,i->data)) gtk_tree_model_get(m,&it,2,&full,-1);
+        if(full) g_ptr_array_add(src,full);
+    }
+    g_list_free_full(l,(GDestroyNotify)gtk_tree_path_free);
+    if(!src->len) g_ptr_array_add(src,g_strdup(fallback));
+
+    /* next to the first item; one item names the archive, several take their folder's name */
+    char *dir=g_path_get_dirname(src->pdata[0]);
+    char *base=g_path_get_basename(src->len==1 ? src->pdata[0] : dir);
+    char *name=g_strconcat(strcmp(base,"/") ? base : "Archive",".zip",NULL);
+    int err=0;
+    char *zip=utils_free_name(dir,name,NULL,&err);
+
+    if(!zip){
+        show_error(ex,"Compress failed",g_strerror(err));
+    } else {
+        g_ptr_array_add(src,NULL);
+        ex->zip_job=zipjob_compress((const char*const*)src->pdata,zip,
+            on_compress_progress,on_zip_done,hold(ex));
+        gtk_widget_show(ex->zip_cancel);
+    }
+
+    g_free(zip);
+    g_free(name);
+    g_free(base);
+    g_free(dir);
+    g_ptr_array_free(src,TRUE);
+}
+
+static gboolean is_zip(const char *p){
+    size_t n=strlen(p);
+    return n>4 && !g_ascii_strcasecmp(p+n-4,".zip") && !vfs_is_virtual(p);
+}
+
+/* into a new folder named after the archive, never over existing files */
+static void extract_here(Explorer *ex,const char *zip){
+    WATCHDOG_SCOPE("extract_here");
+    if(zip_busy(ex)) return;
+
+    char *dir=g_path_get_dirname(zip);
+    char *base=g_path_get_basename(zip);
+    base[strlen(base)-4]=0;
+    int err=0;
+    char *dest=utils_free_name(dir,base,NULL,&err);
+
+    if(!dest){
+        show_error(ex,"Extract failed",g_strerror(err));
+    } else {
+        ex->zip_job=zipjob_extract(zip,dest,on_extract_progress,on_zip_done,hold(ex));
+        gtk_widget_show(ex->zip_cancel);
+    }
+
+    g_free(dest);
+    g_free(base);
+    g_free(dir);
+}
+
+static void file_rename(Explorer *ex,const char *old){
+    WATCHDOG_SCOPE("file_rename");
+    if(read_only(ex,old,"Rename failed")) return;
 
     char oldc[4096];
     g_strlcpy(oldc,old,sizeof(oldc));
 
     GtkWidget *d=gtk_dialog_new_with_buttons(
-        "Rename",GTK_WINDOW(main_window),
+        "Rename",GTK_WINDOW(ex->window),
         GTK_DIALOG_MODAL,"Cancel",GTK_RESPONSE_CANCEL,"OK",
         GTK_RESPONSE_ACCEPT,NULL
     );
@@ -646,16 +1078,122 @@ static void file_rename(GtkMenuItem *i,gpointer data){
         char np[4096];
         snprintf(np,sizeof(np),"%s/%s",dir,nn);
 
-        rename(oldc,np);
+        int rc=sudo_mode ? priv_rename(oldc,np) : (rename(oldc,np) ? errno : 0);
+        if(rc) show_error(ex,"Rename failed",g_strerror(rc));
         g_free(dir);
     }
 
     gtk_widget_destroy(d);
-    ui_load_directory(GTK_ICON_VIEW(grid_view),current_path);
-    update_status();
+    refresh_view(ex);
+}
+
+static void open_dupe_dir(const char *dir,gpointer data){
+    Explorer *ex=data;
+    load_path(ex,dir,TRUE);
+    gtk_window_present(GTK_WINDOW(ex->window));
+}
+
+static void open_jump_dir(const char *dir,gpointer data){
+    Explorer *ex=data;
+    if(!g_file_test(dir,G_FILE_TEST_IS_DIR) && !vfs_is_dir(dir)){
+        /* moved or deleted since; it should not come up again */
+        frecency_forget(dir);
+        char *msg=g_strdup_printf("%s is no longer there",dir);
+        show_error(ex,"Jump to",msg);
+        g_free(msg);
+        return;
+    }
+    load_path(ex,dir,TRUE);
+}
+
+static void on_jump(GtkButton *b,Explorer *ex){
+    jump_window_open(GTK_WINDOW(ex->window),open_jump_dir,ex);
+}
+
+static gboolean on_window_key(GtkWidget *w,GdkEventKey *ev,Explorer *ex){
+    if(!(ev->state&GDK_CONTROL_MASK)) return FALSE;
+
+    switch(ev->keyval){
+    case GDK_KEY_j: case GDK_KEY_J: on_jump(NULL,ex); return TRUE;
+    case GDK_KEY_plus: case GDK_KEY_equal: case GDK_KEY_KP_Add: zoom_by(ex,1); return TRUE;
+    case GDK_KEY_minus: case GDK_KEY_KP_Subtract: zoom_by(ex,-1); return TRUE;
+    case GDK_KEY_0: case GDK_KEY_KP_0: zoom_by(ex,ICONCACHE_BASE-ui_get_zoom(GTK_ICON_VIEW(ex->grid_view))); return TRUE;
+    default: return FALSE;
+    }
+}
+
+static void find_duplicates(Explorer *ex,const char *root){
+    WATCHDOG_SCOPE("find_duplicates");
+    dupes_window_open(GTK_WINDOW(ex->window),root,open_dupe_dir,ex);
+}
+
+static void compare_with(Explorer *ex,const char *left){
+    GtkWidget *d=gtk_file_chooser_dialog_new(
+        "Compare With",GTK_WINDOW(ex->window),
+        GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+        "Cancel",GTK_RESPONSE_CANCEL,
+        "Compare",GTK_RESPONSE_ACCEPT,NULL
+    );
+
+    if(gtk_dialog_run(GTK_DIALOG(d))==GTK_RESPONSE_ACCEPT){
+        char *right=gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(d));
+        if(!right || !strcmp(right,left)) show_error(ex,"Compare","Pick a different folder to compare with");
+        else compare_window_open(GTK_WINDOW(ex->window),left,right,open_dupe_dir,ex);
+        g_free(right);
+    }
+
+    gtk_widget_destroy(d);
+}
+
+/* menu items and sidebar buttons carry the path they act on */
+static void on_path(GtkWidget *w,const char *path,GCallback cb,Explorer *ex){
+    g_object_set_data_full(G_OBJECT(w),"path",g_strdup(path),g_free);
+    g_signal_connect(w,GTK_IS_MENU_ITEM(w)?"activate":"clicked",cb,ex);
 }
 
-static gboolean on_right(GtkWidget *w,GdkEventButton *ev){
+static const char* path_of(gpointer w){ return g_object_get_data(G_OBJECT(w),"path"); }
+
+static void menu_load(GtkMenuItem *i,Explorer *ex){ load_path(ex,path_of(i),TRUE); }
+static void menu_open(GtkMenuItem *i,Explorer *ex){ open_file(ex,path_of(i)); }
+
+static void menu_open_with(GtkMenuItem *i,Explorer *ex){
+    GError *err=NULL;
+    if(launch_with(g_object_get_data(G_OBJECT(i),"app"),path_of(i),&err)) return;
+    show_error(ex,"Could not open file",err->message);
+    g_error_free(err);
+}
+
+/* a submenu of the applications for path, from the launcher's cache */
+static GtkWidget* open_with_menu(Explorer *ex,const char *path){
+    GPtrArray *apps=launch_apps_for(path);
+    if(!apps->len){ g_ptr_array_unref(apps); return NULL; }
+
+    GtkWidget *sub=gtk_menu_new();
+    for(guint i=0;i<apps->len;i++){
+        GAppInfo *app=apps->pdata[i];
+        GtkWidget *it=gtk_menu_item_new_with_label(g_app_info_get_display_name(app));
+        g_object_set_data_full(G_OBJECT(it),"app",g_object_ref(app),g_object_unref);
+        on_path(it,path,G_CALLBACK(menu_open_with),ex);
+        gtk_menu_shell_append(GTK_MENU_SHELL(sub),it);
+    }
+    g_ptr_array_unref(apps);
+
+    GtkWidget *with=gtk_menu_item_new_with_label("Open with");
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(with),sub);
+    return with;
+}
+static void menu_copy(GtkMenuItem *i,Explorer *ex){ do_copy(path_of(i)); }
+static void menu_cut(GtkMenuItem *i,Explorer *ex){ do_cut(path_of(i)); }
+static void menu_rename(GtkMenuItem *i,Explorer *ex){ file_rename(ex,path_of(i)); }
+static void menu_delete(GtkMenuItem *i,Explorer *ex){ file_delete(ex,path_of(i)); }
+static void menu_paste(GtkMenuItem *i,Explorer *ex){ file_paste(ex,path_of(i)); }
+static void menu_dupes(GtkMenuItem *i,Explorer *ex){ find_duplicates(ex,path_of(i)); }
+static void menu_compare(GtkMenuItem *i,Explorer *ex){ compare_with(ex,path_of(i)); }
+static void menu_compress(GtkMenuItem *i,Explorer *ex){ compress_selection(ex,path_of(i)); }
+static void menu_extract(GtkMenuItem *i,Explorer *ex){ extract_here(ex,path_of(i)); }
+
+static gboolean on_right(GtkWidget *w,GdkEventButton *ev,Explorer *ex){
+    WATCHDOG_SCOPE("on_right");
     if(ev->type!=GDK_BUTTON_PRESS || ev->button!=3) return FALSE;
 
     GtkWidget *m=gtk_menu_new();
@@ -666,97 +1204,160 @@ static gboolean on_right(GtkWidget *w,GdkEventButton *ev){
     GtkWidget *p = gtk_menu_item_new_with_label("Paste");
     GtkWidget *r = gtk_menu_item_new_with_label("Rename");
     GtkWidget *d = gtk_menu_item_new_with_label("Delete");
+    GtkWidget *z = gtk_menu_item_new_with_label("Compress");
+    GtkWidget *x = gtk_menu_item_new_with_label("Extract here");
+    GtkWidget *dup = gtk_menu_item_new_with_label("Find duplicates here");
+    GtkWidget *cmp = gtk_menu_item_new_with_label("Compare with…");
+
+    char *path=NULL; gboolean isd=FALSE;
+    gboolean ok=get_sel(ex,&path,&isd);
 
     gtk_menu_shell_append(GTK_MENU_SHELL(m),o);
+    /* archive members have to be copied out first; Open does that */
+    GtkWidget *with=ok && !isd && !vfs_is_virtual(path) ? open_with_menu(ex,path) : NULL;
+    if(with) gtk_menu_shell_append(GTK_MENU_SHELL(m),with);
     gtk_menu_shell_append(GTK_MENU_SHELL(m),c);
     gtk_menu_shell_append(GTK_MENU_SHELL(m),t);
     gtk_menu_shell_append(GTK_MENU_SHELL(m),p);
     gtk_menu_shell_append(GTK_MENU_SHELL(m),r);
     gtk_menu_shell_append(GTK_MENU_SHELL(m),d);
+    gtk_menu_shell_append(GTK_MENU_SHELL(m),gtk_separator_menu_item_new());
+    gtk_menu_shell_append(GTK_MENU_SHELL(m),z);
+    if(ok && !isd && is_zip(path)) gtk_menu_shell_append(GTK_MENU_SHELL(m),x);
+    gtk_menu_shell_append(GTK_MENU_SHELL(m),gtk_separator_menu_item_new());
+    gtk_menu_shell_append(GTK_MENU_SHELL(m),dup);
+    /* both trees are walked from disk; archives have no place there */
+    if(!vfs_is_virtual(ok&&isd?path:ex->current_path)) gtk_menu_shell_append(GTK_MENU_SHELL(m),cmp);
     gtk_widget_show_all(m);
 
-    char *path=NULL; gboolean isd=FALSE;
-    gboolean ok=get_sel(&path,&isd);
-
     if(ok){
-        if(isd)
-            g_signal_connect_swapped(o,"activate",
-                G_CALLBACK(load_path),g_strdup(path));
-        else
-            g_signal_connect_swapped(o,"activate",
-                G_CALLBACK(open_with_default),g_strdup(path));
+        on_path(o,path,isd ? G_CALLBACK(menu_load) : G_CALLBACK(menu_open),ex);
+        on_path(c,path,G_CALLBACK(menu_copy),ex);
+        on_path(t,path,G_CALLBACK(menu_cut),ex);
+        on_path(r,path,G_CALLBACK(menu_rename),ex);
+        on_path(d,path,G_CALLBACK(menu_delete),ex);
+        on_path(z,path,G_CALLBACK(menu_compress),ex);
+        on_path(x,path,G_CALLBACK(menu_extract),ex);
+    }
+
+    on_path(p,ex->current_path,G_CALLBACK(menu_paste),ex);
+    on_path(dup,ok&&isd?path:ex->current_path,G_CALLBACK(menu_dupes),ex);
+    on_path(cmp,ok&&isd?path:ex->current_path,G_CALLBACK(menu_compare),ex);
 
-        g_signal_connect_swapped(c, "activate",
-            G_CALLBACK(do_copy), g_strdup(path));
+    gtk_menu_popup_at_pointer(GTK_MENU(m),(GdkEvent*)ev);
+
+    g_free(path);
+    return TRUE;
+}
 
-        g_signal_connect_swapped(t, "activate",
-            G_CALLBACK(do_cut), g_strdup(path));
+static void on_sudo(GtkToggleButton *b,Explorer *ex);
+
+/* SUDO mode belongs to the process, so every window follows the toggle */
+static void sync_sudo(void){
+    GList *l=gtk_application_get_windows(GTK_APPLICATION(g_application_get_default()));
+    for(;l;l=l->next){
+        Explorer *ex=g_object_get_data(G_OBJECT(l->data),"explorer");
+        if(!ex) continue;
+        g_signal_handlers_block_by_func(ex->sudo_btn,on_sudo,ex);
+        gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(ex->sudo_btn),sudo_mode);
+        g_signal_handlers_unblock_by_func(ex->sudo_btn,on_sudo,ex);
+        gtk_widget_set_sensitive(ex->sudo_btn,TRUE);
+        refresh_view(ex);
+    }
+}
 
+static void on_sudo_ready(gboolean ok,const char *error,gpointer d){
+    Explorer *ex=release(d);
 
-        g_signal_connect(r,"activate",
-            G_CALLBACK(file_rename),g_strdup(path));
+    if(ok) sudo_mode = TRUE;
+    sync_sudo();
+    if(!ok) show_error(ex,"SUDO mode is unavailable",error);
+}
 
-        g_signal_connect_swapped(d,"activate",
-            G_CALLBACK(file_delete),g_strdup(path));
+static void on_sudo(GtkToggleButton *b,Explorer *ex){
+    WATCHDOG_SCOPE("on_sudo");
+    if(!gtk_toggle_button_get_active(b)){
+        /* the helper stays up so toggling back on needs no new password */
+        sudo_mode = FALSE;
+        sync_sudo();
+        return;
     }
 
-    g_signal_connect_swapped(p,"activate",
-        G_CALLBACK(file_paste),g_strdup(current_path));
+    gtk_widget_set_sensitive(GTK_WIDGET(b),FALSE);
+    priv_start(on_sudo_ready,hold(ex));
+}
 
-    gtk_menu_popup_at_pointer(GTK_MENU(m),(GdkEvent*)ev);
+static void sidebar_open(GtkButton *b,Explorer *ex){
+    WATCHDOG_SCOPE("sidebar_open");
+    load_path(ex,path_of(b),TRUE);
+}
 
-    g_free(path);
-    return TRUE;
+static gboolean sidebar_hover(GtkWidget *b,GdkEvent *ev,gpointer d){
+    prefetch_hint(path_of(b),TRUE);
+    return FALSE;
 }
 
-static void on_sudo(GtkToggleButton *b,gpointer d){
-    sudo_mode = gtk_toggle_button_get_active(b);
-    ui_load_directory(GTK_ICON_VIEW(grid_view),current_path);
-    update_status();
+static void sidebar_add(Explorer *ex,const char *label,const char *path){
+    GtkWidget *b=gtk_button_new_with_label(label);
+    on_path(b,path,G_CALLBACK(sidebar_open),ex);
+    g_signal_connect(b,"enter-notify-event",G_CALLBACK(sidebar_hover),NULL);
+    gtk_box_pack_start(GTK_BOX(ex->sidebar_top),b,FALSE,FALSE,2);
 }
 
-static void sidebar_open(GtkButton *b,gpointer d){
-    load_path(d,TRUE);
+static void sidebar_add_user(Explorer *ex,const char *path){
+    char *base=g_path_get_basename(path);
+
+    char shortname[64];
+    if(strlen(base)>14)
+        snprintf(shortname,sizeof(shortname),"%.12s…",base);
+    else snprintf(shortname,sizeof(shortname),"%s",base);
+
+    sidebar_add(ex,shortname,path);
+    g_free(base);
 }
 
-static GtkWidget* create_sidebar(void){
+static GtkWidget* create_sidebar(Explorer *ex){
     GtkWidget *outer=gtk_box_new(GTK_ORIENTATION_VERTICAL,0);
     GtkWidget *scroll=gtk_scrolled_window_new(NULL,NULL);
     gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll),
         GTK_POLICY_AUTOMATIC,GTK_POLICY_AUTOMATIC);
 
-    sidebar_top=gtk_box_new(GTK_ORIENTATION_VERTICAL,4);
-    gtk_container_add(GTK_CONTAINER(scroll),sidebar_top);
+    ex->sidebar_top=gtk_box_new(GTK_ORIENTATION_VERTICAL,4);
+    gtk_container_add(GTK_CONTAINER(scroll),ex->sidebar_top);
     gtk_box_pack_start(GTK_BOX(outer),scroll,TRUE,TRUE,0);
 
     GtkWidget *bottom=gtk_box_new(GTK_ORIENTATION_VERTICAL,4);
     GtkWidget *add=gtk_button_new_with_label("+ Add Shortcut");
-    g_signal_connect(add,"clicked",G_CALLBACK(add_shortcut),NULL);
+    g_signal_connect(add,"clicked",G_CALLBACK(add_shortcut),ex);
     gtk_box_pack_start(GTK_BOX(bottom),add,FALSE,FALSE,4);
     gtk_box_pack_start(GTK_BOX(outer),bottom,FALSE,FALSE,0);
 
     const char *H = g_get_home_dir();
+    char *desktop=g_build_filename(H,"Desktop",NULL);
+    char *downloads=g_build_filename(H,"Downloads",NULL);
 
     struct { const char *lbl; const char *path; } arr[]={
         {"Home",H},
-        {"Desktop",g_strdup_printf("%s/Desktop",H)},
-        {"Downloads",g_strdup_printf("%s/Downloads",H)},
+        {"Desktop",desktop},
+        {"Downloads",downloads},
         {"Root","/"}
     };
 
     for(int i=0;i<4;i++){
-        GtkWidget *b=gtk_button_new_with_label(arr[i].lbl);
-        g_signal_connect(b,"clicked",G_CALLBACK(sidebar_open),
-            g_strdup(arr[i].path));
-        gtk_box_pack_start(GTK_BOX(sidebar_top),b,FALSE,FALSE,2);
+        sidebar_add(ex,arr[i].lbl,arr[i].path);
+        prefetch_hint(arr[i].path,FALSE);
     }
+    for(const char *const *p=session_shortcuts();*p;p++)
+        sidebar_add_user(ex,*p);
 
+    g_free(desktop);
+    g_free(downloads);
     return outer;
 }
 
-static void add_shortcut(GtkButton *b){
+static void add_shortcut(GtkButton *b,Explorer *ex){
     GtkWidget *d=gtk_file_chooser_dialog_new(
-        "Select Folder",NULL,
+        "Select Folder",GTK_WINDOW(ex->window),
         GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
         "Cancel",GTK_RESPONSE_CANCEL,
         "Add",GTK_RESPONSE_ACCEPT,NULL
@@ -764,82 +1365,206 @@ static void add_shortcut(GtkButton *b){
 
     if(gtk_dialog_run(GTK_DIALOG(d))==GTK_RESPONSE_ACCEPT){
         char *f=gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(d));
-        char *base=g_path_get_basename(f);
-
-        char shortname[64];
-        if(strlen(base)>14)
-            snprintf(shortname,sizeof(shortname),"%.12s…",base);
-        else snprintf(shortname,sizeof(shortname),"%s",base);
-
-        GtkWidget *btn=gtk_button_new_with_label(shortname);
-        g_signal_connect(btn,"clicked",
-            G_CALLBACK(sidebar_open),g_strdup(f));
-
-        gtk_box_pack_start(GTK_BOX(sidebar_top),btn,FALSE,FALSE,2);
-        gtk_widget_show_all(sidebar_top);
-
-        g_free(base);
+        sidebar_add_user(ex,f);
+        gtk_widget_show_all(ex->sidebar_top);
+        session_add_shortcut(f);
+        g_free(f);
     }
 
     gtk_widget_destroy(d);
 }
 
 static void on_theme(GtkComboBoxText *b){
-    const char *t=gtk_combo_box_text_get_active_text(b);
+    WATCHDOG_SCOPE("on_theme");
+    gchar *t=gtk_combo_box_text_get_active_text(b);
     if(!t) return;
 
-   
+    const char *file=theme_file_for_name(t);
     char wo_file[256];
-    snprintf(wo_file, sizeof(wo_file), "%s.wo", t);
-    
-    if (g_file_test(wo_file, G_FILE_TEST_EXISTS)) {
-        load_theme(wo_file);
-    } else {
+    if(!file){
+        snprintf(wo_file,sizeof(wo_file),"%s.wo",t);
+        file=wo_file;
+    }
+    theme_apply(file);
+    g_free(t);
 
-        if(!strcmp(t,"OLED"))
-            load_theme("oled.css");
-        else if(!strcmp(t,"Red"))
-            load_theme("red.css");
-        else if(!strcmp(t,"Blue"))
-            load_theme("blue.css");
-        else {
-            
-            load_theme(wo_file);
-        }
+    /* parse the next entry while idle so stepping through the list is instant */
+    GtkTreeModel *m=gtk_combo_box_get_model(GTK_COMBO_BOX(b));
+    GtkTreeIter it;
+    int next=gtk_combo_box_get_active(GTK_COMBO_BOX(b))+1;
+    if(gtk_tree_model_iter_nth_child(m,&it,NULL,next)){
+        gchar *n=NULL;
+        gtk_tree_model_get(m,&it,0,&n,-1);
+        if(n) theme_prewarm(theme_file_for_name(n));
+        g_free(n);
     }
 }
 
-static GtkWidget* create_statusbar(void){
+/* a new window shows the theme the others already use */
+static void select_current_theme(GtkWidget *theme_box){
+    const char *cur=theme_current();
+    GtkTreeModel *m=gtk_combo_box_get_model(GTK_COMBO_BOX(theme_box));
+    GtkTreeIter it;
+    int index=0;
+
+    gtk_combo_box_set_active(GTK_COMBO_BOX(theme_box),0);
+    if(!cur || !gtk_tree_model_get_iter_first(m,&it)) return;
+    do{
+        gchar *n=NULL;
+        gtk_tree_model_get(m,&it,0,&n,-1);
+        const char *file=n ? theme_file_for_name(n) : NULL;
+        gboolean match=file && !strcmp(file,cur);
+        g_free(n);
+        if(match){
+            gtk_combo_box_set_active(GTK_COMBO_BOX(theme_box),index);
+            return;
+        }
+        index++;
+    }while(gtk_tree_model_iter_next(m,&it));
+}
+
+static GtkWidget* create_statusbar(Explorer *ex){
     GtkWidget *box=gtk_box_new(GTK_ORIENTATION_HORIZONTAL,6);
     gtk_widget_set_name(box,"statusbar");
 
-    status_label=gtk_label_new("Items:");
-    gtk_label_set_xalign(GTK_LABEL(status_label),0.0);
+    ex->status_label=gtk_label_new("Items:");
+    gtk_label_set_xalign(GTK_LABEL(ex->status_label),0.0);
+
+    gtk_box_pack_start(GTK_BOX(box),ex->status_label,FALSE,FALSE,8);
 
-    gtk_box_pack_start(GTK_BOX(box),status_label,FALSE,FALSE,8);
+    /* shown while an archive job runs */
+    ex->zip_cancel=gtk_button_new_with_label("Cancel");
+    gtk_widget_set_no_show_all(ex->zip_cancel,TRUE);
+    g_signal_connect(ex->zip_cancel,"clicked",G_CALLBACK(on_zip_cancel),ex);
+    gtk_box_pack_end(GTK_BOX(box),ex->zip_cancel,FALSE,FALSE,8);
 
     return box;
 }
 
-GtkWidget* explorer_create_window(void){
-    history_back=g_ptr_array_new();
-    history_forward=g_ptr_array_new();
+/* NULL-terminated, borrowing the history's strings */
+static char** history_strv(GPtrArray *h){
+    char **v=g_new(char*,h->len+1);
+    for(guint i=0;i<h->len;i++) v[i]=h->pdata[i];
+    v[h->len]=NULL;
+    return v;
+}
 
-    g_strlcpy(current_path,g_get_home_dir(),sizeof(current_path));
+/* the last window closed is the one the next start reopens */
+static void save_session(Explorer *ex){
+    SessionWindow sw={ ex->current_path };
+    gtk_window_get_size(GTK_WINDOW(ex->window),&sw.width,&sw.height);
+    sw.maximized=gtk_window_is_maximized(GTK_WINDOW(ex->window));
+    sw.zoom=ui_get_zoom(GTK_ICON_VIEW(ex->grid_view));
+    sw.back=history_strv(ex->history_back);
+    sw.forward=history_strv(ex->history_forward);
+    session_save_window(&sw);
+    g_free(sw.back);
+    g_free(sw.forward);
+
+    /* only a plain listing of a real folder is worth painting next time */
+    const char *q=gtk_entry_get_text(GTK_ENTRY(ex->search_entry));
+    if(ex->view_error || sudo_mode || vfs_is_virtual(ex->current_path) || (q && q[0])) return;
+
+    GtkTreeModel *m=gtk_icon_view_get_model(GTK_ICON_VIEW(ex->grid_view));
+    GPtrArray *names=g_ptr_array_new_with_free_func(g_free);
+    GtkTreeIter it;
+    guint total=0;
+    gboolean ok=gtk_tree_model_get_iter_first(m,&it);
+    for(;ok;ok=gtk_tree_model_iter_next(m,&it),total++){
+        if(names->len==SESSION_SNAPSHOT_MAX) continue;
+        char *name=NULL;
+        gtk_tree_model_get(m,&it,1,&name,-1);
+        if(name) g_ptr_array_add(names,name);
+    }
+    session_snapshot_save(ex->current_path,names,total);
+    g_ptr_array_free(names,TRUE);
+}
+
+static void on_destroy(GtkWidget *w,Explorer *ex){
+    save_session(ex);
+    stop_revalidate(ex);
+    g_object_set_data(G_OBJECT(w),"explorer",NULL);
+    if(ex->query_timer) g_source_remove(ex->query_timer);
+    /* a running archive job finishes on its own, like a drop */
+    g_clear_object(&ex->zip_job);
+    search_cancel(GTK_LIST_STORE(gtk_icon_view_get_model(GTK_ICON_VIEW(ex->grid_view))));
+    clear_forward(ex);
+    g_ptr_array_free(ex->history_forward,TRUE);
+    for(guint i=0;i<ex->history_back->len;i++)
+        g_free(ex->history_back->pdata[i]);
+    g_ptr_array_free(ex->history_back,TRUE);
+    if(ex->hovered) gtk_tree_path_free(ex->hovered);
+    g_free(ex);
+}
+
+static void on_revalidated(const char *dir,GList *fresh,int err,gpointer data){
+    Explorer *ex=data;
+    g_clear_object(&ex->revalidate);
 
-    GtkWidget *w=gtk_window_new(GTK_WINDOW_TOPLEVEL);
-    enable_theme_drop(w);  
-    main_window=w;
+    /* gone or unreadable since the snapshot: show it the way a listing would */
+    if(err){ refresh_view(ex); return; }
+    if(!fresh) return;
+
+    utils_store_merge(GTK_LIST_STORE(gtk_icon_view_get_model(GTK_ICON_VIEW(ex->grid_view))),fresh);
+    complete_feed(dir,fresh,FALSE);
+    update_status(ex);
+}
+
+/* the restored folder as it was at exit, checked against the disk in the background */
+static void first_paint(Explorer *ex,gboolean restored){
+    GList *snap=restored && !sudo_mode ? session_snapshot_load(ex->current_path) : NULL;
+    if(!snap){
+        refresh_view(ex);
+        return;
+    }
+
+    ui_show_listing(GTK_ICON_VIEW(ex->grid_view),snap);
+    ex->view_error=0;
+    update_status(ex);
+    ex->revalidate=g_cancellable_new();
+    session_revalidate(ex->current_path,ex->revalidate,on_revalidated,ex);
+}
+
+GtkWidget* explorer_window_new(GtkApplication *app,const char *path){
+    Explorer *ex=g_malloc0(sizeof(Explorer));
+    ex->history_back=g_ptr_array_new();
+    ex->history_forward=g_ptr_array_new();
+
+    /* only the first window of a run picks up where the last one left off */
+    static gboolean started=FALSE;
+    SessionWindow *sw=!path && !started ? session_last_window() : NULL;
+    started=TRUE;
+    if(sw && !g_file_test(sw->path,G_FILE_TEST_IS_DIR) && !vfs_is_dir(sw->path)){
+        session_window_free(sw);
+        sw=NULL;
+    }
+
+    g_strlcpy(ex->current_path,sw ? sw->path : path ? path : g_get_home_dir(),sizeof(ex->current_path));
+    for(char **p=sw && sw->back ? sw->back : NULL;p && *p;p++) push_back(ex,*p);
+    for(char **p=sw && sw->forward ? sw->forward : NULL;p && *p;p++) push_forward(ex,*p);
+
+    GtkWidget *w=gtk_application_window_new(app);
+    ex->window=w;
+    g_object_set_data(G_OBJECT(w),"explorer",ex);
+    g_signal_connect(w,"destroy",G_CALLBACK(on_destroy),ex);
+    enable_theme_drop(ex);
 
     gtk_window_set_title(GTK_WINDOW(w),"WO Files");
     gtk_window_set_default_size(GTK_WINDOW(w),1400,900);
-
-    load_theme("oled.css");
+    if(sw && sw->width>0 && sw->height>0) gtk_window_set_default_size(GTK_WINDOW(w),sw->width,sw->height);
+    if(sw && sw->maximized) gtk_window_maximize(GTK_WINDOW(w));
+
+    theme_init(w);
+    if(!theme_current()){
+        char *saved=session_theme();
+        if(!saved || !theme_apply(saved)) theme_apply("oled.css");
+        g_free(saved);
+    }
 
     GtkWidget *hbox=gtk_box_new(GTK_ORIENTATION_HORIZONTAL,6);
     gtk_container_add(GTK_CONTAINER(w),hbox);
 
-    GtkWidget *sidebar=create_sidebar();
+    GtkWidget *sidebar=create_sidebar(ex);
     gtk_widget_set_name(sidebar,"sidebar");
     gtk_widget_set_size_request(sidebar,220,-1);
     gtk_box_pack_start(GTK_BOX(hbox),sidebar,FALSE,FALSE,0);
@@ -851,6 +1576,7 @@ GtkWidget* explorer_create_window(void){
     gtk_box_pack_start(GTK_BOX(right),bar,FALSE,FALSE,0);
 
     GtkWidget *theme_box=gtk_combo_box_text_new();
+    ex->theme_box=theme_box;
     gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(theme_box),"OLED");
     gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(theme_box),"Red");
     gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(theme_box),"Blue");
@@ -858,51 +1584,77 @@ GtkWidget* explorer_create_window(void){
 
     load_saved_wo_themes(theme_box);
     
-    gtk_combo_box_set_active(GTK_COMBO_BOX(theme_box),0);
+    select_current_theme(theme_box);
     g_signal_connect(theme_box,"changed",G_CALLBACK(on_theme),NULL);
 
     GtkWidget *back=gtk_button_new_with_label("◀");
     GtkWidget *fwd =gtk_button_new_with_label("▶");
     GtkWidget *up  =gtk_button_new_with_label("⬆");
-    GtkWidget *sudo_btn=gtk_toggle_button_new_with_label("SUDO");
+    GtkWidget *jump=gtk_button_new_with_label("Jump");
+    gtk_widget_set_tooltip_text(jump,"Jump to a visited folder (Ctrl+J)");
+    ex->sudo_btn=gtk_toggle_button_new_with_label("SUDO");
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(ex->sudo_btn),sudo_mode);
 
     gtk_box_pack_start(GTK_BOX(bar),back,FALSE,FALSE,0);
     gtk_box_pack_start(GTK_BOX(bar),fwd,FALSE,FALSE,0);
     gtk_box_pack_start(GTK_BOX(bar),up,FALSE,FALSE,0);
-    gtk_box_pack_start(GTK_BOX(bar),sudo_btn,FALSE,FALSE,0);
+    gtk_box_pack_start(GTK_BOX(bar),jump,FALSE,FALSE,0);
+    gtk_box_pack_start(GTK_BOX(bar),ex->sudo_btn,FALSE,FALSE,0);
 
-    path_entry = gtk_entry_new();
-    gtk_entry_set_text(GTK_ENTRY(path_entry),current_path);
-    gtk_box_pack_start(GTK_BOX(bar),path_entry,TRUE,TRUE,0);
+    ex->preview_btn=gtk_toggle_button_new_with_label("Preview");
+    gtk_box_pack_start(GTK_BOX(bar),ex->preview_btn,FALSE,FALSE,0);
 
-    search_entry=gtk_entry_new();
-    gtk_entry_set_placeholder_text(GTK_ENTRY(search_entry),"Search…");
-    gtk_box_pack_start(GTK_BOX(bar),search_entry,FALSE,FALSE,0);
+    ex->path_entry = gtk_entry_new();
+    gtk_entry_set_text(GTK_ENTRY(ex->path_entry),ex->current_path);
+    gtk_box_pack_start(GTK_BOX(bar),ex->path_entry,TRUE,TRUE,0);
+    create_path_completion(ex);
+
+    ex->search_entry=gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(ex->search_entry),"Search…");
+    gtk_box_pack_start(GTK_BOX(bar),ex->search_entry,FALSE,FALSE,0);
 
     gtk_box_pack_end(GTK_BOX(bar),theme_box,FALSE,FALSE,0);
 
-    grid_view = ui_create_grid();
+    ex->grid_view = ui_create_grid();
     GtkWidget *scroll=gtk_scrolled_window_new(NULL,NULL);
     gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll),
         GTK_POLICY_AUTOMATIC,GTK_POLICY_AUTOMATIC);
 
-    gtk_container_add(GTK_CONTAINER(scroll),grid_view);
-    gtk_box_pack_start(GTK_BOX(right),scroll,TRUE,TRUE,0);
+    gtk_container_add(GTK_CONTAINER(scroll),ex->grid_view);
+
+    ex->preview=preview_new();
+    gtk_widget_set_no_show_all(ex->preview,TRUE);
+    GtkWidget *paned=gtk_paned_new(GTK_ORIENTATION_HORIZONTAL);
+    gtk_paned_pack1(GTK_PANED(paned),scroll,TRUE,FALSE);
+    gtk_paned_pack2(GTK_PANED(paned),ex->preview,TRUE,TRUE);
+    gtk_paned_set_position(GTK_PANED(paned),700);
+    gtk_box_pack_start(GTK_BOX(right),paned,TRUE,TRUE,0);
 
-    GtkWidget *status=create_statusbar();
+    GtkWidget *status=create_statusbar(ex);
     gtk_box_pack_start(GTK_BOX(right),status,FALSE,FALSE,0);
 
-    ui_load_directory(GTK_ICON_VIEW(grid_view),current_path);
-    update_status();
-
-    g_signal_connect(back,"clicked",G_CALLBACK(on_back),NULL);
-    g_signal_connect(fwd,"clicked",G_CALLBACK(on_forward),NULL);
-    g_signal_connect(up,"clicked",G_CALLBACK(on_up),NULL);
-    g_signal_connect(path_entry,"activate",G_CALLBACK(on_path_enter),NULL);
-    g_signal_connect(search_entry,"changed",G_CALLBACK(on_search),NULL);
-    g_signal_connect(grid_view,"item-activated",G_CALLBACK(on_item_activated),NULL);
-    g_signal_connect(grid_view,"button-press-event",G_CALLBACK(on_right),NULL);
-    g_signal_connect(sudo_btn,"toggled",G_CALLBACK(on_sudo),NULL);
+    if(sw) ui_set_zoom(GTK_ICON_VIEW(ex->grid_view),sw->zoom);
+    first_paint(ex,sw!=NULL);
+    prefetch_neighbours(ex);
+    session_window_free(sw);
+
+    g_signal_connect(back,"clicked",G_CALLBACK(on_back),ex);
+    g_signal_connect(fwd,"clicked",G_CALLBACK(on_forward),ex);
+    g_signal_connect(up,"clicked",G_CALLBACK(on_up),ex);
+    g_signal_connect(jump,"clicked",G_CALLBACK(on_jump),ex);
+    g_signal_connect(w,"key-press-event",G_CALLBACK(on_window_key),ex);
+    g_signal_connect(ex->path_entry,"activate",G_CALLBACK(on_path_enter),ex);
+    g_signal_connect(ex->search_entry,"changed",G_CALLBACK(on_search),ex);
+    g_signal_connect(ex->grid_view,"item-activated",G_CALLBACK(on_item_activated),ex);
+    gtk_widget_add_events(ex->grid_view,GDK_POINTER_MOTION_MASK);
+    g_signal_connect(ex->grid_view,"motion-notify-event",G_CALLBACK(on_grid_motion),ex);
+    gtk_widget_add_events(ex->grid_view,GDK_SCROLL_MASK|GDK_SMOOTH_SCROLL_MASK);
+    g_signal_connect(ex->grid_view,"scroll-event",G_CALLBACK(on_grid_scroll),ex);
+    g_signal_connect(ex->grid_view,"selection-changed",G_CALLBACK(on_grid_selection),ex);
+    g_signal_connect(ex->grid_view,"button-press-event",G_CALLBACK(on_right),ex);
+    enable_grid_dnd(ex);
+    g_signal_connect(ex->sudo_btn,"toggled",G_CALLBACK(on_sudo),ex);
+    g_signal_connect(ex->preview_btn,"toggled",G_CALLBACK(on_preview_toggled),ex);
 
     return w;
 }
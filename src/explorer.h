@@ -3,6 +3,7 @@
 
 #include <gtk/gtk.h>
 
-GtkWidget* explorer_create_window(void);
+/* a browser window at path (home when NULL); its state lives with the window */
+GtkWidget* explorer_window_new(GtkApplication *app, const char *path);
 
 #endif
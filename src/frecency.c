@@ -0,0 +1,429 @@
+#define _GNU_SOURCE
+#include "frecency.h"
+#include "hash.h"
+#include "trace.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FRECENCY_MAGIC "WOFREC1\n"
+#define FRECENCY_HALF_LIFE (7 * 24 * 3600.0)
+#define FRECENCY_MAX 65536          /* records kept; the lowest scores go first */
+#define FRECENCY_MIN_CAP 1024
+#define FRECENCY_MIN_STRINGS (64 * 1024)
+#define FRECENCY_WORDS 8
+/* a path and its ASCII-lowered twin, each NUL-terminated */
+#define SPAN(len) (2 * ((gsize) (len) + 1))
+
+typedef struct {
+    char magic[8];
+    guint32 count;              /* records written, forgotten ones included */
+    guint32 cap;
+    guint32 strings;            /* bytes of the string area in use */
+    guint32 strings_cap;
+    guint32 reserved[10];
+} FrecHeader;
+
+typedef struct {
+    guint64 hash;               /* XXH64 of the path; 0 once forgotten */
+    guint64 mask;               /* char_bit() of every byte of the path */
+    double stamp;               /* when the decayed score equals 1 */
+    guint32 visits;
+    guint32 last;               /* unix time of the latest visit */
+    guint32 path;               /* offset in the string area of SPAN(len) bytes */
+    guint32 len;
+} FrecRecord;
+
+static int store_fd = -1;
+static guchar *store_map = NULL;
+static gsize store_len = 0;
+static GHashTable *store_index = NULL;     /* &record->hash -> record */
+
+static FrecHeader* header(void) { return (FrecHeader*) store_map; }
+static FrecRecord* records(void) { return (FrecRecord*) (store_map + sizeof(FrecHeader)); }
+
+static char* strings(void)
+{
+    return (char*) (store_map + sizeof(FrecHeader) + (gsize) header()->cap * sizeof(FrecRecord));
+}
+
+static gsize file_size(guint32 cap, guint32 strings_cap)
+{
+    return sizeof(FrecHeader) + (gsize) cap * sizeof(FrecRecord) + strings_cap;
+}
+
+static inline guchar lower(guchar c)
+{
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
+}
+
+/* letters fold to lower case; bytes past ASCII share the upper bits */
+static inline guint64 char_bit(guchar c)
+{
+    c = lower(c);
+    if (c >= 'a' && c <= 'z') return 1ULL << (c - 'a');
+    if (c >= '0' && c <= '9') return 1ULL << (26 + c - '0');
+    return 1ULL << (36 + c % 28);
+}
+
+static guint64 mask_of(const char *s, gsize len)
+{
+    guint64 m = 0;
+    for (gsize i = 0; i < len; i++) m |= char_bit(s[i]);
+    return m;
+}
+
+static char* store_path(void)
+{
+    return g_build_filename(g_get_user_data_dir(), "wo-files", "frecency.db", NULL);
+}
+
+static void unmap(void)
+{
+    if (store_index) g_hash_table_destroy(store_index);
+    if (store_map) munmap(store_map, store_len);
+    if (store_fd >= 0) close(store_fd);
+    store_index = NULL;
+    store_map = NULL;
+    store_len = 0;
+    store_fd = -1;
+}
+
+static gboolean map_file(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (gsize) st.st_size < sizeof(FrecHeader)) return FALSE;
+
+    guchar *m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) return FALSE;
+
+    /* a file from another version, or cut short, is started over */
+    const FrecHeader *h = (const FrecHeader*) m;
+    if (memcmp(h->magic, FRECENCY_MAGIC, 8) || h->count > h->cap || h->strings > h->strings_cap ||
+        file_size(h->cap, h->strings_cap) > (gsize) st.st_size) {
+        munmap(m, st.st_size);
+        return FALSE;
+    }
+
+    store_fd = fd;
+    store_map = m;
+    store_len = st.st_size;
+    store_index = g_hash_table_new(g_int64_hash, g_int64_equal);
+
+    FrecRecord *r = records();
+    for (guint32 i = 0; i < h->count; i++) {
+        if (!r[i].hash) continue;
+        /* a record pointing past the strings is dropped, not read */
+        if ((gsize) r[i].path + SPAN(r[i].len) > h->strings) r[i].hash = 0;
+        else g_hash_table_insert(store_index, &r[i].hash, &r[i]);
+    }
+    return TRUE;
+}
+
+static gint by_stamp_desc(gconstpointer a, gconstpointer b)
+{
+    const FrecRecord *x = a, *y = b;
+    return x->stamp < y->stamp ? 1 : x->stamp > y->stamp ? -1 : 0;
+}
+
+/*
+ * Writes the live records into a fresh file with room to grow, keeping
+ * the FRECENCY_MAX best when there are more, and maps it in place of the
+ * old one. Runs when the store is full, so rarely.
+ */
+static gboolean rebuild(guint32 want_cap, guint32 want_strings)
+{
+    GArray *live = g_array_new(FALSE, FALSE, sizeof(FrecRecord));
+    GString *text = g_string_new(NULL);
+
+    if (store_map) {
+        FrecRecord *r = records();
+        for (guint32 i = 0; i < header()->count; i++)
+            if (r[i].hash) g_array_append_val(live, r[i]);
+    }
+
+    /* at the limit, the best three quarters stay and the rest make room */
+    if (live->len >= FRECENCY_MAX) {
+        g_array_sort(live, by_stamp_desc);
+        g_array_set_size(live, FRECENCY_MAX * 3 / 4);
+    }
+
+    guint32 cap = MAX(FRECENCY_MIN_CAP, MAX(want_cap, live->len * 2));
+    cap = MIN(cap, FRECENCY_MAX);
+
+    FrecRecord *out = g_new0(FrecRecord, cap);
+    guint32 n = 0;
+    for (guint i = 0; i < live->len && n < cap; i++) {
+        FrecRecord rec = g_array_index(live, FrecRecord, i);
+        const char *p = strings() + rec.path;
+        rec.path = text->len;
+        g_string_append_len(text, p, SPAN(rec.len));
+        out[n++] = rec;
+    }
+    guint32 strings_cap = MAX(FRECENCY_MIN_STRINGS, MAX(want_strings, text->len * 2));
+
+    FrecHeader h = { 0 };
+    memcpy(h.magic, FRECENCY_MAGIC, 8);
+    h.count = n;
+    h.cap = cap;
+    h.strings = text->len;
+    h.strings_cap = strings_cap;
+
+    char *path = store_path();
+    char *tmp = g_strconcat(path, ".tmp", NULL);
+    char *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0700);
+
+    gboolean ok = FALSE;
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0 && ftruncate(fd, file_size(cap, strings_cap)) == 0 &&
+        pwrite(fd, &h, sizeof(h), 0) == sizeof(h) &&
+        pwrite(fd, out, (gsize) n * sizeof(FrecRecord), sizeof(h)) == (gssize) (n * sizeof(FrecRecord)) &&
+        pwrite(fd, text->str, text->len, sizeof(h) + (gsize) cap * sizeof(FrecRecord)) == (gssize) text->len &&
+        rename(tmp, path) == 0) {
+        unmap();
+        ok = map_file(fd);
+    }
+    if (!ok) {
+        g_warning("frecency: cannot write %s: %s", path, g_strerror(errno));
+        if (fd >= 0 && fd != store_fd) close(fd);
+        g_unlink(tmp);
+    }
+
+    g_free(dir);
+    g_free(tmp);
+    g_free(path);
+    g_free(out);
+    g_string_free(text, TRUE);
+    g_array_free(live, TRUE);
+    return ok;
+}
+
+static gboolean ensure_open(void)
+{
+    static gboolean broken = FALSE;
+    if (store_map) return TRUE;
+    if (broken) return FALSE;
+
+    char *path = store_path();
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    g_free(path);
+
+    if (fd >= 0 && map_file(fd)) return TRUE;
+    if (fd >= 0) close(fd);
+    /* one warning is enough; the session goes on without a store */
+    broken = !rebuild(0, 0);
+    return !broken;
+}
+
+static FrecRecord* find(const char *dir, gsize len, guint64 *hash)
+{
+    *hash = hash_buffer(dir, len, 0);
+    if (!*hash) *hash = 1;
+
+    FrecRecord *r = g_hash_table_lookup(store_index, hash);
+    /* a 64-bit collision is a new folder, which then takes the slot over */
+    if (r && (r->len != len || memcmp(strings() + r->path, dir, len))) return NULL;
+    return r;
+}
+
+static double now_seconds(void)
+{
+    return g_get_real_time() / (double) G_USEC_PER_SEC;
+}
+
+void frecency_visit(const char *dir)
+{
+    if (!ensure_open()) return;
+
+    gsize len = strlen(dir);
+    guint64 hash;
+    FrecRecord *r = find(dir, len, &hash);
+    double now = now_seconds();
+
+    if (r) {
+        /* score(now) + 1, folded back into a stamp */
+        double score = exp2((r->stamp - now) / FRECENCY_HALF_LIFE);
+        r->stamp = now + FRECENCY_HALF_LIFE * log2(score + 1);
+        r->visits++;
+        r->last = now;
+        return;
+    }
+
+    FrecHeader *h = header();
+    if (h->count == h->cap || h->strings + SPAN(len) > h->strings_cap) {
+        if (!rebuild(h->count + 1, h->strings + SPAN(len))) return;
+        h = header();
+        /* still full when every slot is live and the cap is reached */
+        if (h->count == h->cap || h->strings + SPAN(len) > h->strings_cap) return;
+    }
+
+    char *p = strings() + h->strings;
+    memcpy(p, dir, len + 1);
+    for (gsize i = 0; i <= len; i++) p[len + 1 + i] = lower(dir[i]);
+    r = &records()[h->count];
+    r->hash = hash;
+    r->mask = mask_of(dir, len);
+    r->stamp = now;
+    r->visits = 1;
+    r->last = now;
+    r->path = h->strings;
+    r->len = len;
+
+    /* the header moves last, so a crash mid-visit leaves the old store */
+    h->strings += SPAN(len);
+    h->count++;
+    g_hash_table_insert(store_index, &r->hash, r);
+}
+
+void frecency_forget(const char *dir)
+{
+    if (!ensure_open()) return;
+
+    guint64 hash;
+    FrecRecord *r = find(dir, strlen(dir), &hash);
+    if (!r) return;
+    g_hash_table_remove(store_index, &r->hash);
+    r->hash = 0;
+}
+
+/* ---------- ranking ---------- */
+
+/* paths are short; a first-byte scan beats memmem's setup */
+static const char* word_at(const char *at, const char *end, const char *word, gsize n)
+{
+    for (end -= n; at <= end; at++)
+        if (*at == *word && !memcmp(at, word, n)) return at;
+    return NULL;
+}
+
+static const char* word_last(const char *start, const char *at, const char *word, gsize n)
+{
+    for (at -= n; at >= start; at--)
+        if (*at == *word && !memcmp(at, word, n)) return at;
+    return NULL;
+}
+
+typedef struct {
+    char *words[FRECENCY_WORDS];
+    gsize lens[FRECENCY_WORDS];
+    guint n;
+    char *letters;              /* the words run together, for the subsequence pass */
+    guint64 mask;
+} Query;
+
+/*
+ * log2 of the weight a lowered path gets for q, in half-lives, -INFINITY when it
+ * does not match. Words in order rank by where the last one lands (the
+ * whole folder name, its start, inside it, further up); a subsequence of
+ * the letters ranks below any of those, and is not tried when it could
+ * not beat need.
+ */
+static double weigh(const Query *q, const char *p, gsize len, double need)
+{
+    const char *end = p + len;
+    const char *slash = memrchr(p, '/', len);
+    const char *base = slash && slash + 1 < end ? slash + 1 : p;
+
+    const char *at = p, *hit = NULL;
+    guint i;
+    for (i = 0; i + 1 < q->n; i++) {
+        hit = word_at(at, end, q->words[i], q->lens[i]);
+        if (!hit) break;
+        at = hit + q->lens[i];
+    }
+    /* the last word as far right as it goes, so a match in the name is found */
+    if (i + 1 == q->n) hit = word_last(at, end, q->words[i], q->lens[i]);
+
+    if (i + 1 == q->n && hit) {
+        if (hit == base && hit + q->lens[i] == end) return 2;
+        if (hit == base) return 1.5;
+        if (hit > base) return 1;
+        return 0;
+    }
+
+    /* the letter scan is the slow part; skip it when it cannot place */
+    if (need >= -1) return -INFINITY;
+    const char *c = p - 1;
+    for (const char *s = q->letters; *s; s++) {
+        c = memchr(c + 1, *s, end - c - 1);
+        if (!c) return -INFINITY;
+    }
+    return c >= base ? -1 : -2;
+}
+
+typedef struct {
+    double key;
+    const FrecRecord *r;
+} Ranked;
+
+guint frecency_query(const char *text, guint max, GPtrArray *out)
+{
+    if (!max || !ensure_open()) return 0;
+    TRACE_SCOPE("frecency_query");
+
+    Query q = { { 0 } };
+    char *folded = g_ascii_strdown(text, -1);
+    char **parts = g_strsplit_set(folded, " \t", -1);
+    GString *letters = g_string_new(NULL);
+    for (char **w = parts; *w; w++) {
+        if (!**w || q.n == FRECENCY_WORDS) continue;
+        q.words[q.n] = *w;
+        q.lens[q.n] = strlen(*w);
+        q.mask |= mask_of(*w, q.lens[q.n]);
+        g_string_append(letters, *w);
+        q.n++;
+    }
+    q.letters = letters->str;
+
+    /* the best max so far, best first; candidates are few after the mask test */
+    Ranked *best = g_new(Ranked, max);
+    guint n = 0;
+
+    const FrecRecord *r = records();
+    const char *str = strings();
+    for (guint32 i = 0; i < header()->count; i++, r++) {
+        if (!r->hash || (q.mask & ~r->mask)) continue;
+        /* no weight lifts a record past the full-name bonus */
+        if (n == max && r->stamp + 2 * FRECENCY_HALF_LIFE <= best[n - 1].key) continue;
+
+        double key = r->stamp;
+        if (q.n) {
+            double need = n == max ? (best[n - 1].key - r->stamp) / FRECENCY_HALF_LIFE : -INFINITY;
+            double w = weigh(&q, str + r->path + r->len + 1, r->len, need);
+            if (w == -INFINITY) continue;
+            key += w * FRECENCY_HALF_LIFE;
+        }
+        if (n == max && key <= best[n - 1].key) continue;
+
+        guint at = n < max ? n++ : n - 1;
+        while (at > 0 && best[at - 1].key < key) {
+            best[at] = best[at - 1];
+            at--;
+        }
+        best[at].key = key;
+        best[at].r = r;
+    }
+
+    for (guint i = 0; i < n; i++)
+        g_ptr_array_add(out, g_strndup(str + best[i].r->path, best[i].r->len));
+
+    TRACE_ITEMS(header()->count);
+    g_free(best);
+    g_string_free(letters, TRUE);
+    g_strfreev(parts);
+    g_free(folded);
+    return n;
+}
+
+void frecency_close(void)
+{
+    if (store_map) msync(store_map, store_len, MS_ASYNC);
+    unmap();
+}
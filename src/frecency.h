@@ -0,0 +1,34 @@
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <glib.h>
+
+/*
+ * Visited folders, ranked by how often and how lately they were opened.
+ * The store is one mmapped file under the user data dir: fixed-size
+ * records (path hash, visit count, a character mask for the matcher and
+ * a decayed score) followed by the paths, each with a lower-case copy
+ * for the matcher. A score halves every week and is kept as the single
+ * time at which it is worth one visit, so visits never need re-aging and
+ * sorting by that time sorts by score. Main thread only; the file is
+ * opened on first use.
+ */
+
+/* dir was just opened */
+void frecency_visit(const char *dir);
+/* dir is gone, or unwanted in the results */
+void frecency_forget(const char *dir);
+
+/*
+ * Up to max folders for query, best first, appended to out as new
+ * strings. Words must occur in the path in order, the last one counting
+ * more inside the folder's own name; when they do not, the letters alone
+ * are tried as a subsequence at a lower rank. "" ranks every folder by
+ * score alone.
+ */
+guint frecency_query(const char *query, guint max, GPtrArray *out);
+
+/* unmaps the store; the next call opens it again */
+void frecency_close(void);
+
+#endif
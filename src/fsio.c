@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+#include "fsio.h"
+#include "trace.h"
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#define FSIO_DEPTH 64
+#define FSIO_CHUNK (256 * 1024)
+#define FSIO_COPY_SLOTS 8
+#define FSIO_SYNC_BUF (128 * 1024)
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned tail;          /* our SQ tail, published by ring_enter() */
+    unsigned queued;        /* SQEs not yet handed to the kernel */
+} Ring;
+
+typedef void (*ReapFunc)(guint64 data, int res, gpointer user);
+
+static void ring_free(Ring *r)
+{
+    if (r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_len);
+    if (r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_len);
+    if (r->sq_ring && r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_len);
+    close(r->fd);
+    g_free(r);
+}
+
+static GPrivate thread_ring = G_PRIVATE_INIT((GDestroyNotify) ring_free);
+static FsioBackend backend = FSIO_SYNC;
+
+static gboolean ops_supported(int fd)
+{
+    static const int needed[] = { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE };
+    gsize size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = g_malloc0(size);
+
+    gboolean ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (guint i = 0; ok && i < G_N_ELEMENTS(needed); i++)
+        ok = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+
+    g_free(probe);
+    return ok;
+}
+
+static Ring* ring_new(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = syscall(__NR_io_uring_setup, FSIO_DEPTH, &p);
+    if (fd < 0) return NULL;
+    if (!ops_supported(fd)) {
+        close(fd);
+        return NULL;
+    }
+
+    Ring *r = g_malloc0(sizeof(Ring));
+    r->fd = fd;
+    r->entries = p.sq_entries;
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    gboolean single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) r->sq_len = r->cq_len = MAX(r->sq_len, r->cq_len);
+
+    r->sq_ring = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    r->cq_ring = single ? r->sq_ring :
+                 mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED) {
+        ring_free(r);
+        return NULL;
+    }
+
+    char *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_head = (unsigned*) (sq + p.sq_off.head);
+    r->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned*) (sq + p.sq_off.array);
+    r->cq_head = (unsigned*) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+    r->tail = *r->sq_tail;
+    return r;
+}
+
+static void pick_backend(void)
+{
+    static gsize once = 0;
+    if (!g_once_init_enter(&once)) return;
+
+    const char *env = g_getenv("WO_IO");
+    if (env && !strcmp(env, "uring")) {
+        Ring *r = ring_new();
+        if (r) {
+            g_private_set(&thread_ring, r);
+            backend = FSIO_URING;
+        } else {
+            g_warning("WO_IO=uring: io_uring is not usable here, using sync I/O");
+        }
+    } else if (env && strcmp(env, "sync")) {
+        g_warning("WO_IO=%s: unknown backend, using sync I/O", env);
+    }
+
+    g_once_init_leave(&once, 1);
+}
+
+FsioBackend fsio_backend(void)
+{
+    pick_backend();
+    return backend;
+}
+
+const char* fsio_backend_name(void)
+{
+    return fsio_backend() == FSIO_URING ? "uring" : "sync";
+}
+
+/* this thread's ring, NULL for sync I/O */
+static Ring* ring_get(void)
+{
+    if (fsio_backend() != FSIO_URING) return NULL;
+
+    Ring *r = g_private_get(&thread_ring);
+    if (!r) {
+        /* a thread that cannot get one (RLIMIT_MEMLOCK...) does sync I/O */
+        r = ring_new();
+        if (r) g_private_set(&thread_ring, r);
+    }
+    return r;
+}
+
+/*
+ * A failed io_uring_enter() leaves requests we can no longer wait for,
+ * writing into buffers we can no longer free; the ring and the buffers
+ * are leaked and the thread gets a new ring next time.
+ */
+static void ring_abandon(Ring *r, int err)
+{
+    g_warning("io_uring_enter: %s", g_strerror(err));
+    g_private_set(&thread_ring, NULL);
+}
+
+/* callers keep at most r->entries requests in flight, so there is always room */
+static struct io_uring_sqe* ring_sqe(Ring *r, guint64 data)
+{
+    unsigned idx = r->tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = data;
+    r->sq_array[idx] = idx;
+    r->tail++;
+    r->queued++;
+    return sqe;
+}
+
+/* submits everything queued and waits for at least one completion; 0 or an errno */
+static int ring_enter(Ring *r)
+{
+    __atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+
+    for (;;) {
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
+        int n = syscall(__NR_io_uring_enter, r->fd, r->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0) {
+            r->queued -= MIN((unsigned) n, r->queued);
+            return 0;
+        }
+        if (errno == EINTR) continue;
+        /* the completion queue is full; reaping makes room */
+        if (errno == EAGAIN || errno == EBUSY) return 0;
+        return errno;
+    }
+}
+
+static guint ring_reap(Ring *r, ReapFunc func, gpointer user)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    guint n = 0;
+
+    for (; head != tail; head++, n++) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        func(cqe->user_data, cqe->res, user);
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/* ---- stat ---- */
+
+static void fill_stat(struct stat *st, const struct statx *sx)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(sx->stx_dev_major, sx->stx_dev_minor);
+    st->st_ino = sx->stx_ino;
+    st->st_mode = sx->stx_mode;
+    st->st_nlink = sx->stx_nlink;
+    st->st_uid = sx->stx_uid;
+    st->st_gid = sx->stx_gid;
+    st->st_rdev = makedev(sx->stx_rdev_major, sx->stx_rdev_minor);
+    st->st_size = sx->stx_size;
+    st->st_blksize = sx->stx_blksize;
+    st->st_blocks = sx->stx_blocks;
+    st->st_atim.tv_sec = sx->stx_atime.tv_sec;
+    st->st_atim.tv_nsec = sx->stx_atime.tv_nsec;
+    st->st_mtim.tv_sec = sx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = sx->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = sx->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = sx->stx_ctime.tv_nsec;
+}
+
+static void stat_sync(int dirfd, FsioStat *items, guint n)
+{
+    for (guint i = 0; i < n; i++) {
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
+        items[i].err = fstatat(dirfd, items[i].name, &items[i].st, AT_SYMLINK_NOFOLLOW) ? errno : 0;
+    }
+}
+
+typedef struct {
+    FsioStat *items;
+    struct statx *bufs;     /* one per slot */
+    guint *item_of;         /* slot -> item */
+    guint *free_slots;
+    guint nfree;
+    guint done;
+} StatBatch;
+
+static void stat_reaped(guint64 slot, int res, gpointer user)
+{
+    StatBatch *b = user;
+    FsioStat *it = &b->items[b->item_of[slot]];
+
+    it->err = res < 0 ? -res : 0;
+    if (!it->err) fill_stat(&it->st, &b->bufs[slot]);
+    b->free_slots[b->nfree++] = slot;
+    b->done++;
+}
+
+void fsio_stat_batch(int dirfd, FsioStat *items, guint n)
+{
+    TRACE_SCOPE("fsio_stat_batch");
+    TRACE_ITEMS(n);
+
+    Ring *r = ring_get();
+    if (!r || n < 2) {
+        stat_sync(dirfd, items, n);
+        return;
+    }
+
+    guint depth = MIN(r->entries, n);
+    StatBatch b = { items, g_new(struct statx, depth), g_new(guint, depth), g_new(guint, depth), 0, 0 };
+    for (guint i = 0; i < depth; i++) b.free_slots[b.nfree++] = i;
+
+    /* a slot is refilled as soon as its answer is in */
+    guint next = 0;
+    while (b.done < n) {
+        for (; next < n && b.nfree; next++) {
+            guint slot = b.free_slots[--b.nfree];
+            b.item_of[slot] = next;
+
+            struct io_uring_sqe *sqe = ring_sqe(r, slot);
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dirfd;
+            sqe->addr = (uintptr_t) items[next].name;
+            sqe->len = STATX_BASIC_STATS;
+            sqe->off = (uintptr_t) &b.bufs[slot];
+            sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        }
+
+        int rc = ring_enter(r);
+        if (rc) {
+            ring_abandon(r, rc);
+            stat_sync(dirfd, items, n);
+            return;
+        }
+        ring_reap(r, stat_reaped, &b);
+    }
+
+    g_free(b.bufs);
+    g_free(b.item_of);
+    g_free(b.free_slots);
+}
+
+/* ---- copy ---- */
+
+static void add_bytes(guint64 *bytes, guint64 n)
+{
+    if (bytes) __atomic_fetch_add(bytes, n, __ATOMIC_RELAXED);
+}
+
+/* from both files' current offsets */
+static int copy_sync(int in, int out, guint64 *bytes)
+{
+    char *buf = g_malloc(FSIO_SYNC_BUF);
+    int rc = 0;
+    ssize_t r;
+
+    for (;;) {
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
+        r = read(in, buf, FSIO_SYNC_BUF);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+
+        for (ssize_t off = 0; off < r; ) {
+            TRACE_COUNT(TRACE_SYSCALLS, 1);
+            ssize_t w = write(out, buf + off, r - off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                rc = w < 0 ? errno : EIO;
+                break;
+            }
+            off += w;
+        }
+        if (rc) break;
+        add_bytes(bytes, r);
+    }
+    if (r < 0 && !rc) rc = errno;
+
+    g_free(buf);
+    return rc;
+}
+
+typedef struct {
+    char *buf;
+    goffset off;
+    gsize len;              /* bytes this slot is responsible for */
+    gsize filled;
+    gsize written;
+    gboolean writing;
+} CopySlot;
+
+typedef struct {
+    Ring *r;
+    int in, out;
+    goffset next, size;
+    CopySlot slots[FSIO_COPY_SLOTS];
+    guint busy;
+    int err;
+    guint64 *bytes;
+} CopyRun;
+
+static void queue_read(CopyRun *c, guint i)
+{
+    CopySlot *s = &c->slots[i];
+    struct io_uring_sqe *sqe = ring_sqe(c->r, i);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = c->in;
+    sqe->addr = (uintptr_t) (s->buf + s->filled);
+    sqe->len = s->len - s->filled;
+    sqe->off = s->off + s->filled;
+}
+
+static void queue_write(CopyRun *c, guint i)
+{
+    CopySlot *s = &c->slots[i];
+    struct io_uring_sqe *sqe = ring_sqe(c->r, i);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = c->out;
+    sqe->addr = (uintptr_t) (s->buf + s->written);
+    sqe->len = s->filled - s->written;
+    sqe->off = s->off + s->written;
+}
+
+/* gives slot i the next chunk, or retires it */
+static void next_chunk(CopyRun *c, guint i)
+{
+    CopySlot *s = &c->slots[i];
+    if (c->err || c->next >= c->size) {
+        c->busy--;
+        return;
+    }
+
+    s->off = c->next;
+    s->len = MIN(FSIO_CHUNK, c->size - c->next);
+    s->filled = s->written = 0;
+    s->writing = FALSE;
+    c->next += s->len;
+    queue_read(c, i);
+}
+
+/* each slot reads its chunk then writes it at the same offset, independently of the others */
+static void copy_reaped(guint64 i, int res, gpointer user)
+{
+    CopyRun *c = user;
+    CopySlot *s = &c->slots[i];
+
+    if (res == -EAGAIN || res == -EINTR) {
+        if (s->writing) queue_write(c, i);
+        else queue_read(c, i);
+        return;
+    }
+    if (res < 0 || c->err) {
+        if (res < 0 && !c->err) c->err = -res;
+        c->busy--;
+        return;
+    }
+
+    if (!s->writing) {
+        s->filled += res;
+        /* short reads are read again; nothing at all means the file shrank */
+        if (res && s->filled < s->len) {
+            queue_read(c, i);
+            return;
+        }
+        if (!s->filled) {
+            c->busy--;
+            return;
+        }
+        s->writing = TRUE;
+        queue_write(c, i);
+        return;
+    }
+
+    if (!res) {
+        c->err = EIO;
+        c->busy--;
+        return;
+    }
+    s->written += res;
+    add_bytes(c->bytes, res);
+    if (s->written < s->filled) queue_write(c, i);
+    else next_chunk(c, i);
+}
+
+/* [start, size) of in to the same offsets of out, FSIO_COPY_SLOTS chunks in flight */
+static int copy_uring(Ring *r, int in, int out, goffset start, goffset size, guint64 *bytes)
+{
+    CopyRun *c = g_malloc0(sizeof(CopyRun));
+    char *mem = g_malloc(FSIO_COPY_SLOTS * FSIO_CHUNK);
+    c->r = r;
+    c->in = in;
+    c->out = out;
+    c->next = start;
+    c->size = size;
+    c->bytes = bytes;
+
+    c->busy = FSIO_COPY_SLOTS;
+    for (guint i = 0; i < FSIO_COPY_SLOTS; i++) {
+        c->slots[i].buf = mem + i * FSIO_CHUNK;
+        next_chunk(c, i);
+    }
+
+    while (c->busy) {
+        int rc = ring_enter(r);
+        if (rc) {
+            ring_abandon(r, rc);
+            return rc;
+        }
+        ring_reap(r, copy_reaped, c);
+    }
+
+    int err = c->err;
+    g_free(mem);
+    g_free(c);
+    return err;
+}
+
+static void open_reaped(guint64 i, int res, gpointer user)
+{
+    ((int*) user)[i] = res;
+}
+
+/* both opens in one submission; dst is only created once src has opened */
+static int open_pair(Ring *r, const char *src, const char *dst, int oflags, mode_t mode, int *in, int *out)
+{
+    int res[2] = { -ECANCELED, -ECANCELED };
+
+    struct io_uring_sqe *sqe = ring_sqe(r, 0);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t) src;
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    sqe->flags = IOSQE_IO_LINK;
+
+    sqe = ring_sqe(r, 1);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t) dst;
+    sqe->len = mode & 07777;
+    sqe->open_flags = oflags;
+
+    for (guint got = 0; got < 2; ) {
+        int rc = ring_enter(r);
+        if (rc) {
+            ring_abandon(r, rc);
+            return rc;
+        }
+        got += ring_reap(r, open_reaped, res);
+    }
+
+    if (res[0] < 0) return -res[0];
+    if (res[1] < 0) {
+        close(res[0]);
+        return -res[1];
+    }
+    *in = res[0];
+    *out = res[1];
+    return 0;
+}
+
+static int open_sync(const char *src, const char *dst, int oflags, mode_t mode, int *in, int *out)
+{
+    TRACE_COUNT(TRACE_SYSCALLS, 2);
+    *in = open(src, O_RDONLY | O_CLOEXEC);
+    if (*in < 0) return errno;
+
+    *out = open(dst, oflags, mode & 07777);
+    if (*out < 0) {
+        int e = errno;
+        close(*in);
+        return e;
+    }
+    return 0;
+}
+
+int fsio_copy_file(const char *src, const char *dst, mode_t mode, gboolean replace, guint64 *bytes)
+{
+    TRACE_SCOPE("fsio_copy_file");
+    Ring *r = ring_get();
+    int oflags = O_WRONLY | O_CREAT | O_CLOEXEC | (replace ? O_TRUNC : O_EXCL);
+    int in = -1, out = -1;
+
+    int rc = r ? open_pair(r, src, dst, oflags, mode, &in, &out)
+               : open_sync(src, dst, oflags, mode, &in, &out);
+    if (rc) return rc;
+
+    for (;;) {
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
+        ssize_t n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+        if (n > 0) {
+            add_bytes(bytes, n);
+            continue;
+        }
+        if (n == 0) break;
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+            rc = errno;
+            break;
+        }
+
+        /* across filesystems, or a filesystem that cannot; carry on from where it got */
+        struct stat st;
+        goffset at = lseek(in, 0, SEEK_CUR);
+        if (r && at >= 0 && fstat(in, &st) == 0 && S_ISREG(st.st_mode))
+            rc = copy_uring(r, in, out, at, st.st_size, bytes);
+        else
+            rc = copy_sync(in, out, bytes);
+        break;
+    }
+
+    close(in);
+    if (close(out) && !rc) rc = errno;
+    return rc;
+}
@@ -0,0 +1,41 @@
+#ifndef FSIO_H
+#define FSIO_H
+
+#include <glib.h>
+#include <sys/stat.h>
+
+/*
+ * Batched filesystem calls. WO_IO picks the backend when the process
+ * starts: "sync" (the default) issues one blocking call after another;
+ * "uring" queues them on a per-thread io_uring, set up with raw
+ * syscalls, keeping up to 64 in flight so that NFS, FUSE or cloud disk
+ * round trips overlap. A kernel without io_uring, or without the statx,
+ * openat, read and write ops, falls back to sync with a warning.
+ */
+
+typedef enum {
+    FSIO_SYNC,
+    FSIO_URING
+} FsioBackend;
+
+FsioBackend fsio_backend(void);
+const char* fsio_backend_name(void);
+
+typedef struct {
+    const char *name;       /* relative to the batch's dirfd */
+    struct stat st;
+    int err;                /* 0, or the errno of this entry */
+} FsioStat;
+
+/* lstat of every item, in any order; items keep their own results */
+void fsio_stat_batch(int dirfd, FsioStat *items, guint n);
+
+/*
+ * Copies src into dst, created with mode (or truncated, with replace).
+ * copy_file_range() is tried first on either backend, since a copy the
+ * kernel or file server does itself beats any read/write loop. bytes,
+ * when not NULL, is added to atomically as data lands. 0 or an errno.
+ */
+int fsio_copy_file(const char *src, const char *dst, mode_t mode, gboolean replace, guint64 *bytes);
+
+#endif
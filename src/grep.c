@@ -0,0 +1,257 @@
+#define _GNU_SOURCE
+#include "grep.h"
+#include "trace.h"
+#include <glib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GREP_BINARY_PROBE 8192
+#define GREP_CHUNK (1024 * 1024)
+/* the tail of a line cut at the end of a chunk, scanned again with the next */
+#define GREP_OVERLAP 4096
+#define GREP_PREVIEW_MAX 160
+
+struct GrepPattern {
+    char *lit;
+    size_t len;
+    gboolean icase;
+    /* case-insensitive literals are prefiltered on their rarest byte */
+    size_t anchor;
+    unsigned char lo, hi;
+    GRegex *re;
+};
+
+/* letters from most to least common in text and logs */
+static const char letter_rank[] = "etaoinsrhldcumfpgwybvkxjqz";
+
+static int byte_rank(unsigned char c)
+{
+    const char *r = strchr(letter_rank, g_ascii_tolower(c));
+    if (g_ascii_isalpha(c) && r) return r - letter_rank;
+    /* digits and punctuation are case-invariant, one memchr is enough */
+    return 100;
+}
+
+GrepPattern* grep_compile(const char *spec, GError **err)
+{
+    size_t n = strlen(spec);
+    if (!n) {
+        g_set_error_literal(err, G_REGEX_ERROR, G_REGEX_ERROR_COMPILE, "empty pattern");
+        return NULL;
+    }
+
+    GrepPattern *p = g_malloc0(sizeof(GrepPattern));
+
+    /* smart case, like most grep front ends */
+    p->icase = TRUE;
+    for (const char *s = spec; *s; s++)
+        if (g_ascii_isupper(*s)) p->icase = FALSE;
+
+    if (n > 2 && spec[0] == '/' && spec[n - 1] == '/') {
+        char *body = g_strndup(spec + 1, n - 2);
+        GRegexCompileFlags flags = G_REGEX_RAW | G_REGEX_MULTILINE | G_REGEX_OPTIMIZE;
+        if (p->icase) flags |= G_REGEX_CASELESS;
+        p->re = g_regex_new(body, flags, 0, err);
+        g_free(body);
+        if (!p->re) {
+            g_free(p);
+            return NULL;
+        }
+        return p;
+    }
+
+    p->lit = g_strdup(spec);
+    p->len = n;
+
+    int best = -1;
+    for (size_t i = 0; i < n; i++) {
+        int r = byte_rank((unsigned char) spec[i]);
+        if (r > best) {
+            best = r;
+            p->anchor = i;
+        }
+    }
+    p->lo = g_ascii_tolower(spec[p->anchor]);
+    p->hi = g_ascii_toupper(spec[p->anchor]);
+    return p;
+}
+
+void grep_free(GrepPattern *p)
+{
+    if (!p) return;
+    if (p->re) g_regex_unref(p->re);
+    g_free(p->lit);
+    g_free(p);
+}
+
+/* memchr on the anchor byte (both cases), then compare the whole needle */
+static const char* find_icase(const GrepPattern *p, const char *s, size_t n)
+{
+    const char *end = s + n;
+    const char *cur = s + p->anchor;
+    const char *next_lo = NULL, *next_hi = NULL;
+
+    while (cur < end) {
+        if (next_lo != end && (!next_lo || next_lo < cur)) {
+            next_lo = memchr(cur, p->lo, end - cur);
+            if (!next_lo) next_lo = end;
+        }
+        if (p->hi == p->lo) next_hi = end;
+        else if (next_hi != end && (!next_hi || next_hi < cur)) {
+            next_hi = memchr(cur, p->hi, end - cur);
+            if (!next_hi) next_hi = end;
+        }
+
+        const char *c = MIN(next_lo, next_hi);
+        if (c == end) return NULL;
+
+        const char *start = c - p->anchor;
+        if (start + p->len <= end && !g_ascii_strncasecmp(start, p->lit, p->len))
+            return start;
+        cur = c + 1;
+    }
+    return NULL;
+}
+
+static const char* find_match(const GrepPattern *p, const char *s, size_t n)
+{
+    if (p->re) {
+        GMatchInfo *mi = NULL;
+        const char *at = NULL;
+        if (g_regex_match_full(p->re, s, n, 0, 0, &mi, NULL)) {
+            int from;
+            g_match_info_fetch_pos(mi, 0, &from, NULL);
+            at = s + from;
+        }
+        g_match_info_free(mi);
+        return at;
+    }
+
+    if (n < p->len) return NULL;
+    if (p->icase) return find_icase(p, s, n);
+    return memmem(s, n, p->lit, p->len);
+}
+
+static void fill_hit(GrepHit *hit, const char *buf, size_t n, const char *at)
+{
+    guint line = 1;
+    for (const char *c = buf; (c = memchr(c, '\n', at - c)); c++)
+        line++;
+
+    const char *from = memrchr(buf, '\n', at - buf);
+    from = from ? from + 1 : buf;
+    const char *to = memchr(at, '\n', buf + n - at);
+    if (!to) to = buf + n;
+
+    /* keep the match in view on very long lines */
+    if (to - from > GREP_PREVIEW_MAX) {
+        if (at - from > GREP_PREVIEW_MAX / 2) from = at - GREP_PREVIEW_MAX / 2;
+        if (to - from > GREP_PREVIEW_MAX) to = from + GREP_PREVIEW_MAX;
+    }
+
+    char *valid = g_utf8_make_valid(from, to - from);
+    hit->line = line;
+    hit->preview = g_strstrip(valid);
+}
+
+static int open_quiet(int dirfd, const char *name)
+{
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK | O_NOATIME);
+    if (fd < 0 && errno == EPERM)
+        fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    return fd;
+}
+
+/* one read buffer per scanning thread, kept between files */
+static GPrivate chunk_key = G_PRIVATE_INIT(g_free);
+
+static char* chunk_buffer(void)
+{
+    char *b = g_private_get(&chunk_key);
+    if (!b) {
+        b = g_malloc(GREP_CHUNK);
+        g_private_set(&chunk_key, b);
+    }
+    return b;
+}
+
+static guint count_lines(const char *s, size_t n)
+{
+    guint lines = 0;
+    for (const char *end = s + n; (s = memchr(s, '\n', end - s)); s++)
+        lines++;
+    return lines;
+}
+
+/*
+ * Read with pread() rather than mapped: a log rotated or a build output
+ * rewritten while it is scanned only ends the scan early, where a mapping
+ * would take the process down with SIGBUS.
+ */
+GrepResult grep_file(const GrepPattern *p, int dirfd, const char *name, GrepHit *hit)
+{
+    int fd = open_quiet(dirfd, name);
+    if (fd < 0) return GREP_ERROR;
+
+    TRACE_COUNT(TRACE_SYSCALLS, 3);
+
+    if (fstat(fd, &hit->st) != 0 || !S_ISREG(hit->st.st_mode)) {
+        close(fd);
+        return GREP_ERROR;
+    }
+
+    guint64 limit = MIN((guint64) hit->st.st_size, GREP_MAX_SCAN);
+    if (limit > GREP_CHUNK) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    char *buf = chunk_buffer();
+    guint64 off = 0;
+    size_t have = 0;        /* carried over from the last chunk, at the front of buf */
+    guint lines = 0;        /* newlines before buf */
+    GrepResult rc = GREP_NONE;
+
+    while (off < limit) {
+        ssize_t r = pread(fd, buf + have, MIN(GREP_CHUNK - have, limit - off), off);
+        if (r < 0 && errno == EINTR) continue;
+        /* shorter than it was a moment ago: what was read is all there is */
+        if (r <= 0) {
+            if (off == 0 && r < 0) rc = GREP_ERROR;
+            break;
+        }
+
+        gboolean first = off == 0;
+        size_t n = have + r;
+        off += r;
+
+        if (first && memchr(buf, 0, MIN(n, GREP_BINARY_PROBE))) {
+            rc = GREP_BINARY;
+            break;
+        }
+
+        /* whole lines, so a match is never split; a line longer than half a chunk is cut */
+        size_t carry = 0;
+        if (off < limit) {
+            const char *nl = memrchr(buf, '\n', n);
+            carry = nl ? n - (nl + 1 - buf) : n;
+            if (carry > GREP_CHUNK / 2) carry = MIN(n, GREP_OVERLAP);
+        }
+
+        const char *at = find_match(p, buf, n);
+        if (at) {
+            fill_hit(hit, buf, n, at);
+            hit->line += lines;
+            rc = GREP_MATCH;
+            break;
+        }
+
+        /* the carried bytes hold no newline, either way they were chosen */
+        lines += count_lines(buf, n - carry);
+        memmove(buf, buf + n - carry, carry);
+        have = carry;
+    }
+
+    close(fd);
+    return rc;
+}
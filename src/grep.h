@@ -0,0 +1,32 @@
+#ifndef GREP_H
+#define GREP_H
+
+#include <glib.h>
+#include <sys/stat.h>
+
+/* files are scanned up to this many bytes */
+#define GREP_MAX_SCAN (64 * 1024 * 1024)
+
+typedef enum {
+    GREP_NONE,
+    GREP_MATCH,
+    GREP_BINARY,
+    GREP_ERROR
+} GrepResult;
+
+typedef struct GrepPattern GrepPattern;
+
+typedef struct {
+    guint line;         /* 1-based */
+    char *preview;      /* the matching line, trimmed, valid UTF-8 */
+    struct stat st;
+} GrepHit;
+
+/* "/re/" is a regular expression, anything else a literal; lower-case patterns ignore case */
+GrepPattern* grep_compile(const char *spec, GError **err);
+void grep_free(GrepPattern *p);
+
+/* thread-safe; name is opened relative to dirfd */
+GrepResult grep_file(const GrepPattern *p, int dirfd, const char *name, GrepHit *hit);
+
+#endif
@@ -0,0 +1,218 @@
+#include "hash.h"
+#include <string.h>
+
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3  1609587929392839161ULL
+#define P4  9650029242287828579ULL
+#define P5  2870177450012600261ULL
+
+static inline guint64 rotl(guint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline guint64 read64(const guchar *p)
+{
+    guint64 v;
+    memcpy(&v, p, 8);
+    return GUINT64_FROM_LE(v);
+}
+
+static inline guint32 read32(const guchar *p)
+{
+    guint32 v;
+    memcpy(&v, p, 4);
+    return GUINT32_FROM_LE(v);
+}
+
+static inline guint64 mix(guint64 acc, guint64 in)
+{
+    acc += in * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+static inline guint64 merge(guint64 acc, guint64 v)
+{
+    acc ^= mix(0, v);
+    return acc * P1 + P4;
+}
+
+static void stripe(guint64 *v, const guchar *p)
+{
+    v[0] = mix(v[0], read64(p));
+    v[1] = mix(v[1], read64(p + 8));
+    v[2] = mix(v[2], read64(p + 16));
+    v[3] = mix(v[3], read64(p + 24));
+}
+
+void hash_init(HashState *h, guint64 seed)
+{
+    memset(h, 0, sizeof(*h));
+    h->seed = seed;
+    h->v[0] = seed + P1 + P2;
+    h->v[1] = seed + P2;
+    h->v[2] = seed;
+    h->v[3] = seed - P1;
+}
+
+void hash_update(HashState *h, const void *data, gsize len)
+{
+    const guchar *p = data;
+    const guchar *end = p + len;
+
+    h->total += len;
+
+    if (h->buf_len + len < 32) {
+        memcpy(h->buf + h->buf_len, p, len);
+        h->buf_len += len;
+        return;
+    }
+
+    if (h->buf_len) {
+        gsize fill = 32 - h->buf_len;
+        memcpy(h->buf + h->buf_len, p, fill);
+        stripe(h->v, h->buf);
+        p += fill;
+        h->buf_len = 0;
+    }
+
+    while (p + 32 <= end) {
+        stripe(h->v, p);
+        p += 32;
+    }
+
+    h->buf_len = end - p;
+    memcpy(h->buf, p, h->buf_len);
+}
+
+guint64 hash_digest(const HashState *h)
+{
+    guint64 acc;
+
+    if (h->total >= 32) {
+        acc = rotl(h->v[0], 1) + rotl(h->v[1], 7) + rotl(h->v[2], 12) + rotl(h->v[3], 18);
+        for (int i = 0; i < 4; i++)
+            acc = merge(acc, h->v[i]);
+    } else {
+        acc = h->seed + P5;
+    }
+
+    acc += h->total;
+
+    const guchar *p = h->buf;
+    guint n = h->buf_len;
+
+    for (; n >= 8; p += 8, n -= 8) {
+        acc ^= mix(0, read64(p));
+        acc = rotl(acc, 27) * P1 + P4;
+    }
+    if (n >= 4) {
+        acc ^= (guint64) read32(p) * P1;
+        acc = rotl(acc, 23) * P2 + P3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n; p++, n--) {
+        acc ^= *p * P5;
+        acc = rotl(acc, 11) * P1;
+    }
+
+    acc ^= acc >> 33;
+    acc *= P2;
+    acc ^= acc >> 29;
+    acc *= P3;
+    acc ^= acc >> 32;
+    return acc;
+}
+
+guint64 hash_buffer(const void *data, gsize len, guint64 seed)
+{
+    HashState h;
+    hash_init(&h, seed);
+    hash_update(&h, data, len);
+    return hash_digest(&h);
+}
+
+/* ---------- crc32 ---------- */
+
+#define CRC_POLY 0xedb88320u
+
+static guint32 crc_table[8][256];
+
+static void crc_init(void)
+{
+    static gsize ready = 0;
+    if (!g_once_init_enter(&ready)) return;
+
+    for (guint32 i = 0; i < 256; i++) {
+        guint32 c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ CRC_POLY : c >> 1;
+        crc_table[0][i] = c;
+    }
+    /* slice-by-8: table k advances a byte seen k positions earlier */
+    for (int k = 1; k < 8; k++)
+        for (int i = 0; i < 256; i++)
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xff];
+
+    g_once_init_leave(&ready, 1);
+}
+
+guint32 hash_crc32(guint32 crc, const void *data, gsize len)
+{
+    const guchar *p = data;
+    crc_init();
+    crc = ~crc;
+
+    for (; len >= 8; p += 8, len -= 8) {
+        guint32 a = read32(p) ^ crc, b = read32(p + 4);
+        crc = crc_table[7][a & 0xff] ^ crc_table[6][(a >> 8) & 0xff] ^
+              crc_table[5][(a >> 16) & 0xff] ^ crc_table[4][a >> 24] ^
+              crc_table[3][b & 0xff] ^ crc_table[2][(b >> 8) & 0xff] ^
+              crc_table[1][(b >> 16) & 0xff] ^ crc_table[0][b >> 24];
+    }
+    for (; len; p++, len--)
+        crc = crc_table[0][(crc ^ *p) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+static guint32 gf2_times(const guint32 *mat, guint32 vec)
+{
+    guint32 sum = 0;
+    for (; vec; vec >>= 1, mat++)
+        if (vec & 1) sum ^= *mat;
+    return sum;
+}
+
+static void gf2_square(guint32 *sq, const guint32 *mat)
+{
+    for (int n = 0; n < 32; n++) sq[n] = gf2_times(mat, mat[n]);
+}
+
+/* zlib's crc32_combine: runs crc_a through len_b zero bytes by repeated squaring */
+guint32 hash_crc32_combine(guint32 crc_a, guint32 crc_b, guint64 len_b)
+{
+    guint32 even[32], odd[32];
+    if (len_b == 0) return crc_a ^ crc_b;
+
+    /* operator for one zero bit, then two, then four */
+    odd[0] = CRC_POLY;
+    for (int n = 1; n < 32; n++) odd[n] = 1u << (n - 1);
+    gf2_square(even, odd);
+    gf2_square(odd, even);
+
+    do {
+        gf2_square(even, odd);
+        if (len_b & 1) crc_a = gf2_times(even, crc_a);
+        len_b >>= 1;
+        if (!len_b) break;
+
+        gf2_square(odd, even);
+        if (len_b & 1) crc_a = gf2_times(odd, crc_a);
+        len_b >>= 1;
+    } while (len_b);
+
+    return crc_a ^ crc_b;
+}
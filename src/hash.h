@@ -0,0 +1,27 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <glib.h>
+
+/* XXH64, streaming. Not cryptographic; for telling file contents apart quickly. */
+
+typedef struct {
+    guint64 total;
+    guint64 seed;
+    guint64 v[4];
+    guchar buf[32];
+    guint buf_len;
+} HashState;
+
+void hash_init(HashState *h, guint64 seed);
+void hash_update(HashState *h, const void *data, gsize len);
+guint64 hash_digest(const HashState *h);
+
+guint64 hash_buffer(const void *data, gsize len, guint64 seed);
+
+/* CRC-32 as zip and gzip use it; start from 0 */
+guint32 hash_crc32(guint32 crc, const void *data, gsize len);
+/* the CRC of A then B, from crc(A), crc(B) and B's length */
+guint32 hash_crc32_combine(guint32 crc_a, guint32 crc_b, guint64 len_b);
+
+#endif
@@ -0,0 +1,119 @@
+#include "iconcache.h"
+#include "trace.h"
+#include <gtk/gtk.h>
+
+#define ICONCACHE_MAX_SCALE 3
+
+static const int sizes[ICONCACHE_LEVELS] = { 24, 48, 96, 192 };
+
+/* one per source image; [level][scale - 1], the base slot is not a reference */
+typedef struct {
+    GdkPixbuf *pix[ICONCACHE_LEVELS][ICONCACHE_MAX_SCALE];
+    cairo_surface_t *surf[ICONCACHE_LEVELS][ICONCACHE_MAX_SCALE];
+} Mips;
+
+static GQuark mips_quark(void)
+{
+    static GQuark q = 0;
+    if (!q) q = g_quark_from_static_string("iconcache-mips");
+    return q;
+}
+
+static void mips_free(gpointer data)
+{
+    Mips *m = data;
+    for (int l = 0; l < ICONCACHE_LEVELS; l++) {
+        for (int s = 0; s < ICONCACHE_MAX_SCALE; s++) {
+            if (m->surf[l][s]) cairo_surface_destroy(m->surf[l][s]);
+            if (m->pix[l][s] && !(l == ICONCACHE_BASE && s == 0)) g_object_unref(m->pix[l][s]);
+        }
+    }
+    g_free(m);
+}
+
+int iconcache_size(int level)
+{
+    return sizes[CLAMP(level, 0, ICONCACHE_LEVELS - 1)];
+}
+
+/* a window may later move to a denser monitor; decode for the densest one */
+static int screen_scale(void)
+{
+    int scale = 1;
+    GdkDisplay *d = gdk_display_get_default();
+    for (int i = 0; d && i < gdk_display_get_n_monitors(d); i++)
+        scale = MAX(scale, gdk_monitor_get_scale_factor(gdk_display_get_monitor(d, i)));
+    return MIN(scale, ICONCACHE_MAX_SCALE);
+}
+
+static GdkPixbuf* decode(const char *file, int px)
+{
+    GdkPixbuf *raw = gdk_pixbuf_new_from_file_at_size(file, px, px, NULL);
+    if (raw) return raw;
+
+    GdkPixbuf *block = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, px, px);
+    gdk_pixbuf_fill(block, 0x777777ff);
+    return block;
+}
+
+/* the longer side to px, aspect kept */
+static GdkPixbuf* shrink(GdkPixbuf *from, int px)
+{
+    int w = gdk_pixbuf_get_width(from), h = gdk_pixbuf_get_height(from);
+    int side = MAX(w, h);
+    if (side == px) return g_object_ref(from);
+    return gdk_pixbuf_scale_simple(from, MAX(1, w * px / side), MAX(1, h * px / side),
+                                   GDK_INTERP_BILINEAR);
+}
+
+GdkPixbuf* iconcache_new(const char *file)
+{
+    TRACE_SCOPE("iconcache_new");
+
+    Mips *m = g_new0(Mips, 1);
+    int scale = screen_scale();
+    GdkPixbuf *top = decode(file, sizes[ICONCACHE_LEVELS - 1] * scale);
+    m->pix[ICONCACHE_LEVELS - 1][scale - 1] = top;
+
+    GdkPixbuf *base = shrink(top, sizes[ICONCACHE_BASE]);
+    m->pix[ICONCACHE_BASE][0] = base;
+    g_object_set_qdata_full(G_OBJECT(base), mips_quark(), m, mips_free);
+    return base;
+}
+
+static GdkPixbuf* level_pixbuf(Mips *m, int level, int scale)
+{
+    GdkPixbuf **slot = &m->pix[level][scale - 1];
+    if (*slot) return *slot;
+
+    /* the smallest level at least as big; past the top, the biggest there is */
+    int want = sizes[level] * scale;
+    GdkPixbuf *from = NULL;
+    int from_px = 0;
+    for (int l = 0; l < ICONCACHE_LEVELS; l++) {
+        for (int s = 0; s < ICONCACHE_MAX_SCALE; s++) {
+            int px = sizes[l] * (s + 1);
+            if (!m->pix[l][s]) continue;
+            if (!from || (px >= want ? from_px < want || px < from_px : px > from_px)) {
+                from = m->pix[l][s];
+                from_px = px;
+            }
+        }
+    }
+
+    *slot = shrink(from, want);
+    return *slot;
+}
+
+cairo_surface_t* iconcache_surface(GdkPixbuf *base, int level, int scale)
+{
+    Mips *m = g_object_get_qdata(G_OBJECT(base), mips_quark());
+    if (!m) return NULL;
+
+    level = CLAMP(level, 0, ICONCACHE_LEVELS - 1);
+    scale = CLAMP(scale, 1, ICONCACHE_MAX_SCALE);
+
+    cairo_surface_t **s = &m->surf[level][scale - 1];
+    if (!*s) *s = gdk_cairo_surface_create_from_pixbuf(level_pixbuf(m, level, scale), scale, NULL);
+    return *s;
+}
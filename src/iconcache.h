@@ -0,0 +1,30 @@
+#ifndef ICONCACHE_H
+#define ICONCACHE_H
+
+#include <gtk/gtk.h>
+
+/*
+ * Icons and thumbnails at every zoom level. A source image is decoded
+ * once, at the top level for the largest monitor scale factor; the other
+ * levels are downsampled from the nearest larger one on first use and
+ * kept, so zooming never reads or decodes the file again. The chain hangs
+ * on a base pixbuf (ICONCACHE_BASE at scale 1) that stands for the image
+ * in list stores. Main thread only.
+ */
+
+#define ICONCACHE_LEVELS 4          /* 24, 48, 96 and 192 px */
+#define ICONCACHE_BASE 1
+
+/* logical size of a level in px */
+int iconcache_size(int level);
+
+/* a new base pixbuf for file; an unreadable file gives a grey block */
+GdkPixbuf* iconcache_new(const char *file);
+
+/*
+ * base at level for a widget with the given scale factor, owned by base.
+ * NULL when base did not come from iconcache_new().
+ */
+cairo_surface_t* iconcache_surface(GdkPixbuf *base, int level, int scale);
+
+#endif
@@ -0,0 +1,160 @@
+#include "jump.h"
+#include "frecency.h"
+#include <gtk/gtk.h>
+#include <string.h>
+
+#define JUMP_ROWS 50
+
+enum { COL_SHOWN, COL_PATH };
+
+typedef struct {
+    GtkWidget *window;
+    GtkWidget *view;
+    GtkListStore *store;
+    JumpOpenFunc open;
+    gpointer open_data;
+} Jump;
+
+/* ~/src reads better than /home/someone/src */
+static char* shown_name(const char *path)
+{
+    const char *home = g_get_home_dir();
+    size_t n = strlen(home);
+    if (n > 1 && !strncmp(path, home, n) && (path[n] == '/' || !path[n]))
+        return g_strconcat("~", path + n, NULL);
+    return g_strdup(path);
+}
+
+static void select_row(Jump *j, int row)
+{
+    GtkTreePath *p = gtk_tree_path_new_from_indices(row, -1);
+    gtk_tree_view_set_cursor(GTK_TREE_VIEW(j->view), p, NULL, FALSE);
+    gtk_tree_path_free(p);
+}
+
+static void on_changed(GtkEditable *e, gpointer data)
+{
+    Jump *j = data;
+    GPtrArray *found = g_ptr_array_new_with_free_func(g_free);
+    frecency_query(gtk_entry_get_text(GTK_ENTRY(e)), JUMP_ROWS, found);
+
+    gtk_list_store_clear(j->store);
+    for (guint i = 0; i < found->len; i++) {
+        char *shown = shown_name(found->pdata[i]);
+        gtk_list_store_insert_with_values(j->store, NULL, -1,
+                                          COL_SHOWN, shown, COL_PATH, found->pdata[i], -1);
+        g_free(shown);
+    }
+    if (found->len) select_row(j, 0);
+
+    g_ptr_array_free(found, TRUE);
+}
+
+static void open_row(Jump *j, GtkTreeIter *it)
+{
+    char *path = NULL;
+    gtk_tree_model_get(GTK_TREE_MODEL(j->store), it, COL_PATH, &path, -1);
+
+    /* the window goes first; open may raise another one */
+    JumpOpenFunc open = j->open;
+    gpointer data = j->open_data;
+    gtk_widget_destroy(j->window);
+    if (path && open) open(path, data);
+    g_free(path);
+}
+
+static void on_activate(GtkEntry *e, gpointer data)
+{
+    Jump *j = data;
+    GtkTreeIter it;
+    GtkTreeSelection *sel = gtk_tree_view_get_selection(GTK_TREE_VIEW(j->view));
+    if (gtk_tree_selection_get_selected(sel, NULL, &it)) open_row(j, &it);
+}
+
+static void on_row_activated(GtkTreeView *v, GtkTreePath *p, GtkTreeViewColumn *c, gpointer data)
+{
+    Jump *j = data;
+    GtkTreeIter it;
+    if (gtk_tree_model_get_iter(GTK_TREE_MODEL(j->store), &it, p)) open_row(j, &it);
+}
+
+/* the entry keeps focus; arrows move through the list from there */
+static gboolean on_key(GtkWidget *w, GdkEventKey *ev, gpointer data)
+{
+    Jump *j = data;
+    int rows = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(j->store), NULL);
+    int row = -1;
+
+    GtkTreePath *p = NULL;
+    gtk_tree_view_get_cursor(GTK_TREE_VIEW(j->view), &p, NULL);
+    if (p) {
+        row = gtk_tree_path_get_indices(p)[0];
+        gtk_tree_path_free(p);
+    }
+
+    switch (ev->keyval) {
+    case GDK_KEY_Escape:
+        gtk_widget_destroy(j->window);
+        return TRUE;
+    case GDK_KEY_Down:
+        if (row + 1 < rows) select_row(j, row + 1);
+        return TRUE;
+    case GDK_KEY_Up:
+        if (row > 0) select_row(j, row - 1);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static void on_destroy(GtkWidget *w, gpointer data)
+{
+    Jump *j = data;
+    g_object_unref(j->store);
+    g_free(j);
+}
+
+void jump_window_open(GtkWindow *parent, JumpOpenFunc open, gpointer data)
+{
+    Jump *j = g_malloc0(sizeof(Jump));
+    j->open = open;
+    j->open_data = data;
+
+    j->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_title(GTK_WINDOW(j->window), "Jump to");
+    gtk_window_set_transient_for(GTK_WINDOW(j->window), parent);
+    gtk_window_set_destroy_with_parent(GTK_WINDOW(j->window), TRUE);
+    gtk_window_set_modal(GTK_WINDOW(j->window), TRUE);
+    gtk_window_set_position(GTK_WINDOW(j->window), GTK_WIN_POS_CENTER_ON_PARENT);
+    gtk_window_set_default_size(GTK_WINDOW(j->window), 640, 420);
+
+    GtkWidget *entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(entry), "Folder…");
+
+    j->store = gtk_list_store_new(2, G_TYPE_STRING, G_TYPE_STRING);
+    j->view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(j->store));
+    gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(j->view), FALSE);
+    gtk_widget_set_can_focus(j->view, FALSE);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(j->view), -1, NULL,
+        gtk_cell_renderer_text_new(), "text", COL_SHOWN, NULL);
+
+    GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+    gtk_container_add(GTK_CONTAINER(scroll), j->view);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+    gtk_container_set_border_width(GTK_CONTAINER(box), 6);
+    gtk_box_pack_start(GTK_BOX(box), entry, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(box), scroll, TRUE, TRUE, 0);
+    gtk_container_add(GTK_CONTAINER(j->window), box);
+
+    g_signal_connect(entry, "changed", G_CALLBACK(on_changed), j);
+    g_signal_connect(entry, "activate", G_CALLBACK(on_activate), j);
+    g_signal_connect(entry, "key-press-event", G_CALLBACK(on_key), j);
+    g_signal_connect(j->view, "row-activated", G_CALLBACK(on_row_activated), j);
+    g_signal_connect(j->window, "destroy", G_CALLBACK(on_destroy), j);
+
+    /* most visited first, before anything is typed */
+    on_changed(GTK_EDITABLE(entry), j);
+    gtk_widget_show_all(j->window);
+    gtk_widget_grab_focus(entry);
+}
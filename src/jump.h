@@ -0,0 +1,16 @@
+#ifndef JUMP_H
+#define JUMP_H
+
+#include <gtk/gtk.h>
+
+/*
+ * "Jump to": a small window with an entry that ranks visited folders
+ * from the frecency store as you type. Up and Down pick a row, Enter or
+ * a click opens it, Escape closes the window.
+ */
+
+typedef void (*JumpOpenFunc)(const char *dir, gpointer data);
+
+void jump_window_open(GtkWindow *parent, JumpOpenFunc open, gpointer data);
+
+#endif
@@ -0,0 +1,122 @@
+#include "launch.h"
+#include "trace.h"
+#include <gtk/gtk.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LAUNCH_SNIFF 4096
+
+static GHashTable *apps_by_type = NULL;    /* content type -> GPtrArray of GAppInfo */
+static GAppInfoMonitor *monitor = NULL;
+
+static void on_apps_changed(GAppInfoMonitor *m, gpointer data)
+{
+    g_hash_table_remove_all(apps_by_type);
+}
+
+/* the name decides for nearly everything; the bytes only when it cannot */
+static char* content_type(const char *path)
+{
+    gboolean uncertain = FALSE;
+    char *type = g_content_type_guess(path, NULL, 0, &uncertain);
+    if (!uncertain) return type;
+
+    /* opening a FIFO or device would block or have side effects; only regular files are read */
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return type;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOCTTY);
+    if (fd < 0) return type;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return type;
+    }
+
+    guchar head[LAUNCH_SNIFF];
+    ssize_t n = read(fd, head, sizeof(head));
+    close(fd);
+    if (n <= 0) return type;
+
+    g_free(type);
+    return g_content_type_guess(path, head, n, NULL);
+}
+
+static gboolean listed(GPtrArray *apps, GAppInfo *app)
+{
+    for (guint i = 0; i < apps->len; i++)
+        if (g_app_info_equal(apps->pdata[i], app)) return TRUE;
+    return FALSE;
+}
+
+static void add_all(GPtrArray *apps, GList *list)
+{
+    for (GList *l = list; l; l = l->next) {
+        if (!listed(apps, l->data)) g_ptr_array_add(apps, g_object_ref(l->data));
+    }
+    g_list_free_full(list, g_object_unref);
+}
+
+static GPtrArray* apps_for_type(const char *type)
+{
+    if (!apps_by_type) {
+        apps_by_type = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify) g_ptr_array_unref);
+        monitor = g_app_info_monitor_get();
+        g_signal_connect(monitor, "changed", G_CALLBACK(on_apps_changed), NULL);
+    }
+
+    GPtrArray *apps = g_hash_table_lookup(apps_by_type, type);
+    if (apps) return apps;
+
+    TRACE_SCOPE("launch apps_for_type");
+    apps = g_ptr_array_new_with_free_func(g_object_unref);
+
+    GAppInfo *def = g_app_info_get_default_for_type(type, FALSE);
+    if (def) g_ptr_array_add(apps, def);
+    add_all(apps, g_app_info_get_recommended_for_type(type));
+    add_all(apps, g_app_info_get_fallback_for_type(type));
+
+    g_hash_table_insert(apps_by_type, g_strdup(type), apps);
+    return apps;
+}
+
+GPtrArray* launch_apps_for(const char *path)
+{
+    char *type = content_type(path);
+    GPtrArray *apps = g_ptr_array_ref(apps_for_type(type));
+    g_free(type);
+    return apps;
+}
+
+gboolean launch_with(GAppInfo *app, const char *path, GError **error)
+{
+    GList files = { g_file_new_for_path(path), NULL, NULL };
+    GdkAppLaunchContext *ctx = gdk_display_get_app_launch_context(gdk_display_get_default());
+
+    gboolean ok = g_app_info_launch(app, &files, G_APP_LAUNCH_CONTEXT(ctx), error);
+
+    g_object_unref(ctx);
+    g_object_unref(files.data);
+    return ok;
+}
+
+gboolean launch_default(const char *path, GError **error)
+{
+    char *type = content_type(path);
+    GPtrArray *apps = apps_for_type(type);
+
+    gboolean ok;
+    if (apps->len) {
+        ok = launch_with(apps->pdata[0], path, error);
+    } else {
+        char *what = g_content_type_get_description(type);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "No application is set to open %s files", what);
+        g_free(what);
+        ok = FALSE;
+    }
+
+    g_free(type);
+    return ok;
+}
@@ -0,0 +1,22 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <gio/gio.h>
+
+/*
+ * Opening files in other applications without a shell. The content type
+ * comes from the name, or from the first bytes when the name is not
+ * enough; the applications for a type are looked up in the desktop-file
+ * and mimeapps.list databases once and cached until GIO reports a
+ * change. Launching is a single spawn of the handler. Main thread only.
+ */
+
+/* opens path in the default application for its type */
+gboolean launch_default(const char *path, GError **error);
+
+/* applications for path's type, the default first; a new reference */
+GPtrArray* launch_apps_for(const char *path);
+
+gboolean launch_with(GAppInfo *app, const char *path, GError **error);
+
+#endif
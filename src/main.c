@@ -1,12 +1,52 @@
 #include <gtk/gtk.h>
 #include "explorer.h"
+#include "frecency.h"
+#include "trace.h"
+#include "watchdog.h"
+
+/*
+ * One process per session: a second launch is handed to the running
+ * instance over D-Bus and opens a window there, reusing its icon,
+ * listing, thumbnail and theme caches.
+ */
+
+static void on_startup(GApplication *app, gpointer data)
+{
+    trace_init();
+    watchdog_start();
+}
+
+static void on_shutdown(GApplication *app, gpointer data)
+{
+    watchdog_stop();
+    frecency_close();
+    trace_finish();
+}
+
+static void on_activate(GApplication *app, gpointer data)
+{
+    gtk_widget_show_all(explorer_window_new(GTK_APPLICATION(app), NULL));
+}
+
+/* `wo-files DIR...` opens one window per folder */
+static void on_open(GApplication *app, GFile **files, gint n, const gchar *hint, gpointer data)
+{
+    for (gint i = 0; i < n; i++) {
+        char *path = g_file_get_path(files[i]);
+        gtk_widget_show_all(explorer_window_new(GTK_APPLICATION(app), path));
+        g_free(path);
+    }
+}
 
 int main(int argc, char **argv) {
-    gtk_init(&argc, &argv);
+    GtkApplication *app = gtk_application_new("org.wo.Files", G_APPLICATION_HANDLES_OPEN);
 
-    GtkWidget *win = explorer_create_window();
-    gtk_widget_show_all(win);
+    g_signal_connect(app, "startup", G_CALLBACK(on_startup), NULL);
+    g_signal_connect(app, "shutdown", G_CALLBACK(on_shutdown), NULL);
+    g_signal_connect(app, "activate", G_CALLBACK(on_activate), NULL);
+    g_signal_connect(app, "open", G_CALLBACK(on_open), NULL);
 
-    gtk_main();
-    return 0;
+    int rc = g_application_run(G_APPLICATION(app), argc, argv);
+    g_object_unref(app);
+    return rc;
 }
@@ -0,0 +1,442 @@
+#include "mime.h"
+#include "utils.h"
+#include "trace.h"
+#include <gtk/gtk.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNIFF_HEAD 512
+#define SNIFF_ISO_OFFSET 0x8001
+#define SNIFF_POST_EVERY 64
+#define SNIFF_CACHE_MAX 50000
+
+/* ---------- name table ---------- */
+
+typedef struct {
+    const char *match;
+    const char *icon;
+} NameRule;
+
+/* whole file names, case-sensitive */
+static const NameRule known_names[] = {
+    { "Makefile", "sh" }, { "makefile", "sh" }, { "GNUmakefile", "sh" },
+    { "Dockerfile", "sh" }, { "Containerfile", "sh" }, { "configure", "sh" },
+    { "CMakeLists.txt", "sh" }, { "meson.build", "sh" }, { "PKGBUILD", "sh" },
+    { ".bashrc", "sh" }, { ".bash_profile", "sh" }, { ".profile", "sh" },
+    { ".zshrc", "sh" }, { ".xinitrc", "sh" },
+    { "README", "txt" }, { "LICENSE", "txt" }, { "COPYING", "txt" },
+    { "AUTHORS", "txt" }, { "CHANGELOG", "txt" }, { "NEWS", "txt" },
+    { "TODO", "txt" }, { "INSTALL", "txt" }, { ".gitignore", "txt" },
+    { "Gemfile", "rb" }, { "Rakefile", "rb" },
+};
+
+/* suffixes with more than one dot, checked before the last extension */
+static const NameRule multi_suffixes[] = {
+    { ".tar.gz", "zip" }, { ".tar.bz2", "zip" }, { ".tar.xz", "zip" },
+    { ".tar.zst", "zip" }, { ".tar.lz", "zip" }, { ".user.js", "ts" },
+    { ".d.ts", "ts" }, { ".blade.php", "php" },
+};
+
+/* rotated logs: app.log.1, syslog.2.gz is caught by .gz first */
+static const char *log_infix = ".log.";
+
+/* lower-cased extension -> icon; identity entries cover every asset */
+static const NameRule extensions[] = {
+    { "apk", "apk" }, { "c", "c" }, { "cs", "cs" }, { "css", "css" },
+    { "csv", "csv" }, { "db", "db" }, { "doc", "doc" }, { "dwg", "dwg" },
+    { "gif", "gif" }, { "html", "html" }, { "iso", "iso" }, { "java", "java" },
+    { "jpg", "jpg" }, { "log", "log" }, { "mp3", "mp3" }, { "mp4", "mp4" },
+    { "nmea", "nmea" }, { "pas", "pas" }, { "pdf", "pdf" }, { "php", "php" },
+    { "png", "png" }, { "ppt", "ppt" }, { "py", "py" }, { "r", "r" },
+    { "rb", "rb" }, { "rtf", "rtf" }, { "sh", "sh" }, { "sql", "sql" },
+    { "ts", "ts" }, { "txt", "txt" }, { "xls", "xls" }, { "zip", "zip" },
+
+    { "jpeg", "jpg" }, { "jpe", "jpg" }, { "jfif", "jpg" },
+    { "htm", "html" }, { "xhtml", "html" },
+    { "h", "c" }, { "cc", "c" }, { "cpp", "c" }, { "cxx", "c" },
+    { "hh", "c" }, { "hpp", "c" }, { "hxx", "c" },
+    { "docx", "doc" }, { "odt", "doc" }, { "xlsx", "xls" }, { "ods", "xls" },
+    { "pptx", "ppt" }, { "odp", "ppt" },
+    { "tgz", "zip" }, { "gz", "zip" }, { "bz2", "zip" }, { "xz", "zip" },
+    { "zst", "zip" }, { "7z", "zip" }, { "rar", "zip" }, { "tar", "zip" },
+    { "jar", "java" }, { "class", "java" }, { "img", "iso" },
+    { "mkv", "mp4" }, { "webm", "mp4" }, { "mov", "mp4" }, { "avi", "mp4" },
+    { "m4v", "mp4" }, { "wav", "mp3" }, { "flac", "mp3" }, { "ogg", "mp3" },
+    { "opus", "mp3" }, { "m4a", "mp3" }, { "aac", "mp3" },
+    { "bash", "sh" }, { "zsh", "sh" }, { "fish", "sh" },
+    { "sqlite", "db" }, { "sqlite3", "db" },
+    { "md", "txt" }, { "rst", "txt" }, { "ini", "txt" }, { "conf", "txt" },
+    { "cfg", "txt" }, { "yaml", "txt" }, { "yml", "txt" }, { "toml", "txt" },
+    { "json", "txt" },
+    { "tsx", "ts" }, { "pyw", "py" }, { "dxf", "dwg" }, { "phtml", "php" },
+};
+
+static GHashTable *name_table = NULL;   /* known name -> icon */
+static GHashTable *ext_table = NULL;    /* lower-case extension -> icon */
+
+static void build_tables(void)
+{
+    name_table = g_hash_table_new(g_str_hash, g_str_equal);
+    ext_table = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (guint i = 0; i < G_N_ELEMENTS(known_names); i++)
+        g_hash_table_insert(name_table, (char*) known_names[i].match, (char*) known_names[i].icon);
+    for (guint i = 0; i < G_N_ELEMENTS(extensions); i++)
+        g_hash_table_insert(ext_table, (char*) extensions[i].match, (char*) extensions[i].icon);
+}
+
+static gboolean has_suffix_nocase(const char *name, size_t len, const char *suffix)
+{
+    size_t sl = strlen(suffix);
+    return len > sl && !g_ascii_strcasecmp(name + len - sl, suffix);
+}
+
+const char* mime_icon_for_name(const char *name)
+{
+    if (!name_table) build_tables();
+
+    const char *icon = g_hash_table_lookup(name_table, name);
+    if (icon) return icon;
+
+    size_t len = strlen(name);
+    for (guint i = 0; i < G_N_ELEMENTS(multi_suffixes); i++)
+        if (has_suffix_nocase(name, len, multi_suffixes[i].match))
+            return multi_suffixes[i].icon;
+
+    const char *ext = strrchr(name, '.');
+    if (!ext || ext == name || ext[1] == 0) {
+        /* leading-dot names and names without one are left to the sniffer */
+        return NULL;
+    }
+    ext++;
+
+    char lower[16];
+    size_t el = strlen(ext);
+    if (el < sizeof(lower)) {
+        for (size_t i = 0; i <= el; i++)
+            lower[i] = g_ascii_tolower(ext[i]);
+        icon = g_hash_table_lookup(ext_table, lower);
+        if (icon) return icon;
+
+        if (g_ascii_isdigit(lower[0]) && strstr(name, log_infix))
+            return "log";
+    }
+
+    return NULL;
+}
+
+/* ---------- sniffing ---------- */
+
+typedef struct {
+    guint64 dev;
+    guint64 ino;
+    gint64 mtime;
+    guint64 size;
+} SniffKey;
+
+typedef struct {
+    SniffKey key;
+    guint index;
+    char *path;
+    const char *icon;
+} SniffItem;
+
+typedef struct {
+    GtkListStore *store;
+    guint gen;
+    GArray *items;   /* SniffItem */
+} SniffBatch;
+
+static GThreadPool *pool = NULL;
+
+static GMutex cache_lock;
+static GHashTable *cache = NULL;   /* SniffKey -> icon, "" when nothing matched */
+
+static GtkListStore *pending_store = NULL;
+static GArray *pending = NULL;
+
+static guint key_hash(gconstpointer p)
+{
+    const SniffKey *k = p;
+    guint64 h = k->ino * 0x9e3779b97f4a7c15ULL ^ k->dev ^ (guint64) k->mtime * 31 ^ k->size;
+    return (guint) (h ^ (h >> 32));
+}
+
+static gboolean key_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, sizeof(SniffKey));
+}
+
+static const char* cache_lookup(const SniffKey *k)
+{
+    g_mutex_lock(&cache_lock);
+    const char *icon = cache ? g_hash_table_lookup(cache, k) : NULL;
+    g_mutex_unlock(&cache_lock);
+    return icon;
+}
+
+static void cache_store(const SniffKey *k, const char *icon)
+{
+    g_mutex_lock(&cache_lock);
+    if (!cache)
+        cache = g_hash_table_new_full(key_hash, key_equal, g_free, NULL);
+    if (g_hash_table_size(cache) >= SNIFF_CACHE_MAX)
+        g_hash_table_remove_all(cache);
+    SniffKey *copy = g_new(SniffKey, 1);
+    *copy = *k;
+    g_hash_table_insert(cache, copy, (char*) (icon ? icon : ""));
+    g_mutex_unlock(&cache_lock);
+}
+
+static const char* shebang_icon(const guchar *b, gssize n)
+{
+    char line[128];
+    gssize i = 2, o = 0;
+
+    while (i < n && b[i] != '\n' && o < (gssize) sizeof(line) - 1)
+        line[o++] = b[i++];
+    line[o] = 0;
+
+    /* "#!/usr/bin/env python3" names the interpreter as the first argument */
+    char *interp = g_strstrip(line);
+    char *args = strchr(interp, ' ');
+    if (args) *args++ = 0;
+
+    char *base = strrchr(interp, '/');
+    base = base ? base + 1 : interp;
+    if (!strcmp(base, "env") && args) {
+        base = g_strstrip(args);
+        char *sp = strchr(base, ' ');
+        if (sp) *sp = 0;
+    }
+
+    if (g_str_has_prefix(base, "python")) return "py";
+    if (g_str_has_prefix(base, "ruby")) return "rb";
+    if (g_str_has_prefix(base, "php")) return "php";
+    if (g_str_has_prefix(base, "Rscript")) return "r";
+    return "sh";
+}
+
+static gboolean looks_like_text(const guchar *b, gssize n)
+{
+    if (n == 0) return FALSE;
+    if (memchr(b, 0, n)) return FALSE;
+
+    /* a cut-off multibyte sequence at the end of the window is fine */
+    const char *end;
+    if (!g_utf8_validate((const char*) b, n, &end) && (const guchar*) end < b + n - 4)
+        return FALSE;
+
+    gssize ctrl = 0;
+    for (gssize i = 0; i < n; i++)
+        if (b[i] < 0x20 && b[i] != '\n' && b[i] != '\r' && b[i] != '\t' && b[i] != '\f')
+            ctrl++;
+    return ctrl * 20 < n;
+}
+
+static const char* sniff_bytes(const guchar *b, gssize n, const guchar *iso, gssize iso_n)
+{
+#define HAS(off, lit) (n >= (off) + (gssize) sizeof(lit) - 1 && !memcmp(b + (off), lit, sizeof(lit) - 1))
+    if (HAS(0, "\x89PNG\r\n\x1a\n")) return "png";
+    if (HAS(0, "\xff\xd8\xff")) return "jpg";
+    if (HAS(0, "GIF87a") || HAS(0, "GIF89a")) return "gif";
+    if (HAS(0, "%PDF-")) return "pdf";
+    if (HAS(0, "PK\x03\x04") || HAS(0, "PK\x05\x06")) return "zip";
+    if (HAS(0, "\x1f\x8b") || HAS(0, "BZh") || HAS(0, "\xfd" "7zXZ\0") ||
+        HAS(0, "7z\xbc\xaf\x27\x1c") || HAS(0, "Rar!\x1a\x07") || HAS(0, "\x28\xb5\x2f\xfd"))
+        return "zip";
+    if (HAS(257, "ustar")) return "zip";
+    if (HAS(0, "SQLite format 3")) return "db";
+    if (HAS(0, "ID3") || HAS(0, "\xff\xfb") || HAS(0, "\xff\xf3") || HAS(0, "fLaC") ||
+        HAS(0, "OggS"))
+        return "mp3";
+    if (HAS(4, "ftyp") || HAS(0, "\x1a\x45\xdf\xa3")) return "mp4";
+    if (HAS(0, "{\\rtf")) return "rtf";
+    if (HAS(0, "\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1")) return "doc";
+    if (HAS(0, "AC10")) return "dwg";
+    if (HAS(0, "#!")) return shebang_icon(b, n);
+    if (HAS(0, "<?php")) return "php";
+    if (iso_n >= 5 && !memcmp(iso, "CD001", 5)) return "iso";
+#undef HAS
+
+    if (!looks_like_text(b, n)) return NULL;
+
+    gssize skip = 0;
+    while (skip < n && g_ascii_isspace(b[skip])) skip++;
+    if (n - skip >= 5 && (!g_ascii_strncasecmp((const char*) b + skip, "<!doctype html", MIN(14, n - skip)) ||
+                          !g_ascii_strncasecmp((const char*) b + skip, "<html", 5)))
+        return "html";
+    if (n - skip >= 3 && b[skip] == '$' && b[skip + 1] == 'G')
+        return "nmea";
+    return "txt";
+}
+
+/* one small read at the head, a second one only where an ISO descriptor can be */
+static const char* sniff_file(const SniffItem *item)
+{
+    int fd = open(item->path, O_RDONLY | O_CLOEXEC | O_NONBLOCK | O_NOATIME);
+    if (fd < 0 && errno == EPERM)
+        fd = open(item->path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) return NULL;
+
+    guchar head[SNIFF_HEAD], iso[5];
+    gssize n = pread(fd, head, sizeof(head), 0);
+    gssize iso_n = 0;
+
+    if (n >= 0 && item->key.size >= SNIFF_ISO_OFFSET + sizeof(iso))
+        iso_n = pread(fd, iso, sizeof(iso), SNIFF_ISO_OFFSET);
+
+    TRACE_COUNT(TRACE_SYSCALLS, iso_n ? 4 : 3);
+    close(fd);
+
+    return n > 0 ? sniff_bytes(head, n, iso, iso_n) : NULL;
+}
+
+static guint store_gen(GtkListStore *store)
+{
+    return GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(store), "mime-gen"));
+}
+
+static void batch_free(SniffBatch *b)
+{
+    for (guint i = 0; i < b->items->len; i++)
+        g_free(g_array_index(b->items, SniffItem, i).path);
+    g_array_free(b->items, TRUE);
+    g_object_unref(b->store);
+    g_free(b);
+}
+
+static SniffBatch* batch_new(GtkListStore *store, guint gen)
+{
+    SniffBatch *b = g_malloc0(sizeof(SniffBatch));
+    b->store = g_object_ref(store);
+    b->gen = gen;
+    b->items = g_array_new(FALSE, FALSE, sizeof(SniffItem));
+    return b;
+}
+
+/* main thread: put the sniffed icons on rows that still show the same file */
+static gboolean apply_results(gpointer data)
+{
+    SniffBatch *b = data;
+    GtkTreeModel *m = GTK_TREE_MODEL(b->store);
+
+    if (b->gen == store_gen(b->store)) {
+        TRACE_SCOPE("mime apply");
+
+        for (guint i = 0; i < b->items->len; i++) {
+            SniffItem *item = &g_array_index(b->items, SniffItem, i);
+            GtkTreeIter it;
+            char *path = NULL;
+
+            if (!gtk_tree_model_iter_nth_child(m, &it, NULL, item->index)) continue;
+            gtk_tree_model_get(m, &it, 2, &path, -1);
+
+            if (path && !strcmp(path, item->path)) {
+                TRACE_ITEMS(1);
+                gtk_list_store_set(b->store, &it, 0, utils_icon_for_key(item->icon), -1);
+            }
+            g_free(path);
+        }
+    }
+
+    batch_free(b);
+    return G_SOURCE_REMOVE;
+}
+
+static void sniff_batch(gpointer data, gpointer user_data)
+{
+    SniffBatch *b = data;
+    SniffBatch *out = batch_new(b->store, b->gen);
+
+    for (guint i = 0; i < b->items->len; i++) {
+        SniffItem *item = &g_array_index(b->items, SniffItem, i);
+
+        /* the view moved on while this batch was queued */
+        if (b->gen != store_gen(b->store))
+            break;
+
+        const char *icon = cache_lookup(&item->key);
+        if (!icon) {
+            icon = sniff_file(item);
+            cache_store(&item->key, icon);
+        }
+        if (!icon || !icon[0]) continue;
+
+        SniffItem r = *item;
+        r.icon = icon;
+        item->path = NULL;
+        g_array_append_val(out->items, r);
+
+        if (out->items->len >= SNIFF_POST_EVERY) {
+            g_idle_add(apply_results, out);
+            out = batch_new(b->store, b->gen);
+        }
+    }
+
+    if (out->items->len) g_idle_add(apply_results, out);
+    else batch_free(out);
+
+    batch_free(b);
+}
+
+void mime_sniff_queue(GtkListStore *store, GtkTreeIter *it, const UtilsEntry *e)
+{
+    /* entries from the SUDO helper have no inode and are not readable as us */
+    if (e->is_dir || !S_ISREG(e->mode) || !e->ino || !e->size) return;
+
+    SniffKey key = { e->dev, e->ino, e->mtime, e->size };
+
+    const char *icon = cache_lookup(&key);
+    if (icon) {
+        if (icon[0]) gtk_list_store_set(store, it, 0, utils_icon_for_key(icon), -1);
+        return;
+    }
+
+    if (pending_store != store) {
+        if (pending_store) mime_sniff_flush(pending_store);
+        pending_store = g_object_ref(store);
+        pending = g_array_new(FALSE, FALSE, sizeof(SniffItem));
+    }
+
+    GtkTreePath *tp = gtk_tree_model_get_path(GTK_TREE_MODEL(store), it);
+    SniffItem item = { key, gtk_tree_path_get_indices(tp)[0], g_strdup(e->path), NULL };
+    gtk_tree_path_free(tp);
+
+    g_array_append_val(pending, item);
+}
+
+void mime_sniff_flush(GtkListStore *store)
+{
+    if (!pending_store || pending_store != store) return;
+
+    SniffBatch *b = g_malloc0(sizeof(SniffBatch));
+    b->store = pending_store;
+    b->gen = store_gen(store);
+    b->items = pending;
+
+    pending_store = NULL;
+    pending = NULL;
+
+    if (!pool)
+        pool = g_thread_pool_new(sniff_batch, NULL, 1, FALSE, NULL);
+
+    g_thread_pool_push(pool, b, NULL);
+}
+
+void mime_store_reset(GtkListStore *store)
+{
+    g_object_set_data(G_OBJECT(store), "mime-gen", GUINT_TO_POINTER(store_gen(store) + 1));
+
+    if (pending_store != store) return;
+
+    for (guint i = 0; i < pending->len; i++)
+        g_free(g_array_index(pending, SniffItem, i).path);
+    g_array_free(pending, TRUE);
+    g_object_unref(pending_store);
+    pending_store = NULL;
+    pending = NULL;
+}
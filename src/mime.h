@@ -0,0 +1,25 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <gtk/gtk.h>
+#include "utils.h"
+
+/*
+ * File type resolution for the icon grid. Names are classified first
+ * (well-known filenames, multi-dot suffixes, extension aliases); only
+ * files the name says nothing about are sniffed, on a worker thread, and
+ * their row icons are replaced when the answer comes back. Sniff results
+ * are cached by (dev, ino, mtime, size).
+ */
+
+/* icon key ("zip", "c", ...) for a name, NULL when the name is inconclusive */
+const char* mime_icon_for_name(const char *name);
+
+/* row `it` of `store` shows e; sniff it and upgrade its icon later */
+void mime_sniff_queue(GtkListStore *store, GtkTreeIter *it, const UtilsEntry *e);
+/* hand everything queued for `store` to the worker */
+void mime_sniff_flush(GtkListStore *store);
+/* the rows of `store` are about to be replaced; drop late results */
+void mime_store_reset(GtkListStore *store);
+
+#endif
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include "prefetch.h"
+#include "utils.h"
+#include "trace.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PREFETCH_QUEUE_MAX 32
+#define PREFETCH_MAX_BYTES (16 * 1024 * 1024)
+#define PREFETCH_MAX_ENTRIES 20000
+#define PREFETCH_TTL_US (30 * G_USEC_PER_SEC)
+#define PREFETCH_BUSY_WAIT_US (20 * 1000)
+
+/* from linux/ioprio.h, which is not always installed */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+typedef struct {
+    char *path;
+    GList *list;
+    gsize bytes;
+    struct stat st;          /* of the folder, taken before it was read */
+    gint64 made;
+} Listing;
+
+static GMutex lock;
+static GCond cond;
+static GQueue queue = G_QUEUE_INIT;     /* paths; urgent ones at the head */
+static GQueue cache = G_QUEUE_INIT;     /* Listing, newest at the head */
+static gsize cache_bytes = 0;
+static GThread *thread = NULL;
+static gint busy = 0;
+
+static void listing_free(Listing *l)
+{
+    g_list_free_full(l->list, (GDestroyNotify) utils_entry_free);
+    g_free(l->path);
+    g_free(l);
+}
+
+static gboolean same_dir(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+           a->st_ctim.tv_sec == b->st_ctim.tv_sec && a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+static GList* find_cached(const char *path)
+{
+    for (GList *l = cache.head; l; l = l->next)
+        if (!strcmp(((Listing*) l->data)->path, path)) return l;
+    return NULL;
+}
+
+static void idle_priority(void)
+{
+    /* only this thread: the UI keeps its normal I/O class */
+#ifdef SYS_ioprio_set
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+        g_warning("prefetch: ioprio_set: %s", g_strerror(errno));
+#endif
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+}
+
+static void prefetch_dir(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return;
+
+    g_mutex_lock(&lock);
+    GList *old = find_cached(path);
+    gboolean fresh = old && same_dir(&((Listing*) old->data)->st, &st);
+    g_mutex_unlock(&lock);
+    if (fresh) return;
+
+    TRACE_SCOPE("prefetch_dir");
+
+    int err;
+    GList *list = utils_scan_dir(path, &err);
+    if (err) return;
+
+    /* reading it warmed the kernel's caches; a huge listing is not worth holding too */
+    guint n = 0;
+    gsize bytes = 0;
+    for (GList *l = list; l; l = l->next, n++) {
+        UtilsEntry *e = l->data;
+        bytes += sizeof(GList) + sizeof(UtilsEntry) + strlen(e->name) + strlen(e->path) + 2;
+    }
+    if (n > PREFETCH_MAX_ENTRIES || bytes > PREFETCH_MAX_BYTES / 4) {
+        g_list_free_full(list, (GDestroyNotify) utils_entry_free);
+        return;
+    }
+    TRACE_ITEMS(n);
+
+    Listing *item = g_malloc0(sizeof(Listing));
+    item->path = g_strdup(path);
+    item->list = list;
+    item->bytes = bytes;
+    item->st = st;
+    item->made = g_get_monotonic_time();
+
+    g_mutex_lock(&lock);
+    if ((old = find_cached(path))) {
+        Listing *o = old->data;
+        cache_bytes -= o->bytes;
+        g_queue_delete_link(&cache, old);
+        listing_free(o);
+    }
+    g_queue_push_head(&cache, item);
+    cache_bytes += bytes;
+    while (cache_bytes > PREFETCH_MAX_BYTES) {
+        Listing *o = g_queue_pop_tail(&cache);
+        cache_bytes -= o->bytes;
+        listing_free(o);
+    }
+    g_mutex_unlock(&lock);
+}
+
+static gpointer prefetch_thread(gpointer data)
+{
+    idle_priority();
+
+    for (;;) {
+        g_mutex_lock(&lock);
+        while (!queue.length) g_cond_wait(&cond, &lock);
+        char *path = g_queue_pop_head(&queue);
+        g_mutex_unlock(&lock);
+
+        /* never race a listing the user is waiting for */
+        while (g_atomic_int_get(&busy)) g_usleep(PREFETCH_BUSY_WAIT_US);
+
+        prefetch_dir(path);
+        g_free(path);
+    }
+    return NULL;
+}
+
+void prefetch_hint(const char *path, gboolean urgent)
+{
+    if (sudo_mode || !path || !path[0]) return;
+
+    g_mutex_lock(&lock);
+
+    if (!thread) thread = g_thread_new("prefetch", prefetch_thread, NULL);
+
+    for (GList *l = queue.head; l; l = l->next) {
+        if (!strcmp(l->data, path)) {
+            if (!urgent) goto out;
+            g_free(l->data);
+            g_queue_delete_link(&queue, l);
+            break;
+        }
+    }
+
+    if (urgent) g_queue_push_head(&queue, g_strdup(path));
+    else g_queue_push_tail(&queue, g_strdup(path));
+
+    while (queue.length > PREFETCH_QUEUE_MAX)
+        g_free(g_queue_pop_tail(&queue));
+
+    g_cond_signal(&cond);
+out:
+    g_mutex_unlock(&lock);
+}
+
+void prefetch_forget(void)
+{
+    g_mutex_lock(&lock);
+    while (queue.length) g_free(g_queue_pop_head(&queue));
+    g_mutex_unlock(&lock);
+}
+
+gboolean prefetch_take(const char *path, GList **list)
+{
+    g_mutex_lock(&lock);
+    GList *l = find_cached(path);
+    Listing *item = l ? l->data : NULL;
+    if (item) {
+        cache_bytes -= item->bytes;
+        g_queue_delete_link(&cache, l);
+    }
+    g_mutex_unlock(&lock);
+
+    if (!item) return FALSE;
+
+    struct stat st;
+    gboolean ok = stat(path, &st) == 0 && same_dir(&item->st, &st) &&
+                  g_get_monotonic_time() - item->made < PREFETCH_TTL_US;
+
+    if (ok) {
+        *list = item->list;
+        item->list = NULL;
+    }
+    listing_free(item);
+    return ok;
+}
+
+void prefetch_pause(void)
+{
+    g_atomic_int_inc(&busy);
+}
+
+void prefetch_resume(void)
+{
+    g_atomic_int_add(&busy, -1);
+}
@@ -0,0 +1,27 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <glib.h>
+
+/*
+ * Lists folders the user is likely to open next (the hovered or selected
+ * folder, sidebar shortcuts, the parent, recent history) on one thread
+ * running at idle I/O and CPU priority. Each listing is kept until it is
+ * taken by the navigation it predicted or pushed out by a 16 MB budget;
+ * it is only handed out while the folder's mtime and ctime are unchanged,
+ * and for at most 30 s, since edits inside files do not touch the folder.
+ */
+
+/* urgent hints jump the queue; the rest wait behind them */
+void prefetch_hint(const char *path, gboolean urgent);
+/* drops queued hints, which were made for the previous view */
+void prefetch_forget(void);
+
+/* the cached listing for path, removed from the cache */
+gboolean prefetch_take(const char *path, GList **list);
+
+/* foreground listings hold the prefetcher off the disk */
+void prefetch_pause(void);
+void prefetch_resume(void);
+
+#endif
@@ -0,0 +1,638 @@
+#define _GNU_SOURCE
+#include "preview.h"
+#include "trace.h"
+#include <gtk/gtk.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PREVIEW_CHUNK (8 * 1024 * 1024)
+#define PREVIEW_MARK_BYTES (64 * 1024)
+#define PREVIEW_WINDOW (4 * PREVIEW_MARK_BYTES)
+#define PREVIEW_ROW_MAX 4096
+#define PREVIEW_PROBE 8192
+#define PREVIEW_TICK_MS 250
+#define PREVIEW_WHEEL_ROWS 3
+#define PREVIEW_FONT "Monospace 10"
+
+typedef struct {
+    GtkWidget *box;
+    GtkWidget *area;
+    GtkWidget *info;
+    GtkWidget *follow;
+    GtkAdjustment *adj;
+    PangoFontDescription *font;
+
+    char *path;
+    int fd;
+    goffset size;
+    dev_t dev;
+    ino_t ino;
+
+    /* what the main thread last read; never mapped, so a truncation only reads short */
+    char *win;
+    goffset win_off;
+    gsize win_len;
+
+    goffset top;            /* first byte of the first row on screen */
+    goffset line_off;       /* line_of() cache, -1 when empty */
+    gint64 line;
+    gboolean at_end;        /* last row on screen; Follow keeps it there */
+    int row_height;
+    gboolean syncing;
+    guint tick;
+
+    /* written by the indexer under lock, read by the main thread */
+    GMutex lock;
+    GArray *marks;          /* guint64 newlines before byte k * PREVIEW_MARK_BYTES */
+    guint64 lines;          /* newlines in [0, indexed) */
+    goffset indexed;
+
+    GThread *indexer;
+    gint stop;
+    gint indexing;
+} Preview;
+
+/* bit i set when p[i] is a newline */
+static inline guint64 newline_mask(const char *p)
+{
+    guint64 m = 0;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (p + 16 * i));
+        m |= (guint64) (guint16) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * i);
+    }
+#else
+    for (int i = 0; i < 64; i++)
+        m |= (guint64) (p[i] == '\n') << i;
+#endif
+    return m;
+}
+
+static guint64 count_newlines(const char *p, gsize n)
+{
+    guint64 count = 0;
+    gsize i = 0;
+
+    for (; i + 64 <= n; i += 64)
+        count += __builtin_popcountll(newline_mask(p + i));
+    for (; i < n; i++)
+        count += p[i] == '\n';
+    return count;
+}
+
+/* worker thread; the main thread leaves size alone until it is joined */
+static gpointer index_thread(gpointer data)
+{
+    Preview *pv = data;
+    TRACE_SCOPE("preview_index");
+
+    g_mutex_lock(&pv->lock);
+    goffset pos = pv->indexed;
+    guint64 lines = pv->lines;
+    g_mutex_unlock(&pv->lock);
+
+    char *buf = g_malloc(PREVIEW_CHUNK);
+    GArray *found = g_array_new(FALSE, FALSE, sizeof(guint64));
+
+    while (pos < pv->size && !g_atomic_int_get(&pv->stop)) {
+        ssize_t n = pread(pv->fd, buf, MIN(PREVIEW_CHUNK, pv->size - pos), pos);
+        if (n < 0 && errno == EINTR) continue;
+        /* shrank under us; check_file() starts over */
+        if (n <= 0) break;
+
+        /* a mark every PREVIEW_MARK_BYTES, so no line number is counted from further back */
+        g_array_set_size(found, 0);
+        for (ssize_t i = 0; i < n; ) {
+            goffset at = pos + i;
+            gsize piece = MIN((gsize) (n - i), PREVIEW_MARK_BYTES - at % PREVIEW_MARK_BYTES);
+            if (at % PREVIEW_MARK_BYTES == 0) g_array_append_val(found, lines);
+            lines += count_newlines(buf + i, piece);
+            i += piece;
+        }
+        TRACE_ITEMS(n);
+
+        g_mutex_lock(&pv->lock);
+        g_array_append_vals(pv->marks, found->data, found->len);
+        pv->lines = lines;
+        pv->indexed = pos + n;
+        g_mutex_unlock(&pv->lock);
+
+        pos += n;
+    }
+
+    g_array_free(found, TRUE);
+    g_free(buf);
+    g_atomic_int_set(&pv->indexing, 0);
+    return NULL;
+}
+
+static void start_indexer(Preview *pv)
+{
+    if (pv->indexer || pv->indexed >= pv->size) return;
+    g_atomic_int_set(&pv->stop, 0);
+    g_atomic_int_set(&pv->indexing, 1);
+    pv->indexer = g_thread_new("preview-index", index_thread, pv);
+}
+
+/* at most one chunk away */
+static void stop_indexer(Preview *pv)
+{
+    if (!pv->indexer) return;
+    g_atomic_int_set(&pv->stop, 1);
+    g_thread_join(pv->indexer);
+    pv->indexer = NULL;
+}
+
+/*
+ * Bytes [off, off + n) of the file, n <= PREVIEW_WINDOW, read with a window
+ * around them; *got is short past EOF or when the file shrank. Valid until
+ * the next call.
+ */
+static const char* view(Preview *pv, goffset off, gsize n, gsize *got)
+{
+    if (off < pv->win_off || off + (goffset) n > pv->win_off + (goffset) pv->win_len) {
+        goffset from = MAX(0, off - (goffset) (PREVIEW_WINDOW - n) / 2);
+        gsize len = 0;
+        while (len < PREVIEW_WINDOW) {
+            ssize_t r = pread(pv->fd, pv->win + len, PREVIEW_WINDOW - len, from + len);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            len += r;
+        }
+        pv->win_off = from;
+        pv->win_len = len;
+    }
+
+    goffset end = MIN(off + (goffset) n, pv->win_off + (goffset) pv->win_len);
+    *got = end > off ? end - off : 0;
+    return *got ? pv->win + (off - pv->win_off) : pv->win;
+}
+
+/* line number of the line starting at off, -1 while the indexer is short of it */
+static gint64 line_of(Preview *pv, goffset off)
+{
+    /* redraws without scrolling ask for the same top again */
+    if (off == pv->line_off) return pv->line;
+
+    g_mutex_lock(&pv->lock);
+    if (off > pv->indexed || !pv->marks->len) {
+        g_mutex_unlock(&pv->lock);
+        return -1;
+    }
+    guint k = MIN(off / PREVIEW_MARK_BYTES, pv->marks->len - 1);
+    guint64 line = g_array_index(pv->marks, guint64, k);
+    g_mutex_unlock(&pv->lock);
+
+    goffset start = (goffset) k * PREVIEW_MARK_BYTES;
+    gsize got;
+    const char *p = view(pv, start, off - start, &got);
+    if (got < (gsize) (off - start)) return -1;
+
+    pv->line_off = off;
+    pv->line = line + count_newlines(p, got);
+    return pv->line;
+}
+
+/* a row is a line, or a PREVIEW_ROW_MAX piece of a longer one; *s is valid until the next read */
+static goffset row_end(Preview *pv, goffset off, const char **s, gsize *len)
+{
+    gsize got;
+    const char *p = view(pv, off, MIN(pv->size - off, PREVIEW_ROW_MAX), &got);
+    if (s) *s = p;
+    if (!got) {
+        /* cut short since it was sized: nothing more to show */
+        *len = 0;
+        return pv->size;
+    }
+
+    const char *nl = memchr(p, '\n', got);
+    *len = nl ? (gsize) (nl - p) : got;
+    return off + *len + (nl ? 1 : 0);
+}
+
+static goffset row_before(Preview *pv, goffset off)
+{
+    if (off <= 0) return 0;
+    goffset lo = MAX(0, off - 1 - PREVIEW_ROW_MAX);
+    gsize got;
+    const char *p = view(pv, lo, off - 1 - lo, &got);
+    const char *nl = memrchr(p, '\n', got);
+    if (nl) return lo + (nl - p) + 1;
+    return lo == 0 ? 0 : off - PREVIEW_ROW_MAX;
+}
+
+/* start of the row that byte v is on */
+static goffset row_at(Preview *pv, goffset v)
+{
+    goffset lo = MAX(0, v - PREVIEW_ROW_MAX);
+    gsize got;
+    const char *p = view(pv, lo, v - lo, &got);
+    const char *nl = memrchr(p, '\n', got);
+    if (nl) return lo + (nl - p) + 1;
+    return lo == 0 ? 0 : v;
+}
+
+static int visible_rows(Preview *pv)
+{
+    return MAX(1, gtk_widget_get_allocated_height(pv->area) / pv->row_height);
+}
+
+/* top of the last screen, scanned back from EOF */
+static goffset last_top(Preview *pv)
+{
+    goffset off = pv->size;
+    for (int n = visible_rows(pv); n > 0 && off > 0; n--)
+        off = row_before(pv, off);
+    return off;
+}
+
+/*
+ * The scrollbar works in bytes: it needs no index, and a 10 GB file
+ * scrolls the same the moment it is opened as once it is indexed.
+ */
+static void sync_view(Preview *pv)
+{
+    goffset last = last_top(pv);
+    if (pv->top > last) pv->top = last;
+    pv->at_end = pv->top == last;
+
+    int rows = visible_rows(pv);
+    gdouble page = MAX(pv->size - last, 1);
+    pv->syncing = TRUE;
+    gtk_adjustment_configure(pv->adj, pv->top, 0, MAX(pv->size, 1), page / rows, page, page);
+    pv->syncing = FALSE;
+    gtk_widget_queue_draw(pv->area);
+}
+
+static void scroll_rows(Preview *pv, int n)
+{
+    gsize len;
+    if (!pv->path) return;
+    for (; n > 0 && pv->top < pv->size; n--) pv->top = row_end(pv, pv->top, NULL, &len);
+    for (; n < 0 && pv->top > 0; n++) pv->top = row_before(pv, pv->top);
+    sync_view(pv);
+}
+
+static void update_info(Preview *pv)
+{
+    g_mutex_lock(&pv->lock);
+    guint64 lines = pv->lines;
+    goffset indexed = pv->indexed;
+    g_mutex_unlock(&pv->lock);
+
+    char *name = g_path_get_basename(pv->path);
+    char *size = g_format_size(pv->size);
+    char *text;
+
+    if (indexed < pv->size) {
+        text = g_strdup_printf("%s  ·  %s  ·  indexing %d%%", name, size,
+                               (int) (indexed * 100 / pv->size));
+    } else {
+        /* a last line without a newline still counts */
+        gsize got;
+        const char *last = pv->size ? view(pv, pv->size - 1, 1, &got) : NULL;
+        if (last && got && *last != '\n') lines++;
+        text = g_strdup_printf("%s  ·  %s  ·  %" G_GUINT64_FORMAT " lines", name, size, lines);
+    }
+    gtk_label_set_text(GTK_LABEL(pv->info), text);
+
+    g_free(text);
+    g_free(size);
+    g_free(name);
+}
+
+static void close_file(Preview *pv)
+{
+    stop_indexer(pv);
+    if (pv->fd >= 0) close(pv->fd);
+    pv->fd = -1;
+    pv->size = 0;
+    pv->win_len = 0;
+    pv->line_off = -1;
+    if (pv->tick) g_source_remove(pv->tick);
+    pv->tick = 0;
+
+    g_free(pv->path);
+    pv->path = NULL;
+    g_array_set_size(pv->marks, 0);
+    pv->lines = 0;
+    pv->indexed = 0;
+    pv->top = 0;
+    pv->at_end = FALSE;
+}
+
+static gboolean on_tick(gpointer data);
+
+static void open_file(Preview *pv, const char *path)
+{
+    close_file(pv);
+    gtk_widget_queue_draw(pv->area);
+    if (!path) {
+        gtk_label_set_text(GTK_LABEL(pv->info), "");
+        return;
+    }
+
+    struct stat st;
+    const char *problem = NULL;
+
+    /* opening a FIFO would wait for a writer on the main thread: stat first, and never block */
+    if (stat(path, &st) != 0) problem = g_strerror(errno);
+    else if (!S_ISREG(st.st_mode)) problem = "Not a regular file";
+    else if ((pv->fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK)) < 0 || fstat(pv->fd, &st) != 0)
+        problem = g_strerror(errno);
+    else if (!S_ISREG(st.st_mode)) problem = "Not a regular file";
+    else {
+        gsize got;
+        pv->size = st.st_size;
+        const char *p = view(pv, 0, MIN(pv->size, PREVIEW_PROBE), &got);
+        if (memchr(p, '\0', got)) problem = "Binary file";
+    }
+
+    if (problem) {
+        char *name = g_path_get_basename(path);
+        char *text = g_strdup_printf("%s  ·  %s", name, problem);
+        gtk_label_set_text(GTK_LABEL(pv->info), text);
+        g_free(text);
+        g_free(name);
+        close_file(pv);
+        return;
+    }
+
+    pv->path = g_strdup(path);
+    pv->dev = st.st_dev;
+    pv->ino = st.st_ino;
+
+    start_indexer(pv);
+    pv->tick = g_timeout_add(PREVIEW_TICK_MS, on_tick, pv);
+
+    sync_view(pv);
+    update_info(pv);
+}
+
+/* a truncated or rotated file starts over; appends are shown when following */
+static void check_file(Preview *pv)
+{
+    struct stat st, now;
+    if (fstat(pv->fd, &st) != 0) return;
+
+    gboolean follow = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(pv->follow));
+    gboolean rotated = follow && stat(pv->path, &now) == 0 &&
+                       (now.st_ino != pv->ino || now.st_dev != pv->dev);
+
+    if (rotated || st.st_size < pv->size) {
+        char *path = g_strdup(pv->path);
+        gboolean at_end = pv->at_end;
+        open_file(pv, path);
+        g_free(path);
+        if (at_end) {
+            pv->top = pv->size;
+            sync_view(pv);
+        }
+        return;
+    }
+    if (!follow || st.st_size == pv->size) return;
+
+    gboolean at_end = pv->at_end;
+    goffset top = pv->top;
+    stop_indexer(pv);
+    pv->size = st.st_size;
+    pv->win_len = 0;
+    start_indexer(pv);
+    pv->top = at_end ? pv->size : top;
+    sync_view(pv);
+}
+
+static gboolean on_tick(gpointer data)
+{
+    Preview *pv = data;
+    gboolean busy = pv->indexer != NULL;
+
+    if (pv->indexer && !g_atomic_int_get(&pv->indexing)) {
+        g_thread_join(pv->indexer);
+        pv->indexer = NULL;
+    }
+
+    check_file(pv);
+    if (!pv->path) {
+        pv->tick = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    /* line numbers appear as the index passes them */
+    if (busy) {
+        update_info(pv);
+        gtk_widget_queue_draw(pv->area);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_draw(GtkWidget *w, cairo_t *cr, Preview *pv)
+{
+    TRACE_SCOPE("preview_draw");
+    GtkStyleContext *ctx = gtk_widget_get_style_context(w);
+    int width = gtk_widget_get_allocated_width(w);
+    int height = gtk_widget_get_allocated_height(w);
+
+    gtk_render_background(ctx, cr, 0, 0, width, height);
+    if (!pv->path) return FALSE;
+
+    PangoLayout *layout = gtk_widget_create_pango_layout(w, NULL);
+    pango_layout_set_font_description(layout, pv->font);
+
+    gint64 line = line_of(pv, pv->top);
+    int gutter = 0;
+    char num[32];
+
+    if (line >= 0) {
+        g_snprintf(num, sizeof(num), "%" G_GINT64_FORMAT, line + visible_rows(pv) + 1);
+        pango_layout_set_text(layout, num, -1);
+        pango_layout_get_pixel_size(layout, &gutter, NULL);
+        gutter += 16;
+    }
+
+    goffset off = pv->top;
+    gboolean starts_line = TRUE;
+    int rows = 0;
+
+    for (int y = 0; y < height && off < pv->size; y += pv->row_height, rows++) {
+        const char *s;
+        gsize len;
+        goffset next = row_end(pv, off, &s, &len);
+        gboolean ends_line = next > off + (goffset) len;
+
+        if (line >= 0 && starts_line) {
+            g_snprintf(num, sizeof(num), "%" G_GINT64_FORMAT, ++line);
+            pango_layout_set_text(layout, num, -1);
+            gtk_render_layout(ctx, cr, 4, y, layout);
+        }
+
+        if (len && s[len - 1] == '\r') len--;
+        char *valid = g_utf8_validate(s, len, NULL) ? NULL : g_utf8_make_valid(s, len);
+        pango_layout_set_text(layout, valid ? valid : s, valid ? -1 : (int) len);
+        gtk_render_layout(ctx, cr, gutter + 4, y, layout);
+        g_free(valid);
+
+        starts_line = ends_line;
+        off = next;
+    }
+    TRACE_ITEMS(rows);
+
+    g_object_unref(layout);
+    return FALSE;
+}
+
+static void on_size(GtkWidget *w, GdkRectangle *r, Preview *pv)
+{
+    if (pv->path) sync_view(pv);
+}
+
+static void on_scrollbar(GtkAdjustment *adj, Preview *pv)
+{
+    if (pv->syncing || !pv->path) return;
+
+    goffset v = gtk_adjustment_get_value(adj);
+    goffset top = v >= pv->size ? pv->size : row_at(pv, v);
+
+    /* a step smaller than the row would snap straight back */
+    if (top == pv->top && v > pv->top) {
+        gsize len;
+        top = row_end(pv, pv->top, NULL, &len);
+    }
+    pv->top = top;
+    sync_view(pv);
+}
+
+static gboolean on_scroll(GtkWidget *w, GdkEventScroll *ev, Preview *pv)
+{
+    if (ev->direction == GDK_SCROLL_UP) scroll_rows(pv, -PREVIEW_WHEEL_ROWS);
+    else if (ev->direction == GDK_SCROLL_DOWN) scroll_rows(pv, PREVIEW_WHEEL_ROWS);
+    else if (ev->direction == GDK_SCROLL_SMOOTH) scroll_rows(pv, (int) (ev->delta_y * PREVIEW_WHEEL_ROWS));
+    return TRUE;
+}
+
+static void jump_end(Preview *pv)
+{
+    pv->top = pv->size;
+    sync_view(pv);
+}
+
+static gboolean on_key(GtkWidget *w, GdkEventKey *ev, Preview *pv)
+{
+    int page = MAX(1, visible_rows(pv) - 1);
+
+    switch (ev->keyval) {
+    case GDK_KEY_Up:        scroll_rows(pv, -1); break;
+    case GDK_KEY_Down:      scroll_rows(pv, 1); break;
+    case GDK_KEY_Page_Up:   scroll_rows(pv, -page); break;
+    case GDK_KEY_Page_Down: scroll_rows(pv, page); break;
+    case GDK_KEY_Home:      pv->top = 0; sync_view(pv); break;
+    case GDK_KEY_End:       jump_end(pv); break;
+    default: return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean on_press(GtkWidget *w, GdkEventButton *ev, Preview *pv)
+{
+    gtk_widget_grab_focus(w);
+    return FALSE;
+}
+
+static void on_end(GtkButton *b, Preview *pv)
+{
+    if (pv->path) jump_end(pv);
+}
+
+static void on_follow(GtkToggleButton *b, Preview *pv)
+{
+    if (!gtk_toggle_button_get_active(b) || !pv->path) return;
+    check_file(pv);
+    jump_end(pv);
+}
+
+static void on_destroy(GtkWidget *w, Preview *pv)
+{
+    close_file(pv);
+    g_array_free(pv->marks, TRUE);
+    g_free(pv->win);
+    g_mutex_clear(&pv->lock);
+    pango_font_description_free(pv->font);
+    g_free(pv);
+}
+
+GtkWidget* preview_new(void)
+{
+    Preview *pv = g_malloc0(sizeof(Preview));
+    pv->fd = -1;
+    pv->win = g_malloc(PREVIEW_WINDOW);
+    pv->line_off = -1;
+    pv->marks = g_array_new(FALSE, FALSE, sizeof(guint64));
+    g_mutex_init(&pv->lock);
+    pv->font = pango_font_description_from_string(PREVIEW_FONT);
+
+    pv->box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    gtk_widget_set_name(pv->box, "preview");
+    g_object_set_data(G_OBJECT(pv->box), "preview", pv);
+
+    GtkWidget *head = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+    pv->info = gtk_label_new("");
+    gtk_label_set_xalign(GTK_LABEL(pv->info), 0.0);
+    gtk_label_set_ellipsize(GTK_LABEL(pv->info), PANGO_ELLIPSIZE_MIDDLE);
+    GtkWidget *end = gtk_button_new_with_label("⤓");
+    gtk_widget_set_tooltip_text(end, "Jump to the end");
+    pv->follow = gtk_toggle_button_new_with_label("Follow");
+    gtk_widget_set_tooltip_text(pv->follow, "Keep showing lines as they are appended");
+
+    gtk_box_pack_start(GTK_BOX(head), pv->info, TRUE, TRUE, 4);
+    gtk_box_pack_start(GTK_BOX(head), end, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(head), pv->follow, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(pv->box), head, FALSE, FALSE, 0);
+
+    GtkWidget *body = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    pv->area = gtk_drawing_area_new();
+    gtk_widget_set_can_focus(pv->area, TRUE);
+    gtk_widget_add_events(pv->area, GDK_SCROLL_MASK | GDK_SMOOTH_SCROLL_MASK |
+                          GDK_BUTTON_PRESS_MASK | GDK_KEY_PRESS_MASK);
+    pv->adj = gtk_adjustment_new(0, 0, 1, 1, 1, 1);
+    GtkWidget *bar = gtk_scrollbar_new(GTK_ORIENTATION_VERTICAL, pv->adj);
+
+    gtk_box_pack_start(GTK_BOX(body), pv->area, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(body), bar, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(pv->box), body, TRUE, TRUE, 0);
+    /* the caller decides when the pane itself is shown */
+    gtk_widget_show_all(head);
+    gtk_widget_show_all(body);
+
+    PangoLayout *layout = gtk_widget_create_pango_layout(pv->area, "0");
+    pango_layout_set_font_description(layout, pv->font);
+    pango_layout_get_pixel_size(layout, NULL, &pv->row_height);
+    pv->row_height = MAX(pv->row_height, 1);
+    g_object_unref(layout);
+
+    g_signal_connect(pv->area, "draw", G_CALLBACK(on_draw), pv);
+    g_signal_connect(pv->area, "size-allocate", G_CALLBACK(on_size), pv);
+    g_signal_connect(pv->area, "scroll-event", G_CALLBACK(on_scroll), pv);
+    g_signal_connect(pv->area, "key-press-event", G_CALLBACK(on_key), pv);
+    g_signal_connect(pv->area, "button-press-event", G_CALLBACK(on_press), pv);
+    g_signal_connect(pv->adj, "value-changed", G_CALLBACK(on_scrollbar), pv);
+    g_signal_connect(end, "clicked", G_CALLBACK(on_end), pv);
+    g_signal_connect(pv->follow, "toggled", G_CALLBACK(on_follow), pv);
+    g_signal_connect(pv->box, "destroy", G_CALLBACK(on_destroy), pv);
+
+    return pv->box;
+}
+
+void preview_show(GtkWidget *preview, const char *path)
+{
+    Preview *pv = g_object_get_data(G_OBJECT(preview), "preview");
+    if (!pv || (path && pv->path && !strcmp(path, pv->path))) return;
+    TRACE_SCOPE("preview_show");
+    open_file(pv, path);
+}
@@ -0,0 +1,21 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <gtk/gtk.h>
+
+/*
+ * Text preview pane for files of any size. The file is read with pread()
+ * a window at a time, never mapped, and only the rows on screen are read
+ * for drawing; a background thread counts newlines (64 bytes per step)
+ * and keeps the line count at every 64 KB, so a line number is never
+ * counted from further back than that. The end is found by scanning back
+ * from EOF, so it needs no index, and with Follow on appended bytes are
+ * read and shown like `tail -f`.
+ */
+
+GtkWidget* preview_new(void);
+
+/* show path, or nothing when path is NULL */
+void preview_show(GtkWidget *preview, const char *path);
+
+#endif
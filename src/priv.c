@@ -0,0 +1,419 @@
+#include "priv.h"
+#include "utils.h"
+#include <glib.h>
+#include <glib-unix.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* one helper per process, started on first SUDO toggle and kept alive */
+static int sock = -1;
+static GPid helper_pid = 0;
+static gboolean ready = FALSE;
+static guint hello_watch = 0;
+static GMutex lock;
+static GPrivate channel;    /* a worker's own socket, stored as fd + 1 */
+
+/* every caller waiting for the helper, oldest first */
+typedef struct {
+    PrivReadyFunc cb;
+    gpointer data;
+} Waiter;
+
+static GQueue waiters = G_QUEUE_INIT;
+
+static int read_full(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    while (n) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static int send_full(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n) {
+        ssize_t w = send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static char* helper_path(void)
+{
+    const char *env = g_getenv("WO_HELPER");
+    if (env) return g_strdup(env);
+
+    char *exe = g_file_read_link("/proc/self/exe", NULL);
+    if (!exe) return NULL;
+
+    char *dir = g_path_get_dirname(exe);
+    char *p = g_build_filename(dir, "wo-helper", NULL);
+    g_free(dir);
+    g_free(exe);
+
+    if (g_file_test(p, G_FILE_TEST_IS_EXECUTABLE)) return p;
+    g_free(p);
+    return NULL;
+}
+
+static void finish_start(gboolean ok, const char *error)
+{
+    if (!ok) priv_stop();
+
+    /* a callback may start again; it queues behind the ones being answered */
+    GQueue answer = waiters;
+    g_queue_init(&waiters);
+
+    Waiter *w;
+    while ((w = g_queue_pop_head(&answer))) {
+        w->cb(ok, error, w->data);
+        g_free(w);
+    }
+}
+
+static gboolean on_hello(gint fd, GIOCondition cond, gpointer data)
+{
+    hello_watch = 0;
+
+    PrivReply rp;
+    char hello[8];
+
+    if (read_full(fd, &rp, sizeof(rp)) || rp.len != sizeof(hello) ||
+        read_full(fd, hello, sizeof(hello))) {
+        finish_start(FALSE, "Authorization was refused or the helper failed to start.");
+        return G_SOURCE_REMOVE;
+    }
+
+    guint32 magic, uid;
+    memcpy(&magic, hello, 4);
+    memcpy(&uid, hello + 4, 4);
+
+    if (magic != PRIV_MAGIC) {
+        finish_start(FALSE, "wo-helper speaks a different protocol; rebuild both binaries.");
+        return G_SOURCE_REMOVE;
+    }
+
+    if (uid != 0)
+        g_warning("wo-helper running as uid %u, not root", uid);
+
+    ready = TRUE;
+    finish_start(TRUE, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_helper_exit(GPid pid, gint status, gpointer data)
+{
+    g_spawn_close_pid(pid);
+    if (pid != helper_pid) return;
+
+    helper_pid = 0;
+    if (ready) g_warning("wo-helper exited, SUDO mode is unavailable until restarted");
+
+    /* pkexec refused before the socket reported the hang-up */
+    if (!g_queue_is_empty(&waiters))
+        finish_start(FALSE, "Authorization was refused or the helper failed to start.");
+    else
+        priv_stop();
+}
+
+void priv_start(PrivReadyFunc cb, gpointer data)
+{
+    if (ready) {
+        cb(TRUE, NULL, data);
+        return;
+    }
+
+    Waiter *w = g_new(Waiter, 1);
+    w->cb = cb;
+    w->data = data;
+    g_queue_push_tail(&waiters, w);
+
+    /* already waiting for pkexec; this caller is answered with the first */
+    if (sock >= 0) return;
+
+    char *helper = helper_path();
+    if (!helper) {
+        finish_start(FALSE, "wo-helper was not found next to wo-files. Build it with make.");
+        return;
+    }
+
+    /* WO_HELPER_NO_PKEXEC runs the helper unprivileged as a local stand-in */
+    gboolean direct = getuid() == 0 || g_getenv("WO_HELPER_NO_PKEXEC");
+    char *pkexec = direct ? NULL : g_find_program_in_path("pkexec");
+
+    if (!direct && !pkexec) {
+        g_free(helper);
+        finish_start(FALSE, "pkexec is not installed, so wo-files cannot gain root rights.");
+        return;
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) {
+        g_free(helper);
+        g_free(pkexec);
+        finish_start(FALSE, g_strerror(errno));
+        return;
+    }
+
+    char *argv[3];
+    int n = 0;
+    if (pkexec) argv[n++] = pkexec;
+    argv[n++] = helper;
+    argv[n] = NULL;
+
+    GError *err = NULL;
+    gboolean ok = g_spawn_async_with_fds(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                                         NULL, NULL, &helper_pid, sv[1], sv[1], -1, &err);
+    close(sv[1]);
+    g_free(helper);
+    g_free(pkexec);
+
+    if (!ok) {
+        close(sv[0]);
+        char *msg = g_strdup(err ? err->message : "spawn failed");
+        if (err) g_error_free(err);
+        finish_start(FALSE, msg);
+        g_free(msg);
+        return;
+    }
+
+    sock = sv[0];
+    g_child_watch_add(helper_pid, on_helper_exit, NULL);
+
+    /* the hello arrives once pkexec has authenticated, keep the UI live meanwhile */
+    hello_watch = g_unix_fd_add(sock, G_IO_IN | G_IO_HUP | G_IO_ERR, on_hello, NULL);
+}
+
+void priv_stop(void)
+{
+    g_mutex_lock(&lock);
+
+    if (hello_watch) {
+        g_source_remove(hello_watch);
+        hello_watch = 0;
+    }
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+    ready = FALSE;
+
+    g_mutex_unlock(&lock);
+}
+
+gboolean priv_running(void)
+{
+    return ready;
+}
+
+static int send_request(int fd, guint32 op, const char *a, const char *b)
+{
+    size_t la = strlen(a) + 1;
+    size_t lb = b ? strlen(b) + 1 : 0;
+    PrivRequest rq = { op, la + lb };
+
+    if (send_full(fd, &rq, sizeof(rq)) || send_full(fd, a, la) || (b && send_full(fd, b, lb)))
+        return -1;
+    return 0;
+}
+
+/* the request and its reply, -1 when the connection broke */
+static int round_trip(int fd, guint32 op, const char *a, const char *b,
+                      PrivReply *rp, char **payload)
+{
+    *payload = NULL;
+    if (send_request(fd, op, a, b) || read_full(fd, rp, sizeof(*rp)) || rp->len > PRIV_MAX_MSG)
+        return -1;
+
+    *payload = rp->len ? g_malloc(rp->len) : NULL;
+    if (rp->len && read_full(fd, *payload, rp->len)) {
+        g_free(*payload);
+        *payload = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* one round trip; returns the helper's errno, payload in *out when asked for */
+static int transact(guint32 op, const char *a, const char *b, char **out, guint32 *out_len)
+{
+    PrivReply rp = { 0, 0 };
+    char *payload;
+    int rc;
+
+    if (out) *out = NULL;
+    if (out_len) *out_len = 0;
+
+    int own = GPOINTER_TO_INT(g_private_get(&channel)) - 1;
+    if (own >= 0) {
+        /* this thread's alone; a broken one fails its job, not SUDO mode */
+        if (round_trip(own, op, a, b, &rp, &payload)) {
+            priv_detach();
+            return EPIPE;
+        }
+    } else {
+        g_mutex_lock(&lock);
+
+        if (!ready) {
+            g_mutex_unlock(&lock);
+            return ENOTCONN;
+        }
+
+        if (round_trip(sock, op, a, b, &rp, &payload)) {
+            g_mutex_unlock(&lock);
+            g_warning("wo-helper connection lost");
+            priv_stop();
+            return EPIPE;
+        }
+
+        g_mutex_unlock(&lock);
+    }
+
+    rc = rp.status;
+    if (out) {
+        *out = payload;
+        *out_len = rp.len;
+    } else {
+        g_free(payload);
+    }
+    return rc;
+}
+
+/* the reply header, and the descriptor it carries; -1 with *rc set otherwise */
+static int recv_fd(int fd, int *rc)
+{
+    PrivReply rp = { 0, 0 };
+    struct iovec iov = { &rp, sizeof(rp) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr m = { .msg_iov = &iov, .msg_iovlen = 1,
+                        .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+
+    ssize_t r;
+    do r = recvmsg(fd, &m, MSG_CMSG_CLOEXEC); while (r < 0 && errno == EINTR);
+    if (r != sizeof(rp)) {
+        *rc = EPIPE;
+        return -1;
+    }
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&m);
+    int got = -1;
+    if (c && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+        memcpy(&got, CMSG_DATA(c), sizeof(got));
+
+    *rc = rp.status ? rp.status : got < 0 ? EPROTO : 0;
+    if (*rc && got >= 0) close(got);
+    return *rc ? -1 : got;
+}
+
+int priv_attach(void)
+{
+    if (g_private_get(&channel)) return 0;
+
+    int rc = 0, fd = -1;
+    g_mutex_lock(&lock);
+    if (!ready) {
+        rc = ENOTCONN;
+    } else if (send_request(sock, PRIV_OP_CHANNEL, "", NULL)) {
+        rc = EPIPE;
+    } else {
+        fd = recv_fd(sock, &rc);
+    }
+    g_mutex_unlock(&lock);
+
+    if (rc == EPIPE) {
+        g_warning("wo-helper connection lost");
+        priv_stop();
+    }
+    if (fd >= 0) g_private_set(&channel, GINT_TO_POINTER(fd + 1));
+    return rc;
+}
+
+void priv_detach(void)
+{
+    int fd = GPOINTER_TO_INT(g_private_get(&channel)) - 1;
+    if (fd >= 0) close(fd);
+    g_private_set(&channel, NULL);
+}
+
+GList* priv_list_dir(const char *path, int *err)
+{
+    char *buf;
+    guint32 len;
+    int rc = transact(PRIV_OP_LIST, path, NULL, &buf, &len);
+
+    if (err) *err = rc;
+    if (rc) return NULL;
+
+    GList *list = NULL;
+    guint32 off = 0;
+    char name[65536];
+
+    while (off + sizeof(PrivDirent) <= len) {
+        PrivDirent de;
+        memcpy(&de, buf + off, sizeof(de));
+        off += sizeof(de);
+        if (off + de.name_len > len) break;
+
+        memcpy(name, buf + off, de.name_len);
+        name[de.name_len] = 0;
+        off += de.name_len;
+
+        UtilsEntry *e = utils_entry_new(path, name, S_ISDIR(de.mode));
+        e->size = de.size;
+        e->mtime = de.mtime;
+        e->mode = de.mode;
+
+        list = g_list_prepend(list, e);
+    }
+
+    g_free(buf);
+    return g_list_reverse(list);
+}
+
+int priv_stat(const char *path, PrivStat *out)
+{
+    char *buf;
+    guint32 len;
+    int rc = transact(PRIV_OP_STAT, path, NULL, &buf, &len);
+
+    if (!rc && len == sizeof(PrivStat)) memcpy(out, buf, sizeof(PrivStat));
+    else if (!rc) rc = EPROTO;
+
+    g_free(buf);
+    return rc;
+}
+
+int priv_rename(const char *src, const char *dst)
+{
+    return transact(PRIV_OP_RENAME, src, dst, NULL, NULL);
+}
+
+int priv_delete(const char *path)
+{
+    return transact(PRIV_OP_DELETE, path, NULL, NULL, NULL);
+}
+
+int priv_copy(const char *src, const char *dst)
+{
+    return transact(PRIV_OP_COPY, src, dst, NULL, NULL);
+}
+
+int priv_move(const char *src, const char *dst)
+{
+    return transact(PRIV_OP_MOVE, src, dst, NULL, NULL);
+}
@@ -0,0 +1,29 @@
+#ifndef PRIV_H
+#define PRIV_H
+
+#include <glib.h>
+#include "privproto.h"
+
+typedef void (*PrivReadyFunc)(gboolean ok, const char *error, gpointer data);
+
+void priv_start(PrivReadyFunc cb, gpointer data);
+void priv_stop(void);
+gboolean priv_running(void);
+
+/*
+ * Gives the calling worker thread a helper connection of its own until
+ * priv_detach(); the calls below then go through it. Without one, every
+ * call shares the main connection and waits for the one before it, so a
+ * job copying a tree would hold up the main thread's listings.
+ */
+int priv_attach(void);
+void priv_detach(void);
+
+GList* priv_list_dir(const char *path, int *err);
+int priv_stat(const char *path, PrivStat *out);
+int priv_rename(const char *src, const char *dst);
+int priv_delete(const char *path);
+int priv_copy(const char *src, const char *dst);
+int priv_move(const char *src, const char *dst);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef PRIVPROTO_H
+#define PRIVPROTO_H
+
+#include <stdint.h>
+
+/*
+ * Wire format between wo-files and wo-helper over a socketpair.
+ * Every request is a PrivRequest header followed by len payload bytes,
+ * every reply a PrivReply header (status is 0 or an errno) followed by
+ * len payload bytes. Paths travel NUL-terminated; two-path ops send
+ * "src\0dst\0". Both ends are the same build, so native byte order.
+ * Copies and moves never replace an existing destination (EEXIST).
+ *
+ * PRIV_OP_CHANNEL forks the helper: its reply carries, as SCM_RIGHTS,
+ * a new socket served by the child with the same protocol and no hello.
+ */
+
+#define PRIV_MAGIC      0x31484f57u   /* "WOH1", sent once as the hello reply */
+#define PRIV_MAX_MSG    (64u << 20)
+
+enum {
+    PRIV_OP_LIST = 1,   /* path -> PrivDirent records */
+    PRIV_OP_STAT,       /* path -> PrivStat */
+    PRIV_OP_RENAME,     /* src, dst */
+    PRIV_OP_DELETE,     /* path, recursive */
+    PRIV_OP_COPY,       /* src, dst, recursive */
+    PRIV_OP_MOVE,       /* src, dst, copy + delete across devices */
+    PRIV_OP_CHANNEL     /* "" -> a socket of its own, for a background job */
+};
+
+typedef struct {
+    uint32_t op;
+    uint32_t len;
+} PrivRequest;
+
+typedef struct {
+    int32_t status;
+    uint32_t len;
+} PrivReply;
+
+/* one per directory entry, followed by name_len bytes of name (no NUL) */
+typedef struct {
+    uint64_t size;
+    int64_t mtime;
+    uint32_t mode;
+    uint16_t name_len;
+    uint16_t pad;
+} PrivDirent;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t mode;
+    uint32_t pad;
+} PrivStat;
+
+#endif
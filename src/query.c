@@ -0,0 +1,365 @@
+#define _GNU_SOURCE
+#include "query.h"
+#include "trace.h"
+#include <gio/gio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef enum {
+    /* in evaluation order: name-only checks, then stat, then contents */
+    TERM_TYPE,
+    TERM_DEPTH,
+    TERM_EXT,
+    TERM_NAME,
+    TERM_GLOB,
+    TERM_PATH,
+    TERM_SIZE,
+    TERM_AGE,
+    TERM_CONTENT
+} TermKind;
+
+typedef enum { OP_EQ, OP_LT, OP_LE, OP_GT, OP_GE } CmpOp;
+
+typedef struct {
+    TermKind kind;
+    gboolean negate;
+    CmpOp op;
+    gint64 num;
+    char *text;
+    char **list;
+    unsigned char type;
+    GrepPattern *grep;
+} Term;
+
+struct Query {
+    GArray *terms;          /* Term, sorted by kind */
+    int max_depth;          /* deepest entry that can still match */
+    GPtrArray *prune;       /* -path: texts, whole subtrees are skipped */
+    gint64 now;
+};
+
+static const char *keys[] = { "name:", "ext:", "path:", "type:", "content:",
+                              "size", "modified", "depth" };
+
+static const char* parse_op(const char *s, CmpOp *op)
+{
+    if (s[0] == '<' && s[1] == '=') { *op = OP_LE; return s + 2; }
+    if (s[0] == '>' && s[1] == '=') { *op = OP_GE; return s + 2; }
+    if (s[0] == '<') { *op = OP_LT; return s + 1; }
+    if (s[0] == '>') { *op = OP_GT; return s + 1; }
+    if (s[0] == '=' || s[0] == ':') { *op = OP_EQ; return s + 1; }
+    return NULL;
+}
+
+gboolean query_looks_structured(const char *text)
+{
+    char **tok = g_strsplit_set(text, " \t", -1);
+    gboolean found = FALSE;
+
+    for (int i = 0; tok[i] && !found; i++) {
+        const char *t = tok[i][0] == '-' ? tok[i] + 1 : tok[i];
+        for (guint k = 0; k < G_N_ELEMENTS(keys) && !found; k++) {
+            size_t kl = strlen(keys[k]);
+            if (strncmp(t, keys[k], kl)) continue;
+            CmpOp op;
+            found = keys[k][kl - 1] == ':' || parse_op(t + kl, &op);
+        }
+    }
+
+    g_strfreev(tok);
+    return found;
+}
+
+static gboolean parse_number(const char *s, const char *units, const gint64 *scale,
+                             gint64 *out)
+{
+    char *end;
+    double v = g_ascii_strtod(s, &end);
+    if (end == s || v < 0) return FALSE;
+
+    gint64 mult = 1;
+    if (*end) {
+        const char *u = strchr(units, *end);
+        if (!u) return FALSE;
+        mult = scale[u - units];
+        end++;
+        /* 100M, 100MB and 100MiB all mean the same here */
+        if (!g_ascii_strcasecmp(end, "b") || !g_ascii_strcasecmp(end, "ib")) end += strlen(end);
+    }
+    if (*end) return FALSE;
+
+    *out = (gint64) (v * mult);
+    return TRUE;
+}
+
+static gboolean compare(gint64 a, CmpOp op, gint64 b)
+{
+    switch (op) {
+    case OP_LT: return a < b;
+    case OP_LE: return a <= b;
+    case OP_GT: return a > b;
+    case OP_GE: return a >= b;
+    default:    return a == b;
+    }
+}
+
+static void term_clear(Term *t)
+{
+    g_free(t->text);
+    g_strfreev(t->list);
+    grep_free(t->grep);
+}
+
+static gboolean parse_term(const char *tok, Term *t, GError **err)
+{
+    static const char size_units[] = "kKmMgGtT";
+    static const gint64 size_scale[] = { 1LL << 10, 1LL << 10, 1LL << 20, 1LL << 20,
+                                         1LL << 30, 1LL << 30, 1LL << 40, 1LL << 40 };
+    static const char age_units[] = "smhdwy";
+    static const gint64 age_scale[] = { 1, 60, 3600, 86400, 7 * 86400, 365 * 86400 };
+
+    memset(t, 0, sizeof(*t));
+    if (tok[0] == '-' && tok[1]) {
+        t->negate = TRUE;
+        tok++;
+    }
+
+    const char *v;
+    if ((v = g_str_has_prefix(tok, "name:") ? tok + 5 : NULL)) {
+        t->kind = strpbrk(v, "*?[") ? TERM_GLOB : TERM_NAME;
+        t->text = g_strdup(v);
+    } else if ((v = g_str_has_prefix(tok, "ext:") ? tok + 4 : NULL)) {
+        t->kind = TERM_EXT;
+        char **l = g_strsplit(v, ",", -1);
+        for (int i = 0; l[i]; i++) {
+            char *e = g_strconcat(".", l[i][0] == '.' ? l[i] + 1 : l[i], NULL);
+            g_free(l[i]);
+            l[i] = e;
+        }
+        t->list = l;
+    } else if ((v = g_str_has_prefix(tok, "path:") ? tok + 5 : NULL)) {
+        t->kind = TERM_PATH;
+        t->text = g_strdup(v);
+    } else if ((v = g_str_has_prefix(tok, "type:") ? tok + 5 : NULL)) {
+        t->kind = TERM_TYPE;
+        t->type = !strcmp(v, "f") || !strcmp(v, "file") ? DT_REG :
+                  !strcmp(v, "d") || !strcmp(v, "dir") ? DT_DIR :
+                  !strcmp(v, "l") || !strcmp(v, "link") ? DT_LNK : DT_UNKNOWN;
+        if (t->type == DT_UNKNOWN) {
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "type: wants f, d or l, not \"%s\"", v);
+            return FALSE;
+        }
+    } else if ((v = g_str_has_prefix(tok, "content:") ? tok + 8 : NULL)) {
+        t->kind = TERM_CONTENT;
+        t->grep = grep_compile(v, err);
+        if (!t->grep) return FALSE;
+    } else if (g_str_has_prefix(tok, "size") && (v = parse_op(tok + 4, &t->op))) {
+        t->kind = TERM_SIZE;
+        if (!parse_number(v, size_units, size_scale, &t->num)) {
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "bad size \"%s\" (try 100M)", v);
+            return FALSE;
+        }
+    } else if (g_str_has_prefix(tok, "modified") && (v = parse_op(tok + 8, &t->op))) {
+        t->kind = TERM_AGE;
+        if (!parse_number(v, age_units, age_scale, &t->num)) {
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "bad age \"%s\" (try 2d)", v);
+            return FALSE;
+        }
+    } else if (g_str_has_prefix(tok, "depth") && (v = parse_op(tok + 5, &t->op))) {
+        t->kind = TERM_DEPTH;
+        char *end;
+        t->num = strtol(v, &end, 10);
+        if (end == v || *end) {
+            g_set_error(err, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "bad depth \"%s\"", v);
+            return FALSE;
+        }
+    } else {
+        t->kind = TERM_NAME;
+        t->text = g_strdup(tok);
+    }
+    return TRUE;
+}
+
+static gint by_kind(gconstpointer a, gconstpointer b)
+{
+    const Term *ta = a, *tb = b;
+    return (int) ta->kind - (int) tb->kind;
+}
+
+/*
+ * Splits on whitespace. A quote opens only where a term or its value
+ * starts (`"a b"`, `-"a b"`, `content:'a b'`) and nothing inside is
+ * unescaped, so regex backslashes and apostrophes in words are kept as
+ * typed. A quote still open at the end runs to the end of the text.
+ */
+static GPtrArray* split_terms(const char *text)
+{
+    GPtrArray *out = g_ptr_array_new_with_free_func(g_free);
+    const char *s = text;
+
+    for (;;) {
+        while (g_ascii_isspace(*s)) s++;
+        if (!*s) break;
+
+        GString *tok = g_string_new(NULL);
+        gboolean value_start = TRUE, keyed = FALSE;
+
+        while (*s && !g_ascii_isspace(*s)) {
+            if (value_start && (*s == '"' || *s == '\'')) {
+                const char *end = strchr(s + 1, *s);
+                if (!end) end = s + strlen(s);
+                g_string_append_len(tok, s + 1, end - s - 1);
+                s = *end ? end + 1 : end;
+                value_start = FALSE;
+                continue;
+            }
+            value_start = (*s == '-' && !tok->len) || (*s == ':' && !keyed);
+            if (*s == ':') keyed = TRUE;
+            g_string_append_c(tok, *s++);
+        }
+        g_ptr_array_add(out, g_string_free(tok, FALSE));
+    }
+    return out;
+}
+
+Query* query_compile(const char *text, GError **err)
+{
+    GPtrArray *argv = split_terms(text);
+
+    Query *q = g_malloc0(sizeof(Query));
+    q->terms = g_array_new(FALSE, FALSE, sizeof(Term));
+    q->prune = g_ptr_array_new();
+    q->max_depth = INT_MAX;
+    q->now = g_get_real_time() / G_USEC_PER_SEC;
+
+    for (guint i = 0; i < argv->len; i++) {
+        Term t;
+        if (!parse_term(argv->pdata[i], &t, err)) {
+            term_clear(&t);
+            g_ptr_array_free(argv, TRUE);
+            query_free(q);
+            return NULL;
+        }
+        g_array_append_val(q->terms, t);
+    }
+    g_ptr_array_free(argv, TRUE);
+
+    /* g_array_sort is not stable, but terms of one kind commute */
+    g_array_sort(q->terms, by_kind);
+
+    for (guint i = 0; i < q->terms->len; i++) {
+        Term *t = &g_array_index(q->terms, Term, i);
+
+        if (t->kind == TERM_PATH && t->negate)
+            g_ptr_array_add(q->prune, t->text);
+
+        if (t->kind == TERM_DEPTH && !t->negate) {
+            int d = t->op == OP_LT ? t->num - 1 :
+                    t->op == OP_LE || t->op == OP_EQ ? t->num : INT_MAX;
+            q->max_depth = MIN(q->max_depth, d);
+        }
+    }
+
+    return q;
+}
+
+void query_free(Query *q)
+{
+    if (!q) return;
+    for (guint i = 0; i < q->terms->len; i++)
+        term_clear(&g_array_index(q->terms, Term, i));
+    g_array_free(q->terms, TRUE);
+    g_ptr_array_free(q->prune, TRUE);
+    g_free(q);
+}
+
+gboolean query_enter_dir(const Query *q, const WalkEntry *e)
+{
+    if (e->depth >= q->max_depth) return FALSE;
+
+    for (guint i = 0; i < q->prune->len; i++)
+        if (strstr(e->path, q->prune->pdata[i])) return FALSE;
+
+    return TRUE;
+}
+
+static gboolean has_ext(const char *name, char **exts)
+{
+    size_t n = strlen(name);
+    for (int i = 0; exts[i]; i++) {
+        size_t el = strlen(exts[i]);
+        if (n > el && !g_ascii_strcasecmp(name + n - el, exts[i])) return TRUE;
+    }
+    return FALSE;
+}
+
+static gboolean need_stat(const WalkEntry *e, QueryResult *r)
+{
+    if (r->have_stat) return TRUE;
+    TRACE_COUNT(TRACE_SYSCALLS, 1);
+    r->have_stat = fstatat(e->dirfd, e->name, &r->st, AT_SYMLINK_NOFOLLOW) == 0;
+    return r->have_stat;
+}
+
+static gboolean eval(const Query *q, const Term *t, const WalkEntry *e, QueryResult *r)
+{
+    switch (t->kind) {
+    case TERM_TYPE:
+        return e->type == t->type;
+    case TERM_DEPTH:
+        return compare(e->depth, t->op, t->num);
+    case TERM_EXT:
+        return !e->is_dir && has_ext(e->name, t->list);
+    case TERM_NAME:
+        return strcasestr(e->name, t->text) != NULL;
+    case TERM_GLOB:
+        return fnmatch(t->text, e->name, FNM_CASEFOLD) == 0;
+    case TERM_PATH:
+        return strstr(e->path, t->text) != NULL;
+    case TERM_SIZE:
+        return !e->is_dir && need_stat(e, r) && compare(r->st.st_size, t->op, t->num);
+    case TERM_AGE:
+        return need_stat(e, r) && compare(q->now - r->st.st_mtime, t->op, t->num);
+    case TERM_CONTENT: {
+        if (e->type != DT_REG) return FALSE;
+        GrepHit h;
+        GrepResult rc = grep_file(t->grep, e->dirfd, e->name, &h);
+        if (rc == GREP_ERROR) return FALSE;
+
+        r->scanned += MIN((guint64) h.st.st_size, GREP_MAX_SCAN);
+        r->st = h.st;
+        r->have_stat = TRUE;
+        if (rc != GREP_MATCH) return FALSE;
+
+        /* the first positive content term supplies the preview */
+        if (!t->negate && !r->have_grep) {
+            r->grep = h;
+            r->have_grep = TRUE;
+        } else {
+            g_free(h.preview);
+        }
+        return TRUE;
+    }
+    }
+    return FALSE;
+}
+
+gboolean query_match(const Query *q, const WalkEntry *e, QueryResult *r)
+{
+    memset(r, 0, sizeof(*r));
+
+    for (guint i = 0; i < q->terms->len; i++) {
+        const Term *t = &g_array_index(q->terms, Term, i);
+        if (eval(q, t, e, r) == t->negate) {
+            if (r->have_grep) g_free(r->grep.preview);
+            r->have_grep = FALSE;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
@@ -0,0 +1,51 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <glib.h>
+#include <sys/stat.h>
+#include "walk.h"
+#include "grep.h"
+
+/*
+ * Search box queries, e.g. `ext:log size>100M modified<2d depth<4 -path:node_modules`.
+ *
+ *   word            name contains word (any case)
+ *   name:glob       name matches a shell glob (any case)
+ *   ext:a,b         name ends in .a or .b
+ *   path:text       full path contains text
+ *   type:f|d|l      regular file, directory, symlink
+ *   size<op>N[kMGT] size in bytes, op is < <= > >= =
+ *   modified<op>N[smhdwy]   age of the last change
+ *   depth<op>N      1 is the folder being searched
+ *   content:text    file contents, see grep.h
+ *
+ * A leading '-' negates a term. All terms must hold. Quotes keep spaces in
+ * a term or its value (content:"two words"); they open only there, and
+ * backslashes are kept as typed, so content:/a\d+/ and content:don't work.
+ * The query compiles to a program ordered by cost: name checks first, stat
+ * only when a size or age term is left, content last. `depth<` and
+ * `-path:` prune directories before they are opened.
+ */
+
+typedef struct Query Query;
+
+typedef struct {
+    struct stat st;
+    gboolean have_stat;
+    GrepHit grep;
+    gboolean have_grep;
+    guint64 scanned;   /* content bytes read */
+} QueryResult;
+
+/* cheap check used while typing: does the text use any key: or key<op> term? */
+gboolean query_looks_structured(const char *text);
+
+Query* query_compile(const char *text, GError **err);
+void query_free(Query *q);
+
+/* worker-safe; r->grep.preview is owned by the caller on a match */
+gboolean query_match(const Query *q, const WalkEntry *e, QueryResult *r);
+/* may the walk descend into e at all? */
+gboolean query_enter_dir(const Query *q, const WalkEntry *e);
+
+#endif
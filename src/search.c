@@ -0,0 +1,193 @@
+#include "search.h"
+#include "walk.h"
+#include "query.h"
+#include "mime.h"
+#include "utils.h"
+#include "trace.h"
+#include <gtk/gtk.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+
+#define SEARCH_DRAIN_MS 60
+#define SEARCH_DRAIN_MAX 500
+
+typedef struct {
+    char *path;
+    char *name;
+    char *preview;          /* matching line for content: queries, else NULL */
+    guint line;
+    gboolean is_dir;
+    struct stat st;
+} SearchHit;
+
+typedef struct {
+    GtkListStore *store;
+    Walk *walk;
+    Query *query;
+    GAsyncQueue *hits;      /* SearchHit, filled by the walk's workers */
+    guint64 entries;
+    guint64 bytes;
+    guint found;
+    gboolean walk_done;
+    SearchProgressFunc cb;
+    gpointer data;
+} Search;
+
+/* the running search of a store is its "search" data */
+static Search* current(GtkListStore *store)
+{
+    return g_object_get_data(G_OBJECT(store), "search");
+}
+
+static void hit_free(SearchHit *h)
+{
+    g_free(h->path);
+    g_free(h->name);
+    g_free(h->preview);
+    g_free(h);
+}
+
+static void search_free(Search *s)
+{
+    SearchHit *h;
+    while ((h = g_async_queue_try_pop(s->hits)))
+        hit_free(h);
+    g_async_queue_unref(s->hits);
+    query_free(s->query);
+    walk_unref(s->walk);
+    g_object_unref(s->store);
+    g_free(s);
+}
+
+/* worker thread */
+static gboolean visit(Walk *w, const WalkEntry *e, gpointer data)
+{
+    Search *s = data;
+    QueryResult r;
+
+    __atomic_fetch_add(&s->entries, 1, __ATOMIC_RELAXED);
+
+    if (query_match(s->query, e, &r)) {
+        /* only matches need the stat fields the grid keeps */
+        if (!r.have_stat && fstatat(e->dirfd, e->name, &r.st, AT_SYMLINK_NOFOLLOW) != 0) {
+            if (r.have_grep) g_free(r.grep.preview);
+            return FALSE;
+        }
+
+        SearchHit *h = g_malloc(sizeof(SearchHit));
+        h->path = g_strdup(e->path);
+        h->name = g_strdup(e->name);
+        h->preview = r.have_grep ? r.grep.preview : NULL;
+        h->line = r.have_grep ? r.grep.line : 0;
+        h->is_dir = e->is_dir;
+        h->st = r.st;
+        g_async_queue_push(s->hits, h);
+    }
+
+    if (r.scanned)
+        __atomic_fetch_add(&s->bytes, r.scanned, __ATOMIC_RELAXED);
+
+    return e->is_dir && query_enter_dir(s->query, e);
+}
+
+static void walk_done(Walk *w, gboolean cancelled, gpointer data)
+{
+    Search *s = data;
+    s->walk_done = TRUE;
+}
+
+static void append_hit(Search *s, SearchHit *h)
+{
+    UtilsEntry e = {
+        .name = h->name,
+        .path = h->path,
+        .is_dir = h->is_dir,
+        .size = h->st.st_size,
+        .mtime = h->st.st_mtime,
+        .dev = h->st.st_dev,
+        .ino = h->st.st_ino,
+        .mode = h->st.st_mode,
+    };
+    GtkTreeIter it;
+    utils_store_append(s->store, &e, &it);
+
+    if (h->preview) {
+        char *tip = g_markup_printf_escaped("<b>%s</b>\n%u: %s", h->path, h->line, h->preview);
+        gtk_list_store_set(s->store, &it, 4, tip, -1);
+        g_free(tip);
+    }
+}
+
+/* main thread: move found files into the view a slice at a time */
+static gboolean drain(gpointer data)
+{
+    Search *s = data;
+    gboolean live = s == current(s->store);
+    SearchHit *h;
+    guint n = 0;
+
+    TRACE_SCOPE("search drain");
+
+    while ((!live || n < SEARCH_DRAIN_MAX) && (h = g_async_queue_try_pop(s->hits))) {
+        if (live) {
+            append_hit(s, h);
+            s->found++;
+            TRACE_ITEMS(1);
+        }
+        hit_free(h);
+        n++;
+    }
+
+    gboolean finished = s->walk_done && g_async_queue_length(s->hits) == 0;
+
+    if (live) {
+        if (n) mime_sniff_flush(s->store);
+
+        SearchProgress p = {
+            s->found,
+            __atomic_load_n(&s->entries, __ATOMIC_RELAXED),
+            __atomic_load_n(&s->bytes, __ATOMIC_RELAXED),
+            finished,
+        };
+        if (s->cb) s->cb(&p, s->data);
+    }
+
+    if (!finished) return G_SOURCE_CONTINUE;
+
+    if (current(s->store) == s) g_object_set_data(G_OBJECT(s->store), "search", NULL);
+    search_free(s);
+    return G_SOURCE_REMOVE;
+}
+
+void search_start(GtkListStore *store, const char *root, Query *query,
+                  gboolean hidden, SearchProgressFunc cb, gpointer data)
+{
+    search_cancel(store);
+
+    Search *s = g_malloc0(sizeof(Search));
+    s->store = g_object_ref(store);
+    s->query = query;
+    s->hits = g_async_queue_new();
+    s->cb = cb;
+    s->data = data;
+
+    g_object_set_data(G_OBJECT(store), "search", s);
+    s->walk = walk_start(root, hidden, visit, walk_done, s);
+    g_timeout_add(SEARCH_DRAIN_MS, drain, s);
+}
+
+void search_cancel(GtkListStore *store)
+{
+    Search *s = current(store);
+    if (!s) return;
+
+    /* the drain timer frees it once the workers have let go */
+    walk_cancel(s->walk);
+    g_object_set_data(G_OBJECT(store), "search", NULL);
+}
+
+gboolean search_running(GtkListStore *store)
+{
+    return current(store) != NULL;
+}
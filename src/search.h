@@ -0,0 +1,27 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <gtk/gtk.h>
+#include "query.h"
+
+/*
+ * Background searches that stream rows into the grid. One search runs
+ * per store; starting another or reloading the view cancels it.
+ */
+
+typedef struct {
+    guint found;
+    guint64 entries;
+    guint64 bytes;
+    gboolean done;
+} SearchProgress;
+
+typedef void (*SearchProgressFunc)(const SearchProgress *p, gpointer data);
+
+/* entries under root matching query (see query.h); takes the query */
+void search_start(GtkListStore *store, const char *root, Query *query,
+                  gboolean hidden, SearchProgressFunc cb, gpointer data);
+void search_cancel(GtkListStore *store);
+gboolean search_running(GtkListStore *store);
+
+#endif
@@ -0,0 +1,342 @@
+#include "session.h"
+#include "utils.h"
+#include "fsio.h"
+#include "theme.h"
+#include "trace.h"
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "WOSNAP1\n"
+
+typedef struct {
+    char magic[8];
+    gint64 mtime_ns;            /* of the folder, taken before its entries */
+    gint64 ctime_ns;
+    guint32 count;              /* entries that follow */
+    guint32 complete;           /* 0 when the view held more than were saved */
+    guint32 path_len;           /* the folder's path follows the header */
+    guint32 reserved;
+} SnapHeader;
+
+/* each followed by name_len bytes of name */
+typedef struct {
+    guint64 size;
+    guint64 dev;
+    guint64 ino;
+    gint64 mtime;
+    guint32 mode;
+    guint32 name_len;
+} SnapEntry;
+
+/* the snapshot handed out last, for session_revalidate() */
+static struct {
+    char *dir;
+    gint64 mtime_ns;
+    gint64 ctime_ns;
+    gboolean complete;
+} loaded;
+
+static GKeyFile *ini = NULL;
+static char **shortcuts = NULL;
+
+static char* config_file(const char *name)
+{
+    return g_build_filename(g_get_user_config_dir(), "wo-files", name, NULL);
+}
+
+static char* cache_file(const char *name)
+{
+    return g_build_filename(g_get_user_cache_dir(), "wo-files", name, NULL);
+}
+
+/* takes path */
+static void write_file(char *path, const char *data, gsize len)
+{
+    GError *err = NULL;
+    char *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0700);
+    if (!g_file_set_contents(path, data, len, &err)) {
+        g_warning("session: %s", err->message);
+        g_error_free(err);
+    }
+    g_free(dir);
+    g_free(path);
+}
+
+static GKeyFile* keys(void)
+{
+    if (ini) return ini;
+
+    ini = g_key_file_new();
+    char *path = config_file("session.ini");
+    /* a first run has no file; anything unreadable is started over */
+    g_key_file_load_from_file(ini, path, G_KEY_FILE_NONE, NULL);
+    g_free(path);
+    return ini;
+}
+
+static void save_keys(void)
+{
+    gsize len;
+    char *data = g_key_file_to_data(keys(), &len, NULL);
+    write_file(config_file("session.ini"), data, len);
+    g_free(data);
+}
+
+/* ---------- window, theme, shortcuts ---------- */
+
+SessionWindow* session_last_window(void)
+{
+    GKeyFile *k = keys();
+    char *path = g_key_file_get_string(k, "window", "path", NULL);
+    if (!path) return NULL;
+
+    SessionWindow *w = g_new0(SessionWindow, 1);
+    w->path = path;
+    w->width = g_key_file_get_integer(k, "window", "width", NULL);
+    w->height = g_key_file_get_integer(k, "window", "height", NULL);
+    w->maximized = g_key_file_get_boolean(k, "window", "maximized", NULL);
+    w->zoom = g_key_file_get_integer(k, "window", "zoom", NULL);
+    w->back = g_key_file_get_string_list(k, "window", "back", NULL, NULL);
+    w->forward = g_key_file_get_string_list(k, "window", "forward", NULL, NULL);
+    return w;
+}
+
+void session_window_free(SessionWindow *w)
+{
+    if (!w) return;
+    g_free(w->path);
+    g_strfreev(w->back);
+    g_strfreev(w->forward);
+    g_free(w);
+}
+
+static void set_list(GKeyFile *k, const char *key, char **list)
+{
+    g_key_file_set_string_list(k, "window", key, (const char* const*) list,
+                               list ? g_strv_length(list) : 0);
+}
+
+void session_save_window(const SessionWindow *w)
+{
+    GKeyFile *k = keys();
+    g_key_file_set_string(k, "window", "path", w->path);
+    g_key_file_set_integer(k, "window", "width", w->width);
+    g_key_file_set_integer(k, "window", "height", w->height);
+    g_key_file_set_boolean(k, "window", "maximized", w->maximized);
+    g_key_file_set_integer(k, "window", "zoom", w->zoom);
+    set_list(k, "back", w->back);
+    set_list(k, "forward", w->forward);
+
+    if (theme_current()) g_key_file_set_string(k, "session", "theme", theme_current());
+    save_keys();
+}
+
+char* session_theme(void)
+{
+    return g_key_file_get_string(keys(), "session", "theme", NULL);
+}
+
+const char* const* session_shortcuts(void)
+{
+    if (!shortcuts) shortcuts = g_key_file_get_string_list(keys(), "session", "shortcuts", NULL, NULL);
+    if (!shortcuts) shortcuts = g_new0(char*, 1);
+    return (const char* const*) shortcuts;
+}
+
+void session_add_shortcut(const char *path)
+{
+    session_shortcuts();
+    if (g_strv_contains((const char* const*) shortcuts, path)) return;
+
+    guint n = g_strv_length(shortcuts);
+    shortcuts = g_renew(char*, shortcuts, n + 2);
+    shortcuts[n] = g_strdup(path);
+    shortcuts[n + 1] = NULL;
+
+    g_key_file_set_string_list(keys(), "session", "shortcuts", (const char* const*) shortcuts, n + 1);
+    save_keys();
+}
+
+/* ---------- listing snapshot ---------- */
+
+static gint64 ns(const struct timespec *t)
+{
+    return (gint64) t->tv_sec * G_GINT64_CONSTANT(1000000000) + t->tv_nsec;
+}
+
+void session_snapshot_save(const char *dir, GPtrArray *names, guint total)
+{
+    TRACE_SCOPE("session_snapshot_save");
+
+    int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) return;
+
+    /* the folder first: a change made while its entries are read shows as stale */
+    struct stat st;
+    if (fstat(dfd, &st) != 0) {
+        close(dfd);
+        return;
+    }
+
+    guint n = MIN(names->len, SESSION_SNAPSHOT_MAX);
+    FsioStat *items = g_new0(FsioStat, MAX(n, 1));
+    for (guint i = 0; i < n; i++) items[i].name = names->pdata[i];
+    fsio_stat_batch(dfd, items, n);
+    close(dfd);
+
+    SnapHeader h = { SNAPSHOT_MAGIC };
+    h.mtime_ns = ns(&st.st_mtim);
+    h.ctime_ns = ns(&st.st_ctim);
+    h.complete = n == total;
+    h.path_len = strlen(dir);
+
+    GByteArray *out = g_byte_array_new();
+    g_byte_array_append(out, (const guint8*) &h, sizeof(h));
+    g_byte_array_append(out, (const guint8*) dir, h.path_len);
+
+    for (guint i = 0; i < n; i++) {
+        /* gone since it was shown; the next start reads the folder again */
+        if (items[i].err) {
+            h.complete = FALSE;
+            continue;
+        }
+        SnapEntry e = {
+            items[i].st.st_size, items[i].st.st_dev, items[i].st.st_ino,
+            items[i].st.st_mtime, items[i].st.st_mode, strlen(items[i].name)
+        };
+        g_byte_array_append(out, (const guint8*) &e, sizeof(e));
+        g_byte_array_append(out, (const guint8*) items[i].name, e.name_len);
+        h.count++;
+    }
+    memcpy(out->data, &h, sizeof(h));
+
+    write_file(cache_file("last-listing"), (const char*) out->data, out->len);
+    g_byte_array_unref(out);
+    g_free(items);
+}
+
+GList* session_snapshot_load(const char *dir)
+{
+    TRACE_SCOPE("session_snapshot_load");
+
+    char *path = cache_file("last-listing");
+    char *data = NULL;
+    gsize len = 0;
+    gboolean ok = g_file_get_contents(path, &data, &len, NULL);
+    g_free(path);
+    if (!ok) return NULL;
+
+    SnapHeader h;
+    gsize dlen = strlen(dir);
+    if (len < sizeof(h)) goto out;
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, 8) || h.path_len != dlen || len - sizeof(h) < dlen ||
+        memcmp(data + sizeof(h), dir, dlen))
+        goto out;
+
+    GList *list = NULL;
+    gsize at = sizeof(h) + dlen;
+    for (guint32 i = 0; i < h.count; i++) {
+        SnapEntry e;
+        if (len - at < sizeof(e)) break;
+        memcpy(&e, data + at, sizeof(e));
+        at += sizeof(e);
+        if (len - at < e.name_len) break;
+
+        char *name = g_strndup(data + at, e.name_len);
+        at += e.name_len;
+
+        UtilsEntry *u = utils_entry_new(dir, name, S_ISDIR(e.mode));
+        u->size = e.size;
+        u->mtime = e.mtime;
+        u->dev = e.dev;
+        u->ino = e.ino;
+        u->mode = e.mode;
+        list = g_list_prepend(list, u);
+        g_free(name);
+    }
+    TRACE_ITEMS(h.count);
+
+    g_free(loaded.dir);
+    loaded.dir = g_strdup(dir);
+    loaded.mtime_ns = h.mtime_ns;
+    loaded.ctime_ns = h.ctime_ns;
+    /* a truncated file is as good as a truncated view */
+    loaded.complete = h.complete && at == len;
+
+    g_free(data);
+    return g_list_reverse(list);
+
+out:
+    g_free(data);
+    return NULL;
+}
+
+typedef struct {
+    char *dir;
+    gint64 mtime_ns;
+    gint64 ctime_ns;
+    gboolean complete;
+    gboolean changed;
+    GList *fresh;
+    int err;
+    SessionFreshFunc done;
+    gpointer data;
+} Revalidate;
+
+static void revalidate_free(Revalidate *r)
+{
+    g_list_free_full(r->fresh, (GDestroyNotify) utils_entry_free);
+    g_free(r->dir);
+    g_free(r);
+}
+
+/* worker thread */
+static void revalidate_thread(GTask *task, gpointer src, gpointer data, GCancellable *c)
+{
+    Revalidate *r = data;
+    TRACE_SCOPE("session_revalidate");
+
+    struct stat st;
+    if (stat(r->dir, &st) != 0) {
+        r->err = errno;
+    } else if (!r->complete || ns(&st.st_mtim) != r->mtime_ns || ns(&st.st_ctim) != r->ctime_ns) {
+        r->changed = TRUE;
+        r->fresh = utils_scan_dir(r->dir, &r->err);
+    }
+    g_task_return_boolean(task, TRUE);
+}
+
+static void revalidate_done(GObject *src, GAsyncResult *res, gpointer data)
+{
+    Revalidate *r = g_task_get_task_data(G_TASK(res));
+    /* a cancelled check belongs to a view that has moved on */
+    if (!g_task_propagate_boolean(G_TASK(res), NULL)) return;
+    r->done(r->dir, r->changed ? r->fresh : NULL, r->err, r->data);
+}
+
+void session_revalidate(const char *dir, GCancellable *cancellable,
+                        SessionFreshFunc done, gpointer data)
+{
+    Revalidate *r = g_new0(Revalidate, 1);
+    r->dir = g_strdup(dir);
+    r->done = done;
+    r->data = data;
+    /* without a snapshot of dir there is nothing to trust */
+    if (loaded.dir && !strcmp(loaded.dir, dir)) {
+        r->mtime_ns = loaded.mtime_ns;
+        r->ctime_ns = loaded.ctime_ns;
+        r->complete = loaded.complete;
+    }
+
+    GTask *task = g_task_new(NULL, cancellable, revalidate_done, NULL);
+    g_task_set_task_data(task, r, (GDestroyNotify) revalidate_free);
+    g_task_run_in_thread(task, revalidate_thread);
+    g_object_unref(task);
+}
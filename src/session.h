@@ -0,0 +1,58 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <gio/gio.h>
+
+/*
+ * What a restart brings back. The last window closed leaves its folder,
+ * size, zoom and history in session.ini under the user config dir, along
+ * with the theme and the sidebar shortcuts the user added. The first
+ * window of the next run reopens there and paints a snapshot of the
+ * folder's listing (up to SESSION_SNAPSHOT_MAX entries, with their lstat
+ * results) from the user cache dir before anything is read from disk;
+ * the folder is then checked in the background and only re-read when
+ * its mtime or ctime moved or the snapshot was cut short. Main thread
+ * only, except where noted.
+ */
+
+#define SESSION_SNAPSHOT_MAX 2000
+
+typedef struct {
+    char *path;
+    int width, height;
+    gboolean maximized;
+    int zoom;
+    char **back;                /* oldest first */
+    char **forward;
+} SessionWindow;
+
+/* the window to reopen, or NULL on a first run; free with session_window_free() */
+SessionWindow* session_last_window(void);
+void session_window_free(SessionWindow *w);
+/* records w as the last window closed, with the current theme */
+void session_save_window(const SessionWindow *w);
+
+/* the theme file in use at the end of the last run, or NULL; a new string */
+char* session_theme(void);
+
+/* folders the user pinned to the sidebar, in the order they were added */
+const char* const* session_shortcuts(void);
+void session_add_shortcut(const char *path);
+
+/* saves the listing of dir for the next start; names come from the grid */
+void session_snapshot_save(const char *dir, GPtrArray *names, guint total);
+
+/* the saved listing of dir as UtilsEntry, or NULL when there is none for it */
+GList* session_snapshot_load(const char *dir);
+
+/*
+ * Checks the snapshot of dir on a worker thread. done runs on the main
+ * thread, unless cancellable was cancelled first, with the fresh listing
+ * when the folder changed since (NULL when the snapshot still holds), or
+ * an errno when it cannot be read any more. fresh is freed after done.
+ */
+typedef void (*SessionFreshFunc)(const char *dir, GList *fresh, int err, gpointer data);
+void session_revalidate(const char *dir, GCancellable *cancellable,
+                        SessionFreshFunc done, gpointer data);
+
+#endif
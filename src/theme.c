@@ -0,0 +1,541 @@
+#include "theme.h"
+#include "trace.h"
+#include <gtk/gtk.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* parsed providers kept around so switching back is just a swap */
+#define THEME_CACHE_MAX 4
+
+typedef struct {
+    GtkCssProvider *provider;
+    struct timespec mtime;
+    gint64 last_used;
+} ThemeEntry;
+
+static GHashTable *cache = NULL;   /* file -> ThemeEntry */
+static GHashTable *names = NULL;   /* combo name -> file */
+
+static GtkCssProvider *active = NULL;
+static char *active_file = NULL;
+
+static GtkWidget *theme_window = NULL;
+static gboolean restyle_pending = FALSE;
+static gint64 restyle_switch = 0;
+static gint64 restyle_frame = 0;
+
+/* hot reload: one debounce timer per file, results older than gen are dropped */
+#define THEME_RELOAD_DEBOUNCE_MS 120
+
+typedef struct {
+    guint timer;
+    guint gen;
+    gint64 first_event;
+} ReloadState;
+
+typedef struct {
+    char *file;
+    guint gen;
+    gint64 first_event;
+    char *css;
+    char *error;
+} ReloadJob;
+
+static GFileMonitor *theme_monitor = NULL;
+static GHashTable *reloads = NULL;   /* file -> ReloadState */
+
+static void theme_watch_start(void);
+
+static void entry_free(gpointer p)
+{
+    ThemeEntry *e = p;
+    g_object_unref(e->provider);
+    g_free(e);
+}
+
+void theme_ensure_dir(void)
+{
+    struct stat st = {0};
+    if (stat(THEME_DIR, &st) == -1) {
+        mkdir("assets", 0755);
+        mkdir(THEME_DIR, 0755);
+    }
+}
+
+void theme_init(GtkWidget *window)
+{
+    /* restyles are timed on the newest window; the theme itself is screen-wide */
+    if (theme_window)
+        g_object_remove_weak_pointer(G_OBJECT(theme_window), (gpointer*) &theme_window);
+    theme_window = window;
+    g_object_add_weak_pointer(G_OBJECT(theme_window), (gpointer*) &theme_window);
+
+    if (cache) return;
+
+    cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, entry_free);
+    names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    theme_register("OLED", "oled.css");
+    theme_register("Red", "red.css");
+    theme_register("Blue", "blue.css");
+
+    theme_watch_start();
+}
+
+void theme_register(const char *name, const char *file)
+{
+    g_hash_table_replace(names, g_strdup(name), g_strdup(file));
+}
+
+const char* theme_file_for_name(const char *name)
+{
+    return g_hash_table_lookup(names, name);
+}
+
+char* theme_css_from_wo(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+
+    GString *css = g_string_new("");
+    char line[4096];
+    gboolean in_css = FALSE;
+    gboolean has_theme_name = FALSE;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (!in_css) {
+            if (g_str_has_prefix(line, "THEMENAME:")) {
+                has_theme_name = TRUE;
+                continue;
+            }
+
+            if (g_str_has_prefix(line, "---") || has_theme_name) {
+                in_css = TRUE;
+
+                if (g_str_has_prefix(line, "---")) {
+                    continue;
+                }
+            } else {
+                continue;
+            }
+        }
+
+        g_string_append(css, line);
+    }
+
+    fclose(f);
+
+    if (css->len == 0) {
+        g_string_free(css, TRUE);
+        return NULL;
+    }
+
+    return g_string_free(css, FALSE);
+}
+
+char* theme_name_from_wo(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return NULL;
+    }
+
+    char line[256];
+    char *theme_name = NULL;
+
+    if (fgets(line, sizeof(line), f)) {
+        if (g_str_has_prefix(line, "THEMENAME:")) {
+            char name[128] = {0};
+            if (sscanf(line, "THEMENAME: %127[^\n]", name) == 1) {
+                theme_name = g_strdup(name);
+            }
+        }
+    }
+
+    fclose(f);
+    return theme_name;
+}
+
+/* css is the already extracted .wo body, or NULL to read the file here */
+static GtkCssProvider* build_provider(const char *file, const char *css)
+{
+    TRACE_SCOPE("theme parse");
+    char full[512];
+    snprintf(full, sizeof(full), THEME_DIR "/%s", file);
+
+    GtkCssProvider *provider = gtk_css_provider_new();
+    GError *error = NULL;
+    gboolean ok;
+
+    if (g_str_has_suffix(file, ".wo")) {
+        char *css_content = css ? g_strdup(css) : theme_css_from_wo(full);
+        if (!css_content) {
+            g_warning("No CSS content extracted from: %s", full);
+            g_object_unref(provider);
+            return NULL;
+        }
+        ok = gtk_css_provider_load_from_data(provider, css_content, -1, &error);
+        g_free(css_content);
+    } else {
+        /* from the path so url() stays relative to the theme directory */
+        ok = gtk_css_provider_load_from_path(provider, full, &error);
+    }
+
+    if (!ok) {
+        g_warning("CSS load failed: %s", error ? error->message : "Unknown error");
+        if (error) g_error_free(error);
+        g_object_unref(provider);
+        return NULL;
+    }
+
+    return provider;
+}
+
+static GtkCssProvider* parse_theme(const char *file)
+{
+    return build_provider(file, NULL);
+}
+
+static void evict_old(void)
+{
+    while (g_hash_table_size(cache) > THEME_CACHE_MAX) {
+        GHashTableIter it;
+        gpointer k, v;
+        const char *oldest = NULL;
+        gint64 oldest_used = G_MAXINT64;
+
+        g_hash_table_iter_init(&it, cache);
+        while (g_hash_table_iter_next(&it, &k, &v)) {
+            ThemeEntry *e = v;
+            if (e->provider == active) continue;
+            if (e->last_used < oldest_used) {
+                oldest_used = e->last_used;
+                oldest = k;
+            }
+        }
+
+        if (!oldest) return;
+        g_hash_table_remove(cache, oldest);
+    }
+}
+
+static struct timespec theme_mtime(const char *file)
+{
+    char full[512];
+    snprintf(full, sizeof(full), THEME_DIR "/%s", file);
+
+    struct stat st = {0};
+    stat(full, &st);
+    return st.st_mtim;
+}
+
+static ThemeEntry* cache_insert(const char *file, GtkCssProvider *provider, struct timespec mtime)
+{
+    ThemeEntry *e = g_malloc(sizeof(ThemeEntry));
+    e->provider = provider;
+    e->mtime = mtime;
+    e->last_used = g_get_monotonic_time();
+    g_hash_table_replace(cache, g_strdup(file), e);
+
+    evict_old();
+    return e;
+}
+
+/* returns the cached provider for file, re-parsing only if it changed on disk */
+static ThemeEntry* lookup_theme(const char *file, gboolean *hit)
+{
+    struct timespec mtime = theme_mtime(file);
+
+    ThemeEntry *e = g_hash_table_lookup(cache, file);
+    if (e && e->mtime.tv_sec == mtime.tv_sec &&
+        e->mtime.tv_nsec == mtime.tv_nsec) {
+        e->last_used = g_get_monotonic_time();
+        *hit = TRUE;
+        return e;
+    }
+
+    *hit = FALSE;
+
+    GtkCssProvider *provider = parse_theme(file);
+    if (!provider) return NULL;
+
+    return cache_insert(file, provider, mtime);
+}
+
+static void on_before_paint(GdkFrameClock *clock, gpointer data)
+{
+    restyle_frame = g_get_monotonic_time();
+}
+
+static void on_after_paint(GdkFrameClock *clock, gpointer data)
+{
+    gint64 now = g_get_monotonic_time();
+
+    g_signal_handlers_disconnect_by_func(clock, on_before_paint, NULL);
+    g_signal_handlers_disconnect_by_func(clock, on_after_paint, NULL);
+    restyle_pending = FALSE;
+
+    g_message("theme: %s restyle %.1f ms (first frame %.1f ms after switch)",
+        active_file ? active_file : "?",
+        (now - restyle_frame) / 1000.0,
+        (now - restyle_switch) / 1000.0);
+}
+
+/* times the first frame after a switch, which is where GTK does the restyle */
+static void watch_restyle(void)
+{
+    restyle_switch = g_get_monotonic_time();
+    restyle_frame = restyle_switch;
+
+    if (restyle_pending || !theme_window) return;
+
+    GdkFrameClock *clock = gtk_widget_get_frame_clock(theme_window);
+    if (!clock) return;
+
+    restyle_pending = TRUE;
+    g_signal_connect(clock, "before-paint", G_CALLBACK(on_before_paint), NULL);
+    g_signal_connect(clock, "after-paint", G_CALLBACK(on_after_paint), NULL);
+}
+
+static void swap_in(ThemeEntry *e, const char *file)
+{
+    GdkScreen *screen = gdk_screen_get_default();
+
+    /* add the new one before dropping the old so no frame is drawn unthemed */
+    gtk_style_context_add_provider_for_screen(
+        screen,
+        GTK_STYLE_PROVIDER(e->provider),
+        GTK_STYLE_PROVIDER_PRIORITY_APPLICATION
+    );
+
+    if (active) {
+        gtk_style_context_remove_provider_for_screen(
+            screen,
+            GTK_STYLE_PROVIDER(active)
+        );
+        g_object_unref(active);
+    }
+
+    active = g_object_ref(e->provider);
+
+    char *old_file = active_file;
+    active_file = g_strdup(file);
+    g_free(old_file);
+
+    watch_restyle();
+}
+
+const char* theme_current(void)
+{
+    return active_file;
+}
+
+gboolean theme_apply(const char *file)
+{
+    TRACE_SCOPE("theme_apply");
+    gint64 t0 = g_get_monotonic_time();
+    gboolean hit = FALSE;
+
+    ThemeEntry *e = lookup_theme(file, &hit);
+    if (!e) return FALSE;
+
+    if (e->provider == active) return TRUE;
+
+    swap_in(e, file);
+
+    g_message("theme: %s %s in %.1f ms", file,
+        hit ? "swapped from cache" : "parsed",
+        (g_get_monotonic_time() - t0) / 1000.0);
+
+    return TRUE;
+}
+
+static gboolean prewarm_idle(gpointer data)
+{
+    char *file = data;
+    gboolean hit;
+
+    lookup_theme(file, &hit);
+
+    g_free(file);
+    return G_SOURCE_REMOVE;
+}
+
+void theme_prewarm(const char *file)
+{
+    if (!file || g_hash_table_contains(cache, file)) return;
+    g_idle_add_full(G_PRIORITY_LOW, prewarm_idle, g_strdup(file), NULL);
+}
+
+/* cheap structural check so a half-saved file never reaches the parser */
+static const char* precheck_css(const char *css)
+{
+    int depth = 0;
+    gboolean in_comment = FALSE;
+    char quote = 0;
+
+    for (const char *c = css; *c; c++) {
+        if (in_comment) {
+            if (c[0] == '*' && c[1] == '/') { in_comment = FALSE; c++; }
+            continue;
+        }
+        if (quote) {
+            if (*c == '\\' && c[1]) c++;
+            else if (*c == quote) quote = 0;
+            continue;
+        }
+        if (c[0] == '/' && c[1] == '*') { in_comment = TRUE; c++; continue; }
+        if (*c == '"' || *c == '\'') quote = *c;
+        else if (*c == '{') depth++;
+        else if (*c == '}' && --depth < 0) return "unexpected '}'";
+    }
+
+    if (in_comment) return "unterminated comment";
+    if (quote) return "unterminated string";
+    if (depth) return "unbalanced braces";
+    return NULL;
+}
+
+static void reload_job_free(gpointer p)
+{
+    ReloadJob *j = p;
+    g_free(j->file);
+    g_free(j->css);
+    g_free(j->error);
+    g_free(j);
+}
+
+/* worker: read and extract the file, nothing that touches GTK */
+static void reload_thread(GTask *task, gpointer src, gpointer data, GCancellable *c)
+{
+    TRACE_SCOPE("theme reload read");
+    ReloadJob *j = data;
+    char full[512];
+    snprintf(full, sizeof(full), THEME_DIR "/%s", j->file);
+
+    if (g_str_has_suffix(j->file, ".wo"))
+        j->css = theme_css_from_wo(full);
+    else
+        g_file_get_contents(full, &j->css, NULL, NULL);
+
+    if (!j->css)
+        j->error = g_strdup("file is empty or unreadable");
+    else {
+        const char *err = precheck_css(j->css);
+        if (err) j->error = g_strdup(err);
+    }
+
+    g_task_return_boolean(task, j->error == NULL);
+}
+
+static void reload_done(GObject *src, GAsyncResult *res, gpointer data)
+{
+    ReloadJob *j = g_task_get_task_data(G_TASK(res));
+    ReloadState *rs = g_hash_table_lookup(reloads, j->file);
+
+    /* a newer save is already queued, or the user switched themes meanwhile */
+    if (!rs || rs->gen != j->gen) return;
+    if (!active_file || strcmp(active_file, j->file)) return;
+
+    if (j->error) {
+        g_warning("theme: %s not reloaded, keeping current: %s", j->file, j->error);
+        return;
+    }
+
+    GtkCssProvider *provider = build_provider(j->file, j->css);
+    if (!provider) {
+        g_warning("theme: %s not reloaded, keeping current", j->file);
+        return;
+    }
+
+    ThemeEntry *e = cache_insert(j->file, provider, theme_mtime(j->file));
+    swap_in(e, j->file);
+
+    g_message("theme: %s reloaded %.1f ms after save",
+        j->file, (g_get_monotonic_time() - j->first_event) / 1000.0);
+}
+
+static gboolean reload_fire(gpointer data)
+{
+    const char *file = data;
+    ReloadState *rs = g_hash_table_lookup(reloads, file);
+    rs->timer = 0;
+
+    ReloadJob *j = g_malloc0(sizeof(ReloadJob));
+    j->file = g_strdup(file);
+    j->gen = ++rs->gen;
+    j->first_event = rs->first_event;
+
+    GTask *task = g_task_new(NULL, NULL, reload_done, NULL);
+    g_task_set_task_data(task, j, reload_job_free);
+    g_task_run_in_thread(task, reload_thread);
+    g_object_unref(task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void on_theme_file_changed(GFileMonitor *m, GFile *file, GFile *other,
+                                  GFileMonitorEvent ev, gpointer data)
+{
+    GFile *target = file;
+
+    switch (ev) {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+        break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        /* editors that save via rename land the new contents on `other` */
+        target = other;
+        break;
+    default:
+        return;
+    }
+
+    if (!target) return;
+
+    char *name = g_file_get_basename(target);
+
+    /* only the applied theme needs work now, the rest re-parse lazily on mtime */
+    if (!active_file || strcmp(name, active_file)) {
+        g_free(name);
+        return;
+    }
+
+    gpointer key = NULL, value = NULL;
+    if (!g_hash_table_lookup_extended(reloads, name, &key, &value)) {
+        key = g_strdup(name);
+        value = g_malloc0(sizeof(ReloadState));
+        g_hash_table_insert(reloads, key, value);
+    }
+
+    ReloadState *rs = value;
+    if (rs->timer)
+        g_source_remove(rs->timer);
+    else
+        rs->first_event = g_get_monotonic_time();
+
+    rs->timer = g_timeout_add(THEME_RELOAD_DEBOUNCE_MS, reload_fire, key);
+    g_free(name);
+}
+
+static void theme_watch_start(void)
+{
+    theme_ensure_dir();
+
+    GFile *dir = g_file_new_for_path(THEME_DIR);
+    GError *error = NULL;
+
+    theme_monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    g_object_unref(dir);
+
+    if (!theme_monitor) {
+        g_warning("theme: hot reload disabled: %s", error ? error->message : "no monitor");
+        if (error) g_error_free(error);
+        return;
+    }
+
+    reloads = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_signal_connect(theme_monitor, "changed", G_CALLBACK(on_theme_file_changed), NULL);
+}
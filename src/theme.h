@@ -0,0 +1,22 @@
+#ifndef THEME_H
+#define THEME_H
+
+#include <gtk/gtk.h>
+
+#define THEME_DIR "assets/themes"
+
+void theme_init(GtkWidget *window);
+void theme_ensure_dir(void);
+
+void theme_register(const char *name, const char *file);
+const char* theme_file_for_name(const char *name);
+
+gboolean theme_apply(const char *file);
+/* the file last applied, NULL before the first theme_apply() */
+const char* theme_current(void);
+void theme_prewarm(const char *file);
+
+char* theme_css_from_wo(const char *path);
+char* theme_name_from_wo(const char *path);
+
+#endif
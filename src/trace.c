@@ -0,0 +1,199 @@
+#include "trace.h"
+
+#ifdef WO_TRACE
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TRACE_MAX_EVENTS (1 << 20)
+
+typedef struct {
+    const char *name;
+    gint64 ts;
+    gint64 dur;
+    gint64 items;
+    guint tid;
+    gboolean counters;
+    gint64 values[TRACE_COUNTER_LAST];
+} TraceEvent;
+
+static const char *counter_names[TRACE_COUNTER_LAST] = {
+    "syscalls", "entries", "icon_hits", "icon_misses", "allocs", "stalls", "stall_us"
+};
+
+static GMutex lock;
+static GArray *events = NULL;
+static gint64 counters[TRACE_COUNTER_LAST];
+static gint64 origin = 0;
+static guint main_tid = 0;
+static gboolean dropped = FALSE;
+
+static __thread int depth = 0;
+
+static guint current_tid(void)
+{
+    return (guint) syscall(SYS_gettid);
+}
+
+static void push_event(TraceEvent *ev)
+{
+    g_mutex_lock(&lock);
+    if (events->len < TRACE_MAX_EVENTS)
+        g_array_append_val(events, *ev);
+    else
+        dropped = TRUE;
+    g_mutex_unlock(&lock);
+}
+
+TraceScope trace_scope_begin(const char *name)
+{
+    TraceScope s = { name, g_get_monotonic_time(), 0 };
+    depth++;
+    return s;
+}
+
+void trace_scope_end(TraceScope *s)
+{
+    depth--;
+    if (!events) return;
+
+    TraceEvent ev = {
+        .name = s->name,
+        .ts = s->start,
+        .dur = g_get_monotonic_time() - s->start,
+        .items = s->items,
+        .tid = current_tid(),
+    };
+
+    /* sample counters once per top-level stage on the UI thread */
+    if (depth == 0 && ev.tid == main_tid) {
+        ev.counters = TRUE;
+        for (int i = 0; i < TRACE_COUNTER_LAST; i++)
+            ev.values[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    }
+
+    push_event(&ev);
+}
+
+void trace_count(TraceCounter c, gint64 n)
+{
+    __atomic_fetch_add(&counters[c], n, __ATOMIC_RELAXED);
+}
+
+/* a span measured from elsewhere (the watchdog) that belongs on the UI track */
+void trace_complete(const char *name, gint64 start, gint64 dur)
+{
+    if (!events) return;
+
+    TraceEvent ev = {
+        .name = name,
+        .ts = start,
+        .dur = dur,
+        .tid = main_tid,
+    };
+    push_event(&ev);
+}
+
+static const char* trace_path(void)
+{
+    static char fallback[64];
+    const char *p = g_getenv("WO_TRACE_FILE");
+    if (p && p[0]) return p;
+
+    snprintf(fallback, sizeof(fallback), "/tmp/wo-files-trace-%d.json", (int) getpid());
+    return fallback;
+}
+
+static gboolean on_sigusr1(gpointer data)
+{
+    trace_dump(trace_path());
+    return G_SOURCE_CONTINUE;
+}
+
+void trace_init(void)
+{
+    events = g_array_sized_new(FALSE, FALSE, sizeof(TraceEvent), 4096);
+    origin = g_get_monotonic_time();
+    main_tid = current_tid();
+
+    g_unix_signal_add(SIGUSR1, on_sigusr1, NULL);
+}
+
+void trace_finish(void)
+{
+    if (g_getenv("WO_TRACE_FILE"))
+        trace_dump(trace_path());
+}
+
+static void write_json_string(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((unsigned char) *s < 0x20) fprintf(f, "\\u%04x", *s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+gboolean trace_dump(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        g_warning("trace: cannot write %s", path);
+        return FALSE;
+    }
+
+    int pid = getpid();
+
+    g_mutex_lock(&lock);
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", f);
+    fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+               "\"args\":{\"name\":\"main\"}}", pid, main_tid);
+
+    for (guint i = 0; i < events->len; i++) {
+        TraceEvent *ev = &g_array_index(events, TraceEvent, i);
+
+        fputs(",\n{\"name\":", f);
+        write_json_string(f, ev->name);
+        fprintf(f, ",\"cat\":\"wo\",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT
+                   ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%u",
+                ev->ts - origin, ev->dur, pid, ev->tid);
+
+        if (ev->items) {
+            double per_sec = ev->dur ? ev->items * 1e6 / ev->dur : 0;
+            fprintf(f, ",\"args\":{\"items\":%" G_GINT64_FORMAT ",\"per_sec\":%.0f}",
+                    ev->items, per_sec);
+        }
+        fputc('}', f);
+
+        if (ev->counters) {
+            fputs(",\n{\"name\":\"counters\",\"ph\":\"C\"", f);
+            fprintf(f, ",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"args\":{",
+                    ev->ts + ev->dur - origin, pid);
+            for (int c = 0; c < TRACE_COUNTER_LAST; c++)
+                fprintf(f, "%s\"%s\":%" G_GINT64_FORMAT, c ? "," : "",
+                        counter_names[c], ev->values[c]);
+            fputs("}}", f);
+        }
+    }
+
+    fputs("\n],\"otherData\":{", f);
+    for (int c = 0; c < TRACE_COUNTER_LAST; c++)
+        fprintf(f, "%s\"%s\":%" G_GINT64_FORMAT, c ? "," : "",
+                counter_names[c], __atomic_load_n(&counters[c], __ATOMIC_RELAXED));
+    fprintf(f, ",\"dropped_events\":%s}}\n", dropped ? "true" : "false");
+
+    g_mutex_unlock(&lock);
+
+    fclose(f);
+    g_message("trace: wrote %s", path);
+    return TRUE;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+
+/*
+ * Hot-path instrumentation, compiled in with `make TRACE=1`.
+ * Scopes become Chrome trace-event "X" events; counters are sampled
+ * whenever a top-level scope on the main thread closes; stalls come in
+ * from the watchdog. The trace is written to $WO_TRACE_FILE at exit and
+ * on SIGUSR1.
+ */
+
+typedef enum {
+    TRACE_SYSCALLS,
+    TRACE_ENTRIES,
+    TRACE_ICON_HITS,
+    TRACE_ICON_MISSES,
+    TRACE_ALLOCS,
+    TRACE_STALLS,
+    TRACE_STALL_US,
+    TRACE_COUNTER_LAST
+} TraceCounter;
+
+#ifdef WO_TRACE
+
+typedef struct {
+    const char *name;
+    gint64 start;
+    gint64 items;
+} TraceScope;
+
+void trace_init(void);
+void trace_finish(void);
+gboolean trace_dump(const char *path);
+
+TraceScope trace_scope_begin(const char *name);
+void trace_scope_end(TraceScope *s);
+void trace_count(TraceCounter c, gint64 n);
+void trace_complete(const char *name, gint64 start, gint64 dur);
+
+/* one per block; closes automatically when the block is left */
+#define TRACE_SCOPE(name) \
+    TraceScope _trace_scope __attribute__((cleanup(trace_scope_end))) = trace_scope_begin(name)
+#define TRACE_ITEMS(n) (_trace_scope.items += (n))
+#define TRACE_COUNT(c, n) trace_count((c), (n))
+
+#else
+
+#define TRACE_SCOPE(name) do { } while (0)
+#define TRACE_ITEMS(n) do { } while (0)
+#define TRACE_COUNT(c, n) do { } while (0)
+
+static inline void trace_init(void) { }
+static inline void trace_finish(void) { }
+static inline void trace_complete(const char *name, gint64 start, gint64 dur) { }
+
+#endif
+
+#endif
@@ -1,26 +1,71 @@
 #include "ui.h"
 #include "utils.h"
+#include "mime.h"
+#include "iconcache.h"
+#include "search.h"
+#include "trace.h"
+#include "watchdog.h"
 #include <gtk/gtk.h>
 #include <string.h>
 
+/* column 0 holds the icon's base pixbuf; it is drawn at the view's zoom */
+static void icon_data(GtkCellLayout *layout, GtkCellRenderer *cell,
+                      GtkTreeModel *m, GtkTreeIter *it, gpointer data)
+{
+    GdkPixbuf *base = NULL;
+    gtk_tree_model_get(m, it, 0, &base, -1);
+
+    cairo_surface_t *s = base ? iconcache_surface(base, ui_get_zoom(GTK_ICON_VIEW(layout)),
+                                                  gtk_widget_get_scale_factor(GTK_WIDGET(layout))) : NULL;
+    if (s)
+        g_object_set(cell, "surface", s, NULL);
+    else
+        g_object_set(cell, "pixbuf", base, NULL);
+
+    if (base) g_object_unref(base);
+}
+
+int ui_get_zoom(GtkIconView *v)
+{
+    return GPOINTER_TO_INT(g_object_get_data(G_OBJECT(v), "zoom"));
+}
+
+void ui_set_zoom(GtkIconView *v, int level)
+{
+    level = CLAMP(level, 0, ICONCACHE_LEVELS - 1);
+    g_object_set_data(G_OBJECT(v), "zoom", GINT_TO_POINTER(level));
+
+    int size = iconcache_size(level);
+    GtkCellRenderer *icon = g_object_get_data(G_OBJECT(v), "icon-cell");
+    gtk_cell_renderer_set_fixed_size(icon, size, size);
+    /* names need room to wrap under the smallest icons */
+    gtk_icon_view_set_item_width(v, MAX(size + 32, 64));
+}
+
 GtkWidget* ui_create_grid(void)
 {
     GtkListStore *st = gtk_list_store_new(
-        4,
+        5,
         GDK_TYPE_PIXBUF,  
         G_TYPE_STRING,   
         G_TYPE_STRING,  
-        G_TYPE_BOOLEAN 
+        G_TYPE_BOOLEAN,
+        G_TYPE_STRING    /* tooltip markup, set by content search */
     );
 
     GtkWidget *v = gtk_icon_view_new_with_model(GTK_TREE_MODEL(st));
     g_object_unref(st);
 
-    gtk_icon_view_set_pixbuf_column(GTK_ICON_VIEW(v), 0);
+    GtkCellRenderer *icon = gtk_cell_renderer_pixbuf_new();
+    gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(v), icon, FALSE);
+    gtk_cell_layout_set_cell_data_func(GTK_CELL_LAYOUT(v), icon, icon_data, NULL, NULL);
+    g_object_set_data(G_OBJECT(v), "icon-cell", icon);
+
     gtk_icon_view_set_text_column(GTK_ICON_VIEW(v), 1);
-    gtk_icon_view_set_item_width(GTK_ICON_VIEW(v), 80);
+    ui_set_zoom(GTK_ICON_VIEW(v), ICONCACHE_BASE);
     gtk_icon_view_set_spacing(GTK_ICON_VIEW(v), 6);
     gtk_icon_view_set_margin(GTK_ICON_VIEW(v), 10);
+    gtk_icon_view_set_tooltip_column(GTK_ICON_VIEW(v), 4);
 
     return v;
 }
@@ -28,20 +73,32 @@ GtkWidget* ui_create_grid(void)
 void ui_load_directory(GtkIconView *v, const char *path)
 {
     GtkListStore *s = GTK_LIST_STORE(gtk_icon_view_get_model(v));
+    search_cancel(s);
+    mime_store_reset(s);
     gtk_list_store_clear(s);
     utils_read_directory(s, path);
 }
 
+void ui_show_listing(GtkIconView *v, GList *list)
+{
+    GtkListStore *s = GTK_LIST_STORE(gtk_icon_view_get_model(v));
+    search_cancel(s);
+    mime_store_reset(s);
+    gtk_list_store_clear(s);
+    utils_store_fill(s, list);
+}
+
 GdkPixbuf* ui_load_thumbnail(const char *path)
 {
     if (!g_file_test(path, G_FILE_TEST_EXISTS)) return NULL;
-    return gdk_pixbuf_new_from_file_at_size(path, 48, 48, NULL);
+    return iconcache_new(path);
 }
 
 static void deep(GtkListStore *st, const char *dir, const char *q)
 {
+    TRACE_SCOPE("deep");
+    WATCHDOG_SCOPE("deep");
     GList *list = utils_list_dir(dir);
-    GtkTreeIter it;
 
     for (GList *l = list; l; l = l->next)
     {
@@ -49,14 +106,8 @@ static void deep(GtkListStore *st, const char *dir, const char *q)
 
         if (strcasestr(e->name, q))
         {
-            gtk_list_store_append(st, &it);
-            gtk_list_store_set(st, &it,
-                0, utils_get_icon(e->name, e->is_dir), 
-                1, e->name,
-                2, e->path,
-                3, e->is_dir,
-                -1
-            );
+            TRACE_ITEMS(1);
+            utils_store_append(st, e, NULL);
         }
 
         if (e->is_dir)
@@ -71,6 +122,8 @@ static void deep(GtkListStore *st, const char *dir, const char *q)
 void ui_filter_search(GtkIconView *v, const char *path, const char *q)
 {
     GtkListStore *s = GTK_LIST_STORE(gtk_icon_view_get_model(v));
+    search_cancel(s);
+    mime_store_reset(s);
     gtk_list_store_clear(s);
 
     if (strlen(q) < 2)
@@ -80,4 +133,16 @@ void ui_filter_search(GtkIconView *v, const char *path, const char *q)
     }
 
     deep(s, path, q);
+    mime_sniff_flush(s);
+}
+
+void ui_query_search(GtkIconView *v, const char *path, Query *query,
+                     SearchProgressFunc cb, gpointer data)
+{
+    GtkListStore *s = GTK_LIST_STORE(gtk_icon_view_get_model(v));
+    search_cancel(s);
+    mime_store_reset(s);
+    gtk_list_store_clear(s);
+
+    search_start(s, path, query, sudo_mode, cb, data);
 }
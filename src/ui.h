@@ -2,10 +2,19 @@
 #define UI_H
 
 #include <gtk/gtk.h>
+#include "search.h"
 
 GtkWidget* ui_create_grid(void);
 void ui_load_directory(GtkIconView *view, const char *path);
+/* shows a listing (UtilsEntry, freed here) made elsewhere, without reading the folder */
+void ui_show_listing(GtkIconView *view, GList *list);
 void ui_filter_search(GtkIconView *view, const char *path, const char *q);
+/* a base pixbuf with its own mip chain, drawn at any zoom */
 GdkPixbuf* ui_load_thumbnail(const char *path);
+/* icon size of the grid, 0 to ICONCACHE_LEVELS - 1; new grids start at ICONCACHE_BASE */
+void ui_set_zoom(GtkIconView *view, int level);
+int ui_get_zoom(GtkIconView *view);
+void ui_query_search(GtkIconView *view, const char *path, Query *query,
+                     SearchProgressFunc cb, gpointer data);
 
 #endif
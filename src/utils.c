@@ -1,58 +1,112 @@
 #include "utils.h"
+#include "priv.h"
+#include "mime.h"
+#include "vfs.h"
+#include "prefetch.h"
+#include "complete.h"
+#include "fsio.h"
+#include "iconcache.h"
+#include "trace.h"
 #include <gtk/gtk.h>
 #include <dirent.h>
+#include <errno.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 static GdkPixbuf *icon_folder = NULL;
 static GdkPixbuf *icon_fallback = NULL;
+static GHashTable *icon_cache = NULL;   /* icon key -> base pixbuf with its mips */
+static int list_error = 0;
 
-GdkPixbuf* utils_load_scaled(const char *file, int size)
+#define UTILS_STAT_WINDOW 1024
+
+static void load_base_icons(void)
+{
+    if (!icon_folder)
+        icon_folder = iconcache_new("assets/folder.png");
+
+    if (!icon_fallback)
+        icon_fallback = iconcache_new("assets/file.png");
+}
+
+/* assets/<key>.png, loaded once; unknown keys share the fallback */
+GdkPixbuf* utils_icon_for_key(const char *key)
 {
-    GError *err = NULL;
-    GdkPixbuf *raw = gdk_pixbuf_new_from_file(file, &err);
+    load_base_icons();
+
+    if (!icon_cache)
+        icon_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
+    GdkPixbuf *icon = g_hash_table_lookup(icon_cache, key);
+    if (icon)
+    {
+        TRACE_COUNT(TRACE_ICON_HITS, 1);
+        return icon;
+    }
+
+    TRACE_COUNT(TRACE_ICON_MISSES, 1);
+    TRACE_SCOPE("utils_get_icon load");
+
+    char p[256];
+    snprintf(p, sizeof(p), "assets/%s.png", key);
 
-    if (!raw)
+    TRACE_COUNT(TRACE_SYSCALLS, 1);
+    if (g_file_test(p, G_FILE_TEST_EXISTS))
+        icon = iconcache_new(p);
+
+    if (!icon)
     {
-        GdkPixbuf *block = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, size, size);
-        gdk_pixbuf_fill(block, 0x777777ff);
-        return block;
+        /* remember misses too, but don't let junk extensions grow this forever */
+        if (g_hash_table_size(icon_cache) >= 1024)
+            return icon_fallback;
+        icon = g_object_ref(icon_fallback);
     }
 
-    GdkPixbuf *scaled = gdk_pixbuf_scale_simple(raw, size, size, GDK_INTERP_BILINEAR);
-    g_object_unref(raw);
-    return scaled;
+    g_hash_table_insert(icon_cache, g_strdup(key), icon);
+    return icon;
 }
 
 GdkPixbuf* utils_get_icon(const char *name, gboolean is_dir)
 {
-    if (!icon_folder)
-        icon_folder = utils_load_scaled("assets/folder.png", 48);
-
-    if (!icon_fallback)
-        icon_fallback = utils_load_scaled("assets/file.png", 48);
+    load_base_icons();
 
     if (is_dir)
         return icon_folder;
 
-    const char *ext = strrchr(name, '.');
+    const char *key = mime_icon_for_name(name);
+    if (key)
+        return utils_icon_for_key(key);
 
-    if (ext && ext[1] != 0)
-    {
-        ext++;
+    /* not in the table, but someone may have dropped an icon in assets/ */
+    const char *ext = strrchr(name, '.');
 
-        char p[256];
-        snprintf(p, sizeof(p), "assets/%s.png", ext);
+    if (!ext || ext[1] == 0)
+        return icon_fallback;
 
-        if (g_file_test(p, G_FILE_TEST_EXISTS))
-        {
-            GdkPixbuf *icon = utils_load_scaled(p, 48);
-            if (icon) return icon;
-        }
-    }
+    return utils_icon_for_key(ext + 1);
+}
 
-    return icon_fallback;
+/* one grid row; rows whose name gave no icon are handed to the sniffer */
+void utils_store_append(GtkListStore *store, const UtilsEntry *e, GtkTreeIter *out)
+{
+    GtkTreeIter it;
+    GdkPixbuf *icon = utils_get_icon(e->name, e->is_dir);
+
+    gtk_list_store_append(store, &it);
+    gtk_list_store_set(store, &it,
+        0, icon,
+        1, e->name,
+        2, e->path,
+        3, e->is_dir,
+        -1
+    );
+
+    if (icon == icon_fallback)
+        mime_sniff_queue(store, &it, e);
+
+    if (out)
+        *out = it;
 }
 
 
@@ -64,9 +118,11 @@ void utils_entry_free(UtilsEntry *e)
     g_free(e);
 }
 
-static UtilsEntry* make_entry(const char *dir, const char *name, gboolean is_dir)
+UtilsEntry* utils_entry_new(const char *dir, const char *name, gboolean is_dir)
 {
-    UtilsEntry *e = g_malloc(sizeof(UtilsEntry));
+    TRACE_COUNT(TRACE_ALLOCS, 3);
+
+    UtilsEntry *e = g_malloc0(sizeof(UtilsEntry));
     e->name = g_strdup(name);
 
     char full[4096];
@@ -77,86 +133,243 @@ static UtilsEntry* make_entry(const char *dir, const char *name, gboolean is_dir
     return e;
 }
 
-GList* utils_list_dir(const char *path)
+static int lstat_exists(const char *path)
+{
+    struct stat st;
+    return lstat(path, &st) ? errno : 0;
+}
+
+/*
+ * The counter goes before the extension; an existing file is never the
+ * answer. A name that cannot be looked up (EACCES in a folder we may not
+ * search) may well exist, so it is not taken as free.
+ */
+char* utils_free_name(const char *dir, const char *name, UtilsExistsFunc exists, int *err)
+{
+    if (!exists) exists = lstat_exists;
+    const char *dot = strrchr(name, '.');
+    if (!dot || dot == name) dot = name + strlen(name);
+
+    char *path = g_build_filename(dir, name, NULL);
+    for (int n = 2; ; n++) {
+        int rc = exists(path);
+        if (rc == ENOENT) return path;
+        g_free(path);
+        if (rc) {
+            if (err) *err = rc;
+            return NULL;
+        }
+
+        char *alt = g_strdup_printf("%.*s (%d)%s", (int) (dot - name), name, n, dot);
+        path = g_build_filename(dir, alt, NULL);
+        g_free(alt);
+    }
+}
+
+int utils_list_error(void)
+{
+    return list_error;
+}
+
+/* only paths that are not real directories get to look inside archives */
+static GList* list_vfs(const char *path)
+{
+    int err;
+    GList *list = vfs_list_dir(path, &err);
+    if (err == 0) list_error = 0;
+    return list;
+}
+
+/* lstats a window of names in one batch and prepends what it finds to list */
+static GList* scan_window(const char *path, int dfd, FsioStat *items, guint n, GList *list, guint *found)
+{
+    fsio_stat_batch(dfd, items, n);
+
+    for (guint i = 0; i < n; i++)
+    {
+        const FsioStat *it = &items[i];
+        if (it->err) continue;
+
+        (*found)++;
+        TRACE_COUNT(TRACE_ENTRIES, 1);
+
+        UtilsEntry *e = utils_entry_new(path, it->name, S_ISDIR(it->st.st_mode));
+        e->size = it->st.st_size;
+        e->mtime = it->st.st_mtime;
+        e->dev = it->st.st_dev;
+        e->ino = it->st.st_ino;
+        e->mode = it->st.st_mode;
+
+        list = g_list_prepend(list, e);
+    }
+    return list;
+}
+
+GList* utils_scan_dir(const char *path, int *err)
 {
+    TRACE_SCOPE("utils_scan_dir");
+    *err = 0;
+
+    TRACE_COUNT(TRACE_SYSCALLS, 1);
     DIR *d = opendir(path);
-    if (!d) return NULL;
+    if (!d) {
+        *err = errno;
+        return NULL;
+    }
+
+    /* names are read first, then stat'ed a window at a time through fsio */
+    GStringChunk *names = g_string_chunk_new(4096);
+    FsioStat *items = g_new0(FsioStat, UTILS_STAT_WINDOW);
+    guint n = 0, found = 0;
 
     struct dirent *ent;
     GList *list = NULL;
 
     while ((ent = readdir(d)) != NULL)
     {
-        if (!strcmp(ent->d_name, ".")) continue;
-
-     
-        if (!sudo_mode && ent->d_name[0] == '.')
+        if (ent->d_name[0] == '.')
             continue;
 
-        char full[4096];
-        snprintf(full, sizeof(full), "%s/%s", path, ent->d_name);
+        items[n++].name = g_string_chunk_insert(names, ent->d_name);
+        if (n == UTILS_STAT_WINDOW) {
+            list = scan_window(path, dirfd(d), items, n, list, &found);
+            n = 0;
+        }
+    }
+    list = scan_window(path, dirfd(d), items, n, list, &found);
 
-        struct stat st;
-        if (lstat(full, &st) != 0) continue;
+    TRACE_ITEMS(found);
 
-        gboolean is_dir = S_ISDIR(st.st_mode);
-
-        list = g_list_prepend(list, make_entry(path, ent->d_name, is_dir));
-    }
+    g_free(items);
+    g_string_chunk_free(names);
 
+    TRACE_COUNT(TRACE_SYSCALLS, 1);
     closedir(d);
     return g_list_reverse(list);
 }
 
+GList* utils_list_dir(const char *path)
+{
+    TRACE_SCOPE("utils_list_dir");
+    list_error = 0;
+
+    /* SUDO mode lists through the root helper; without one it is an error, not an empty dir */
+    if (sudo_mode) {
+        if (!priv_running()) {
+            list_error = ENOTCONN;
+            return NULL;
+        }
+        GList *list = priv_list_dir(path, &list_error);
+        if (list_error == ENOTDIR || list_error == ENOENT) return list_vfs(path);
+        return list;
+    }
 
-void utils_read_directory(GtkListStore *store, const char *dir)
+    /* a listing the prefetcher already made, if the folder has not changed since */
+    GList *list;
+    if (prefetch_take(path, &list)) return list;
+
+    prefetch_pause();
+    list = utils_scan_dir(path, &list_error);
+    prefetch_resume();
+
+    if (list_error == ENOTDIR || list_error == ENOENT) return list_vfs(path);
+    return list;
+}
+
+
+void utils_store_fill(GtkListStore *store, GList *list)
 {
-    GtkTreeIter it;
-    GList *list = utils_list_dir(dir);
+    TRACE_SCOPE("gtk_list_store_set");
 
     for (GList *l = list; l; l = l->next)
     {
+        TRACE_ITEMS(1);
         UtilsEntry *e = l->data;
 
-        gtk_list_store_append(store, &it);
-        gtk_list_store_set(store, &it,
-            0, utils_get_icon(e->name, e->is_dir),
-            1, e->name,
-            2, e->path,
-            3, e->is_dir,
-            -1
-        );
-
+        utils_store_append(store, e, NULL);
         utils_entry_free(e);
     }
 
     g_list_free(list);
+    mime_sniff_flush(store);
 }
 
+void utils_read_directory(GtkListStore *store, const char *dir)
+{
+    GList *list = utils_list_dir(dir);
+    complete_feed(dir, list, sudo_mode);
+    utils_store_fill(store, list);
+}
 
-void utils_filter_local(GtkListStore *store, const char *path, const char *query)
+/* rows that are still in fresh stay where they are; the rest go, and new names are appended */
+void utils_store_merge(GtkListStore *store, GList *fresh)
 {
+    TRACE_SCOPE("utils_store_merge");
+    GHashTable *left = g_hash_table_new(g_str_hash, g_str_equal);
+
+    for (GList *l = fresh; l; l = l->next)
+    {
+        UtilsEntry *e = l->data;
+        g_hash_table_insert(left, e->name, e);
+    }
+
+    GtkTreeModel *m = GTK_TREE_MODEL(store);
     GtkTreeIter it;
+    gboolean ok = gtk_tree_model_get_iter_first(m, &it);
+
+    while (ok)
+    {
+        char *name = NULL;
+        gboolean is_dir = FALSE;
+        gtk_tree_model_get(m, &it, 1, &name, 3, &is_dir, -1);
+
+        /* a file that became a folder, or the reverse, is a new row */
+        UtilsEntry *e = name ? g_hash_table_lookup(left, name) : NULL;
+        g_free(name);
+
+        if (!e || e->is_dir != is_dir)
+        {
+            ok = gtk_list_store_remove(store, &it);
+            continue;
+        }
+
+        g_hash_table_remove(left, e->name);
+        ok = gtk_tree_model_iter_next(m, &it);
+    }
+
+    for (GList *l = fresh; l; l = l->next)
+    {
+        UtilsEntry *e = l->data;
+        if (!g_hash_table_contains(left, e->name)) continue;
+
+        TRACE_ITEMS(1);
+        utils_store_append(store, e, NULL);
+    }
+
+    g_hash_table_destroy(left);
+    mime_sniff_flush(store);
+}
+
+
+void utils_filter_local(GtkListStore *store, const char *path, const char *query)
+{
     GList *list = utils_list_dir(path);
 
+    TRACE_SCOPE("gtk_list_store_set");
+
     for (GList *l = list; l; l = l->next)
     {
         UtilsEntry *e = l->data;
 
         if (strcasestr(e->name, query))
         {
-            gtk_list_store_append(store, &it);
-            gtk_list_store_set(store, &it,
-                0, utils_get_icon(e->name, e->is_dir),
-                1, e->name,
-                2, e->path,
-                3, e->is_dir,
-                -1
-            );
+            TRACE_ITEMS(1);
+            utils_store_append(store, e, NULL);
         }
 
         utils_entry_free(e);
     }
 
     g_list_free(list);
+    mime_sniff_flush(store);
 }
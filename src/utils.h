@@ -9,15 +9,38 @@ typedef struct {
     char *name;
     char *path;
     gboolean is_dir;
+    /* from lstat; dev and ino are 0 for entries listed by the SUDO helper */
+    guint64 size;
+    gint64 mtime;
+    guint64 dev;
+    guint64 ino;
+    guint32 mode;
 } UtilsEntry;
 
 GList* utils_list_dir(const char *path);
+/* a plain readdir + lstat listing without hidden entries; safe off the main thread */
+GList* utils_scan_dir(const char *path, int *err);
+int utils_list_error(void);
+UtilsEntry* utils_entry_new(const char *dir, const char *name, gboolean is_dir);
 void utils_entry_free(UtilsEntry *e);
+/* 0 when path exists, else an errno; only ENOENT means the name is free */
+typedef int (*UtilsExistsFunc)(const char *path);
+/*
+ * dir/name, or "name (2).ext" and up when that is taken; safe off the main
+ * thread. exists is lstat() when NULL. NULL with *err set when a name
+ * cannot be checked.
+ */
+char* utils_free_name(const char *dir, const char *name, UtilsExistsFunc exists, int *err);
 
 void utils_read_directory(GtkListStore *store, const char *dir);
+/* appends a listing's entries to store and frees them */
+void utils_store_fill(GtkListStore *store, GList *list);
+/* brings store in line with a newer listing of its folder, in place; fresh stays the caller's */
+void utils_store_merge(GtkListStore *store, GList *fresh);
 void utils_filter_local(GtkListStore *store, const char *path, const char *query);
+void utils_store_append(GtkListStore *store, const UtilsEntry *e, GtkTreeIter *out);
 
 GdkPixbuf* utils_get_icon(const char *name, gboolean is_dir);
-GdkPixbuf* utils_load_scaled(const char *file, int size);
+GdkPixbuf* utils_icon_for_key(const char *key);
 
 #endif
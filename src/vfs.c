@@ -0,0 +1,906 @@
+#include "vfs.h"
+#include "utils.h"
+#include "hash.h"
+#include "trace.h"
+#include <gio/gio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VFS_CACHE_MAX 4
+#define VFS_READ_CHUNK (256 * 1024)
+
+#define ZIP_EOCD_SIG      0x06054b50
+#define ZIP64_LOCATOR_SIG 0x07064b50
+#define ZIP64_EOCD_SIG    0x06064b50
+#define ZIP_CDIR_SIG      0x02014b50
+#define ZIP_LOCAL_SIG     0x04034b50
+#define ZIP_METHOD_STORE   0
+#define ZIP_METHOD_DEFLATE 8
+
+#define ISO_SECTOR 2048
+#define ISO_FIRST_VD 16
+
+typedef enum {
+    ARCHIVE_ZIP,
+    ARCHIVE_ISO
+} ArchiveKind;
+
+typedef struct {
+    const char *name;       /* basename, in the archive's string chunk */
+    gboolean is_dir;
+    guint64 size;
+    guint64 csize;          /* zip: compressed size */
+    guint64 offset;         /* zip: local header; iso: start of the extent */
+    guint16 method;         /* zip */
+    guint16 flags;          /* zip general purpose bits */
+    guint32 dos_time;       /* zip: date << 16 | time, local time */
+    gint64 mtime;           /* iso */
+} VfsNode;
+
+typedef struct {
+    gint ref;
+    char *path;
+    guint64 dev;
+    guint64 ino;
+    gint64 mtime;
+    guint64 size;
+    gint64 last_used;
+
+    ArchiveKind kind;
+    int fd;                 /* read with pread(), never mapped: see vfs_read_member() */
+
+    GStringChunk *names;
+    GHashTable *dirs;       /* inner dir ("" is the root) -> GArray of VfsNode */
+    GHashTable *by_name;    /* GArray of VfsNode -> DirIndex, built on first lookup */
+
+    /* iso */
+    guint32 block;
+    gboolean joliet;
+} VfsArchive;
+
+typedef struct {
+    guint len;              /* of the listing when this was built */
+    GHashTable *names;      /* name -> index + 1, the first of equal names */
+} DirIndex;
+
+static GHashTable *archives = NULL;   /* path -> VfsArchive */
+
+static inline guint16 le16(const guchar *p) { return p[0] | p[1] << 8; }
+static inline guint32 le32(const guchar *p) { return le16(p) | (guint32) le16(p + 2) << 16; }
+static inline guint64 le64(const guchar *p) { return le32(p) | (guint64) le32(p + 4) << 32; }
+
+static VfsArchive* archive_ref(VfsArchive *a)
+{
+    g_atomic_int_inc(&a->ref);
+    return a;
+}
+
+static void archive_unref(VfsArchive *a)
+{
+    if (!g_atomic_int_dec_and_test(&a->ref)) return;
+
+    if (a->fd >= 0) close(a->fd);
+    if (a->by_name) g_hash_table_destroy(a->by_name);
+    if (a->dirs) g_hash_table_destroy(a->dirs);
+    if (a->names) g_string_chunk_free(a->names);
+    g_free(a->path);
+    g_free(a);
+}
+
+static gboolean read_at(int fd, void *buf, gsize n, guint64 off)
+{
+    guchar *p = buf;
+    while (n) {
+        ssize_t r = pread(fd, p, n, off);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return FALSE;
+        p += r;
+        off += r;
+        n -= r;
+    }
+    return TRUE;
+}
+
+/* ---------- shared directory table ---------- */
+
+static GArray* ensure_dir(VfsArchive *a, const char *dir)
+{
+    GArray *l = g_hash_table_lookup(a->dirs, dir);
+    if (l) return l;
+
+    l = g_array_new(FALSE, TRUE, sizeof(VfsNode));
+    g_hash_table_insert(a->dirs, g_string_chunk_insert(a->names, dir), l);
+
+    if (dir[0]) {
+        const char *slash = strrchr(dir, '/');
+        char *parent = slash ? g_strndup(dir, slash - dir) : g_strdup("");
+        GArray *pl = ensure_dir(a, parent);
+        g_free(parent);
+
+        VfsNode n = { 0 };
+        n.name = g_string_chunk_insert(a->names, slash ? slash + 1 : dir);
+        n.is_dir = TRUE;
+        g_array_append_val(pl, n);
+    }
+    return l;
+}
+
+static void dir_index_free(DirIndex *x)
+{
+    g_hash_table_destroy(x->names);
+    g_free(x);
+}
+
+/* a flat archive has one huge folder; every stat in it would scan it otherwise */
+static const VfsNode* find_node(VfsArchive *a, GArray *dir, const char *name)
+{
+    DirIndex *x = g_hash_table_lookup(a->by_name, dir);
+    if (!x) {
+        x = g_new0(DirIndex, 1);
+        x->names = g_hash_table_new(g_str_hash, g_str_equal);
+        g_hash_table_insert(a->by_name, dir, x);
+    }
+
+    /* listings only grow while they are built; catch up with what was added */
+    for (; x->len < dir->len; x->len++) {
+        const VfsNode *n = &g_array_index(dir, VfsNode, x->len);
+        if (!g_hash_table_contains(x->names, n->name))
+            g_hash_table_insert(x->names, (gpointer) n->name, GUINT_TO_POINTER(x->len + 1));
+    }
+
+    guint i = GPOINTER_TO_UINT(g_hash_table_lookup(x->names, name));
+    return i ? &g_array_index(dir, VfsNode, i - 1) : NULL;
+}
+
+/* ---------- zip ---------- */
+
+static void zip_add(VfsArchive *a, const guchar *name, guint16 len, VfsNode *n)
+{
+    char path[4096];
+    if (len == 0 || len >= sizeof(path)) return;
+    memcpy(path, name, len);
+    path[len] = 0;
+
+    if (path[len - 1] == '/') {
+        path[--len] = 0;
+        n->is_dir = TRUE;
+    }
+    /* absolute or escaping names are not something to browse into */
+    if (!len || path[0] == '/' || !strcmp(path, "..") || g_str_has_prefix(path, "../") ||
+        strstr(path, "/../") || g_str_has_suffix(path, "/.."))
+        return;
+
+    if (n->is_dir) {
+        ensure_dir(a, path);
+        return;
+    }
+
+    char *slash = strrchr(path, '/');
+    const char *base = path;
+    GArray *dir;
+    if (slash) {
+        *slash = 0;
+        dir = ensure_dir(a, path);
+        base = slash + 1;
+    } else {
+        dir = ensure_dir(a, "");
+    }
+
+    n->name = g_string_chunk_insert(a->names, base);
+    g_array_append_val(dir, *n);
+}
+
+gboolean vfs_zip_walk(int fd, guint64 len, VfsZipFunc fn, gpointer data)
+{
+    if (len < 22) return FALSE;
+
+    /* the end record sits in the last 64 KB + 22 bytes, behind an optional comment */
+    gsize tail_len = MIN(len, 22 + 65535);
+    guint64 tail_off = len - tail_len;
+    guchar *m = g_malloc(tail_len);
+    if (!read_at(fd, m, tail_len, tail_off)) {
+        g_free(m);
+        return FALSE;
+    }
+
+    gssize eocd = -1;
+    for (gsize i = tail_len - 22 + 1; i-- > 0; ) {
+        if (m[i] == 'P' && le32(m + i) == ZIP_EOCD_SIG) {
+            eocd = i;
+            break;
+        }
+    }
+    if (eocd < 0) {
+        g_free(m);
+        return FALSE;
+    }
+
+    guint64 count = le16(m + eocd + 10);
+    guint64 cd_size = le32(m + eocd + 12);
+    guint64 cd_off = le32(m + eocd + 16);
+    guint64 at = tail_off + eocd;
+    g_free(m);
+
+    guchar loc[20], z64[56];
+    if ((count == 0xffff || cd_size == 0xffffffff || cd_off == 0xffffffff) &&
+        at >= 20 && read_at(fd, loc, sizeof(loc), at - 20) && le32(loc) == ZIP64_LOCATOR_SIG) {
+        guint64 z = le64(loc + 8);
+        if (z + 56 <= len && read_at(fd, z64, sizeof(z64), z) && le32(z64) == ZIP64_EOCD_SIG) {
+            count = le64(z64 + 32);
+            cd_size = le64(z64 + 40);
+            cd_off = le64(z64 + 48);
+        }
+    }
+    if (cd_off > len || cd_size > len - cd_off) return FALSE;
+
+    guchar *cd = g_try_malloc(MAX(cd_size, 1));
+    if (!cd || !read_at(fd, cd, cd_size, cd_off)) {
+        g_free(cd);
+        return FALSE;
+    }
+
+    const guchar *p = cd, *end = p + cd_size;
+    for (guint64 i = 0; i < count && p + 46 <= end; i++) {
+        if (le32(p) != ZIP_CDIR_SIG) break;
+
+        guint16 nl = le16(p + 28), xl = le16(p + 30), cl = le16(p + 32);
+        const guchar *name = p + 46;
+        if (name + nl + xl + cl > end) break;
+
+        VfsZipEntry e = { 0 };
+        e.name = name;
+        e.name_len = nl;
+        e.made_by = le16(p + 4);
+        e.flags = le16(p + 8);
+        e.method = le16(p + 10);
+        e.dos_time = (guint32) le16(p + 14) << 16 | le16(p + 12);
+        e.crc = le32(p + 16);
+        e.csize = le32(p + 20);
+        e.size = le32(p + 24);
+        e.attr = le32(p + 38);
+        e.offset = le32(p + 42);
+
+        /* zip64 extra: only the fields saturated above are present, in this order */
+        for (const guchar *x = name + nl; x + 4 <= name + nl + xl; ) {
+            guint16 id = le16(x), sz = le16(x + 2);
+            const guchar *v = x + 4, *vend = v + sz;
+            if (vend > name + nl + xl) break;
+            if (id == 0x0001) {
+                if (e.size == 0xffffffff && v + 8 <= vend) { e.size = le64(v); v += 8; }
+                if (e.csize == 0xffffffff && v + 8 <= vend) { e.csize = le64(v); v += 8; }
+                if (e.offset == 0xffffffff && v + 8 <= vend) { e.offset = le64(v); v += 8; }
+            }
+            x = vend;
+        }
+
+        fn(&e, data);
+        p = name + nl + xl + cl;
+    }
+
+    g_free(cd);
+    return TRUE;
+}
+
+guint64 vfs_zip_data_offset(int fd, guint64 len, guint64 header)
+{
+    guchar h[30];
+    if (header > len || len - header < 30 || !read_at(fd, h, sizeof(h), header) ||
+        le32(h) != ZIP_LOCAL_SIG)
+        return 0;
+    guint64 off = header + 30 + le16(h + 26) + le16(h + 28);
+    return off <= len ? off : 0;
+}
+
+const char* vfs_read_member(int fd, guint64 off, guint64 csize, guint16 method,
+                            GCancellable *cancel, VfsChunkFunc fn, gpointer data)
+{
+    GConverter *z = method == ZIP_METHOD_DEFLATE ?
+                    G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW)) : NULL;
+    guchar *in = g_malloc(VFS_READ_CHUNK);
+    guchar *out = z ? g_malloc(VFS_READ_CHUNK) : NULL;
+    gsize at = 0, have = 0;     /* in[at..have) is read but not used yet */
+    guint64 left = csize;       /* not read yet */
+    const char *why = NULL;
+    gboolean end = FALSE;
+
+    while (!why && !end) {
+        if (g_cancellable_is_cancelled(cancel)) {
+            why = "cancelled";
+            break;
+        }
+
+        if (at == have && left) {
+            ssize_t r = pread(fd, in, MIN(left, VFS_READ_CHUNK), off);
+            if (r < 0 && errno == EINTR) continue;
+            /* shorter than when it was indexed: rewritten or cut underneath us */
+            if (r <= 0) {
+                why = r < 0 ? g_strerror(errno) : "the archive is damaged";
+                break;
+            }
+            off += r;
+            left -= r;
+            at = 0;
+            have = r;
+        }
+
+        const guchar *chunk;
+        gsize n;
+        if (z) {
+            gsize rd = 0, wr = 0;
+            GConverterResult r = g_converter_convert(z, in + at, have - at, out, VFS_READ_CHUNK,
+                                                     G_CONVERTER_FLUSH, &rd, &wr, NULL);
+            at += rd;
+            end = r == G_CONVERTER_FINISHED;
+            /* stuck with input left, or out of input before the stream ended */
+            if (r == G_CONVERTER_ERROR || (!end && !rd && !wr && (at < have || !left))) {
+                why = "the archive is damaged";
+                break;
+            }
+            chunk = out;
+            n = wr;
+        } else {
+            chunk = in + at;
+            n = have - at;
+            at = have;
+            end = !left;
+        }
+
+        int rc = n ? fn(chunk, n, data) : 0;
+        if (rc) why = g_strerror(rc);
+    }
+
+    if (z) g_object_unref(z);
+    g_free(out);
+    g_free(in);
+    return why;
+}
+
+static void zip_index_one(const VfsZipEntry *e, gpointer data)
+{
+    VfsNode n = { 0 };
+    n.flags = e->flags;
+    n.method = e->method;
+    n.dos_time = e->dos_time;
+    n.csize = e->csize;
+    n.size = e->size;
+    n.offset = e->offset;
+    zip_add(data, e->name, e->name_len, &n);
+}
+
+static gboolean zip_index(VfsArchive *a)
+{
+    ensure_dir(a, "");
+    return vfs_zip_walk(a->fd, a->size, zip_index_one, a);
+}
+
+/* ---------- iso9660 ---------- */
+
+static gint64 civil_to_unix(int y, int mo, int d, int h, int mi, int s)
+{
+    /* days from 1970-01-01, proleptic Gregorian */
+    y -= mo <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (mo + (mo > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    gint64 days = (gint64) era * 146097 + doe - 719468;
+    return days * 86400 + h * 3600 + mi * 60 + s;
+}
+
+static char* iso_name(VfsArchive *a, const guchar *rec, guint8 reclen, gboolean *has_nm)
+{
+    guint8 nl = rec[32];
+    const guchar *name = rec + 33;
+
+    if (a->joliet)
+        return g_convert((const char*) name, nl & ~1, "UTF-8", "UTF-16BE", NULL, NULL, NULL);
+
+    /* Rock Ridge NM entries in the system use area carry the POSIX name */
+    const guchar *su = name + nl + !(nl & 1);
+    const guchar *su_end = rec + reclen;
+    GString *rr = NULL;
+    while (su + 4 <= su_end) {
+        guint8 l = su[2];
+        if (l < 4 || su + l > su_end) break;
+        if (su[0] == 'N' && su[1] == 'M' && l > 5) {
+            if (!rr) rr = g_string_new(NULL);
+            g_string_append_len(rr, (const char*) su + 5, l - 5);
+        }
+        su += l;
+    }
+    if (rr) {
+        *has_nm = TRUE;
+        return g_string_free(rr, FALSE);
+    }
+
+    return g_strndup((const char*) name, nl);
+}
+
+static GArray* iso_read_dir(VfsArchive *a, guint64 off, guint64 len, gboolean *has_nm)
+{
+    GArray *l = g_array_new(FALSE, TRUE, sizeof(VfsNode));
+    if (off > a->size || len > a->size - off) return l;
+
+    guchar *buf = g_try_malloc(MAX(len, 1));
+    if (!buf || !read_at(a->fd, buf, len, off)) {
+        g_free(buf);
+        return l;
+    }
+    const guchar *p = buf, *end = p + len;
+
+    while (p < end) {
+        guint8 reclen = p[0];
+        if (reclen == 0) {
+            /* records never straddle a sector; the rest of this one is padding */
+            gsize in_sector = (off + (p - buf)) % ISO_SECTOR;
+            p += ISO_SECTOR - in_sector;
+            continue;
+        }
+        if (reclen < 34 || p + reclen > end) break;
+
+        guint8 nl = p[32];
+        if (33 + nl > reclen) break;
+
+        if (!(nl == 1 && (p[33] == 0 || p[33] == 1))) {
+            char *name = iso_name(a, p, reclen, has_nm);
+            if (name) {
+                /* drop the ";1" version and the dot of extensionless names */
+                char *semi = strrchr(name, ';');
+                if (semi) *semi = 0;
+                size_t n = strlen(name);
+                if (n > 1 && name[n - 1] == '.') name[n - 1] = 0;
+
+                VfsNode node = { 0 };
+                node.name = g_string_chunk_insert(a->names, name);
+                node.is_dir = p[25] & 2;
+                node.offset = (guint64) le32(p + 2) * a->block;
+                node.size = le32(p + 10);
+                node.mtime = civil_to_unix(1900 + p[18], p[19], p[20], p[21], p[22], p[23]) -
+                             (gint8) p[24] * 15 * 60;
+                g_array_append_val(l, node);
+                g_free(name);
+            }
+        }
+        p += reclen;
+    }
+    g_free(buf);
+    return l;
+}
+
+static gboolean iso_index(VfsArchive *a)
+{
+    guchar vd[ISO_SECTOR], pvd_buf[ISO_SECTOR], svd_buf[ISO_SECTOR];
+    const guchar *pvd = NULL, *svd = NULL;
+
+    for (guint s = ISO_FIRST_VD; s < ISO_FIRST_VD + 32; s++) {
+        if (!read_at(a->fd, vd, sizeof(vd), s * (guint64) ISO_SECTOR)) break;
+        if (memcmp(vd + 1, "CD001", 5)) break;
+        if (vd[0] == 255) break;
+        if (vd[0] == 1 && !pvd) pvd = memcpy(pvd_buf, vd, sizeof(vd));
+        /* Joliet announces itself with a UCS-2 escape sequence */
+        if (vd[0] == 2 && vd[88] == '%' && vd[89] == '/' && strchr("@CE", vd[90]))
+            svd = memcpy(svd_buf, vd, sizeof(vd));
+    }
+    if (!pvd) return FALSE;
+
+    a->block = le16(pvd + 128);
+    if (!a->block) a->block = ISO_SECTOR;
+
+    const guchar *root = pvd + 156;
+    gboolean has_nm = FALSE;
+    GArray *l = iso_read_dir(a, (guint64) le32(root + 2) * a->block, le32(root + 10), &has_nm);
+
+    /* plain 8.3 names are a last resort: prefer Rock Ridge, then Joliet */
+    if (!has_nm && svd) {
+        g_array_free(l, TRUE);
+        a->joliet = TRUE;
+        root = svd + 156;
+        l = iso_read_dir(a, (guint64) le32(root + 2) * a->block, le32(root + 10), &has_nm);
+    }
+
+    g_hash_table_insert(a->dirs, g_string_chunk_insert(a->names, ""), l);
+    return TRUE;
+}
+
+/* ISO directories are read the first time someone looks into them */
+static GArray* dir_listing(VfsArchive *a, const char *inner)
+{
+    GArray *l = g_hash_table_lookup(a->dirs, inner);
+    if (l || a->kind != ARCHIVE_ISO || !inner[0]) return l;
+
+    const char *slash = strrchr(inner, '/');
+    char *parent = slash ? g_strndup(inner, slash - inner) : g_strdup("");
+    GArray *pl = dir_listing(a, parent);
+    g_free(parent);
+    if (!pl) return NULL;
+
+    const VfsNode *n = find_node(a, pl, slash ? slash + 1 : inner);
+    if (!n || !n->is_dir) return NULL;
+
+    gboolean has_nm = FALSE;
+    l = iso_read_dir(a, n->offset, n->size, &has_nm);
+    g_hash_table_insert(a->dirs, g_string_chunk_insert(a->names, inner), l);
+    return l;
+}
+
+/* ---------- archive cache ---------- */
+
+static void evict_one(void)
+{
+    GHashTableIter it;
+    gpointer k, v;
+    VfsArchive *oldest = NULL;
+
+    g_hash_table_iter_init(&it, archives);
+    while (g_hash_table_iter_next(&it, &k, &v)) {
+        VfsArchive *a = v;
+        if (!oldest || a->last_used < oldest->last_used) oldest = a;
+    }
+    if (oldest) g_hash_table_remove(archives, oldest->path);
+}
+
+static ArchiveKind sniff_kind(int fd, gboolean *ok)
+{
+    guchar head[4], iso[5];
+    *ok = TRUE;
+
+    if (pread(fd, iso, sizeof(iso), ISO_FIRST_VD * ISO_SECTOR + 1) == sizeof(iso) &&
+        !memcmp(iso, "CD001", 5))
+        return ARCHIVE_ISO;
+
+    /* self-extracting zips start with a stub; their end record still names them */
+    if (pread(fd, head, sizeof(head), 0) == sizeof(head) &&
+        head[0] == 'P' && head[1] == 'K' && (head[2] == 3 || head[2] == 5))
+        return ARCHIVE_ZIP;
+
+    *ok = FALSE;
+    return ARCHIVE_ZIP;
+}
+
+/* the cached index for a regular file, reopened when it changed on disk */
+static VfsArchive* archive_get(const char *path, const struct stat *st)
+{
+    if (!archives)
+        archives = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                         (GDestroyNotify) archive_unref);
+
+    VfsArchive *a = g_hash_table_lookup(archives, path);
+    if (a && a->dev == (guint64) st->st_dev && a->ino == (guint64) st->st_ino &&
+        a->mtime == st->st_mtime && a->size == (guint64) st->st_size) {
+        a->last_used = g_get_monotonic_time();
+        return a;
+    }
+    if (a) g_hash_table_remove(archives, path);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    gboolean ok;
+    ArchiveKind kind = sniff_kind(fd, &ok);
+    if (!ok || st->st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    TRACE_SCOPE("vfs index");
+
+    a = g_malloc0(sizeof(VfsArchive));
+    a->ref = 1;
+    a->path = g_strdup(path);
+    a->dev = st->st_dev;
+    a->ino = st->st_ino;
+    a->mtime = st->st_mtime;
+    a->size = st->st_size;
+    a->kind = kind;
+    a->fd = fd;
+    a->names = g_string_chunk_new(64 * 1024);
+    a->dirs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify) g_array_unref);
+    a->by_name = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                       (GDestroyNotify) dir_index_free);
+    a->last_used = g_get_monotonic_time();
+
+    if (kind == ARCHIVE_ISO) posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+
+    if (!(kind == ARCHIVE_ZIP ? zip_index(a) : iso_index(a))) {
+        archive_unref(a);
+        return NULL;
+    }
+
+    if (g_hash_table_size(archives) >= VFS_CACHE_MAX) evict_one();
+    g_hash_table_insert(archives, a->path, a);
+    return a;
+}
+
+/*
+ * Finds the archive a path runs through. Only the components past the
+ * archive fail to stat, so this costs one stat per level inside it.
+ * inner is "" for the archive itself.
+ */
+static VfsArchive* split(const char *path, char **inner)
+{
+    char buf[4096];
+    if (g_strlcpy(buf, path, sizeof(buf)) >= sizeof(buf)) return NULL;
+
+    size_t n = strlen(buf);
+    while (n > 1 && buf[n - 1] == '/') buf[--n] = 0;
+
+    for (;;) {
+        struct stat st;
+        if (stat(buf, &st) == 0) {
+            if (!S_ISREG(st.st_mode)) return NULL;
+
+            VfsArchive *a = archive_get(buf, &st);
+            if (a) *inner = g_strdup(path[n] == '/' ? path + n + 1 : path + n);
+            if (a && *inner) {
+                /* no trailing slash in keys */
+                size_t il = strlen(*inner);
+                while (il && (*inner)[il - 1] == '/') (*inner)[--il] = 0;
+            }
+            return a;
+        }
+
+        char *slash = strrchr(buf, '/');
+        if (!slash || slash == buf) return NULL;
+        *slash = 0;
+        n = slash - buf;
+    }
+}
+
+/* the node for a member, NULL for the archive root */
+static gboolean lookup(const char *path, VfsArchive **out, char **inner, VfsNode *node)
+{
+    VfsArchive *a = split(path, inner);
+    if (!a) return FALSE;
+    *out = a;
+
+    if (!(*inner)[0]) return TRUE;
+
+    const char *slash = strrchr(*inner, '/');
+    char *parent = slash ? g_strndup(*inner, slash - *inner) : g_strdup("");
+    GArray *dir = dir_listing(a, parent);
+    g_free(parent);
+
+    const VfsNode *n = dir ? find_node(a, dir, slash ? slash + 1 : *inner) : NULL;
+    if (!n) {
+        g_free(*inner);
+        *inner = NULL;
+        return FALSE;
+    }
+    *node = *n;
+    return TRUE;
+}
+
+/* ---------- public ---------- */
+
+gboolean vfs_is_archive(const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    if (!ext || (g_ascii_strcasecmp(ext, ".zip") && g_ascii_strcasecmp(ext, ".iso")))
+        return FALSE;
+
+    char *inner = NULL;
+    VfsArchive *a = split(path, &inner);
+    gboolean ok = a && !inner[0];
+    g_free(inner);
+    return ok;
+}
+
+gboolean vfs_is_virtual(const char *path)
+{
+    char *inner = NULL;
+    VfsArchive *a = split(path, &inner);
+    gboolean ok = a && inner[0];
+    g_free(inner);
+    return ok;
+}
+
+gboolean vfs_is_dir(const char *path)
+{
+    gboolean is_dir;
+    return vfs_stat(path, NULL, &is_dir) && is_dir;
+}
+
+gboolean vfs_stat(const char *path, guint64 *size, gboolean *is_dir)
+{
+    VfsArchive *a;
+    char *inner = NULL;
+    VfsNode n = { 0 };
+
+    if (!lookup(path, &a, &inner, &n)) return FALSE;
+
+    gboolean root = !inner[0];
+    if (size) *size = root ? a->size : n.size;
+    if (is_dir) *is_dir = root || n.is_dir;
+    g_free(inner);
+    return TRUE;
+}
+
+GList* vfs_list_dir(const char *path, int *err)
+{
+    char *inner = NULL;
+    VfsArchive *a = split(path, &inner);
+
+    if (!a) {
+        *err = ENOENT;
+        return NULL;
+    }
+
+    TRACE_SCOPE("vfs_list_dir");
+
+    GArray *dir = dir_listing(a, inner);
+    g_free(inner);
+    if (!dir) {
+        *err = ENOTDIR;
+        return NULL;
+    }
+
+    /* zip stores local time; one offset for the whole listing is close enough */
+    GDateTime *now = g_date_time_new_now_local();
+    gint64 tz = g_date_time_get_utc_offset(now) / G_USEC_PER_SEC;
+    g_date_time_unref(now);
+
+    GList *list = NULL;
+    for (guint i = 0; i < dir->len; i++) {
+        const VfsNode *n = &g_array_index(dir, VfsNode, i);
+        if (!sudo_mode && n->name[0] == '.') continue;
+
+        TRACE_ITEMS(1);
+        UtilsEntry *e = utils_entry_new(path, n->name, n->is_dir);
+        e->size = n->size;
+        e->mode = n->is_dir ? S_IFDIR | 0555 : S_IFREG | 0444;
+
+        if (a->kind == ARCHIVE_ISO) {
+            e->mtime = n->mtime;
+        } else if (n->dos_time) {
+            guint32 t = n->dos_time;
+            e->mtime = civil_to_unix(1980 + (t >> 25), (t >> 21) & 15, (t >> 16) & 31,
+                                     (t >> 11) & 31, (t >> 5) & 63, (t & 31) * 2) - tz;
+        }
+
+        list = g_list_prepend(list, e);
+    }
+
+    *err = 0;
+    return g_list_reverse(list);
+}
+
+typedef struct {
+    VfsArchive *a;
+    guint64 off;
+    guint64 csize;
+    guint16 method;
+    char *dest;
+    int out;
+} ExtractJob;
+
+static void extract_job_free(ExtractJob *j)
+{
+    archive_unref(j->a);
+    g_free(j->dest);
+    g_free(j);
+}
+
+/* the member's data, checked to lie inside the archive; FALSE with error set */
+static gboolean member_range(const char *path, ExtractJob *j, GError **error)
+{
+    VfsArchive *a;
+    char *inner = NULL;
+    VfsNode n;
+
+    if (!lookup(path, &a, &inner, &n) || !inner[0] || n.is_dir) {
+        g_free(inner);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "%s is not a file inside an archive", path);
+        return FALSE;
+    }
+    g_free(inner);
+
+    guint64 off = n.offset, len = n.size;
+
+    if (a->kind == ARCHIVE_ZIP) {
+        off = vfs_zip_data_offset(a->fd, a->size, off);
+        if (!off) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "damaged archive member");
+            return FALSE;
+        }
+        if (n.flags & 1) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "encrypted members are not supported");
+            return FALSE;
+        }
+        if (n.method != ZIP_METHOD_STORE && n.method != ZIP_METHOD_DEFLATE) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                        "compression method %u is not supported", n.method);
+            return FALSE;
+        }
+        len = n.csize;
+    }
+
+    if (off > a->size || len > a->size - off) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "member runs past the end of the archive");
+        return FALSE;
+    }
+
+    /* the job keeps the archive, and with it the descriptor, alive */
+    j->a = archive_ref(a);
+    j->off = off;
+    j->csize = len;
+    j->method = a->kind == ARCHIVE_ZIP ? n.method : ZIP_METHOD_STORE;
+    return TRUE;
+}
+
+static int write_chunk(const guchar *p, gsize n, gpointer data)
+{
+    ExtractJob *j = data;
+    while (n) {
+        ssize_t w = write(j->out, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return errno;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static void extract_thread(GTask *task, gpointer src, gpointer data, GCancellable *c)
+{
+    ExtractJob *j = data;
+
+    char *dir = g_path_get_dirname(j->dest);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    /* written aside and renamed over, so a failure never leaves half a file at dest */
+    const char *why = NULL;
+    char *tmp = g_strconcat(j->dest, ".XXXXXX", NULL);
+    j->out = mkostemp(tmp, O_CLOEXEC);
+    if (j->out < 0) {
+        why = g_strerror(errno);
+    } else {
+        fchmod(j->out, 0644);
+        why = vfs_read_member(j->a->fd, j->off, j->csize, j->method, c, write_chunk, j);
+        if (close(j->out) != 0 && !why) why = g_strerror(errno);
+        if (!why && rename(tmp, j->dest) != 0) why = g_strerror(errno);
+        if (why) unlink(tmp);
+    }
+    g_free(tmp);
+
+    if (why) g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", why);
+    else g_task_return_pointer(task, g_strdup(j->dest), g_free);
+}
+
+void vfs_extract_async(const char *path, const char *dest_dir,
+                       GAsyncReadyCallback cb, gpointer data)
+{
+    GTask *task = g_task_new(NULL, NULL, cb, data);
+    GError *err = NULL;
+    ExtractJob *j = g_malloc0(sizeof(ExtractJob));
+
+    if (!member_range(path, j, &err)) {
+        g_free(j);
+        g_task_return_error(task, err);
+        g_object_unref(task);
+        return;
+    }
+
+    char *base = g_path_get_basename(path);
+    if (dest_dir) {
+        j->dest = g_build_filename(dest_dir, base, NULL);
+    } else {
+        /* one private folder per archive member path, so names never collide */
+        char key[17];
+        g_snprintf(key, sizeof(key), "%016" G_GINT64_MODIFIER "x", hash_buffer(path, strlen(path), 0));
+        j->dest = g_build_filename(g_get_user_cache_dir(), "wo-files", "archives", key, base, NULL);
+    }
+    g_free(base);
+
+    g_task_set_task_data(task, j, (GDestroyNotify) extract_job_free);
+    g_task_run_in_thread(task, extract_thread);
+    g_object_unref(task);
+}
+
+char* vfs_extract_finish(GAsyncResult *res, GError **error)
+{
+    return g_task_propagate_pointer(G_TASK(res), error);
+}
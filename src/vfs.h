@@ -0,0 +1,64 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <gio/gio.h>
+
+/*
+ * Zip and ISO9660 images browsed as directories: "/tmp/a.zip/docs/x.txt".
+ * The archive is read with pread(), never mapped, so one truncated or
+ * rewritten underneath us only reads short. The zip central directory is
+ * indexed up front, ISO directories as they are opened; nothing is
+ * written to disk to list it. Members are streamed out on demand.
+ */
+
+/* a regular file we can browse into */
+gboolean vfs_is_archive(const char *path);
+/* path points inside an archive (not at the archive itself) */
+gboolean vfs_is_virtual(const char *path);
+/* the archive or a directory inside one */
+gboolean vfs_is_dir(const char *path);
+
+/* UtilsEntry list like utils_list_dir(); *err is an errno */
+GList* vfs_list_dir(const char *path, int *err);
+gboolean vfs_stat(const char *path, guint64 *size, gboolean *is_dir);
+
+/* copies a member into dest_dir, or a private cache dir when NULL, off the main thread */
+void vfs_extract_async(const char *path, const char *dest_dir,
+                       GAsyncReadyCallback cb, gpointer data);
+/* the path written */
+char* vfs_extract_finish(GAsyncResult *res, GError **error);
+
+/* one zip central directory record; name is not NUL-terminated */
+typedef struct {
+    const guchar *name;
+    guint16 name_len;
+    guint16 made_by;        /* high byte 3: attr holds a unix mode in its upper half */
+    guint16 flags;
+    guint16 method;
+    guint32 dos_time;       /* date << 16 | time, local time */
+    guint32 crc;
+    guint32 attr;
+    guint64 size;
+    guint64 csize;
+    guint64 offset;         /* of the local header */
+} VfsZipEntry;
+
+typedef void (*VfsZipFunc)(const VfsZipEntry *e, gpointer data);
+
+/* every record of the zip open on fd, zip64 included; FALSE when it has no end record */
+gboolean vfs_zip_walk(int fd, guint64 len, VfsZipFunc fn, gpointer data);
+/* where a member's data starts after its local header, 0 when the header is damaged */
+guint64 vfs_zip_data_offset(int fd, guint64 len, guint64 header);
+
+/* an errno, or 0 to go on */
+typedef int (*VfsChunkFunc)(const guchar *buf, gsize n, gpointer data);
+
+/*
+ * Hands csize bytes at off to fn a buffer at a time, inflated when method
+ * is deflate. Safe from any thread. NULL, or why it stopped ("cancelled"
+ * when cancel fired).
+ */
+const char* vfs_read_member(int fd, guint64 off, guint64 csize, guint16 method,
+                            GCancellable *cancel, VfsChunkFunc fn, gpointer data);
+
+#endif
@@ -0,0 +1,165 @@
+#include "walk.h"
+#include "trace.h"
+#include <glib.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WALK_MAX_THREADS 8
+
+struct Walk {
+    gint ref;
+    gint pending;      /* directories queued or being read */
+    gint cancelled;
+    guint64 dirs;
+    guint64 failed;
+    gboolean hidden;
+    WalkVisitFunc visit;
+    WalkDoneFunc done;
+    gpointer data;
+};
+
+typedef struct {
+    Walk *w;
+    char *path;
+    int depth;
+} WalkTask;
+
+static GThreadPool *pool = NULL;
+
+Walk* walk_ref(Walk *w)
+{
+    g_atomic_int_inc(&w->ref);
+    return w;
+}
+
+void walk_unref(Walk *w)
+{
+    if (w && g_atomic_int_dec_and_test(&w->ref))
+        g_free(w);
+}
+
+void walk_cancel(Walk *w)
+{
+    g_atomic_int_set(&w->cancelled, 1);
+}
+
+gboolean walk_cancelled(Walk *w)
+{
+    return g_atomic_int_get(&w->cancelled);
+}
+
+guint64 walk_dirs_read(Walk *w)
+{
+    return __atomic_load_n(&w->dirs, __ATOMIC_RELAXED);
+}
+
+guint64 walk_failed(Walk *w)
+{
+    return __atomic_load_n(&w->failed, __ATOMIC_RELAXED);
+}
+
+static gboolean walk_finish(gpointer data)
+{
+    Walk *w = data;
+    if (w->done) w->done(w, walk_cancelled(w), w->data);
+    walk_unref(w);
+    return G_SOURCE_REMOVE;
+}
+
+static void push_dir(Walk *w, const char *path, int depth)
+{
+    WalkTask *t = g_malloc(sizeof(WalkTask));
+    t->w = w;
+    t->path = g_strdup(path);
+    t->depth = depth;
+
+    g_atomic_int_inc(&w->pending);
+    g_thread_pool_push(pool, t, NULL);
+}
+
+static void walk_dir(gpointer data, gpointer unused)
+{
+    WalkTask *t = data;
+    Walk *w = t->w;
+    DIR *d = NULL;
+
+    if (!walk_cancelled(w)) {
+        int fd = open(t->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0 && !(d = fdopendir(fd)))
+            close(fd);
+        /* one that vanished since it was listed was not skipped; a missing root was */
+        if (!d && (errno != ENOENT || t->depth == 0)) __atomic_fetch_add(&w->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    if (d) {
+        TRACE_SCOPE("walk_dir");
+        __atomic_fetch_add(&w->dirs, 1, __ATOMIC_RELAXED);
+
+        int dfd = dirfd(d);
+        gboolean root = !strcmp(t->path, "/");
+        struct dirent *ent;
+        char full[PATH_MAX];
+
+        while ((ent = readdir(d)) != NULL && !walk_cancelled(w)) {
+            const char *n = ent->d_name;
+            if (n[0] == '.' && (!n[1] || (n[1] == '.' && !n[2]))) continue;
+            if (!w->hidden && n[0] == '.') continue;
+
+            TRACE_ITEMS(1);
+            TRACE_COUNT(TRACE_ENTRIES, 1);
+
+            unsigned char type = ent->d_type;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                TRACE_COUNT(TRACE_SYSCALLS, 1);
+                if (fstatat(dfd, n, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                    type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK :
+                           S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+
+            if (snprintf(full, sizeof(full), "%s/%s", root ? "" : t->path, n) >= (int) sizeof(full)) {
+                __atomic_fetch_add(&w->failed, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            WalkEntry e = { full, n, t->depth + 1, type == DT_DIR, type, dfd };
+
+            if (w->visit(w, &e, w->data) && e.is_dir)
+                push_dir(w, full, t->depth + 1);
+        }
+
+        TRACE_COUNT(TRACE_SYSCALLS, 1);
+        closedir(d);
+    }
+
+    g_free(t->path);
+    g_free(t);
+
+    if (g_atomic_int_dec_and_test(&w->pending))
+        g_idle_add(walk_finish, w);
+}
+
+Walk* walk_start(const char *root, gboolean hidden,
+                 WalkVisitFunc visit, WalkDoneFunc done, gpointer data)
+{
+    if (!pool) {
+        int n = CLAMP((int) g_get_num_processors(), 2, WALK_MAX_THREADS);
+        pool = g_thread_pool_new(walk_dir, NULL, n, FALSE, NULL);
+    }
+
+    Walk *w = g_malloc0(sizeof(Walk));
+    w->ref = 2;   /* the caller's and the walk's own, dropped in walk_finish */
+    w->hidden = hidden;
+    w->visit = visit;
+    w->done = done;
+    w->data = data;
+
+    push_dir(w, root, 0);
+    return w;
+}
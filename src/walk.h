@@ -0,0 +1,40 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <glib.h>
+
+/*
+ * Parallel directory walk. Every directory is one task on a shared
+ * thread pool, so siblings are read concurrently; the visit callback
+ * runs on those worker threads and must be thread-safe. Hidden entries
+ * are skipped unless asked for, and symlinks are never followed.
+ */
+
+typedef struct Walk Walk;
+
+typedef struct {
+    const char *path;
+    const char *name;
+    int depth;              /* 1 for the root's own entries */
+    gboolean is_dir;
+    unsigned char type;     /* d_type, DT_UNKNOWN when the filesystem has none */
+    int dirfd;              /* the parent, for fstatat()/openat() on name */
+} WalkEntry;
+
+/* return FALSE for a directory to keep the walk out of it */
+typedef gboolean (*WalkVisitFunc)(Walk *w, const WalkEntry *e, gpointer data);
+/* main thread, once every queued directory is finished */
+typedef void (*WalkDoneFunc)(Walk *w, gboolean cancelled, gpointer data);
+
+Walk* walk_start(const char *root, gboolean hidden,
+                 WalkVisitFunc visit, WalkDoneFunc done, gpointer data);
+void walk_cancel(Walk *w);
+gboolean walk_cancelled(Walk *w);
+guint64 walk_dirs_read(Walk *w);
+/* directories that could not be opened and entries whose path was too long */
+guint64 walk_failed(Walk *w);
+
+Walk* walk_ref(Walk *w);
+void walk_unref(Walk *w);
+
+#endif
@@ -0,0 +1,226 @@
+#include "watchdog.h"
+#include "trace.h"
+#include <glib.h>
+#include <glib-unix.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WATCHDOG_BEAT_MS 20
+#define WATCHDOG_POLL_MS 10
+#define WATCHDOG_STACK 8
+
+static const int bucket_ms[] = { 250, 500, 1000, 2500, 5000, 10000 };
+#define WATCHDOG_BUCKETS (G_N_ELEMENTS(bucket_ms) + 1)
+
+typedef struct {
+    guint count;
+    gint64 total_us;
+    gint64 max_us;
+} StallStats;
+
+/* written by the main thread, sampled by the watchdog */
+static gint64 last_beat = 0;
+static const char *stack[WATCHDOG_STACK];
+static int stack_depth = 0;
+
+static GThread *thread = NULL;
+static GMutex lock;
+static GCond stop_cond;
+static gboolean stopping = FALSE;
+static guint beat_source = 0;
+static gint64 threshold_us = 100 * 1000;
+
+/* protected by lock */
+static guint histogram[WATCHDOG_BUCKETS];
+static GHashTable *per_handler = NULL;   /* "outer/inner" -> StallStats */
+static guint total_stalls = 0;
+
+int watchdog_enter(const char *name)
+{
+    int d = __atomic_load_n(&stack_depth, __ATOMIC_RELAXED);
+    if (d < WATCHDOG_STACK)
+        __atomic_store_n(&stack[d], name, __ATOMIC_RELAXED);
+    __atomic_store_n(&stack_depth, d + 1, __ATOMIC_RELEASE);
+    return d;
+}
+
+void watchdog_leave(int *depth)
+{
+    __atomic_store_n(&stack_depth, *depth, __ATOMIC_RELEASE);
+}
+
+static gboolean heartbeat(gpointer data)
+{
+    __atomic_store_n(&last_beat, g_get_monotonic_time(), __ATOMIC_RELEASE);
+    return G_SOURCE_CONTINUE;
+}
+
+/* "on_search/deep": the outermost handler and where it was when sampled */
+static void snapshot_handler(char *out, size_t len)
+{
+    int d = __atomic_load_n(&stack_depth, __ATOMIC_ACQUIRE);
+    if (d > WATCHDOG_STACK) d = WATCHDOG_STACK;
+
+    if (d <= 0) {
+        g_strlcpy(out, "(unnamed)", len);
+        return;
+    }
+
+    const char *outer = __atomic_load_n(&stack[0], __ATOMIC_RELAXED);
+    const char *inner = __atomic_load_n(&stack[d - 1], __ATOMIC_RELAXED);
+
+    if (d == 1 || outer == inner)
+        g_strlcpy(out, outer, len);
+    else
+        snprintf(out, len, "%s/%s", outer, inner);
+}
+
+static void record_stall(const char *handler, gint64 start, gint64 dur)
+{
+    guint b = 0;
+    while (b < G_N_ELEMENTS(bucket_ms) && dur >= bucket_ms[b] * 1000LL) b++;
+
+    g_mutex_lock(&lock);
+
+    histogram[b]++;
+    total_stalls++;
+
+    StallStats *st = g_hash_table_lookup(per_handler, handler);
+    if (!st) {
+        st = g_malloc0(sizeof(StallStats));
+        g_hash_table_insert(per_handler, g_strdup(handler), st);
+    }
+    st->count++;
+    st->total_us += dur;
+    if (dur > st->max_us) st->max_us = dur;
+
+    g_mutex_unlock(&lock);
+
+    TRACE_COUNT(TRACE_STALLS, 1);
+    TRACE_COUNT(TRACE_STALL_US, dur);
+    trace_complete("main-loop stall", start, dur);
+
+    g_warning("main loop stalled %.0f ms in %s", dur / 1000.0, handler);
+}
+
+static gpointer watchdog_thread(gpointer data)
+{
+    gboolean in_stall = FALSE;
+    gint64 stall_from = 0;
+    char handler[256] = "";
+
+    g_mutex_lock(&lock);
+
+    while (!stopping) {
+        gint64 until = g_get_monotonic_time() + WATCHDOG_POLL_MS * 1000;
+        g_cond_wait_until(&stop_cond, &lock, until);
+        if (stopping) break;
+
+        g_mutex_unlock(&lock);
+
+        gint64 now = g_get_monotonic_time();
+        gint64 beat = __atomic_load_n(&last_beat, __ATOMIC_ACQUIRE);
+        gint64 silent = now - beat - WATCHDOG_BEAT_MS * 1000;
+
+        if (!in_stall && silent > threshold_us) {
+            /* sample while still blocked, the handler is what is on the stack now */
+            in_stall = TRUE;
+            stall_from = beat;
+            snapshot_handler(handler, sizeof(handler));
+        } else if (in_stall && beat != stall_from) {
+            in_stall = FALSE;
+            gint64 dur = beat - stall_from - WATCHDOG_BEAT_MS * 1000;
+            record_stall(handler, stall_from + WATCHDOG_BEAT_MS * 1000, dur);
+        }
+
+        g_mutex_lock(&lock);
+    }
+
+    g_mutex_unlock(&lock);
+    return NULL;
+}
+
+static gint by_total(gconstpointer a, gconstpointer b, gpointer data)
+{
+    StallStats *sa = g_hash_table_lookup(data, *(char* const*) a);
+    StallStats *sb = g_hash_table_lookup(data, *(char* const*) b);
+    return sb->total_us > sa->total_us ? 1 : sb->total_us < sa->total_us ? -1 : 0;
+}
+
+char* watchdog_report(void)
+{
+    GString *out = g_string_new(NULL);
+
+    g_mutex_lock(&lock);
+
+    g_string_append_printf(out, "main-loop stalls over %" G_GINT64_FORMAT " ms: %u\n",
+        threshold_us / 1000, total_stalls);
+
+    for (guint b = 0; b < WATCHDOG_BUCKETS; b++) {
+        if (b < G_N_ELEMENTS(bucket_ms))
+            g_string_append_printf(out, "  < %5d ms  %u\n", bucket_ms[b], histogram[b]);
+        else
+            g_string_append_printf(out, "  >=%5d ms  %u\n", bucket_ms[b - 1], histogram[b]);
+    }
+
+    GPtrArray *keys = g_ptr_array_new();
+    GHashTableIter it;
+    gpointer k, v;
+    g_hash_table_iter_init(&it, per_handler);
+    while (g_hash_table_iter_next(&it, &k, &v))
+        g_ptr_array_add(keys, k);
+    g_ptr_array_sort_with_data(keys, by_total, per_handler);
+
+    for (guint i = 0; i < keys->len; i++) {
+        StallStats *st = g_hash_table_lookup(per_handler, keys->pdata[i]);
+        g_string_append_printf(out, "  %-32s %4u stalls  %8.0f ms total  %6.0f ms max\n",
+            (char*) keys->pdata[i], st->count, st->total_us / 1000.0, st->max_us / 1000.0);
+    }
+
+    g_mutex_unlock(&lock);
+
+    g_ptr_array_free(keys, TRUE);
+    return g_string_free(out, FALSE);
+}
+
+static gboolean on_sigusr2(gpointer data)
+{
+    char *r = watchdog_report();
+    g_printerr("%s", r);
+    g_free(r);
+    return G_SOURCE_CONTINUE;
+}
+
+void watchdog_start(void)
+{
+    if (thread) return;
+
+    const char *env = g_getenv("WO_STALL_MS");
+    if (env && atoi(env) > 0)
+        threshold_us = atoi(env) * 1000LL;
+
+    per_handler = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    heartbeat(NULL);
+    beat_source = g_timeout_add_full(G_PRIORITY_HIGH, WATCHDOG_BEAT_MS, heartbeat, NULL, NULL);
+    g_unix_signal_add(SIGUSR2, on_sigusr2, NULL);
+
+    thread = g_thread_new("watchdog", watchdog_thread, NULL);
+}
+
+void watchdog_stop(void)
+{
+    if (!thread) return;
+
+    g_mutex_lock(&lock);
+    stopping = TRUE;
+    g_cond_signal(&stop_cond);
+    g_mutex_unlock(&lock);
+
+    g_thread_join(thread);
+    thread = NULL;
+    g_source_remove(beat_source);
+
+    if (total_stalls) on_sigusr2(NULL);
+}
@@ -0,0 +1,25 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <glib.h>
+
+/*
+ * Main-loop stall detector. A high-priority heartbeat on the main loop is
+ * watched from a separate thread; when it stops for longer than
+ * WO_STALL_MS (default 100) the handlers named with WATCHDOG_SCOPE at that
+ * moment are logged and the stall is added to per-handler stats and a
+ * duration histogram (printed at exit and on SIGUSR2).
+ */
+
+void watchdog_start(void);
+void watchdog_stop(void);
+char* watchdog_report(void);
+
+int watchdog_enter(const char *name);
+void watchdog_leave(int *depth);
+
+/* names the running handler until the enclosing block is left */
+#define WATCHDOG_SCOPE(name) \
+    int _watchdog_scope __attribute__((cleanup(watchdog_leave))) = watchdog_enter(name)
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * wo-find: the listing and search engine of wo-files without GTK.
+ *
+ *   wo-find [-0|-j] [-a] [-l] [DIR] [QUERY...]
+ *
+ * Walks DIR (default ".") with the same parallel walker and query
+ * language as the search box (see src/query.h) and streams every match
+ * to stdout as it is found: one path per line, NUL-terminated with -0,
+ * or one JSON object per line with -j. Results are written by the
+ * worker threads themselves, so memory stays flat however many there
+ * are, and their order is the order they were found in.
+ */
+#define _GNU_SOURCE
+#include "walk.h"
+#include "query.h"
+#include "trace.h"
+#include <glib.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef enum {
+    OUT_LINES,
+    OUT_NUL,
+    OUT_JSON
+} OutputFormat;
+
+typedef struct {
+    Query *query;           /* NULL matches everything */
+    OutputFormat format;
+    gboolean list;
+    GMutex out_lock;
+    guint64 entries;
+    guint64 matches;
+    guint64 bytes;
+    GMainLoop *loop;
+} Find;
+
+static void json_string(GString *s, const char *text)
+{
+    char *valid = g_utf8_validate(text, -1, NULL) ? NULL : g_utf8_make_valid(text, -1);
+    const char *p = valid ? valid : text;
+
+    g_string_append_c(s, '"');
+    for (; *p; p++) {
+        unsigned char c = *p;
+        switch (c) {
+        case '"':  g_string_append(s, "\\\""); break;
+        case '\\': g_string_append(s, "\\\\"); break;
+        case '\n': g_string_append(s, "\\n"); break;
+        case '\r': g_string_append(s, "\\r"); break;
+        case '\t': g_string_append(s, "\\t"); break;
+        default:
+            if (c < 0x20) g_string_append_printf(s, "\\u%04x", c);
+            else g_string_append_c(s, c);
+        }
+    }
+    g_string_append_c(s, '"');
+    g_free(valid);
+}
+
+static char type_char(mode_t mode)
+{
+    if (S_ISDIR(mode)) return 'd';
+    if (S_ISLNK(mode)) return 'l';
+    if (S_ISREG(mode)) return 'f';
+    return 'o';
+}
+
+/* worker thread */
+static void emit(Find *f, const WalkEntry *e, QueryResult *r)
+{
+    if (f->format != OUT_JSON) {
+        g_mutex_lock(&f->out_lock);
+        fputs(e->path, stdout);
+        putchar(f->format == OUT_NUL ? '\0' : '\n');
+        g_mutex_unlock(&f->out_lock);
+        return;
+    }
+
+    if (!r->have_stat && fstatat(e->dirfd, e->name, &r->st, AT_SYMLINK_NOFOLLOW) != 0)
+        return;
+
+    GString *s = g_string_sized_new(256);
+    g_string_append(s, "{\"path\":");
+    json_string(s, e->path);
+    g_string_append(s, ",\"name\":");
+    json_string(s, e->name);
+    g_string_append_printf(s, ",\"type\":\"%c\",\"size\":%" G_GINT64_FORMAT ",\"mtime\":%" G_GINT64_FORMAT,
+                           type_char(r->st.st_mode), (gint64) r->st.st_size, (gint64) r->st.st_mtime);
+    if (r->have_grep) {
+        g_string_append_printf(s, ",\"line\":%u,\"preview\":", r->grep.line);
+        json_string(s, r->grep.preview);
+    }
+    g_string_append(s, "}\n");
+
+    g_mutex_lock(&f->out_lock);
+    fwrite(s->str, 1, s->len, stdout);
+    g_mutex_unlock(&f->out_lock);
+    g_string_free(s, TRUE);
+}
+
+/* worker thread */
+static gboolean visit(Walk *w, const WalkEntry *e, gpointer data)
+{
+    Find *f = data;
+    QueryResult r = { 0 };
+
+    __atomic_fetch_add(&f->entries, 1, __ATOMIC_RELAXED);
+
+    if (!f->query || query_match(f->query, e, &r)) {
+        __atomic_fetch_add(&f->matches, 1, __ATOMIC_RELAXED);
+        emit(f, e, &r);
+        if (r.have_grep) g_free(r.grep.preview);
+    }
+
+    if (r.scanned)
+        __atomic_fetch_add(&f->bytes, r.scanned, __ATOMIC_RELAXED);
+
+    /* --list is one folder, the way the window shows it */
+    if (f->list || !e->is_dir) return FALSE;
+    return !f->query || query_enter_dir(f->query, e);
+}
+
+static void walk_done(Walk *w, gboolean cancelled, gpointer data)
+{
+    Find *f = data;
+    g_main_loop_quit(f->loop);
+}
+
+/* where a quote may open in arg: its start, or after a leading '-' or key: */
+static size_t value_at(const char *arg)
+{
+    size_t i = arg[0] == '-';
+    size_t k = i;
+    while (g_ascii_islower(arg[k])) k++;
+    return k > i && arg[k] == ':' ? k + 1 : i;
+}
+
+/* argv is already split; quote it back so query_compile() sees the same terms */
+static char* join_query(char **args, int n)
+{
+    GString *s = g_string_new(NULL);
+    for (int i = 0; i < n; i++) {
+        const char *a = args[i];
+        size_t at = value_at(a);
+        gboolean quote = strpbrk(a, " \t\n\r\f\v") || a[at] == '"' || a[at] == '\'';
+        char q = strchr(a + at, '"') ? '\'' : '"';
+
+        if (i) g_string_append_c(s, ' ');
+        if (!quote) {
+            g_string_append(s, a);
+            continue;
+        }
+        g_string_append_len(s, a, at);
+        g_string_append_c(s, q);
+        g_string_append(s, a + at);
+        g_string_append_c(s, q);
+    }
+    return g_string_free(s, FALSE);
+}
+
+int main(int argc, char **argv)
+{
+    gboolean nul = FALSE, json = FALSE, hidden = FALSE, list = FALSE, stats = FALSE;
+    GOptionEntry options[] = {
+        { "null", '0', 0, G_OPTION_ARG_NONE, &nul, "End each path with NUL instead of a newline", NULL },
+        { "json", 'j', 0, G_OPTION_ARG_NONE, &json, "Print one JSON object per line", NULL },
+        { "hidden", 'a', 0, G_OPTION_ARG_NONE, &hidden, "Include hidden entries", NULL },
+        { "list", 'l', 0, G_OPTION_ARG_NONE, &list, "Only DIR's own entries, no recursion", NULL },
+        { "stats", 's', 0, G_OPTION_ARG_NONE, &stats, "Print counts and timing to stderr", NULL },
+        { NULL }
+    };
+
+    GError *err = NULL;
+    GOptionContext *ctx = g_option_context_new("[DIR] [QUERY...]");
+    g_option_context_set_summary(ctx,
+        "Lists or searches DIR with the wo-files engine. QUERY uses the search box\n"
+        "syntax: words match names; name: ext: path: type: size modified depth content:");
+    g_option_context_add_main_entries(ctx, options, NULL);
+    if (!g_option_context_parse(ctx, &argc, &argv, &err)) {
+        fprintf(stderr, "wo-find: %s\n", err->message);
+        g_error_free(err);
+        g_option_context_free(ctx);
+        return 2;
+    }
+    g_option_context_free(ctx);
+
+    if (nul && json) {
+        fprintf(stderr, "wo-find: --null and --json do not mix\n");
+        return 2;
+    }
+
+    const char *root = argc > 1 ? argv[1] : ".";
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "wo-find: %s: not a directory\n", root);
+        return 2;
+    }
+
+    Find f = { 0 };
+    f.format = json ? OUT_JSON : nul ? OUT_NUL : OUT_LINES;
+    f.list = list;
+    g_mutex_init(&f.out_lock);
+
+    if (argc > 2) {
+        char *text = join_query(argv + 2, argc - 2);
+        f.query = query_compile(text, &err);
+        g_free(text);
+        if (!f.query) {
+            fprintf(stderr, "wo-find: bad query: %s\n", err->message);
+            g_error_free(err);
+            return 2;
+        }
+    }
+
+    trace_init();
+
+    /* whole records per write keep lines from different workers apart */
+    static char outbuf[64 * 1024];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    gint64 start = g_get_monotonic_time();
+    f.loop = g_main_loop_new(NULL, FALSE);
+    Walk *w = walk_start(root, hidden, visit, walk_done, &f);
+    g_main_loop_run(f.loop);
+    fflush(stdout);
+
+    if (stats)
+        fprintf(stderr, "wo-find: %" G_GUINT64_FORMAT " matches, %" G_GUINT64_FORMAT " entries, %"
+                G_GUINT64_FORMAT " dirs, %.1f MB scanned in %.1f ms\n",
+                f.matches, f.entries, walk_dirs_read(w), f.bytes / (1024.0 * 1024.0),
+                (g_get_monotonic_time() - start) / 1000.0);
+
+    walk_unref(w);
+    g_main_loop_unref(f.loop);
+    if (f.query) query_free(f.query);
+    trace_finish();
+
+    return f.matches ? 0 : 1;
+}
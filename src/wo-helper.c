@@ -0,0 +1,345 @@
+/*
+ * wo-helper: the elevated half of SUDO mode.
+ *
+ * Started once by wo-files (through pkexec, or directly as a local
+ * stand-in) with stdin/stdout bound to one end of a socketpair, then
+ * serves requests until the socket closes. Kept to plain libc so the
+ * code running as root stays small.
+ */
+#define _GNU_SOURCE
+#include "privproto.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IN_FD  0
+#define OUT_FD 1
+
+static int read_full(int fd, void *buf, size_t n)
+{
+    char *p = buf;
+    while (n) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static int reply(int status, const void *data, uint32_t len)
+{
+    PrivReply r = { status, len };
+    if (write_full(OUT_FD, &r, sizeof(r))) return -1;
+    if (len && write_full(OUT_FD, data, len)) return -1;
+    return 0;
+}
+
+/* splits "src\0dst\0" */
+static int two_paths(char *buf, uint32_t len, char **src, char **dst)
+{
+    char *end = memchr(buf, 0, len);
+    if (!end || end + 1 >= buf + len) return -1;
+    *src = buf;
+    *dst = end + 1;
+    return memchr(*dst, 0, buf + len - *dst) ? 0 : -1;
+}
+
+static int do_list(const char *path)
+{
+    DIR *d = opendir(path);
+    if (!d) return reply(errno, NULL, 0);
+
+    size_t cap = 64 * 1024, len = 0;
+    char *out = malloc(cap);
+    struct dirent *ent;
+    int fd = dirfd(d);
+    int err = out ? 0 : ENOMEM;
+
+    while (!err && (ent = readdir(d)) != NULL) {
+        if (!strcmp(ent->d_name, ".")) continue;
+
+        struct stat st;
+        if (fstatat(fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+
+        size_t nl = strlen(ent->d_name);
+        size_t need = sizeof(PrivDirent) + nl;
+        /* half a folder would pass for all of it; say it does not fit instead */
+        if (len + need > PRIV_MAX_MSG) {
+            err = EOVERFLOW;
+            break;
+        }
+        if (len + need > cap) {
+            while (len + need > cap) cap *= 2;
+            char *more = realloc(out, cap);
+            if (!more) {
+                err = ENOMEM;
+                break;
+            }
+            out = more;
+        }
+
+        PrivDirent de = {
+            .size = st.st_size,
+            .mtime = st.st_mtime,
+            .mode = st.st_mode,
+            .name_len = nl,
+        };
+        memcpy(out + len, &de, sizeof(de));
+        memcpy(out + len + sizeof(de), ent->d_name, nl);
+        len += need;
+    }
+
+    closedir(d);
+    int rc = err ? reply(err, NULL, 0) : reply(0, out, len);
+    free(out);
+    return rc;
+}
+
+static int do_stat(const char *path)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0) return reply(errno, NULL, 0);
+
+    PrivStat ps = {
+        .size = st.st_size,
+        .mtime = st.st_mtime,
+        .dev = st.st_dev,
+        .ino = st.st_ino,
+        .mode = st.st_mode,
+    };
+    return reply(0, &ps, sizeof(ps));
+}
+
+static int rm_one(const char *p, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(p) ? errno : 0;
+}
+
+static int delete_tree(const char *path)
+{
+    int rc = nftw(path, rm_one, 64, FTW_DEPTH | FTW_PHYS);
+    return rc < 0 ? errno : rc;
+}
+
+static int copy_reg(const char *src, const char *dst, mode_t mode)
+{
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    if (in < 0) return errno;
+
+    int out = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode & 07777);
+    if (out < 0) {
+        int e = errno;
+        close(in);
+        return e;
+    }
+
+    int rc = 0;
+    for (;;) {
+        ssize_t n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0);
+        if (n > 0) continue;
+        if (n == 0) break;
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL) { rc = errno; break; }
+
+        /* filesystems without copy_file_range */
+        char buf[128 * 1024];
+        ssize_t r;
+        while ((r = read(in, buf, sizeof(buf))) > 0) {
+            if (write_full(out, buf, r)) { rc = errno; break; }
+        }
+        if (r < 0) rc = errno;
+        break;
+    }
+
+    close(in);
+    if (close(out) && !rc) rc = errno;
+    return rc;
+}
+
+static int copy_tree(const char *src, const char *dst)
+{
+    struct stat st;
+    if (lstat(src, &st) != 0) return errno;
+
+    if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t n = readlink(src, target, sizeof(target) - 1);
+        if (n < 0) return errno;
+        target[n] = 0;
+        return symlink(target, dst) ? errno : 0;
+    }
+
+    if (!S_ISDIR(st.st_mode))
+        return copy_reg(src, dst, st.st_mode);
+
+    if (mkdir(dst, st.st_mode & 07777) != 0) return errno;
+
+    DIR *d = opendir(src);
+    if (!d) return errno;
+
+    int rc = 0;
+    struct dirent *ent;
+    while (!rc && (ent = readdir(d)) != NULL) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+
+        char s[PATH_MAX], t[PATH_MAX];
+        snprintf(s, sizeof(s), "%s/%s", src, ent->d_name);
+        snprintf(t, sizeof(t), "%s/%s", dst, ent->d_name);
+        rc = copy_tree(s, t);
+    }
+
+    closedir(d);
+    return rc;
+}
+
+/* rename() that fails with EEXIST instead of replacing dst */
+static int move_noreplace(const char *src, const char *dst)
+{
+    if (renameat2(AT_FDCWD, src, AT_FDCWD, dst, RENAME_NOREPLACE) == 0) return 0;
+    if (errno != EINVAL && errno != ENOSYS) return errno;
+
+    /* filesystems without the flag; checked as closely as they allow */
+    struct stat st;
+    if (lstat(dst, &st) == 0) return EEXIST;
+    if (errno != ENOENT) return errno;
+    return rename(src, dst) ? errno : 0;
+}
+
+/*
+ * The reply carries one end of a new socketpair; a child serves the
+ * other from then on, so a long copy there holds up nothing here.
+ * Returns 0 in both processes.
+ */
+static int do_channel(void)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) return reply(errno, NULL, 0);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        int e = errno;
+        close(sv[0]);
+        close(sv[1]);
+        return reply(e, NULL, 0);
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        if (dup2(sv[1], IN_FD) < 0 || dup2(sv[1], OUT_FD) < 0) _exit(1);
+        close(sv[1]);
+        return 0;
+    }
+    close(sv[1]);
+
+    PrivReply r = { 0, 0 };
+    struct iovec iov = { &r, sizeof(r) };
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct msghdr m = { .msg_iov = &iov, .msg_iovlen = 1,
+                        .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf) };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&m);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &sv[0], sizeof(int));
+
+    ssize_t w;
+    do w = sendmsg(OUT_FD, &m, MSG_NOSIGNAL); while (w < 0 && errno == EINTR);
+    close(sv[0]);
+    return w == (ssize_t) sizeof(r) ? 0 : -1;
+}
+
+static int handle(uint32_t op, char *buf, uint32_t len)
+{
+    char *src, *dst;
+
+    if (!len || buf[len - 1] != 0) return reply(EINVAL, NULL, 0);
+
+    switch (op) {
+    case PRIV_OP_LIST:
+        return do_list(buf);
+    case PRIV_OP_STAT:
+        return do_stat(buf);
+    case PRIV_OP_DELETE:
+        return reply(delete_tree(buf), NULL, 0);
+    case PRIV_OP_RENAME:
+        if (two_paths(buf, len, &src, &dst)) return reply(EINVAL, NULL, 0);
+        return reply(rename(src, dst) ? errno : 0, NULL, 0);
+    case PRIV_OP_COPY:
+        if (two_paths(buf, len, &src, &dst)) return reply(EINVAL, NULL, 0);
+        return reply(copy_tree(src, dst), NULL, 0);
+    case PRIV_OP_MOVE: {
+        if (two_paths(buf, len, &src, &dst)) return reply(EINVAL, NULL, 0);
+        int rc = move_noreplace(src, dst);
+        if (rc != EXDEV) return reply(rc, NULL, 0);
+        rc = copy_tree(src, dst);
+        if (!rc) rc = delete_tree(src);
+        return reply(rc, NULL, 0);
+    }
+    case PRIV_OP_CHANNEL:
+        return do_channel();
+    default:
+        return reply(ENOSYS, NULL, 0);
+    }
+}
+
+int main(void)
+{
+    uint32_t magic = PRIV_MAGIC;
+    uid_t uid = geteuid();
+    char hello[8];
+    memcpy(hello, &magic, 4);
+    memcpy(hello + 4, &uid, 4);
+
+    if (reply(0, hello, sizeof(hello))) return 1;
+
+    /* channel children are never waited for */
+    signal(SIGCHLD, SIG_IGN);
+
+    char *buf = NULL;
+    size_t cap = 0;
+
+    for (;;) {
+        PrivRequest rq;
+        if (read_full(IN_FD, &rq, sizeof(rq))) break;
+        if (rq.len > PRIV_MAX_MSG) break;
+
+        if (rq.len > cap) {
+            char *more = realloc(buf, rq.len);
+            if (!more) break;
+            buf = more;
+            cap = rq.len;
+        }
+        if (rq.len && read_full(IN_FD, buf, rq.len)) break;
+
+        if (handle(rq.op, buf, rq.len)) break;
+    }
+
+    free(buf);
+    return 0;
+}
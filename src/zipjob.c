@@ -0,0 +1,908 @@
+#define _GNU_SOURCE
+#include "zipjob.h"
+#include "vfs.h"
+#include "hash.h"
+#include "trace.h"
+#include <gio/gio.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ZIPJOB_TICK_MS 250
+#define ZIPJOB_PIECE (1 << 20)
+#define ZIPJOB_WINDOW 4             /* pieces queued or held per worker thread */
+#define ZIPJOB_LEVEL 6
+#define ZIPJOB_BUF (256 * 1024)
+
+#define ZIP_LOCAL_SIG      0x04034b50
+#define ZIP_DESC_SIG       0x08074b50
+#define ZIP_CDIR_SIG       0x02014b50
+#define ZIP64_EOCD_SIG     0x06064b50
+#define ZIP64_LOCATOR_SIG  0x07064b50
+#define ZIP_EOCD_SIG       0x06054b50
+#define ZIP_METHOD_STORE   0
+#define ZIP_METHOD_DEFLATE 8
+#define ZIP_FLAG_DESCRIPTOR 0x0008
+#define ZIP_FLAG_UTF8       0x0800
+#define ZIP_MADE_BY_UNIX    0x0300
+/* members this large get zip64 sizes; the margin covers deflate growing incompressible data */
+#define ZIP64_LIMIT 0xf0000000u
+
+typedef struct {
+    char *archive;
+    char **sources;             /* compress */
+    char *dest;                 /* extract */
+    GCancellable *cancel;
+
+    /* counters written by the workers */
+    ZipJobProgress progress;
+    GMutex lock;
+    GCond cond;
+    char *error;                /* first failure, under lock */
+
+    guint tick;
+    gint64 start;
+    gint64 last_time;
+    guint64 last_bytes;
+    guint64 rate;
+    ZipJobProgressFunc on_progress;
+    ZipJobDoneFunc on_done;
+    gpointer data;
+} ZipJob;
+
+static void count(guint64 *field, guint64 n)
+{
+    __atomic_fetch_add(field, n, __ATOMIC_RELAXED);
+}
+
+static void fail(ZipJob *j, const char *what, const char *why)
+{
+    count(&j->progress.failed, 1);
+    g_mutex_lock(&j->lock);
+    if (!j->error) j->error = g_strdup_printf("%s: %s", what, why);
+    g_mutex_unlock(&j->lock);
+}
+
+static guint workers(void)
+{
+    return MAX(1, g_get_num_processors());
+}
+
+/* ---------- compress ---------- */
+
+typedef struct {
+    char *name;                 /* in the archive; folders end in '/' */
+    int fd;                     /* -1 for folders */
+    guint64 size;
+    guint32 mode;
+    guint32 dos_time;
+    guint16 method;
+    guint16 flags;
+    gboolean zip64;
+
+    /* the writer's */
+    guint64 offset;
+    guint64 csize;
+    guint32 crc;
+} Member;
+
+typedef struct {
+    Member *m;
+    guint64 off;
+    gsize len;
+    gboolean last;
+    gboolean done;              /* under the job's lock */
+
+    /* the worker's */
+    GByteArray *out;
+    guint32 crc;
+    const char *why;            /* why the read failed */
+} Piece;
+
+typedef struct {
+    DIR *d;
+    char *path;
+    char *prefix;               /* the folder's archive name, '/' included */
+} Frame;
+
+typedef struct {
+    ZipJob *j;
+    GPtrArray *stack;           /* of Frame, the walk's open folders */
+    guint next_source;
+    Member *cur;                /* still being cut into pieces */
+    guint64 cur_off;
+    dev_t out_dev;
+    ino_t out_ino;
+
+    FILE *out;
+    guint64 pos;
+    int err;
+    GByteArray *hdr;
+    GByteArray *cdir;
+    guint64 entries;
+} Packer;
+
+/* already compressed; deflating them again only costs time */
+static const char *stored_exts[] = {
+    "zip", "gz", "tgz", "bz2", "xz", "zst", "7z", "rar", "jar", "apk", "deb", "rpm",
+    "jpg", "jpeg", "png", "gif", "webp", "mp3", "m4a", "aac", "ogg", "opus", "flac",
+    "mp4", "m4v", "mkv", "webm", "mov", "avi", "docx", "xlsx", "pptx", "odt", "ods", "odp",
+};
+
+static gboolean precompressed(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    if (!dot) return FALSE;
+    for (guint i = 0; i < G_N_ELEMENTS(stored_exts); i++)
+        if (!g_ascii_strcasecmp(dot + 1, stored_exts[i])) return TRUE;
+    return FALSE;
+}
+
+static guint32 dos_time(time_t t)
+{
+    struct tm tm;
+    localtime_r(&t, &tm);
+    /* the format covers 1980 to 2107 */
+    if (tm.tm_year < 80) return 1 << 21 | 1 << 16;
+    if (tm.tm_year > 207) tm.tm_year = 207;
+    return (guint32) (tm.tm_year - 80) << 25 | (guint32) (tm.tm_mon + 1) << 21 |
+           (guint32) tm.tm_mday << 16 | tm.tm_hour << 11 | tm.tm_min << 5 | tm.tm_sec / 2;
+}
+
+static void member_free(Member *m)
+{
+    if (m->fd >= 0) close(m->fd);
+    g_free(m->name);
+    g_free(m);
+}
+
+static void frame_free(Frame *f)
+{
+    closedir(f->d);
+    g_free(f->path);
+    g_free(f->prefix);
+    g_free(f);
+}
+
+/* a member for path, NULL when it is skipped; folders are opened for the walk */
+static Member* add_path(Packer *pk, const char *path, const char *name)
+{
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        fail(pk->j, path, g_strerror(errno));
+        return NULL;
+    }
+    if (st.st_dev == pk->out_dev && st.st_ino == pk->out_ino) return NULL;
+    /* a linked file goes in as its contents; linked folders could loop */
+    if (S_ISLNK(st.st_mode) && (stat(path, &st) != 0 || !S_ISREG(st.st_mode))) return NULL;
+    if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) return NULL;
+
+    Member *m = g_new0(Member, 1);
+    m->fd = -1;
+    m->mode = st.st_mode;
+    m->dos_time = dos_time(st.st_mtime);
+    m->flags = ZIP_FLAG_DESCRIPTOR;
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR *d = opendir(path);
+        if (!d) {
+            fail(pk->j, path, g_strerror(errno));
+            g_free(m);
+            return NULL;
+        }
+        Frame *f = g_new0(Frame, 1);
+        f->d = d;
+        f->path = g_strdup(path);
+        f->prefix = g_strconcat(name, "/", NULL);
+        g_ptr_array_add(pk->stack, f);
+        m->name = g_strdup(f->prefix);
+    } else {
+        m->fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (m->fd < 0) {
+            fail(pk->j, path, g_strerror(errno));
+            g_free(m);
+            return NULL;
+        }
+        m->name = g_strdup(name);
+        m->size = st.st_size;
+        m->method = m->size && !precompressed(name) ? ZIP_METHOD_DEFLATE : ZIP_METHOD_STORE;
+        m->zip64 = m->size >= ZIP64_LIMIT;
+    }
+
+    for (const char *c = m->name; *c; c++) {
+        if ((guchar) *c < 0x80) continue;
+        if (g_utf8_validate(m->name, -1, NULL)) m->flags |= ZIP_FLAG_UTF8;
+        break;
+    }
+    return m;
+}
+
+/* the walk, one member at a time: sources in order, each folder depth first */
+static Member* next_member(Packer *pk)
+{
+    for (;;) {
+        Member *m;
+        if (pk->stack->len) {
+            Frame *f = g_ptr_array_index(pk->stack, pk->stack->len - 1);
+            struct dirent *ent = readdir(f->d);
+            if (!ent) {
+                g_ptr_array_remove_index(pk->stack, pk->stack->len - 1);
+                continue;
+            }
+            if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+
+            char *path = g_build_filename(f->path, ent->d_name, NULL);
+            char *name = g_strconcat(f->prefix, ent->d_name, NULL);
+            m = add_path(pk, path, name);
+            g_free(name);
+            g_free(path);
+        } else if (pk->j->sources[pk->next_source]) {
+            const char *src = pk->j->sources[pk->next_source++];
+            char *name = g_path_get_basename(src);
+            m = add_path(pk, src, name);
+            g_free(name);
+        } else {
+            return NULL;
+        }
+        if (m) return m;
+    }
+}
+
+static Piece* next_piece(Packer *pk)
+{
+    if (!pk->cur) {
+        pk->cur = next_member(pk);
+        pk->cur_off = 0;
+        if (!pk->cur) return NULL;
+    }
+
+    Piece *p = g_new0(Piece, 1);
+    p->m = pk->cur;
+    p->off = pk->cur_off;
+    p->len = MIN(pk->cur->size - p->off, ZIPJOB_PIECE);
+    pk->cur_off += p->len;
+    p->last = pk->cur_off >= pk->cur->size;
+    if (p->last) pk->cur = NULL;
+    return p;
+}
+
+static void piece_free(Piece *p)
+{
+    if (p->out) g_byte_array_unref(p->out);
+    if (p->last) member_free(p->m);
+    g_free(p);
+}
+
+/*
+ * Raw deflate of one piece, on its own: every piece but a member's last
+ * ends on a sync flush, at a byte boundary and without the final-block
+ * bit, so the writer can lay them end to end as one stream.
+ */
+static GByteArray* deflate_piece(const guchar *in, gsize len, gboolean last)
+{
+    GConverter *z = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_RAW, ZIPJOB_LEVEL));
+    GConverterFlags flags = last ? G_CONVERTER_INPUT_AT_END : G_CONVERTER_FLUSH;
+    gsize cap = len + len / 16 + 1024, used = 0;
+    GByteArray *out = g_byte_array_sized_new(cap);
+    g_byte_array_set_size(out, cap);
+
+    for (;;) {
+        gsize rd = 0, wr = 0;
+        GError *err = NULL;
+        GConverterResult r = g_converter_convert(z, in, len, out->data + used, cap - used,
+                                                 flags, &rd, &wr, &err);
+        in += rd;
+        len -= rd;
+        used += wr;
+
+        if (r == G_CONVERTER_ERROR && !g_error_matches(err, G_IO_ERROR, G_IO_ERROR_NO_SPACE)) {
+            g_warning("zipjob: deflate failed: %s", err->message);
+            g_error_free(err);
+            g_byte_array_unref(out);
+            out = NULL;
+            break;
+        }
+        g_clear_error(&err);
+
+        /* a sync flush is complete once it returns with output space to spare */
+        if (r == G_CONVERTER_FINISHED || (!len && !last && used < cap)) break;
+        if (cap - used < 1024) {
+            cap *= 2;
+            g_byte_array_set_size(out, cap);
+        }
+    }
+
+    if (out) g_byte_array_set_size(out, used);
+    g_object_unref(z);
+    return out;
+}
+
+/* pool worker */
+static void piece_thread(gpointer item, gpointer data)
+{
+    Piece *p = item;
+    ZipJob *j = data;
+
+    if (p->len && !g_cancellable_is_cancelled(j->cancel)) {
+        guchar *in = g_malloc(p->len);
+        gsize got = 0;
+        while (got < p->len) {
+            ssize_t n = pread(p->m->fd, in + got, p->len - got, p->off + got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                p->why = n < 0 ? g_strerror(errno) : "the file shrank while it was read";
+                break;
+            }
+            got += n;
+        }
+
+        if (!p->why) {
+            p->crc = hash_crc32(0, in, p->len);
+            if (p->m->method == ZIP_METHOD_DEFLATE) {
+                p->out = deflate_piece(in, p->len, p->last);
+                if (!p->out) p->why = "it could not be compressed";
+            } else {
+                p->out = g_byte_array_new_take(in, p->len);
+                in = NULL;
+            }
+        }
+        g_free(in);
+    }
+
+    g_mutex_lock(&j->lock);
+    p->done = TRUE;
+    g_cond_broadcast(&j->cond);
+    g_mutex_unlock(&j->lock);
+}
+
+static void put16(GByteArray *b, guint16 v)
+{
+    guchar x[2] = { v & 0xff, v >> 8 };
+    g_byte_array_append(b, x, 2);
+}
+
+static void put32(GByteArray *b, guint32 v) { put16(b, v); put16(b, v >> 16); }
+static void put64(GByteArray *b, guint64 v) { put32(b, v); put32(b, v >> 32); }
+
+static void emit(Packer *pk, const void *data, gsize len)
+{
+    if (len && !pk->err && fwrite(data, 1, len, pk->out) != len) pk->err = errno ? errno : EIO;
+    pk->pos += len;
+    __atomic_store_n(&pk->j->progress.written, pk->pos, __ATOMIC_RELAXED);
+}
+
+static void emit_hdr(Packer *pk)
+{
+    emit(pk, pk->hdr->data, pk->hdr->len);
+    g_byte_array_set_size(pk->hdr, 0);
+}
+
+/* sizes and CRC are not known yet; they follow the data in a descriptor */
+static void write_local(Packer *pk, Member *m)
+{
+    GByteArray *b = pk->hdr;
+    guint16 nl = strlen(m->name);
+
+    put32(b, ZIP_LOCAL_SIG);
+    put16(b, m->zip64 ? 45 : 20);
+    put16(b, m->flags);
+    put16(b, m->method);
+    put32(b, m->dos_time);
+    put32(b, 0);
+    put32(b, m->zip64 ? 0xffffffff : 0);
+    put32(b, m->zip64 ? 0xffffffff : 0);
+    put16(b, nl);
+    put16(b, m->zip64 ? 20 : 0);
+    g_byte_array_append(b, (const guchar*) m->name, nl);
+    if (m->zip64) {
+        put16(b, 0x0001);
+        put16(b, 16);
+        put64(b, 0);
+        put64(b, 0);
+    }
+    emit_hdr(pk);
+}
+
+static void write_descriptor(Packer *pk, Member *m)
+{
+    GByteArray *b = pk->hdr;
+    put32(b, ZIP_DESC_SIG);
+    put32(b, m->crc);
+    if (m->zip64) {
+        put64(b, m->csize);
+        put64(b, m->size);
+    } else {
+        put32(b, m->csize);
+        put32(b, m->size);
+    }
+    emit_hdr(pk);
+}
+
+static void add_central(Packer *pk, Member *m)
+{
+    GByteArray *b = pk->cdir;
+    gboolean far = m->offset >= 0xffffffff;
+    guint16 nl = strlen(m->name), xl = (m->zip64 ? 16 : 0) + (far ? 8 : 0);
+    guint16 version = m->zip64 || far ? 45 : 20;
+
+    put32(b, ZIP_CDIR_SIG);
+    put16(b, ZIP_MADE_BY_UNIX | version);
+    put16(b, version);
+    put16(b, m->flags);
+    put16(b, m->method);
+    put32(b, m->dos_time);
+    put32(b, m->crc);
+    put32(b, m->zip64 ? 0xffffffff : m->csize);
+    put32(b, m->zip64 ? 0xffffffff : m->size);
+    put16(b, nl);
+    put16(b, xl ? xl + 4 : 0);
+    put16(b, 0);                /* comment */
+    put16(b, 0);                /* disk */
+    put16(b, 0);                /* internal attributes */
+    put32(b, (m->mode & 0xffff) << 16 | (S_ISDIR(m->mode) ? 0x10 : 0));
+    put32(b, far ? 0xffffffff : m->offset);
+    g_byte_array_append(b, (const guchar*) m->name, nl);
+    if (xl) {
+        put16(b, 0x0001);
+        put16(b, xl);
+        if (m->zip64) {
+            put64(b, m->size);
+            put64(b, m->csize);
+        }
+        if (far) put64(b, m->offset);
+    }
+    pk->entries++;
+}
+
+static void write_end(Packer *pk)
+{
+    guint64 cd_off = pk->pos, cd_size = pk->cdir->len;
+    emit(pk, pk->cdir->data, pk->cdir->len);
+
+    GByteArray *b = pk->hdr;
+    if (pk->entries >= 0xffff || cd_off >= 0xffffffff || cd_size >= 0xffffffff) {
+        guint64 z = pk->pos;
+        put32(b, ZIP64_EOCD_SIG);
+        put64(b, 44);
+        put16(b, ZIP_MADE_BY_UNIX | 45);
+        put16(b, 45);
+        put32(b, 0);
+        put32(b, 0);
+        put64(b, pk->entries);
+        put64(b, pk->entries);
+        put64(b, cd_size);
+        put64(b, cd_off);
+
+        put32(b, ZIP64_LOCATOR_SIG);
+        put32(b, 0);
+        put64(b, z);
+        put32(b, 1);
+    }
+
+    put32(b, ZIP_EOCD_SIG);
+    put16(b, 0);
+    put16(b, 0);
+    put16(b, MIN(pk->entries, 0xffff));
+    put16(b, MIN(pk->entries, 0xffff));
+    put32(b, MIN(cd_size, 0xffffffff));
+    put32(b, MIN(cd_off, 0xffffffff));
+    put16(b, 0);
+    emit_hdr(pk);
+}
+
+/* the writer: pieces arrive here in archive order */
+static gboolean write_piece(Packer *pk, Piece *p)
+{
+    Member *m = p->m;
+    if (p->why) {
+        fail(pk->j, m->name, p->why);
+        return FALSE;
+    }
+
+    if (p->off == 0) {
+        m->offset = pk->pos;
+        write_local(pk, m);
+    }
+    if (p->out) {
+        emit(pk, p->out->data, p->out->len);
+        m->csize += p->out->len;
+    }
+    m->crc = p->off ? hash_crc32_combine(m->crc, p->crc, p->len) : p->crc;
+    count(&pk->j->progress.bytes, p->len);
+
+    if (p->last) {
+        write_descriptor(pk, m);
+        add_central(pk, m);
+        count(&pk->j->progress.files, 1);
+    }
+
+    if (pk->err) {
+        fail(pk->j, pk->j->archive, g_strerror(pk->err));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* worker thread */
+static void compress_thread(GTask *task, gpointer src, gpointer data, GCancellable *c)
+{
+    ZipJob *j = data;
+    TRACE_SCOPE("zip compress");
+
+    int fd = open(j->archive, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fail(j, j->archive, g_strerror(errno));
+        g_task_return_boolean(task, FALSE);
+        return;
+    }
+
+    Packer pk = { 0 };
+    struct stat st;
+    pk.j = j;
+    if (fstat(fd, &st) == 0) {
+        pk.out_dev = st.st_dev;
+        pk.out_ino = st.st_ino;
+    }
+    pk.out = fdopen(fd, "wb");
+    setvbuf(pk.out, NULL, _IOFBF, ZIPJOB_BUF);
+    pk.stack = g_ptr_array_new_with_free_func((GDestroyNotify) frame_free);
+    pk.hdr = g_byte_array_new();
+    pk.cdir = g_byte_array_new();
+
+    /*
+     * Pieces are handed to the pool as the walk finds them, and taken back
+     * in the same order; the window caps how far compression can run
+     * ahead of the writer, and with it the memory held.
+     */
+    guint threads = workers();
+    GThreadPool *pool = g_thread_pool_new(piece_thread, j, threads, FALSE, NULL);
+    GQueue pending = G_QUEUE_INIT;
+    gboolean ok = TRUE;
+
+    for (;;) {
+        Piece *p;
+        while (ok && pending.length < threads * ZIPJOB_WINDOW && (p = next_piece(&pk)) != NULL) {
+            g_queue_push_tail(&pending, p);
+            g_thread_pool_push(pool, p, NULL);
+        }
+
+        p = g_queue_pop_head(&pending);
+        if (!p) break;
+
+        g_mutex_lock(&j->lock);
+        while (!p->done) g_cond_wait(&j->cond, &j->lock);
+        g_mutex_unlock(&j->lock);
+
+        if (ok) ok = !g_cancellable_is_cancelled(c) && write_piece(&pk, p);
+        piece_free(p);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    if (ok) write_end(&pk);
+    if (fclose(pk.out) != 0 && !pk.err) pk.err = errno;
+    if (ok && pk.err) {
+        fail(j, j->archive, g_strerror(pk.err));
+        ok = FALSE;
+    }
+    if (!ok) unlink(j->archive);
+
+    if (pk.cur) member_free(pk.cur);
+    g_ptr_array_free(pk.stack, TRUE);
+    g_byte_array_unref(pk.hdr);
+    g_byte_array_unref(pk.cdir);
+
+    TRACE_ITEMS(pk.entries);
+    g_task_return_boolean(task, ok);
+}
+
+/* ---------- extract ---------- */
+
+typedef struct {
+    char *name;                 /* relative, checked not to escape */
+    guint64 header;             /* local header; the data offset is read in the worker */
+    guint64 size;
+    guint64 csize;
+    guint32 crc;
+    guint32 dos_time;
+    guint32 mode;
+    guint16 method;
+    gboolean is_dir;
+} Item;
+
+typedef struct {
+    ZipJob *j;
+    int fd;                     /* read with pread() from every worker */
+    guint64 len;
+    GArray *items;
+} Unpacker;
+
+static void collect_one(const VfsZipEntry *e, gpointer data)
+{
+    Unpacker *u = data;
+    Item it = { 0 };
+    it.name = g_strndup((const char*) e->name, e->name_len);
+
+    gsize nl = strlen(it.name);
+    while (nl && it.name[nl - 1] == '/') {
+        it.name[--nl] = 0;
+        it.is_dir = TRUE;
+    }
+    if ((e->made_by >> 8) == 3) it.mode = e->attr >> 16;
+    if (S_ISDIR(it.mode)) it.is_dir = TRUE;
+
+    const char *why = NULL;
+    if (!nl || it.name[0] == '/' || !strcmp(it.name, "..") || g_str_has_prefix(it.name, "../") ||
+        strstr(it.name, "/../") || g_str_has_suffix(it.name, "/.."))
+        why = "the name points outside the folder";
+    else if (S_ISLNK(it.mode))
+        why = "links are not extracted";
+    else if (e->flags & 1)
+        why = "encrypted members are not supported";
+    else if (e->method != ZIP_METHOD_STORE && e->method != ZIP_METHOD_DEFLATE)
+        why = "the compression method is not supported";
+
+    if (why) {
+        fail(u->j, nl ? it.name : "(unnamed)", why);
+        g_free(it.name);
+        return;
+    }
+
+    it.header = e->offset;
+    it.size = e->size;
+    it.csize = e->csize;
+    it.crc = e->crc;
+    it.dos_time = e->dos_time;
+    it.method = e->method;
+    g_array_append_val(u->items, it);
+    if (!it.is_dir) count(&u->j->progress.total, it.size);
+}
+
+/* big members start first, so one of them is not left running alone at the end */
+static gint by_csize_desc(gconstpointer a, gconstpointer b)
+{
+    const Item *x = a, *y = b;
+    return x->csize < y->csize ? 1 : x->csize > y->csize ? -1 : 0;
+}
+
+static int write_all(int fd, const guchar *p, gsize n)
+{
+    while (n) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w < 0) return errno;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+typedef struct {
+    ZipJob *j;
+    int fd;
+    guint32 crc;
+    guint64 total;
+} Sink;
+
+static int write_chunk(const guchar *p, gsize n, gpointer data)
+{
+    Sink *s = data;
+    s->crc = hash_crc32(s->crc, p, n);
+    s->total += n;
+    count(&s->j->progress.bytes, n);
+    return write_all(s->fd, p, n);
+}
+
+/* the member's bytes into fd, inflated when they are deflated; NULL or why not */
+static const char* unpack(Unpacker *u, const Item *it, int fd)
+{
+    guint64 data = vfs_zip_data_offset(u->fd, u->len, it->header);
+    if (!data || it->csize > u->len - data) return "the archive is damaged";
+
+    Sink s = { u->j, fd, 0, 0 };
+    const char *why = vfs_read_member(u->fd, data, it->csize, it->method, u->j->cancel,
+                                      write_chunk, &s);
+    if (!why && (s.crc != it->crc || s.total != it->size)) why = "the archive is damaged";
+    return why;
+}
+
+/* pool worker */
+static void item_thread(gpointer item, gpointer data)
+{
+    Item *it = item;
+    Unpacker *u = data;
+    ZipJob *j = u->j;
+    if (g_cancellable_is_cancelled(j->cancel)) return;
+
+    char *path = g_build_filename(j->dest, it->name, NULL);
+    char *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0755);
+    g_free(dir);
+
+    const char *why;
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                  S_ISREG(it->mode) ? (it->mode & 0777) | S_IRUSR | S_IWUSR : 0644);
+    if (fd < 0) {
+        why = g_strerror(errno);
+    } else {
+        why = unpack(u, it, fd);
+        if (!why && it->dos_time) {
+            guint32 t = it->dos_time;
+            GDateTime *dt = g_date_time_new_local(1980 + (t >> 25), (t >> 21) & 15, (t >> 16) & 31,
+                                                  (t >> 11) & 31, (t >> 5) & 63, (t & 31) * 2);
+            if (dt) {
+                struct timespec ts[2] = { { 0, UTIME_OMIT }, { g_date_time_to_unix(dt), 0 } };
+                futimens(fd, ts);
+                g_date_time_unref(dt);
+            }
+        }
+        if (close(fd) != 0 && !why) why = g_strerror(errno);
+    }
+
+    if (!why) count(&j->progress.files, 1);
+    else if (!g_cancellable_is_cancelled(j->cancel)) fail(j, it->name, why);
+    g_free(path);
+}
+
+static int rm_one(const char *p, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(p) ? errno : 0;
+}
+
+/* worker thread */
+static void extract_thread(GTask *task, gpointer src, gpointer data, GCancellable *c)
+{
+    ZipJob *j = data;
+    TRACE_SCOPE("zip extract");
+
+    Unpacker u = { 0 };
+    u.j = j;
+    u.items = g_array_new(FALSE, FALSE, sizeof(Item));
+
+    struct stat st;
+    int fd = open(j->archive, O_RDONLY | O_CLOEXEC);
+    gboolean ok = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (!ok) fail(j, j->archive, fd < 0 ? g_strerror(errno) : "the archive cannot be read");
+
+    if (ok) {
+        u.fd = fd;
+        u.len = st.st_size;
+        ok = vfs_zip_walk(u.fd, u.len, collect_one, &u);
+        if (!ok) fail(j, j->archive, "not a zip archive");
+    }
+    if (ok && mkdir(j->dest, 0755) != 0) {
+        fail(j, j->dest, g_strerror(errno));
+        ok = FALSE;
+    }
+
+    if (ok) {
+        /* folders first, empty ones included; files then only make their own parents */
+        for (guint i = 0; i < u.items->len; i++) {
+            Item *it = &g_array_index(u.items, Item, i);
+            if (!it->is_dir) continue;
+            char *path = g_build_filename(j->dest, it->name, NULL);
+            g_mkdir_with_parents(path, 0755);
+            g_free(path);
+        }
+
+        g_array_sort(u.items, by_csize_desc);
+        GThreadPool *pool = g_thread_pool_new(item_thread, &u, workers(), FALSE, NULL);
+        for (guint i = 0; i < u.items->len; i++) {
+            Item *it = &g_array_index(u.items, Item, i);
+            if (!it->is_dir) g_thread_pool_push(pool, it, NULL);
+        }
+        g_thread_pool_free(pool, FALSE, TRUE);
+
+        if (g_cancellable_is_cancelled(c)) nftw(j->dest, rm_one, 64, FTW_DEPTH | FTW_PHYS);
+    }
+
+    if (fd >= 0) close(fd);
+    for (guint i = 0; i < u.items->len; i++) g_free(g_array_index(u.items, Item, i).name);
+    TRACE_ITEMS(u.items->len);
+    g_array_free(u.items, TRUE);
+
+    g_task_return_boolean(task, ok);
+}
+
+/* ---------- job ---------- */
+
+static void snapshot(ZipJob *j, ZipJobProgress *out)
+{
+    out->files = __atomic_load_n(&j->progress.files, __ATOMIC_RELAXED);
+    out->bytes = __atomic_load_n(&j->progress.bytes, __ATOMIC_RELAXED);
+    out->total = __atomic_load_n(&j->progress.total, __ATOMIC_RELAXED);
+    out->written = __atomic_load_n(&j->progress.written, __ATOMIC_RELAXED);
+    out->failed = __atomic_load_n(&j->progress.failed, __ATOMIC_RELAXED);
+    out->rate = j->rate;
+}
+
+static gboolean on_tick(gpointer data)
+{
+    ZipJob *j = data;
+    gint64 now = g_get_monotonic_time();
+    guint64 bytes = __atomic_load_n(&j->progress.bytes, __ATOMIC_RELAXED);
+
+    /* a short moving average; the first reading is taken as it is */
+    if (now > j->last_time) {
+        guint64 r = (bytes - j->last_bytes) * G_USEC_PER_SEC / (now - j->last_time);
+        j->rate = j->rate ? (j->rate * 3 + r) / 4 : r;
+    }
+    j->last_time = now;
+    j->last_bytes = bytes;
+
+    ZipJobProgress p;
+    snapshot(j, &p);
+    if (j->on_progress) j->on_progress(&p, j->data);
+    return G_SOURCE_CONTINUE;
+}
+
+static void job_done(GObject *src, GAsyncResult *res, gpointer data)
+{
+    ZipJob *j = g_task_get_task_data(G_TASK(res));
+    ZipJobProgress p;
+
+    g_source_remove(j->tick);
+    snapshot(j, &p);
+    /* over the whole run */
+    gint64 took = g_get_monotonic_time() - j->start;
+    if (took > 0) p.rate = p.bytes * G_USEC_PER_SEC / took;
+
+    if (j->on_done)
+        j->on_done(&p, g_cancellable_is_cancelled(j->cancel) ? NULL : j->error, j->data);
+}
+
+static void job_free(ZipJob *j)
+{
+    g_strfreev(j->sources);
+    g_free(j->archive);
+    g_free(j->dest);
+    g_free(j->error);
+    g_object_unref(j->cancel);
+    g_mutex_clear(&j->lock);
+    g_cond_clear(&j->cond);
+    g_free(j);
+}
+
+static GCancellable* job_start(ZipJob *j, GTaskThreadFunc fn)
+{
+    j->cancel = g_cancellable_new();
+    g_mutex_init(&j->lock);
+    g_cond_init(&j->cond);
+    j->start = j->last_time = g_get_monotonic_time();
+    j->tick = g_timeout_add(ZIPJOB_TICK_MS, on_tick, j);
+
+    GTask *task = g_task_new(NULL, j->cancel, job_done, NULL);
+    g_task_set_task_data(task, j, (GDestroyNotify) job_free);
+    g_task_run_in_thread(task, fn);
+    g_object_unref(task);
+    return g_object_ref(j->cancel);
+}
+
+GCancellable* zipjob_compress(const char * const *sources, const char *archive,
+                              ZipJobProgressFunc progress, ZipJobDoneFunc done, gpointer data)
+{
+    ZipJob *j = g_malloc0(sizeof(ZipJob));
+    j->sources = g_strdupv((char**) sources);
+    j->archive = g_strdup(archive);
+    j->on_progress = progress;
+    j->on_done = done;
+    j->data = data;
+    return job_start(j, compress_thread);
+}
+
+GCancellable* zipjob_extract(const char *archive, const char *dest_dir,
+                             ZipJobProgressFunc progress, ZipJobDoneFunc done, gpointer data)
+{
+    ZipJob *j = g_malloc0(sizeof(ZipJob));
+    j->archive = g_strdup(archive);
+    j->dest = g_strdup(dest_dir);
+    j->on_progress = progress;
+    j->on_done = done;
+    j->data = data;
+    return job_start(j, extract_thread);
+}
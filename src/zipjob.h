@@ -0,0 +1,36 @@
+#ifndef ZIPJOB_H
+#define ZIPJOB_H
+
+#include <gio/gio.h>
+
+/*
+ * Zip archives written and unpacked in the background. Compression walks
+ * the sources lazily and deflates members, and 1 MB pieces of large ones,
+ * on a thread pool the way pigz does; a single writer puts the results
+ * out in order, so only a few pieces per core are ever held in memory.
+ * Extraction inflates members in parallel straight into the destination.
+ * Either job stops at the next piece once its cancellable is triggered,
+ * and removes what it had written.
+ */
+
+typedef struct {
+    guint64 files;      /* members finished */
+    guint64 bytes;      /* uncompressed bytes so far */
+    guint64 total;      /* uncompressed bytes in all; 0 while compression is still walking */
+    guint64 written;    /* bytes of the archive so far; compression only */
+    guint64 failed;
+    guint64 rate;       /* uncompressed bytes per second, smoothed */
+} ZipJobProgress;
+
+/* both on the main thread; error is the first failure, NULL when none or cancelled */
+typedef void (*ZipJobProgressFunc)(const ZipJobProgress *p, gpointer data);
+typedef void (*ZipJobDoneFunc)(const ZipJobProgress *p, const char *error, gpointer data);
+
+/* sources go into a new archive under their base names; both return a ref on the job's cancellable */
+GCancellable* zipjob_compress(const char * const *sources, const char *archive,
+                              ZipJobProgressFunc progress, ZipJobDoneFunc done, gpointer data);
+/* dest_dir is created and must not exist yet */
+GCancellable* zipjob_extract(const char *archive, const char *dest_dir,
+                             ZipJobProgressFunc progress, ZipJobDoneFunc done, gpointer data);
+
+#endif